@@ -0,0 +1,241 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * hgfsBufferPool.c --
+ *
+ *    Implementation of the hgfs buffer pool: a lock protected LIFO list of
+ *    free buffers of the pool size. Buffers are handed out from the list
+ *    when it is not empty, and given back to it unless it already holds the
+ *    maximum number of free buffers.
+ *
+ *    Buffers are allocated and freed by different threads (e.g. the request
+ *    input is allocated by the transport thread and freed by a threadpool
+ *    worker) so the pool is shared rather than per thread.
+ *
+ *    A pool which is not initialized, or is already torn down, still hands
+ *    out buffers of its size but allocates and frees them every time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vmware.h"
+#include "mutexRankLib.h"
+#include "util.h"
+#include "hgfsBufferPool.h"
+#include "hgfsServerInt.h"
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBufferPool_Init --
+ *
+ *      Initialize an empty pool of buffers.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Creates the pool lock.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsBufferPool_Init(HgfsBufferPool *pool,   // OUT
+                    const char *name,       // IN: lock name
+                    size_t bufferSize,      // IN: size of the buffers
+                    uint32 maxFree)         // IN: free buffers kept at most
+{
+   ASSERT(pool);
+   ASSERT(bufferSize >= sizeof (void *));
+
+   memset(pool, 0, sizeof *pool);
+   pool->lock = MXUser_CreateExclLock(name, RANK_hgfsBufferPoolLock);
+   pool->bufferSize = bufferSize;
+   pool->maxFree = maxFree;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBufferPool_Exit --
+ *
+ *      Free the pooled buffers and tear down the pool. Buffers still in use
+ *      are freed when they are put back.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Destroys the pool lock.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsBufferPool_Exit(HgfsBufferPool *pool)   // IN/OUT
+{
+   ASSERT(pool);
+
+   if (NULL == pool->lock) {
+      return;
+   }
+
+   LOG(4, "%s: %"FMT64"u allocs %"FMT64"u hits %"FMT64"u frees "
+       "%"FMT64"u drops, high-water %u\n", __FUNCTION__, pool->stats.allocs,
+       pool->stats.hits, pool->stats.frees, pool->stats.drops,
+       pool->stats.highWater);
+
+   while (NULL != pool->freeList) {
+      void *buffer = pool->freeList;
+
+      pool->freeList = *(void **)buffer;
+      free(buffer);
+   }
+   pool->stats.numFree = 0;
+
+   MXUser_DestroyExclLock(pool->lock);
+   pool->lock = NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBufferPool_Get --
+ *
+ *      Get a buffer of the pool size, from the free list if possible.
+ *
+ * Results:
+ *      The buffer, its contents are undefined.
+ *
+ * Side effects:
+ *      May allocate memory.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void *
+HgfsBufferPool_Get(HgfsBufferPool *pool)   // IN/OUT
+{
+   void *buffer = NULL;
+
+   ASSERT(pool);
+
+   if (NULL != pool->lock) {
+      MXUser_AcquireExclLock(pool->lock);
+      pool->stats.allocs++;
+      if (NULL != pool->freeList) {
+         buffer = pool->freeList;
+         pool->freeList = *(void **)buffer;
+         pool->stats.numFree--;
+         pool->stats.hits++;
+      }
+      MXUser_ReleaseExclLock(pool->lock);
+   }
+
+   if (NULL == buffer) {
+      buffer = Util_SafeMalloc(pool->bufferSize);
+   }
+   return buffer;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBufferPool_Put --
+ *
+ *      Give back a buffer obtained from HgfsBufferPool_Get. It is kept on the
+ *      free list unless the list is full.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      May free memory.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsBufferPool_Put(HgfsBufferPool *pool,   // IN/OUT
+                   void *buffer)           // IN: buffer of the pool size
+{
+   ASSERT(pool);
+
+   if (NULL == buffer) {
+      return;
+   }
+
+   if (NULL != pool->lock) {
+      MXUser_AcquireExclLock(pool->lock);
+      pool->stats.frees++;
+      if (pool->stats.numFree < pool->maxFree) {
+         *(void **)buffer = pool->freeList;
+         pool->freeList = buffer;
+         pool->stats.numFree++;
+         pool->stats.highWater = MAX(pool->stats.highWater,
+                                     pool->stats.numFree);
+         buffer = NULL;
+      } else {
+         pool->stats.drops++;
+      }
+      MXUser_ReleaseExclLock(pool->lock);
+   }
+
+   free(buffer);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBufferPool_GetStats --
+ *
+ *      Get a snapshot of the pool statistics.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsBufferPool_GetStats(HgfsBufferPool *pool,         // IN
+                        HgfsServerPoolStats *stats)   // OUT
+{
+   ASSERT(pool);
+   ASSERT(stats);
+
+   if (NULL == pool->lock) {
+      *stats = pool->stats;
+      return;
+   }
+
+   MXUser_AcquireExclLock(pool->lock);
+   *stats = pool->stats;
+   MXUser_ReleaseExclLock(pool->lock);
+}
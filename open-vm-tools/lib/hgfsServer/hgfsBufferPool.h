@@ -0,0 +1,47 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * hgfsBufferPool.h --
+ *
+ *    A pool of fixed size buffers which are recycled instead of being
+ *    freed, up to a high-water mark of free buffers.
+ */
+
+#ifndef _HGFS_BUFFER_POOL_H_
+#define _HGFS_BUFFER_POOL_H_
+
+#include "hgfsServer.h"
+#include "userlock.h"
+
+typedef struct HgfsBufferPool {
+   MXUserExclLock *lock;
+   void *freeList;            /* Free buffers, linked through their first word. */
+   size_t bufferSize;
+   uint32 maxFree;            /* Free buffers kept at most, the rest are freed. */
+   HgfsServerPoolStats stats;
+} HgfsBufferPool;
+
+void HgfsBufferPool_Init(HgfsBufferPool *pool, const char *name,
+                         size_t bufferSize, uint32 maxFree);
+void HgfsBufferPool_Exit(HgfsBufferPool *pool);
+void *HgfsBufferPool_Get(HgfsBufferPool *pool);
+void HgfsBufferPool_Put(HgfsBufferPool *pool, void *buffer);
+void HgfsBufferPool_GetStats(HgfsBufferPool *pool, HgfsServerPoolStats *stats);
+
+#endif // ifndef _HGFS_BUFFER_POOL_H_
@@ -0,0 +1,522 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * hgfsCache.c --
+ *
+ *    Implementation of the hgfs LRU cache: a hash table for the lookups and
+ *    a doubly linked list which keeps the entries in least recently used
+ *    order for the evictions.
+ *
+ *    The cache owns the data put in it and frees it with free(). The remove
+ *    LRU callback is invoked for entries the cache drops on its own, i.e.
+ *    evictions, replacements and destruction, but not for explicitly
+ *    invalidated entries. The callback is always invoked without the cache
+ *    lock held, so it may call into other modules which in turn invalidate
+ *    cache entries.
+ */
+
+#include <string.h>
+
+#include "vmware.h"
+#include "hashTable.h"
+#include "mutexRankLib.h"
+#include "util.h"
+#include "hgfsCache.h"
+#include "hgfsServerInt.h"
+
+typedef struct HgfsCacheEntry {
+   DblLnkLst_Links links;     /* Cache LRU list links. */
+   char *key;                 /* Also the hash table key. */
+   void *data;
+   size_t bytes;              /* Accounted size of the entry. */
+} HgfsCacheEntry;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCacheUnlinkEntry --
+ *
+ *      Remove an entry from the hash table and the LRU list.
+ *
+ *      The cache lock must be held.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsCacheUnlinkEntry(HgfsCache *cache,      // IN
+                     HgfsCacheEntry *entry) // IN
+{
+   HashTable_Delete(cache->hashTable, entry->key);
+   DblLnkLst_Unlink1(&entry->links);
+   cache->stats.numEntries--;
+   cache->stats.numBytes -= entry->bytes;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCacheFreeEntry --
+ *
+ *      Free an unlinked entry and its data, invoking the remove LRU callback
+ *      first if requested.
+ *
+ *      The cache lock must not be held if the callback is invoked.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsCacheFreeEntry(HgfsCache *cache,      // IN
+                   HgfsCacheEntry *entry, // IN
+                   Bool invokeCallback)   // IN
+{
+   if (invokeCallback && cache->callback != NULL) {
+      cache->callback(entry->data);
+   }
+   free(entry->data);
+   free(entry->key);
+   free(entry);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCacheFreeList --
+ *
+ *      Free all the entries of a list of unlinked entries, invoking the
+ *      remove LRU callback for each.
+ *
+ *      The cache lock must not be held.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsCacheFreeList(HgfsCache *cache,        // IN
+                  DblLnkLst_Links *list)   // IN
+{
+   DblLnkLst_Links *link, *nextLink;
+
+   DblLnkLst_ForEachSafe(link, nextLink, list) {
+      HgfsCacheEntry *entry = DblLnkLst_Container(link, HgfsCacheEntry, links);
+
+      DblLnkLst_Unlink1(&entry->links);
+      HgfsCacheFreeEntry(cache, entry, TRUE);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCache_Alloc --
+ *
+ *      Create a cache and the corresponding hash table/doubly linked list/lock.
+ *
+ * Results:
+ *      The cache.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsCache *
+HgfsCache_Alloc(HgfsCacheRemoveLRUCallback callback) // IN
+{
+   HgfsCache *cache = Util_SafeCalloc(1, sizeof *cache);
+
+   cache->hashTable = HashTable_Alloc(HGFS_CACHE_MAX_ENTRIES,
+                                      HASH_STRING_KEY, NULL);
+   DblLnkLst_Init(&cache->links);
+   cache->lock = MXUser_CreateExclLock("HgfsCacheLock",
+                                       RANK_hgfsCacheLock);
+   cache->callback = callback;
+   cache->maxEntries = HGFS_CACHE_MAX_ENTRIES;
+   cache->maxBytes = HGFS_CACHE_MAX_BYTES;
+
+   return cache;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCache_Destroy --
+ *
+ *      Destroy a cache and the corresponding hash table/doubly linked list/lock.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The remove LRU callback is invoked for every remaining entry.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsCache_Destroy(HgfsCache *cache)                    // IN
+{
+   DblLnkLst_Links entries;
+
+   if (cache == NULL) {
+      return;
+   }
+
+   LOG(4, "%s: %u entries, %"FMT64"u hits, %"FMT64"u misses, "
+       "%"FMT64"u evictions\n", __FUNCTION__, cache->stats.numEntries,
+       cache->stats.hits, cache->stats.misses, cache->stats.evictions);
+
+   DblLnkLst_Init(&entries);
+
+   MXUser_AcquireExclLock(cache->lock);
+   while (DblLnkLst_IsLinked(&cache->links)) {
+      HgfsCacheEntry *entry = DblLnkLst_Container(cache->links.next,
+                                                  HgfsCacheEntry, links);
+      HgfsCacheUnlinkEntry(cache, entry);
+      DblLnkLst_LinkLast(&entries, &entry->links);
+   }
+   MXUser_ReleaseExclLock(cache->lock);
+
+   HgfsCacheFreeList(cache, &entries);
+
+   HashTable_Free(cache->hashTable);
+   MXUser_DestroyExclLock(cache->lock);
+   free(cache);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCache_Put --
+ *
+ *      Put an entry into a cache, accounting for the key only.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      See HgfsCache_PutSized.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsCache_Put(HgfsCache *cache,                    // IN
+              const char *key,                     // IN
+              void *data)                          // IN
+{
+   HgfsCache_PutSized(cache, key, data, 0);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCache_PutSized --
+ *
+ *      Put an entry into a cache, as the most recently used one. An existing
+ *      entry with the same key is replaced. Least recently used entries are
+ *      evicted until the cache is within its bounds.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The cache takes ownership of data. The remove LRU callback is invoked
+ *      for the replaced and evicted entries.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsCache_PutSized(HgfsCache *cache,                 // IN
+                   const char *key,                  // IN
+                   void *data,                       // IN
+                   size_t dataBytes)                 // IN: accounted size
+{
+   HgfsCacheEntry *entry;
+   HgfsCacheEntry *oldEntry;
+   DblLnkLst_Links dropped;
+
+   ASSERT(cache);
+   ASSERT(key);
+
+   entry = Util_SafeMalloc(sizeof *entry);
+   DblLnkLst_Init(&entry->links);
+   entry->key = Util_SafeStrdup(key);
+   entry->data = data;
+   entry->bytes = sizeof *entry + strlen(key) + 1 + dataBytes;
+
+   DblLnkLst_Init(&dropped);
+
+   MXUser_AcquireExclLock(cache->lock);
+
+   if (HashTable_Lookup(cache->hashTable, key, (void **)&oldEntry)) {
+      HgfsCacheUnlinkEntry(cache, oldEntry);
+      DblLnkLst_LinkLast(&dropped, &oldEntry->links);
+   }
+
+   HashTable_Insert(cache->hashTable, entry->key, entry);
+   DblLnkLst_LinkLast(&cache->links, &entry->links);
+   cache->stats.numEntries++;
+   cache->stats.numBytes += entry->bytes;
+
+   while (   cache->stats.numEntries > cache->maxEntries
+          || (   cache->stats.numBytes > cache->maxBytes
+              && cache->stats.numEntries > 1)) {
+      HgfsCacheEntry *lru = DblLnkLst_Container(cache->links.next,
+                                                HgfsCacheEntry, links);
+      HgfsCacheUnlinkEntry(cache, lru);
+      DblLnkLst_LinkLast(&dropped, &lru->links);
+      cache->stats.evictions++;
+   }
+
+   MXUser_ReleaseExclLock(cache->lock);
+
+   HgfsCacheFreeList(cache, &dropped);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCache_Get --
+ *
+ *      Get an entry in a cache and mark it as the most recently used one.
+ *
+ *      The returned data is still owned by the cache and may be freed by any
+ *      concurrent put, invalidation or eviction as soon as the cache lock is
+ *      dropped. Only use it if the caller serializes all the accesses to the
+ *      cache with a lock of its own, use HgfsCache_GetCopy otherwise.
+ *
+ * Results:
+ *      TRUE if the key was found, data is set to the cached data.
+ *      FALSE otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsCache_Get(HgfsCache *cache, // IN
+              const char *key,  // IN
+              void **data)      // OUT
+{
+   HgfsCacheEntry *entry;
+   Bool found;
+
+   ASSERT(cache);
+   ASSERT(key);
+   ASSERT(data);
+
+   MXUser_AcquireExclLock(cache->lock);
+
+   found = HashTable_Lookup(cache->hashTable, key, (void **)&entry);
+   if (found) {
+      DblLnkLst_Unlink1(&entry->links);
+      DblLnkLst_LinkLast(&cache->links, &entry->links);
+      *data = entry->data;
+      cache->stats.hits++;
+   } else {
+      cache->stats.misses++;
+   }
+
+   MXUser_ReleaseExclLock(cache->lock);
+
+   return found;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCache_GetCopy --
+ *
+ *      Get a copy of an entry in a cache and mark it as the most recently
+ *      used one. The data is copied while the cache lock is held, so the
+ *      copy stays valid whatever happens to the entry afterwards.
+ *
+ * Results:
+ *      TRUE if the key was found, the first dataSize bytes of the cached data
+ *      are copied to data. FALSE otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsCache_GetCopy(HgfsCache *cache, // IN
+                  const char *key,  // IN
+                  void *data,       // OUT
+                  size_t dataSize)  // IN
+{
+   HgfsCacheEntry *entry;
+   Bool found;
+
+   ASSERT(cache);
+   ASSERT(key);
+   ASSERT(data);
+
+   MXUser_AcquireExclLock(cache->lock);
+
+   found = HashTable_Lookup(cache->hashTable, key, (void **)&entry);
+   if (found) {
+      DblLnkLst_Unlink1(&entry->links);
+      DblLnkLst_LinkLast(&cache->links, &entry->links);
+      memcpy(data, entry->data, dataSize);
+      cache->stats.hits++;
+   } else {
+      cache->stats.misses++;
+   }
+
+   MXUser_ReleaseExclLock(cache->lock);
+
+   return found;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCache_Invalidate --
+ *
+ *      Remove an entry from a cache.
+ *
+ * Results:
+ *      TRUE if the key was found and removed, FALSE otherwise.
+ *
+ * Side effects:
+ *      The entry data is freed. The remove LRU callback is not invoked.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsCache_Invalidate(HgfsCache *cache, // IN
+                     const char *key)  // IN
+{
+   HgfsCacheEntry *entry;
+   Bool found;
+
+   ASSERT(cache);
+   ASSERT(key);
+
+   MXUser_AcquireExclLock(cache->lock);
+   found = HashTable_Lookup(cache->hashTable, key, (void **)&entry);
+   if (found) {
+      HgfsCacheUnlinkEntry(cache, entry);
+   }
+   MXUser_ReleaseExclLock(cache->lock);
+
+   if (found) {
+      HgfsCacheFreeEntry(cache, entry, FALSE);
+   }
+
+   return found;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCache_GetStats --
+ *
+ *      Get a snapshot of the cache statistics.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsCache_GetStats(HgfsCache *cache,       // IN
+                   HgfsCacheStats *stats)  // OUT
+{
+   ASSERT(cache);
+   ASSERT(stats);
+
+   MXUser_AcquireExclLock(cache->lock);
+   *stats = cache->stats;
+   MXUser_ReleaseExclLock(cache->lock);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCache_SetLimits --
+ *
+ *      Set the bounds of a cache.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None. The new bounds are enforced by the next put.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsCache_SetLimits(HgfsCache *cache,    // IN
+                    uint32 maxEntries,   // IN
+                    size_t maxBytes)     // IN
+{
+   ASSERT(cache);
+   ASSERT(maxEntries > 0);
+
+   MXUser_AcquireExclLock(cache->lock);
+   cache->maxEntries = maxEntries;
+   cache->maxBytes = maxBytes;
+   MXUser_ReleaseExclLock(cache->lock);
+}
@@ -29,19 +29,44 @@
 #include "dbllnklst.h"
 #include "userlock.h"
 
+/*
+ * Default bounds of a cache. The byte bound accounts for the keys, the per
+ * entry bookkeeping and the data sizes given to HgfsCache_PutSized; the
+ * cached data itself is opaque to the cache.
+ */
+#define HGFS_CACHE_MAX_ENTRIES   1024
+#define HGFS_CACHE_MAX_BYTES     (1024 * 1024)
+
 typedef void(*HgfsCacheRemoveLRUCallback)(void *data);
 
+typedef struct HgfsCacheStats {
+   uint32 numEntries;         /* Current number of entries. */
+   size_t numBytes;           /* Current number of accounted bytes. */
+   uint64 hits;               /* HgfsCache_Get calls which found the key. */
+   uint64 misses;             /* HgfsCache_Get calls which did not. */
+   uint64 evictions;          /* Entries removed to honour the bounds. */
+} HgfsCacheStats;
+
 typedef struct HgfsCache {
    void *hashTable;
-   DblLnkLst_Links links;
+   DblLnkLst_Links links;     /* Entries, least recently used first. */
    MXUserExclLock *lock;
    HgfsCacheRemoveLRUCallback callback;
+   uint32 maxEntries;
+   size_t maxBytes;
+   HgfsCacheStats stats;
 } HgfsCache;
 
 HgfsCache *HgfsCache_Alloc(HgfsCacheRemoveLRUCallback callback);
 void HgfsCache_Destroy(HgfsCache *cache);
 void HgfsCache_Put(HgfsCache *cache, const char *key, void *data);
+void HgfsCache_PutSized(HgfsCache *cache, const char *key, void *data,
+                        size_t dataBytes);
 Bool HgfsCache_Get(HgfsCache *cache, const char *key, void **data);
+Bool HgfsCache_GetCopy(HgfsCache *cache, const char *key, void *data,
+                       size_t dataSize);
 Bool HgfsCache_Invalidate(HgfsCache *cache, const char *key);
+void HgfsCache_GetStats(HgfsCache *cache, HgfsCacheStats *stats);
+void HgfsCache_SetLimits(HgfsCache *cache, uint32 maxEntries, size_t maxBytes);
 
 #endif // ifndef _HGFS_CACHE_H_
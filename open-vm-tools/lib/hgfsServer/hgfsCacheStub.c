@@ -22,6 +22,8 @@
  *    This file contains the stub implementation for hgfs cache.
  */
 
+#include <string.h>
+
 #include "hgfsCache.h"
 #include "hgfsServerInt.h"
 
@@ -95,6 +97,31 @@ HgfsCache_Put(HgfsCache *cache,                    // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCache_PutSized --
+ *
+ *      Put an entry into a cache.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsCache_PutSized(HgfsCache *cache,                 // IN
+                   const char *key,                  // IN
+                   void *data,                       // IN
+                   size_t dataBytes)                 // IN
+{
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -120,6 +147,32 @@ HgfsCache_Get(HgfsCache *cache, // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCache_GetCopy --
+ *
+ *      Get a copy of an entry in a cache.
+ *
+ * Results:
+ *      Always return FALSE.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsCache_GetCopy(HgfsCache *cache, // IN
+                  const char *key,  // IN
+                  void *data,       // OUT
+                  size_t dataSize)  // IN
+{
+   return FALSE;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -142,3 +195,51 @@ HgfsCache_Invalidate(HgfsCache *cache, // IN
 {
    return FALSE;
 }
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCache_GetStats --
+ *
+ *      Get the cache statistics.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsCache_GetStats(HgfsCache *cache,       // IN
+                   HgfsCacheStats *stats)  // OUT
+{
+   memset(stats, 0, sizeof *stats);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCache_SetLimits --
+ *
+ *      Set the bounds of a cache.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsCache_SetLimits(HgfsCache *cache,    // IN
+                    uint32 maxEntries,   // IN
+                    size_t maxBytes)     // IN
+{
+}
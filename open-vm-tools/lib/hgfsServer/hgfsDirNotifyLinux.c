@@ -0,0 +1,1515 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * hgfsDirNotifyLinux.c --
+ *
+ *	Directory change notification support for Linux, based on inotify.
+ *
+ *	A single inotify instance serves all the subscribers. Watches are
+ *	coalesced: subscribers watching the same directory share one inotify
+ *	watch descriptor, which keeps a reference per subscriber along with
+ *	the directory path relative to the subscriber's shared folder. A
+ *	recursive subscriber references a watch for every directory of its
+ *	tree; watches are added for directories created or moved into the
+ *	tree as the events arrive.
+ *
+ *	A monitor thread reads the events in batches, translates them into
+ *	HGFS events and queues them. Identical consecutive events for the
+ *	same file and subscriber are merged, e.g. the stream of IN_MODIFY
+ *	events a large write generates. The queued events are then delivered
+ *	to the server without the notification lock held. If the kernel
+ *	queue overflows, or a batch exceeds its bound, the affected
+ *	subscribers get a single HGFS_NOTIFY_EVENTS_DROPPED event instead so
+ *	the client knows it has to rescan.
+ */
+
+#define _GNU_SOURCE // for pipe2()
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/poll.h>
+#include <sys/stat.h>
+
+#include "vmware.h"
+#include "vm_basic_types.h"
+#include "dbllnklst.h"
+#include "hashTable.h"
+#include "mutexRankLib.h"
+#include "str.h"
+#include "userlock.h"
+#include "util.h"
+
+#include "hgfsProto.h"
+#include "hgfsServer.h"
+#include "hgfsServerInt.h"
+#include "hgfsUtil.h"
+#include "hgfsDirNotify.h"
+
+#define AS_KEY(_x)  ((const void *)(uintptr_t)(_x))
+
+/* Number of buckets of the watch descriptor hash table. */
+#define HGFS_NOTIFY_WATCH_BUCKETS         1024
+
+/* Size of the buffer the inotify events are read into. */
+#define HGFS_NOTIFY_READ_BUFFER_SIZE      (64 * 1024)
+
+/* Maximum number of events queued for delivery from a single read. */
+#define HGFS_NOTIFY_MAX_PENDING_EVENTS    1024
+
+/* inotify events which are always watched for. */
+#define HGFS_NOTIFY_INOTIFY_BASE_MASK     (IN_CREATE | IN_DELETE |          \
+                                           IN_MOVED_FROM | IN_MOVED_TO |    \
+                                           IN_DELETE_SELF | IN_MOVE_SELF)
+
+typedef struct HgfsNotifySharedFolder {
+   DblLnkLst_Links links;              /* Shared folders list links. */
+   HgfsSharedFolderHandle handle;
+   char *path;                         /* Local path of the share root. */
+   char *shareName;
+} HgfsNotifySharedFolder;
+
+typedef struct HgfsNotifySubscriber {
+   DblLnkLst_Links links;              /* Subscribers list links. */
+   HgfsSubscriberHandle handle;
+   HgfsNotifySharedFolder *sharedFolder;
+   char *path;                         /* Watched directory, share relative. */
+   uint32 eventFilter;                 /* HGFS_NOTIFY_* events to report. */
+   Bool recursive;                     /* Watch the whole directory tree. */
+   struct HgfsSessionInfo *session;
+   int *wds;                           /* Watches referenced. */
+   uint32 numWds;
+   uint32 maxWds;
+} HgfsNotifySubscriber;
+
+typedef struct HgfsNotifyWatchRef {
+   HgfsNotifySubscriber *subscriber;
+   char *relDir;                       /* Watched directory, share relative. */
+} HgfsNotifyWatchRef;
+
+typedef struct HgfsNotifyWatch {
+   int wd;                             /* inotify watch descriptor. */
+   uint32 mask;                        /* inotify events watched for. */
+   HgfsNotifyWatchRef *refs;           /* One per subscriber. */
+   uint32 numRefs;
+   uint32 maxRefs;
+} HgfsNotifyWatch;
+
+/* An event queued for delivery. */
+typedef struct HgfsNotifyEvent {
+   DblLnkLst_Links links;
+   HgfsSharedFolderHandle sharedFolder;
+   HgfsSubscriberHandle subscriber;
+   struct HgfsSessionInfo *session;
+   char *name;                         /* Share relative file name. */
+   uint32 mask;                        /* HGFS_NOTIFY_* events. */
+} HgfsNotifyEvent;
+
+typedef struct HgfsNotifyState {
+   MXUserExclLock *lock;               /* Protects all of the below. */
+   MXUserCondVar *stateChanged;        /* Pause and dispatch transitions. */
+   int inotifyFd;
+   int wakeFds[2];                     /* Pipe to interrupt the poll. */
+   pthread_t thread;
+   Bool threadRunning;
+   Bool exiting;                       /* Monitor thread should terminate. */
+   Bool paused;                        /* Monitor thread is paused. */
+   Bool dispatching;                   /* Events are being delivered. */
+   uint32 deactivated;                 /* Bit per HgfsNotifyActivateReason. */
+   HgfsServerNotifyCallbacks callbacks;
+   DblLnkLst_Links sharedFolders;
+   DblLnkLst_Links subscribers;
+   HashTable *watches;                 /* wd -> HgfsNotifyWatch. */
+   HgfsSharedFolderHandle nextFolderHandle;
+   HgfsSubscriberHandle nextSubscriberHandle;
+   char *readBuffer;
+} HgfsNotifyState;
+
+static HgfsNotifyState *gHgfsNotify = NULL;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyHgfsToInotifyMask --
+ *
+ *    Convert HGFS notification event flags to the inotify events needed to
+ *    generate them.
+ *
+ * Results:
+ *    The inotify event mask.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static uint32
+HgfsNotifyHgfsToInotifyMask(uint32 eventFilter) // IN: HGFS_NOTIFY_* events
+{
+   uint32 mask = HGFS_NOTIFY_INOTIFY_BASE_MASK;
+
+   if (eventFilter & (HGFS_NOTIFY_ACCESS | HGFS_NOTIFY_ATIME)) {
+      mask |= IN_ACCESS;
+   }
+   if (eventFilter & (HGFS_NOTIFY_ATTRIB | HGFS_NOTIFY_CTIME |
+                      HGFS_NOTIFY_CHANGE_SECURITY | HGFS_NOTIFY_CHANGE_EA)) {
+      mask |= IN_ATTRIB;
+   }
+   if (eventFilter & (HGFS_NOTIFY_MODIFY | HGFS_NOTIFY_SIZE |
+                      HGFS_NOTIFY_MTIME)) {
+      mask |= IN_MODIFY;
+   }
+   if (eventFilter & HGFS_NOTIFY_OPEN) {
+      mask |= IN_OPEN;
+   }
+   if (eventFilter & HGFS_NOTIFY_CLOSE_WRITE) {
+      mask |= IN_CLOSE_WRITE;
+   }
+   if (eventFilter & HGFS_NOTIFY_CLOSE_NOWRITE) {
+      mask |= IN_CLOSE_NOWRITE;
+   }
+   return mask;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyInotifyToHgfsMask --
+ *
+ *    Convert an inotify event mask to HGFS notification event flags.
+ *
+ * Results:
+ *    The HGFS_NOTIFY_* events.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static uint32
+HgfsNotifyInotifyToHgfsMask(uint32 mask) // IN: inotify event mask
+{
+   Bool isDir = (mask & IN_ISDIR) != 0;
+   uint32 events = 0;
+
+   if (mask & IN_ACCESS) {
+      events |= HGFS_NOTIFY_ACCESS | HGFS_NOTIFY_ATIME;
+   }
+   if (mask & IN_ATTRIB) {
+      events |= HGFS_NOTIFY_ATTRIB | HGFS_NOTIFY_CTIME |
+                HGFS_NOTIFY_CHANGE_SECURITY;
+   }
+   if (mask & IN_MODIFY) {
+      events |= HGFS_NOTIFY_MODIFY | HGFS_NOTIFY_SIZE | HGFS_NOTIFY_MTIME;
+   }
+   if (mask & IN_OPEN) {
+      events |= HGFS_NOTIFY_OPEN;
+   }
+   if (mask & IN_CLOSE_WRITE) {
+      events |= HGFS_NOTIFY_CLOSE_WRITE;
+   }
+   if (mask & IN_CLOSE_NOWRITE) {
+      events |= HGFS_NOTIFY_CLOSE_NOWRITE;
+   }
+   if (mask & IN_CREATE) {
+      events |= isDir ? HGFS_NOTIFY_CREATE_DIR : HGFS_NOTIFY_CREATE_FILE;
+   }
+   if (mask & IN_DELETE) {
+      events |= isDir ? HGFS_NOTIFY_DELETE_DIR : HGFS_NOTIFY_DELETE_FILE;
+   }
+   if (mask & IN_MOVED_FROM) {
+      events |= isDir ? HGFS_NOTIFY_OLD_DIR_NAME : HGFS_NOTIFY_OLD_FILE_NAME;
+   }
+   if (mask & IN_MOVED_TO) {
+      events |= isDir ? HGFS_NOTIFY_NEW_DIR_NAME : HGFS_NOTIFY_NEW_FILE_NAME;
+   }
+   if (mask & IN_DELETE_SELF) {
+      events |= HGFS_NOTIFY_DELETE_SELF | HGFS_NOTIFY_WATCH_DELETED;
+   }
+   if (mask & IN_MOVE_SELF) {
+      events |= HGFS_NOTIFY_MOVE_SELF;
+   }
+   return events;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyJoinPath --
+ *
+ *    Join a directory and a name, either of which may be empty.
+ *
+ * Results:
+ *    The allocated path.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static char *
+HgfsNotifyJoinPath(const char *dir,  // IN
+                   const char *name) // IN
+{
+   if (*dir == '\0') {
+      return Util_SafeStrdup(name);
+   }
+   if (*name == '\0') {
+      return Util_SafeStrdup(dir);
+   }
+   return Str_SafeAsprintf(NULL, "%s%c%s", dir, DIRSEPC, name);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyFindSubscriber --
+ *
+ *    Find a subscriber by handle. The notification lock must be held.
+ *
+ * Results:
+ *    The subscriber or NULL.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsNotifySubscriber *
+HgfsNotifyFindSubscriber(HgfsSubscriberHandle handle) // IN
+{
+   DblLnkLst_Links *link;
+
+   DblLnkLst_ForEach(link, &gHgfsNotify->subscribers) {
+      HgfsNotifySubscriber *subscriber =
+         DblLnkLst_Container(link, HgfsNotifySubscriber, links);
+
+      if (subscriber->handle == handle) {
+         return subscriber;
+      }
+   }
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyFindSharedFolder --
+ *
+ *    Find a shared folder by handle. The notification lock must be held.
+ *
+ * Results:
+ *    The shared folder or NULL.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsNotifySharedFolder *
+HgfsNotifyFindSharedFolder(HgfsSharedFolderHandle handle) // IN
+{
+   DblLnkLst_Links *link;
+
+   DblLnkLst_ForEach(link, &gHgfsNotify->sharedFolders) {
+      HgfsNotifySharedFolder *folder =
+         DblLnkLst_Container(link, HgfsNotifySharedFolder, links);
+
+      if (folder->handle == handle) {
+         return folder;
+      }
+   }
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyWatchAddRef --
+ *
+ *    Add a watch on a directory for a subscriber. An existing watch on the
+ *    directory is shared, extending its event mask when needed.
+ *
+ *    The notification lock must be held.
+ *
+ * Results:
+ *    TRUE if the directory is watched for the subscriber, FALSE otherwise.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsNotifyWatchAddRef(HgfsNotifySubscriber *subscriber, // IN
+                      const char *relDir)               // IN: share relative
+{
+   uint32 mask = HgfsNotifyHgfsToInotifyMask(subscriber->eventFilter);
+   HgfsNotifyWatch *watch;
+   char *localPath;
+   uint32 i;
+   int wd;
+
+   localPath = HgfsNotifyJoinPath(subscriber->sharedFolder->path, relDir);
+   wd = inotify_add_watch(gHgfsNotify->inotifyFd, localPath,
+                          mask | IN_ONLYDIR | IN_DONT_FOLLOW | IN_MASK_ADD);
+   if (wd < 0) {
+      LOG(4, "%s: failed to watch %s: %d\n", __FUNCTION__, localPath, errno);
+      free(localPath);
+      return FALSE;
+   }
+   free(localPath);
+
+   if (HashTable_Lookup(gHgfsNotify->watches, AS_KEY(wd), (void **)&watch)) {
+      for (i = 0; i < watch->numRefs; i++) {
+         if (watch->refs[i].subscriber == subscriber) {
+            /* Same directory reached twice, e.g. through a bind mount. */
+            return TRUE;
+         }
+      }
+      watch->mask |= mask;
+   } else {
+      watch = Util_SafeCalloc(1, sizeof *watch);
+      watch->wd = wd;
+      watch->mask = mask;
+      HashTable_Insert(gHgfsNotify->watches, AS_KEY(wd), watch);
+   }
+
+   if (watch->numRefs == watch->maxRefs) {
+      watch->maxRefs = watch->maxRefs == 0 ? 2 : watch->maxRefs * 2;
+      watch->refs = Util_SafeRealloc(watch->refs,
+                                     watch->maxRefs * sizeof *watch->refs);
+   }
+   watch->refs[watch->numRefs].subscriber = subscriber;
+   watch->refs[watch->numRefs].relDir = Util_SafeStrdup(relDir);
+   watch->numRefs++;
+
+   if (subscriber->numWds == subscriber->maxWds) {
+      subscriber->maxWds = subscriber->maxWds == 0 ? 4 : subscriber->maxWds * 2;
+      subscriber->wds = Util_SafeRealloc(subscriber->wds,
+                                         subscriber->maxWds *
+                                         sizeof *subscriber->wds);
+   }
+   subscriber->wds[subscriber->numWds++] = wd;
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyWatchRemoveRef --
+ *
+ *    Drop the reference of a subscriber on a watch, removing the watch with
+ *    the last reference. The watch descriptor is not removed from the
+ *    subscriber.
+ *
+ *    The notification lock must be held.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNotifyWatchRemoveRef(HgfsNotifySubscriber *subscriber, // IN
+                         int wd)                           // IN
+{
+   HgfsNotifyWatch *watch;
+   uint32 i;
+
+   if (!HashTable_Lookup(gHgfsNotify->watches, AS_KEY(wd), (void **)&watch)) {
+      /* The kernel already dropped the watch. */
+      return;
+   }
+
+   for (i = 0; i < watch->numRefs; i++) {
+      if (watch->refs[i].subscriber == subscriber) {
+         free(watch->refs[i].relDir);
+         watch->refs[i] = watch->refs[--watch->numRefs];
+         break;
+      }
+   }
+
+   if (watch->numRefs == 0) {
+      inotify_rm_watch(gHgfsNotify->inotifyFd, wd);
+      HashTable_Delete(gHgfsNotify->watches, AS_KEY(wd));
+      free(watch->refs);
+      free(watch);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyAddTree --
+ *
+ *    Watch a directory for a subscriber, and for a recursive subscriber all
+ *    the directories below it. Symbolic links are not followed.
+ *
+ *    The notification lock must be held.
+ *
+ * Results:
+ *    TRUE if the directory itself is watched, FALSE otherwise. Failures to
+ *    watch subdirectories are only logged.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsNotifyAddTree(HgfsNotifySubscriber *subscriber, // IN
+                  const char *relDir)               // IN: share relative
+{
+   char *localPath;
+   DIR *dir;
+   struct dirent *entry;
+
+   if (!HgfsNotifyWatchAddRef(subscriber, relDir)) {
+      return FALSE;
+   }
+   if (!subscriber->recursive) {
+      return TRUE;
+   }
+
+   localPath = HgfsNotifyJoinPath(subscriber->sharedFolder->path, relDir);
+   dir = opendir(localPath);
+   if (dir == NULL) {
+      LOG(4, "%s: failed to open %s: %d\n", __FUNCTION__, localPath, errno);
+      free(localPath);
+      return TRUE;
+   }
+
+   while ((entry = readdir(dir)) != NULL) {
+      Bool isDir;
+      char *childDir;
+
+      if (   strcmp(entry->d_name, ".") == 0
+          || strcmp(entry->d_name, "..") == 0) {
+         continue;
+      }
+
+      if (entry->d_type == DT_UNKNOWN) {
+         struct stat st;
+
+         isDir =    fstatat(dirfd(dir), entry->d_name, &st,
+                            AT_SYMLINK_NOFOLLOW) == 0
+                 && S_ISDIR(st.st_mode);
+      } else {
+         isDir = entry->d_type == DT_DIR;
+      }
+      if (!isDir) {
+         continue;
+      }
+
+      childDir = HgfsNotifyJoinPath(relDir, entry->d_name);
+      if (!HgfsNotifyAddTree(subscriber, childDir)) {
+         LOG(4, "%s: subdirectory %s is not watched\n", __FUNCTION__,
+             childDir);
+      }
+      free(childDir);
+   }
+
+   closedir(dir);
+   free(localPath);
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyRemoveTree --
+ *
+ *    Drop the references of a subscriber on the watches of a directory and
+ *    all the directories below it. Used when a subdirectory of a recursive
+ *    watch is moved away.
+ *
+ *    The notification lock must be held.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNotifyRemoveTree(HgfsNotifySubscriber *subscriber, // IN
+                     const char *relDir)               // IN: share relative
+{
+   size_t relDirLen = strlen(relDir);
+   uint32 i = 0;
+
+   while (i < subscriber->numWds) {
+      HgfsNotifyWatch *watch;
+      Bool inTree = FALSE;
+      uint32 j;
+
+      if (HashTable_Lookup(gHgfsNotify->watches, AS_KEY(subscriber->wds[i]),
+                           (void **)&watch)) {
+         for (j = 0; j < watch->numRefs; j++) {
+            const char *watchDir = watch->refs[j].relDir;
+
+            if (watch->refs[j].subscriber == subscriber) {
+               inTree =    strncmp(watchDir, relDir, relDirLen) == 0
+                        && (   watchDir[relDirLen] == '\0'
+                            || watchDir[relDirLen] == DIRSEPC);
+               break;
+            }
+         }
+      }
+
+      if (inTree) {
+         HgfsNotifyWatchRemoveRef(subscriber, subscriber->wds[i]);
+         subscriber->wds[i] = subscriber->wds[--subscriber->numWds];
+      } else {
+         i++;
+      }
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyFreeSubscriber --
+ *
+ *    Unlink a subscriber, drop all its watches and free it.
+ *
+ *    The notification lock must be held.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNotifyFreeSubscriber(HgfsNotifySubscriber *subscriber) // IN
+{
+   uint32 i;
+
+   for (i = 0; i < subscriber->numWds; i++) {
+      HgfsNotifyWatchRemoveRef(subscriber, subscriber->wds[i]);
+   }
+   DblLnkLst_Unlink1(&subscriber->links);
+   free(subscriber->wds);
+   free(subscriber->path);
+   free(subscriber);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyForgetWatch --
+ *
+ *    Forget a watch the kernel removed, e.g. because the directory was
+ *    deleted.
+ *
+ *    The notification lock must be held.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNotifyForgetWatch(int wd) // IN
+{
+   HgfsNotifyWatch *watch;
+   uint32 i;
+
+   if (!HashTable_Lookup(gHgfsNotify->watches, AS_KEY(wd), (void **)&watch)) {
+      return;
+   }
+
+   for (i = 0; i < watch->numRefs; i++) {
+      HgfsNotifySubscriber *subscriber = watch->refs[i].subscriber;
+      uint32 j;
+
+      for (j = 0; j < subscriber->numWds; j++) {
+         if (subscriber->wds[j] == wd) {
+            subscriber->wds[j] = subscriber->wds[--subscriber->numWds];
+            break;
+         }
+      }
+      free(watch->refs[i].relDir);
+   }
+
+   HashTable_Delete(gHgfsNotify->watches, AS_KEY(wd));
+   free(watch->refs);
+   free(watch);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyQueueEvent --
+ *
+ *    Queue an event for delivery to a subscriber. The event is merged into
+ *    the previous event queued for the same subscriber and file when the
+ *    two are identical. Past the pending events bound the event is replaced
+ *    by an events dropped event.
+ *
+ *    The notification lock must be held.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNotifyQueueEvent(DblLnkLst_Links *pending,         // IN/OUT: event queue
+                     uint32 *numPending,               // IN/OUT: queue length
+                     HgfsNotifySubscriber *subscriber, // IN
+                     const char *name,                 // IN: share relative
+                     uint32 mask)                      // IN: HGFS_NOTIFY_*
+{
+   DblLnkLst_Links *link;
+   HgfsNotifyEvent *event;
+
+   if (*numPending >= HGFS_NOTIFY_MAX_PENDING_EVENTS) {
+      name = "";
+      mask = HGFS_NOTIFY_EVENTS_DROPPED;
+   }
+
+   for (link = pending->prev; link != pending; link = link->prev) {
+      event = DblLnkLst_Container(link, HgfsNotifyEvent, links);
+      if (   event->subscriber == subscriber->handle
+          && strcmp(event->name, name) == 0) {
+         if (event->mask == mask) {
+            return;
+         }
+         break;
+      }
+   }
+
+   event = Util_SafeMalloc(sizeof *event);
+   DblLnkLst_Init(&event->links);
+   event->sharedFolder = subscriber->sharedFolder->handle;
+   event->subscriber = subscriber->handle;
+   event->session = subscriber->session;
+   event->name = Util_SafeStrdup(name);
+   event->mask = mask;
+   DblLnkLst_LinkLast(pending, &event->links);
+   (*numPending)++;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyProcessEvent --
+ *
+ *    Translate an inotify event for the subscribers of its watch, and
+ *    update the watches of recursive subscribers for directories moving in
+ *    and out of their trees.
+ *
+ *    The notification lock must be held.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNotifyProcessEvent(const struct inotify_event *iev, // IN
+                       DblLnkLst_Links *pending,        // IN/OUT: event queue
+                       uint32 *numPending)              // IN/OUT: queue length
+{
+   HgfsNotifyWatch *watch;
+   const char *evName = iev->len > 0 ? iev->name : "";
+   uint32 mask = HgfsNotifyInotifyToHgfsMask(iev->mask);
+   uint32 i;
+
+   if (iev->mask & IN_Q_OVERFLOW) {
+      DblLnkLst_Links *link;
+
+      LOG(4, "%s: inotify queue overflow\n", __FUNCTION__);
+      DblLnkLst_ForEach(link, &gHgfsNotify->subscribers) {
+         HgfsNotifySubscriber *subscriber =
+            DblLnkLst_Container(link, HgfsNotifySubscriber, links);
+
+         HgfsNotifyQueueEvent(pending, numPending, subscriber, "",
+                              HGFS_NOTIFY_EVENTS_DROPPED);
+      }
+      return;
+   }
+
+   if (!HashTable_Lookup(gHgfsNotify->watches, AS_KEY(iev->wd),
+                         (void **)&watch)) {
+      return;
+   }
+
+   if (iev->mask & IN_IGNORED) {
+      HgfsNotifyForgetWatch(iev->wd);
+      return;
+   }
+
+   /*
+    * Iterate over a copy: the references may change while directories are
+    * added to or removed from the recursive watches.
+    */
+   if (watch->numRefs > 0) {
+      uint32 numRefs = watch->numRefs;
+      HgfsNotifyWatchRef *refs = Util_SafeMalloc(numRefs * sizeof *refs);
+
+      for (i = 0; i < numRefs; i++) {
+         refs[i].subscriber = watch->refs[i].subscriber;
+         refs[i].relDir = Util_SafeStrdup(watch->refs[i].relDir);
+      }
+
+      for (i = 0; i < numRefs; i++) {
+         HgfsNotifySubscriber *subscriber = refs[i].subscriber;
+         char *name = HgfsNotifyJoinPath(refs[i].relDir, evName);
+         uint32 subscriberMask = mask & subscriber->eventFilter;
+
+         if (subscriberMask != 0) {
+            HgfsNotifyQueueEvent(pending, numPending, subscriber, name,
+                                 subscriberMask);
+         }
+
+         if (subscriber->recursive && (iev->mask & IN_ISDIR)) {
+            if (   (iev->mask & (IN_CREATE | IN_MOVED_TO))
+                && !HgfsNotifyAddTree(subscriber, name)) {
+               HgfsNotifyQueueEvent(pending, numPending, subscriber, "",
+                                    HGFS_NOTIFY_EVENTS_DROPPED);
+            }
+         }
+         if (   subscriber->recursive
+             && (iev->mask & IN_MOVE_SELF)
+             && strcmp(refs[i].relDir, subscriber->path) != 0) {
+            /* A subdirectory moved out, its new location is not known. */
+            HgfsNotifyRemoveTree(subscriber, refs[i].relDir);
+         }
+         free(name);
+      }
+
+      for (i = 0; i < numRefs; i++) {
+         free(refs[i].relDir);
+      }
+      free(refs);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyDispatch --
+ *
+ *    Deliver the queued events to the server and free them.
+ *
+ *    The notification lock must not be held.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNotifyDispatch(DblLnkLst_Links *pending) // IN: event queue
+{
+   DblLnkLst_Links *link, *nextLink;
+
+   DblLnkLst_ForEachSafe(link, nextLink, pending) {
+      HgfsNotifyEvent *event = DblLnkLst_Container(link, HgfsNotifyEvent,
+                                                   links);
+
+      DblLnkLst_Unlink1(&event->links);
+      gHgfsNotify->callbacks.eventReceive(event->sharedFolder,
+                                          event->subscriber,
+                                          event->name,
+                                          event->mask,
+                                          event->session);
+      free(event->name);
+      free(event);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyMonitorThread --
+ *
+ *    Monitor thread main loop: wait for inotify events and deliver them,
+ *    pausing while event generation is deactivated.
+ *
+ * Results:
+ *    NULL.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void *
+HgfsNotifyMonitorThread(void *data) // IN: notification state
+{
+   HgfsNotifyState *state = data;
+
+   for (;;) {
+      struct pollfd fds[2];
+      DblLnkLst_Links pending;
+      uint32 numPending = 0;
+      ssize_t length;
+      char *ptr;
+
+      MXUser_AcquireExclLock(state->lock);
+      while (!state->exiting && state->deactivated != 0) {
+         if (!state->paused) {
+            state->paused = TRUE;
+            MXUser_BroadcastCondVar(state->stateChanged);
+         }
+         MXUser_WaitCondVarExclLock(state->lock, state->stateChanged);
+      }
+      state->paused = FALSE;
+      if (state->exiting) {
+         MXUser_ReleaseExclLock(state->lock);
+         break;
+      }
+      MXUser_ReleaseExclLock(state->lock);
+
+      fds[0].fd = state->inotifyFd;
+      fds[0].events = POLLIN;
+      fds[1].fd = state->wakeFds[0];
+      fds[1].events = POLLIN;
+      if (poll(fds, ARRAYSIZE(fds), -1) < 0) {
+         if (errno != EINTR) {
+            Log("%s: poll failed: %d\n", __FUNCTION__, errno);
+         }
+         continue;
+      }
+
+      if (fds[1].revents & POLLIN) {
+         char drain[64];
+
+         while (read(state->wakeFds[0], drain, sizeof drain) > 0) {
+         }
+         continue;
+      }
+      if ((fds[0].revents & POLLIN) == 0) {
+         continue;
+      }
+
+      DblLnkLst_Init(&pending);
+
+      MXUser_AcquireExclLock(state->lock);
+      if (state->deactivated != 0) {
+         /* Leave the events queued in the kernel until reactivated. */
+         MXUser_ReleaseExclLock(state->lock);
+         continue;
+      }
+
+      length = read(state->inotifyFd, state->readBuffer,
+                    HGFS_NOTIFY_READ_BUFFER_SIZE);
+      for (ptr = state->readBuffer;
+           length > 0 && ptr < state->readBuffer + length;
+           ptr += sizeof (struct inotify_event) +
+                  ((struct inotify_event *)ptr)->len) {
+         HgfsNotifyProcessEvent((struct inotify_event *)ptr, &pending,
+                                &numPending);
+      }
+      state->dispatching = numPending > 0;
+      MXUser_ReleaseExclLock(state->lock);
+
+      if (numPending > 0) {
+         LOG(8, "%s: delivering %u events\n", __FUNCTION__, numPending);
+         HgfsNotifyDispatch(&pending);
+
+         MXUser_AcquireExclLock(state->lock);
+         state->dispatching = FALSE;
+         MXUser_BroadcastCondVar(state->stateChanged);
+         MXUser_ReleaseExclLock(state->lock);
+      }
+   }
+
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyWakeMonitor --
+ *
+ *    Interrupt the monitor thread poll.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNotifyWakeMonitor(void)
+{
+   char c = 0;
+
+   if (write(gHgfsNotify->wakeFds[1], &c, sizeof c) < 0 && errno != EAGAIN) {
+      Log("%s: failed to wake the monitor: %d\n", __FUNCTION__, errno);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyWaitForDispatchLocked --
+ *
+ *    Wait until the events being delivered are done, so the caller can
+ *    rely on no event being delivered for a removed subscriber. Does not
+ *    wait when called from the delivery itself.
+ *
+ *    The notification lock must be held.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNotifyWaitForDispatchLocked(void)
+{
+   if (   gHgfsNotify->threadRunning
+       && pthread_equal(pthread_self(), gHgfsNotify->thread)) {
+      return;
+   }
+   while (gHgfsNotify->dispatching) {
+      MXUser_WaitCondVarExclLock(gHgfsNotify->lock, gHgfsNotify->stateChanged);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotify_Init --
+ *
+ *    Initialization for the notification component: create the inotify
+ *    instance and start the monitor thread.
+ *
+ * Results:
+ *    HGFS_STATUS_SUCCESS or an error if inotify is not available.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsInternalStatus
+HgfsNotify_Init(const HgfsServerNotifyCallbacks *serverCbData) // IN
+{
+   HgfsNotifyState *state;
+   HgfsInternalStatus status;
+   int err;
+
+   ASSERT(serverCbData != NULL);
+   ASSERT(gHgfsNotify == NULL);
+
+   state = Util_SafeCalloc(1, sizeof *state);
+   state->wakeFds[0] = state->wakeFds[1] = -1;
+
+   state->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+   if (state->inotifyFd < 0) {
+      status = errno;
+      Log("%s: inotify is not available: %d\n", __FUNCTION__, status);
+      goto error;
+   }
+   if (pipe2(state->wakeFds, O_NONBLOCK | O_CLOEXEC) < 0) {
+      status = errno;
+      Log("%s: failed to create the wake pipe: %d\n", __FUNCTION__, status);
+      goto error;
+   }
+
+   state->lock = MXUser_CreateExclLock("HgfsNotifyLock", RANK_hgfsNotifyLock);
+   state->stateChanged = MXUser_CreateCondVarExclLock(state->lock);
+   state->callbacks = *serverCbData;
+   DblLnkLst_Init(&state->sharedFolders);
+   DblLnkLst_Init(&state->subscribers);
+   state->watches = HashTable_Alloc(HGFS_NOTIFY_WATCH_BUCKETS, HASH_INT_KEY,
+                                    NULL);
+   state->readBuffer = Util_SafeMalloc(HGFS_NOTIFY_READ_BUFFER_SIZE);
+
+   gHgfsNotify = state;
+
+   err = pthread_create(&state->thread, NULL, HgfsNotifyMonitorThread, state);
+   if (err != 0) {
+      Log("%s: failed to start the monitor thread: %d\n", __FUNCTION__, err);
+      HgfsNotify_Exit();
+      return err;
+   }
+   state->threadRunning = TRUE;
+
+   LOG(4, "%s: inotify notification active\n", __FUNCTION__);
+   return HGFS_ERROR_SUCCESS;
+
+error:
+   if (state->inotifyFd >= 0) {
+      close(state->inotifyFd);
+   }
+   free(state);
+   return status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotify_Exit --
+ *
+ *    Exit for the notification component: stop the monitor thread and free
+ *    all the shared folders, subscribers and watches.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsNotify_Exit(void)
+{
+   HgfsNotifyState *state = gHgfsNotify;
+   DblLnkLst_Links *link, *nextLink;
+
+   if (state == NULL) {
+      return;
+   }
+
+   if (state->threadRunning) {
+      MXUser_AcquireExclLock(state->lock);
+      state->exiting = TRUE;
+      MXUser_BroadcastCondVar(state->stateChanged);
+      MXUser_ReleaseExclLock(state->lock);
+      HgfsNotifyWakeMonitor();
+      pthread_join(state->thread, NULL);
+      state->threadRunning = FALSE;
+   }
+
+   MXUser_AcquireExclLock(state->lock);
+   DblLnkLst_ForEachSafe(link, nextLink, &state->subscribers) {
+      HgfsNotifyFreeSubscriber(DblLnkLst_Container(link, HgfsNotifySubscriber,
+                                                   links));
+   }
+   DblLnkLst_ForEachSafe(link, nextLink, &state->sharedFolders) {
+      HgfsNotifySharedFolder *folder =
+         DblLnkLst_Container(link, HgfsNotifySharedFolder, links);
+
+      DblLnkLst_Unlink1(&folder->links);
+      free(folder->path);
+      free(folder->shareName);
+      free(folder);
+   }
+   ASSERT(HashTable_GetNumElements(state->watches) == 0);
+   MXUser_ReleaseExclLock(state->lock);
+
+   gHgfsNotify = NULL;
+
+   HashTable_Free(state->watches);
+   close(state->inotifyFd);
+   close(state->wakeFds[0]);
+   close(state->wakeFds[1]);
+   free(state->readBuffer);
+   MXUser_DestroyCondVar(state->stateChanged);
+   MXUser_DestroyExclLock(state->lock);
+   free(state);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotify_Activate --
+ *
+ *    Activates generating file system change notifications. The events
+ *    which occurred while deactivated are delivered, or reported as dropped
+ *    if the kernel queue overflowed meanwhile.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsNotify_Activate(HgfsNotifyActivateReason reason, // IN: reason
+                    struct HgfsSessionInfo *session) // IN: session
+{
+   if (gHgfsNotify == NULL) {
+      return;
+   }
+
+   LOG(4, "%s: reason %d session %p\n", __FUNCTION__, reason, session);
+
+   MXUser_AcquireExclLock(gHgfsNotify->lock);
+   gHgfsNotify->deactivated &= ~(1U << reason);
+   MXUser_BroadcastCondVar(gHgfsNotify->stateChanged);
+   MXUser_ReleaseExclLock(gHgfsNotify->lock);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotify_Deactivate --
+ *
+ *    Deactivates generating file system change notifications. Returns once
+ *    the monitor thread is paused, so no event is delivered until
+ *    reactivated.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsNotify_Deactivate(HgfsNotifyActivateReason reason, // IN: reason
+                      struct HgfsSessionInfo *session) // IN: session
+{
+   if (gHgfsNotify == NULL) {
+      return;
+   }
+
+   LOG(4, "%s: reason %d session %p\n", __FUNCTION__, reason, session);
+
+   MXUser_AcquireExclLock(gHgfsNotify->lock);
+   gHgfsNotify->deactivated |= 1U << reason;
+   HgfsNotifyWakeMonitor();
+   while (gHgfsNotify->threadRunning && !gHgfsNotify->paused) {
+      MXUser_WaitCondVarExclLock(gHgfsNotify->lock, gHgfsNotify->stateChanged);
+   }
+   MXUser_ReleaseExclLock(gHgfsNotify->lock);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotify_AddSharedFolder --
+ *
+ *    Allocates memory and initializes new shared folder structure.
+ *
+ * Results:
+ *    Opaque handle for the new shared folder or HGFS_INVALID_FOLDER_HANDLE
+ *    if adding shared folder fails.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsSharedFolderHandle
+HgfsNotify_AddSharedFolder(const char *path,       // IN: path in the host
+                           const char *shareName)  // IN: name of the shared folder
+{
+   HgfsNotifySharedFolder *folder;
+   HgfsSharedFolderHandle handle;
+
+   if (gHgfsNotify == NULL || path == NULL || shareName == NULL) {
+      return HGFS_INVALID_FOLDER_HANDLE;
+   }
+
+   folder = Util_SafeCalloc(1, sizeof *folder);
+   DblLnkLst_Init(&folder->links);
+   folder->path = Util_SafeStrdup(path);
+   folder->shareName = Util_SafeStrdup(shareName);
+
+   MXUser_AcquireExclLock(gHgfsNotify->lock);
+   if (gHgfsNotify->nextFolderHandle == HGFS_INVALID_FOLDER_HANDLE) {
+      gHgfsNotify->nextFolderHandle = 0;
+   }
+   handle = gHgfsNotify->nextFolderHandle++;
+   folder->handle = handle;
+   DblLnkLst_LinkLast(&gHgfsNotify->sharedFolders, &folder->links);
+   MXUser_ReleaseExclLock(gHgfsNotify->lock);
+
+   LOG(8, "%s: %s (%s) handle %#x\n", __FUNCTION__, shareName, path, handle);
+   return handle;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotify_AddSubscriber --
+ *
+ *    Allocates memory and initializes new subscriber structure, and adds
+ *    the watches for its directory (tree).
+ *
+ * Results:
+ *    Opaque subscriber handle for the new subscriber or HGFS_INVALID_SUBSCRIBER_HANDLE
+ *    if adding subscriber fails.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsSubscriberHandle
+HgfsNotify_AddSubscriber(HgfsSharedFolderHandle sharedFolder, // IN: shared folder handle
+                         const char *path,                    // IN: relative path
+                         uint32 eventFilter,                  // IN: event filter
+                         uint32 recursive,                    // IN: look in subfolders
+                         struct HgfsSessionInfo *session)     // IN: server context
+{
+   HgfsNotifySharedFolder *folder;
+   HgfsNotifySubscriber *subscriber;
+   HgfsSubscriberHandle handle = HGFS_INVALID_SUBSCRIBER_HANDLE;
+
+   if (gHgfsNotify == NULL || path == NULL) {
+      return HGFS_INVALID_SUBSCRIBER_HANDLE;
+   }
+
+   MXUser_AcquireExclLock(gHgfsNotify->lock);
+
+   folder = HgfsNotifyFindSharedFolder(sharedFolder);
+   if (folder == NULL) {
+      LOG(4, "%s: unknown shared folder handle %#x\n", __FUNCTION__,
+          sharedFolder);
+      goto exit;
+   }
+
+   subscriber = Util_SafeCalloc(1, sizeof *subscriber);
+   DblLnkLst_Init(&subscriber->links);
+   subscriber->sharedFolder = folder;
+   subscriber->path = Util_SafeStrdup(path);
+   subscriber->eventFilter = eventFilter;
+   subscriber->recursive = recursive != 0;
+   subscriber->session = session;
+   if (gHgfsNotify->nextSubscriberHandle == HGFS_INVALID_SUBSCRIBER_HANDLE) {
+      gHgfsNotify->nextSubscriberHandle = 0;
+   }
+   subscriber->handle = gHgfsNotify->nextSubscriberHandle++;
+   DblLnkLst_LinkLast(&gHgfsNotify->subscribers, &subscriber->links);
+
+   if (!HgfsNotifyAddTree(subscriber, subscriber->path)) {
+      HgfsNotifyFreeSubscriber(subscriber);
+      goto exit;
+   }
+   handle = subscriber->handle;
+
+   LOG(8, "%s: %s%c%s filter %#x recursive %u: %u watches\n", __FUNCTION__,
+       folder->shareName, DIRSEPC, path, eventFilter, recursive,
+       subscriber->numWds);
+
+exit:
+   MXUser_ReleaseExclLock(gHgfsNotify->lock);
+   return handle;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotify_RemoveSharedFolder --
+ *
+ *    Deallcates memory used by shared folder and performs necessary cleanup.
+ *    Also deletes all subscribers that are defined for the shared folder.
+ *
+ * Results:
+ *    TRUE if the shared folder was found, FALSE otherwise.
+ *
+ * Side effects:
+ *    Removes all subscribers that correspond to the shared folder and invalidates
+ *    thier handles.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsNotify_RemoveSharedFolder(HgfsSharedFolderHandle sharedFolder) // IN
+{
+   HgfsNotifySharedFolder *folder;
+   DblLnkLst_Links *link, *nextLink;
+
+   if (gHgfsNotify == NULL) {
+      return FALSE;
+   }
+
+   MXUser_AcquireExclLock(gHgfsNotify->lock);
+
+   folder = HgfsNotifyFindSharedFolder(sharedFolder);
+   if (folder != NULL) {
+      DblLnkLst_ForEachSafe(link, nextLink, &gHgfsNotify->subscribers) {
+         HgfsNotifySubscriber *subscriber =
+            DblLnkLst_Container(link, HgfsNotifySubscriber, links);
+
+         if (subscriber->sharedFolder == folder) {
+            HgfsNotifyFreeSubscriber(subscriber);
+         }
+      }
+      DblLnkLst_Unlink1(&folder->links);
+      free(folder->path);
+      free(folder->shareName);
+      free(folder);
+   }
+
+   MXUser_ReleaseExclLock(gHgfsNotify->lock);
+
+   return folder != NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotify_RemoveSubscriber --
+ *
+ *    Deallcates memory used by NotificationSubscriber and performs necessary cleanup.
+ *
+ * Results:
+ *    TRUE if the subscriber was found, FALSE otherwise.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsNotify_RemoveSubscriber(HgfsSubscriberHandle subscriber) // IN
+{
+   HgfsNotifySubscriber *entry;
+
+   if (gHgfsNotify == NULL) {
+      return FALSE;
+   }
+
+   MXUser_AcquireExclLock(gHgfsNotify->lock);
+   entry = HgfsNotifyFindSubscriber(subscriber);
+   if (entry != NULL) {
+      HgfsNotifyFreeSubscriber(entry);
+      HgfsNotifyWaitForDispatchLocked();
+   }
+   MXUser_ReleaseExclLock(gHgfsNotify->lock);
+
+   return entry != NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotify_RemoveSessionSubscribers --
+ *
+ *    Removes all entries that are related to a particular session. Waits
+ *    for the events being delivered, so none is delivered to the session
+ *    once this returns.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsNotify_RemoveSessionSubscribers(struct HgfsSessionInfo *session) // IN
+{
+   DblLnkLst_Links *link, *nextLink;
+
+   if (gHgfsNotify == NULL) {
+      return;
+   }
+
+   MXUser_AcquireExclLock(gHgfsNotify->lock);
+   DblLnkLst_ForEachSafe(link, nextLink, &gHgfsNotify->subscribers) {
+      HgfsNotifySubscriber *subscriber =
+         DblLnkLst_Container(link, HgfsNotifySubscriber, links);
+
+      if (subscriber->session == session) {
+         HgfsNotifyFreeSubscriber(subscriber);
+      }
+   }
+   HgfsNotifyWaitForDispatchLocked();
+   MXUser_ReleaseExclLock(gHgfsNotify->lock);
+}
@@ -47,14 +47,17 @@
 #include "hgfsServer.h"
 #include "hgfsServerParameters.h"
 #include "hgfsServerOplock.h"
+#include "hgfsServerOplockInt.h"
 #include "hgfsServerOplockMonitor.h"
 #include "hgfsDirNotify.h"
 #include "hgfsThreadpool.h"
+#include "hgfsBufferPool.h"
 #include "userlock.h"
 #include "poll.h"
 #include "mutexRankLib.h"
 #include "vm_basic_asm.h"
 #include "unicodeOperations.h"
+#include "hostinfo.h"
 
 #ifndef VM_X86_ANY
 #include "random.h"
@@ -129,9 +132,20 @@
 #define NUM_FILE_NODES 100
 #define NUM_SEARCHES 100
 
+/* Terminates a handle index bucket chain. */
+#define HGFS_NODE_INDEX_NONE ((uint32)~((uint32)0))
+
 /* Default maximun number of open nodes that have server locks. */
 #define MAX_LOCKED_FILENODES 10
 
+/*
+ * Host readahead for sequential reads: reads continuing the previous one
+ * before it starts, and the bounds of its window.
+ */
+#define HGFS_READ_AHEAD_SEQUENTIAL_READS 2
+#define HGFS_READ_AHEAD_MIN_WINDOW (128 * 1024)
+#define HGFS_READ_AHEAD_MAX_WINDOW (8 * 1024 * 1024)
+
 
 struct HgfsTransportSessionInfo {
    /* Default session id. */
@@ -179,6 +193,8 @@ typedef struct HgfsInputParam {
    HgfsOp op;                    /* Hgfs operation command code */
    uint32 id;                    /* Request ID to be matched with the reply */
    Bool sessionEnabled;          /* Requests have session enabled headers */
+   Bool compoundEntry;           /* Compound sub-request: reply is not sent */
+   VmTimeType startTime;         /* When the request was received, in us */
 } HgfsInputParam;
 
 /*
@@ -187,7 +203,8 @@ typedef struct HgfsInputParam {
  */
 static HgfsServerConfig gHgfsCfgSettings = {
    (HGFS_CONFIG_NOTIFY_ENABLED | HGFS_CONFIG_VOL_INFO_MIN),
-   HGFS_MAX_CACHED_FILENODES
+   HGFS_MAX_CACHED_FILENODES,
+   0
 };
 
 /*
@@ -286,6 +303,25 @@ static Bool gHgfsDirNotifyActive = FALSE;
  */
 static Bool gHgfsThreadpoolActive = FALSE;
 
+/*
+ * Data throughput counters, see HgfsServer_GetIoStats. Updated by concurrent
+ * requests hence atomic.
+ */
+static Atomic_uint64 gHgfsReadBytes;          /* All data read for clients. */
+static Atomic_uint64 gHgfsReadZeroCopyBytes;  /* Read straight into guest iovs. */
+static Atomic_uint64 gHgfsReadCopiedBytes;    /* Read via an allocated buffer. */
+static Atomic_uint64 gHgfsWriteBytes;         /* All data written for clients. */
+
+/* Per operation counters of all sessions, see HgfsServer_GetOpStats. */
+static HgfsOpStats gHgfsOpStats[HGFS_OP_MAX];
+
+/*
+ * Recycled input parameters of the requests, one is in use per request in
+ * flight. Free ones beyond the cap are released.
+ */
+#define HGFS_INPUT_PARAM_POOL_MAX 64
+static HgfsBufferPool gHgfsInputParamPool;
+
 typedef struct HgfsSharedFolderProperties {
    DblLnkLst_Links links;
    char *name;                                /* Name of the share. */
@@ -294,10 +330,8 @@ typedef struct HgfsSharedFolderProperties {
 
 
 /* Allocate/Add sessions helper functions. */
-#ifndef VMX86_TOOLS
 static void
 HgfsServerAsyncInfoIncCount(HgfsAsyncRequestInfo *info);
-#endif
 
 static Bool
 HgfsServerAllocateSession(HgfsTransportSessionInfo *transportSession,
@@ -359,6 +393,11 @@ static HgfsFileNode *HgfsGetNewNode(HgfsSessionInfo *session);
 static HgfsHandle HgfsFileNode2Handle(HgfsFileNode const *fileNode);
 static HgfsFileNode *HgfsHandle2FileNode(HgfsHandle handle,
                                          HgfsSessionInfo *session);
+static void HgfsNodeIndexRebuild(HgfsSessionInfo *session);
+static void HgfsNodeIndexInsert(HgfsFileNode *node,
+                                HgfsSessionInfo *session);
+static void HgfsNodeIndexRemove(HgfsFileNode *node,
+                                HgfsSessionInfo *session);
 static void HgfsServerExitSessionInternal(HgfsSessionInfo *session);
 static void HgfsServerCompleteRequest(HgfsInternalStatus status,
                                       size_t replyPayloadSize,
@@ -405,6 +444,11 @@ static void HgfsServerClose(HgfsInputParam *input);
 static void HgfsServerSearchClose(HgfsInputParam *input);
 static void HgfsServerSetDirNotifyWatch(HgfsInputParam *input);
 static void HgfsServerRemoveDirNotifyWatch(HgfsInputParam *input);
+static void HgfsServerCompound(HgfsInputParam *input);
+static void HgfsServerCopyFile(HgfsInputParam *input);
+static void HgfsServerSeekExtent(HgfsInputParam *input);
+static void HgfsServerAllocate(HgfsInputParam *input);
+static void HgfsServerOplockBreakAck(HgfsInputParam *input);
 
 
 /*
@@ -423,7 +467,7 @@ static void HgfsServerRemoveDirNotifyWatch(HgfsInputParam *input);
  *----------------------------------------------------------------------------
  */
 
-static void
+void
 HgfsServerSessionGet(HgfsSessionInfo *session)   // IN: session context
 {
    ASSERT(session && Atomic_Read(&session->refCount) != 0);
@@ -449,7 +493,7 @@ HgfsServerSessionGet(HgfsSessionInfo *session)   // IN: session context
  *----------------------------------------------------------------------------
  */
 
-static void
+void
 HgfsServerSessionPut(HgfsSessionInfo *session)   // IN: session context
 {
    ASSERT(session);
@@ -608,22 +652,156 @@ static HgfsFileNode *
 HgfsHandle2FileNode(HgfsHandle handle,        // IN: Hgfs file handle
                     HgfsSessionInfo *session) // IN: Session info
 {
-   unsigned int i;
-   HgfsFileNode *fileNode = NULL;
+   uint32 i;
 
    ASSERT(session);
    ASSERT(session->nodeArray);
+   ASSERT(session->nodeHandleIndex);
+
+   i = session->nodeHandleIndex[handle & (session->numNodeHandleBuckets - 1)];
+   while (i != HGFS_NODE_INDEX_NONE) {
+      HgfsFileNode *fileNode = &session->nodeArray[i];
+
+      ASSERT(fileNode->state != FILENODE_STATE_UNUSED);
+      if (fileNode->handle == handle) {
+         return fileNode;
+      }
+      i = fileNode->handleIndexNext;
+   }
+
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNodeIndexRebuild --
+ *
+ *    (Re)build the handle index of the session's nodeArray. The number of
+ *    buckets is the smallest power of 2 not less than the number of nodes,
+ *    so chains stay short: handles are handed out by a monotonic counter
+ *    and hash uniformly by their low bits.
+ *
+ *    Called when the session is created and whenever the nodeArray grows.
+ *    The session's nodeArrayLock should be acquired prior to calling this
+ *    function.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    Memory allocation.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNodeIndexRebuild(HgfsSessionInfo *session)  // IN: session info
+{
+   uint32 numBuckets = 1;
+   uint32 *buckets;
+   uint32 i;
+
+   ASSERT(session);
+   ASSERT(session->nodeArray);
+
+   while (numBuckets < session->numNodes) {
+      numBuckets <<= 1;
+   }
+
+   buckets = Util_SafeMalloc(numBuckets * sizeof *buckets);
+
+   free(session->nodeHandleIndex);
+   session->nodeHandleIndex = buckets;
+   session->numNodeHandleBuckets = numBuckets;
+
+   for (i = 0; i < numBuckets; i++) {
+      buckets[i] = HGFS_NODE_INDEX_NONE;
+   }
 
-   /* XXX: This O(n) lookup can and should be optimized. */
    for (i = 0; i < session->numNodes; i++) {
-      if (session->nodeArray[i].state != FILENODE_STATE_UNUSED &&
-          session->nodeArray[i].handle == handle) {
-         fileNode = &session->nodeArray[i];
-         break;
+      if (session->nodeArray[i].state != FILENODE_STATE_UNUSED) {
+         HgfsNodeIndexInsert(&session->nodeArray[i], session);
       }
    }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNodeIndexInsert --
+ *
+ *    Add an in-use node to the handle index.
+ *
+ *    The session's nodeArrayLock should be acquired prior to calling this
+ *    function.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNodeIndexInsert(HgfsFileNode *node,        // IN: file node
+                    HgfsSessionInfo *session)  // IN: session info
+{
+   uint32 *bucket;
+
+   ASSERT(node);
+   ASSERT(session->nodeHandleIndex);
+
+   bucket = &session->nodeHandleIndex[node->handle &
+                                      (session->numNodeHandleBuckets - 1)];
+   node->handleIndexNext = *bucket;
+   *bucket = (uint32)(node - session->nodeArray);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNodeIndexRemove --
+ *
+ *    Remove an in-use node from the handle index.
+ *
+ *    The session's nodeArrayLock should be acquired prior to calling this
+ *    function.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNodeIndexRemove(HgfsFileNode *node,        // IN: file node
+                    HgfsSessionInfo *session)  // IN: session info
+{
+   uint32 const nodeIndex = (uint32)(node - session->nodeArray);
+   uint32 *link;
 
-   return fileNode;
+   ASSERT(node);
+   ASSERT(session->nodeHandleIndex);
+
+   link = &session->nodeHandleIndex[node->handle &
+                                    (session->numNodeHandleBuckets - 1)];
+   while (*link != HGFS_NODE_INDEX_NONE) {
+      if (*link == nodeIndex) {
+         *link = node->handleIndexNext;
+         break;
+      }
+      link = &session->nodeArray[*link].handleIndexNext;
+   }
+   node->handleIndexNext = HGFS_NODE_INDEX_NONE;
 }
 
 
@@ -722,7 +900,7 @@ HgfsHandle2FileDesc(HgfsHandle handle,        // IN: Hgfs file handle
    Bool found = FALSE;
    HgfsFileNode *fileNode = NULL;
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
    fileNode = HgfsHandle2FileNode(handle, session);
    if (fileNode == NULL) {
       goto exit;
@@ -735,7 +913,7 @@ HgfsHandle2FileDesc(HgfsHandle handle,        // IN: Hgfs file handle
    found = TRUE;
 
 exit:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return found;
 }
@@ -767,7 +945,7 @@ HgfsHandle2AppendFlag(HgfsHandle handle,        // IN: Hgfs file handle
    Bool found = FALSE;
    HgfsFileNode *fileNode = NULL;
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
    fileNode = HgfsHandle2FileNode(handle, session);
    if (fileNode == NULL) {
       goto exit;
@@ -777,7 +955,7 @@ HgfsHandle2AppendFlag(HgfsHandle handle,        // IN: Hgfs file handle
    found = TRUE;
 
 exit:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return found;
 }
@@ -811,7 +989,7 @@ HgfsHandle2LocalId(HgfsHandle handle,        // IN: Hgfs file handle
 
    ASSERT(localId);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
    fileNode = HgfsHandle2FileNode(handle, session);
    if (fileNode == NULL) {
       goto exit;
@@ -823,7 +1001,7 @@ HgfsHandle2LocalId(HgfsHandle handle,        // IN: Hgfs file handle
    found = TRUE;
 
 exit:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return found;
 }
@@ -851,26 +1029,30 @@ HgfsFileDesc2Handle(fileDesc fd,              // IN: OS handle (file descriptor)
                     HgfsSessionInfo *session, // IN: Session info
                     HgfsHandle *handle)       // OUT: Hgfs file handle
 {
-   unsigned int i;
+   DblLnkLst_Links *link;
    Bool found = FALSE;
    HgfsFileNode *existingFileNode = NULL;
 
    ASSERT(session);
    ASSERT(session->nodeArray);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
 
-   for (i = 0; i < session->numNodes; i++) {
-      existingFileNode = &session->nodeArray[i];
-      if ((existingFileNode->state == FILENODE_STATE_IN_USE_CACHED) &&
-          (existingFileNode->fileDesc == fd)) {
+   /*
+    * Only cached nodes have an open fd: walk the cache, which is bounded by
+    * maxCachedOpenNodes, rather than every node of the session.
+    */
+   DblLnkLst_ForEach(link, &session->nodeCachedList) {
+      existingFileNode = DblLnkLst_Container(link, HgfsFileNode, links);
+      ASSERT(existingFileNode->state == FILENODE_STATE_IN_USE_CACHED);
+      if (existingFileNode->fileDesc == fd) {
          *handle = HgfsFileNode2Handle(existingFileNode);
          found = TRUE;
          break;
       }
    }
 
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return found;
 }
@@ -906,7 +1088,7 @@ HgfsHandle2ShareMode(HgfsHandle handle,         // IN: Hgfs file handle
       return found;
    }
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
 
    existingFileNode = HgfsHandle2FileNode(handle, session);
    if (existingFileNode == NULL) {
@@ -919,7 +1101,7 @@ HgfsHandle2ShareMode(HgfsHandle handle,         // IN: Hgfs file handle
    found = (nameStatus == HGFS_NAME_STATUS_COMPLETE);
 
 exit_unlock:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return found;
 }
@@ -989,7 +1171,7 @@ HgfsHandle2FileNameMode(HgfsHandle handle,       // IN: Hgfs file handle
       return found;
    }
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
 
    existingFileNode = HgfsHandle2FileNode(handle, session);
    if (existingFileNode == NULL) {
@@ -1008,7 +1190,7 @@ HgfsHandle2FileNameMode(HgfsHandle handle,       // IN: Hgfs file handle
    found = TRUE;
 
 exit_unlock:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    *fileName = name;
    *fileNameSize = nameSize;
@@ -1049,7 +1231,7 @@ HgfsHandle2NotifyInfo(HgfsHandle handle,                    // IN: Hgfs file han
    size_t nameSize;
 
    ASSERT(fileName != NULL && fileNameSize != NULL);
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
 
    existingFileNode = HgfsHandle2FileNode(handle, session);
    if (NULL != existingFileNode) {
@@ -1063,7 +1245,7 @@ HgfsHandle2NotifyInfo(HgfsHandle handle,                    // IN: Hgfs file han
       found = TRUE;
    }
 
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return found;
 }
@@ -1099,7 +1281,7 @@ HgfsGetNodeCopy(HgfsHandle handle,        // IN: Hgfs file handle
 
    ASSERT(copy);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
 
    original = HgfsHandle2FileNode(handle, session);
    if (original == NULL) {
@@ -1130,7 +1312,7 @@ HgfsGetNodeCopy(HgfsHandle handle,        // IN: Hgfs file handle
    found = TRUE;
 
 exit:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return found;
 }
@@ -1163,7 +1345,7 @@ HgfsHandleIsSequentialOpen(HgfsHandle handle,        // IN:  Hgfs file handle
 
    ASSERT(sequentialOpen);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
 
    node = HgfsHandle2FileNode(handle, session);
    if (node == NULL) {
@@ -1174,7 +1356,108 @@ HgfsHandleIsSequentialOpen(HgfsHandle handle,        // IN:  Hgfs file handle
    success = TRUE;
 
 exit:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
+
+   return success;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * HgfsHandleTrackRead --
+ *
+ *    Record a read of the file node with the given handle in its read access
+ *    pattern and work out the host readahead to issue for it.
+ *
+ *    Once HGFS_READ_AHEAD_SEQUENTIAL_READS consecutive reads have each continued
+ *    the previous one, readahead starts with a window of a few reads, doubling
+ *    up to HGFS_READ_AHEAD_MAX_WINDOW each time the client gets within half a
+ *    window of its end. A read anywhere else drops back to no readahead.
+ *
+ * Results:
+ *    TRUE on success, FALSE if the handle is invalid. readAhead is filled in
+ *    on success.
+ *
+ * Side effects:
+ *    None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsHandleTrackRead(HgfsHandle handle,         // IN: Hgfs file handle
+                    HgfsSessionInfo *session,  // IN: session info
+                    uint64 offset,             // IN: offset of the read
+                    uint32 size,               // IN: bytes read
+                    HgfsReadAhead *readAhead)  // OUT: readahead to issue
+{
+   HgfsFileNode *node;
+   HgfsReadPattern *pattern;
+   Bool success = FALSE;
+
+   ASSERT(readAhead);
+
+   readAhead->action = HGFS_READ_AHEAD_NONE;
+
+   MXUser_AcquireForWrite(session->nodeArrayLock);
+
+   node = HgfsHandle2FileNode(handle, session);
+   if (node == NULL) {
+      goto exit;
+   }
+   pattern = &node->readPattern;
+   success = TRUE;
+
+   if ((node->flags & HGFS_FILE_NODE_SEQUENTIAL_FL) != 0) {
+      /* Sequential opens ignore the offset and always continue. */
+      offset = pattern->nextOffset;
+   }
+
+   if (offset == pattern->nextOffset) {
+      pattern->sequentialReads++;
+   } else {
+      if (pattern->window != 0) {
+         readAhead->action = HGFS_READ_AHEAD_STOP;
+      }
+      pattern->sequentialReads = 0;
+      pattern->window = 0;
+      pattern->aheadEnd = 0;
+   }
+   pattern->nextOffset = offset + size;
+
+   if (size == 0) {
+      /* End of file, nothing to read ahead. */
+      goto exit;
+   }
+
+   if (pattern->window == 0) {
+      if (pattern->sequentialReads >= HGFS_READ_AHEAD_SEQUENTIAL_READS) {
+         pattern->window = MIN(MAX(HGFS_READ_AHEAD_MIN_WINDOW, 4 * size),
+                               HGFS_READ_AHEAD_MAX_WINDOW);
+         pattern->aheadEnd = pattern->nextOffset + pattern->window;
+         readAhead->action = HGFS_READ_AHEAD_START;
+         readAhead->offset = pattern->nextOffset;
+         readAhead->length = pattern->window;
+      }
+   } else if (pattern->aheadEnd < pattern->nextOffset + pattern->window / 2) {
+      uint64 start = MAX(pattern->aheadEnd, pattern->nextOffset);
+
+      pattern->window = MIN(2 * pattern->window, HGFS_READ_AHEAD_MAX_WINDOW);
+      pattern->aheadEnd = pattern->nextOffset + pattern->window;
+      readAhead->action = HGFS_READ_AHEAD_EXTEND;
+      readAhead->offset = start;
+      readAhead->length = pattern->aheadEnd - start;
+   }
+
+   if (readAhead->action != HGFS_READ_AHEAD_NONE) {
+      LOG(4, "%s: handle %u readahead %d at %"FMT64"u len %"FMT64"u\n",
+          __FUNCTION__, handle, readAhead->action, readAhead->offset,
+          readAhead->length);
+   }
+
+exit:
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return success;
 }
@@ -1207,7 +1490,7 @@ HgfsHandleIsSharedFolderOpen(HgfsHandle handle,        // IN:  Hgfs file handle
 
    ASSERT(sharedFolderOpen);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
 
    node = HgfsHandle2FileNode(handle, session);
    if (node == NULL) {
@@ -1218,7 +1501,7 @@ HgfsHandleIsSharedFolderOpen(HgfsHandle handle,        // IN:  Hgfs file handle
    success = TRUE;
 
 exit:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return success;
 }
@@ -1251,7 +1534,7 @@ HgfsUpdateNodeFileDesc(HgfsHandle handle,        // IN: Hgfs file handle
    HgfsFileNode *node;
    Bool updated = FALSE;
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
 
    node = HgfsHandle2FileNode(handle, session);
    if (node == NULL) {
@@ -1263,7 +1546,7 @@ HgfsUpdateNodeFileDesc(HgfsHandle handle,        // IN: Hgfs file handle
    updated = TRUE;
 
 exit:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return updated;
 }
@@ -1299,12 +1582,21 @@ HgfsUpdateNodeServerLock(fileDesc fd,                // IN: OS handle
    ASSERT(session);
    ASSERT(session->nodeArray);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
 
    for (i = 0; i < session->numNodes; i++) {
       existingFileNode = &session->nodeArray[i];
       if (existingFileNode->state != FILENODE_STATE_UNUSED) {
          if (existingFileNode->fileDesc == fd) {
+            if (existingFileNode->state == FILENODE_STATE_IN_USE_CACHED) {
+               if (   existingFileNode->serverLock == HGFS_LOCK_NONE
+                   && serverLock != HGFS_LOCK_NONE) {
+                  session->numCachedLockedNodes++;
+               } else if (   existingFileNode->serverLock != HGFS_LOCK_NONE
+                          && serverLock == HGFS_LOCK_NONE) {
+                  session->numCachedLockedNodes--;
+               }
+            }
             existingFileNode->serverLock = serverLock;
             updated = TRUE;
             break;
@@ -1312,7 +1604,7 @@ HgfsUpdateNodeServerLock(fileDesc fd,                // IN: OS handle
       }
    }
 
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return updated;
 }
@@ -1343,7 +1635,7 @@ HgfsUpdateNodeAppendFlag(HgfsHandle handle,        // IN: Hgfs file handle
    HgfsFileNode *node;
    Bool updated = FALSE;
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
 
    node = HgfsHandle2FileNode(handle, session);
    if (node == NULL) {
@@ -1356,7 +1648,7 @@ HgfsUpdateNodeAppendFlag(HgfsHandle handle,        // IN: Hgfs file handle
    updated = TRUE;
 
 exit:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return updated;
 }
@@ -1590,6 +1882,12 @@ HgfsGetNewNode(HgfsSessionInfo *session)  // IN: session info
       session->nodeArray = newMem;
       session->numNodes = newNumNodes;
 
+      /*
+       * The index holds array offsets, which survive the move; it only
+       * needs rebuilding to keep the buckets in step with the node count.
+       */
+      HgfsNodeIndexRebuild(session);
+
       if (DOLOG(4)) {
          Log("Dumping nodes after pointer changes\n");
          HgfsDumpAllNodes(session);
@@ -1643,6 +1941,11 @@ HgfsRemoveFileNode(HgfsFileNode *node,        // IN: file node
       node->utf8Name = NULL;
    }
 
+   /* Nodes which failed setup in HgfsAddNewFileNode were never indexed. */
+   if (node->state != FILENODE_STATE_UNUSED) {
+      HgfsNodeIndexRemove(node, session);
+   }
+
    node->state = FILENODE_STATE_UNUSED;
    ASSERT(node->fileCtx == NULL);
    node->fileCtx = NULL;
@@ -1708,9 +2011,9 @@ static void
 HgfsFreeFileNode(HgfsHandle handle,         // IN: Handle to free
                  HgfsSessionInfo *session)  // IN: Session info
 {
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
    HgfsFreeFileNodeInternal(handle, session);
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 }
 
 
@@ -1810,6 +2113,7 @@ HgfsAddNewFileNode(HgfsFileOpenInfo *openInfo,  // IN: open info struct
    newNode->shareAccess = (openInfo->mask & HGFS_OPEN_VALID_SHARE_ACCESS) ?
       openInfo->shareAccess : HGFS_DEFAULT_SHARE_ACCESS;
    newNode->flags = 0;
+   memset(&newNode->readPattern, 0, sizeof newNode->readPattern);
 
    if (append) {
       newNode->flags |= HGFS_FILE_NODE_APPEND_FL;
@@ -1823,6 +2127,7 @@ HgfsAddNewFileNode(HgfsFileOpenInfo *openInfo,  // IN: open info struct
 
    newNode->serverLock = openInfo->acquiredLock;
    newNode->state = FILENODE_STATE_IN_USE_NOT_CACHED;
+   HgfsNodeIndexInsert(newNode, session);
    newNode->shareInfo.readPermissions = openInfo->shareInfo.readPermissions;
    newNode->shareInfo.writePermissions = openInfo->shareInfo.writePermissions;
    newNode->shareInfo.handle = openInfo->shareInfo.handle;
@@ -1942,10 +2247,25 @@ HgfsRemoveFromCacheInternal(HgfsHandle handle,        // IN: Hgfs handle to the
    }
 
    if (node->state == FILENODE_STATE_IN_USE_CACHED) {
+      /*
+       * The descriptor of a plain read only node can be parked for the next
+       * open of the file instead of closed. Sequential nodes depend on the
+       * descriptor offset and locked ones on the lease, so they are closed.
+       */
+      Bool park = node->serverLock == HGFS_LOCK_NONE &&
+                  node->fileCtx == NULL &&
+                  (node->flags & (HGFS_FILE_NODE_APPEND_FL |
+                                  HGFS_FILE_NODE_SEQUENTIAL_FL)) == 0;
+
       /* Unlink the node from the list of cached fileNodes. */
       DblLnkLst_Unlink1(&node->links);
       node->state = FILENODE_STATE_IN_USE_NOT_CACHED;
       session->numCachedOpenNodes--;
+      if (node->serverLock != HGFS_LOCK_NONE) {
+         /* Closing the file releases the lock. */
+         session->numCachedLockedNodes--;
+         node->serverLock = HGFS_LOCK_NONE;
+      }
       LOG(4, "%s: cache entries %u remove node %s id %"FMT64"u fd %u .\n",
           __FUNCTION__, session->numCachedOpenNodes, node->utf8Name,
           node->localId.fileId, node->fileDesc);
@@ -1961,7 +2281,9 @@ HgfsRemoveFromCacheInternal(HgfsHandle handle,        // IN: Hgfs handle to the
        * Instead, we'll just await the lobotomization of the node cache to
        * really fix this.
        */
-      if (HgfsPlatformCloseFile(node->fileDesc, node->fileCtx)) {
+      if (!(park &&
+            HgfsPlatformParkFile(node->fileDesc, node->utf8Name, node->mode)) &&
+          HgfsPlatformCloseFile(node->fileDesc, node->fileCtx)) {
          LOG(4, "%s: Could not close fd %u\n", __FUNCTION__, node->fileDesc);
 
          return FALSE;
@@ -2059,9 +2381,9 @@ HgfsIsServerLockAllowed(HgfsSessionInfo *session)  // IN: session info
 {
    Bool allowed;
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
    allowed = session->numCachedLockedNodes < MAX_LOCKED_FILENODES;
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return allowed;
 }
@@ -2284,7 +2606,7 @@ HgfsGetSearchCopy(HgfsHandle handle,        // IN: Hgfs search handle
 
    ASSERT(copy);
 
-   MXUser_AcquireExclLock(session->searchArrayLock);
+   MXUser_AcquireForRead(session->searchArrayLock);
    original = HgfsSearchHandle2Search(handle, session);
    if (original == NULL) {
       goto exit;
@@ -2309,13 +2631,16 @@ HgfsGetSearchCopy(HgfsHandle handle,        // IN: Hgfs search handle
    /* No dents for the copy, they consume too much memory and aren't needed. */
    copy->dents = NULL;
    copy->numDents = 0;
+   copy->dentsBase = 0;
+   copy->flags = 0;
+   HgfsPlatformScandirCopy(original, copy);
 
    copy->handle = original->handle;
    copy->type = original->type;
    found = TRUE;
 
 exit:
-   MXUser_ReleaseExclLock(session->searchArrayLock);
+   MXUser_ReleaseRWLock(session->searchArrayLock);
 
    return found;
 }
@@ -2362,6 +2687,7 @@ HgfsAddNewSearch(char const *utf8Dir,       // IN: UTF8 name of dir to search in
 
    newSearch->dents = NULL;
    newSearch->numDents = 0;
+   newSearch->dentsBase = 0;
    newSearch->flags = 0;
    newSearch->type = type;
    newSearch->handle = HgfsServerGetNextHandleCounter();
@@ -2443,6 +2769,7 @@ HgfsRemoveSearchInternal(HgfsSearch *search,       // IN: search
    LOG(4, "%s: handle %u, dir %s\n", __FUNCTION__,
        HgfsSearch2SearchHandle(search), search->utf8Dir);
 
+   HgfsPlatformScandirClose(search);
    HgfsFreeSearchDirents(search);
    free(search->utf8Dir);
    free(search->utf8ShareName);
@@ -2484,7 +2811,7 @@ HgfsRemoveSearch(HgfsHandle handle,        // IN: search
    HgfsSearch *search;
    Bool success = FALSE;
 
-   MXUser_AcquireExclLock(session->searchArrayLock);
+   MXUser_AcquireForWrite(session->searchArrayLock);
 
    search = HgfsSearchHandle2Search(handle, session);
    if (search != NULL) {
@@ -2492,7 +2819,7 @@ HgfsRemoveSearch(HgfsHandle handle,        // IN: search
       success = TRUE;
    }
 
-   MXUser_ReleaseExclLock(session->searchArrayLock);
+   MXUser_ReleaseRWLock(session->searchArrayLock);
 
    return success;
 }
@@ -2525,7 +2852,7 @@ HgfsSearchHasReadAllEntries(HgfsHandle handle,        // IN:  Hgfs file handle
 
    ASSERT(NULL != readAllEntries);
 
-   MXUser_AcquireExclLock(session->searchArrayLock);
+   MXUser_AcquireForRead(session->searchArrayLock);
 
    search = HgfsSearchHandle2Search(handle, session);
    if (NULL == search) {
@@ -2536,7 +2863,7 @@ HgfsSearchHasReadAllEntries(HgfsHandle handle,        // IN:  Hgfs file handle
    success = TRUE;
 
 exit:
-   MXUser_ReleaseExclLock(session->searchArrayLock);
+   MXUser_ReleaseRWLock(session->searchArrayLock);
 
    return success;
 }
@@ -2564,7 +2891,7 @@ HgfsSearchSetReadAllEntries(HgfsHandle handle,        // IN:  Hgfs file handle
 {
    HgfsSearch *search;
 
-   MXUser_AcquireExclLock(session->searchArrayLock);
+   MXUser_AcquireForWrite(session->searchArrayLock);
 
    search = HgfsSearchHandle2Search(handle, session);
    if (NULL == search) {
@@ -2574,7 +2901,7 @@ HgfsSearchSetReadAllEntries(HgfsHandle handle,        // IN:  Hgfs file handle
    search->flags |= HGFS_SEARCH_FLAG_READ_ALL_ENTRIES;
 
 exit:
-   MXUser_ReleaseExclLock(session->searchArrayLock);
+   MXUser_ReleaseRWLock(session->searchArrayLock);
 }
 
 
@@ -2608,7 +2935,7 @@ HgfsServerGetDirEntry(HgfsHandle handle,                // IN: Handle to search
    struct DirectoryEntry *dent = NULL;
    HgfsInternalStatus status = HGFS_ERROR_SUCCESS;
 
-   MXUser_AcquireExclLock(session->searchArrayLock);
+   MXUser_AcquireForWrite(session->searchArrayLock);
 
    search = HgfsSearchHandle2Search(handle, session);
    if (search == NULL) {
@@ -2616,8 +2943,9 @@ HgfsServerGetDirEntry(HgfsHandle handle,                // IN: Handle to search
       goto out;
    }
 
-   /* No more entries or none. */
-   if (search->dents == NULL) {
+   /* No more entries or none. Streaming searches read them as needed. */
+   if (search->dents == NULL &&
+       (search->flags & HGFS_SEARCH_FLAG_STREAMING) == 0) {
       goto out;
    }
 
@@ -2632,7 +2960,7 @@ HgfsServerGetDirEntry(HgfsHandle handle,                // IN: Handle to search
                                     remove,
                                     &dent);
 out:
-   MXUser_ReleaseExclLock(session->searchArrayLock);
+   MXUser_ReleaseRWLock(session->searchArrayLock);
    *dirEntry = dent;
 
    return status;
@@ -2717,7 +3045,7 @@ HgfsUpdateNodeNames(const char *oldLocalName,  // IN: Name of file to look for
 
    newBufferLen = strlen(newLocalName);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
 
    for (i = 0; i < session->numNodes; i++) {
       fileNode = &session->nodeArray[i];
@@ -2743,7 +3071,7 @@ HgfsUpdateNodeNames(const char *oldLocalName,  // IN: Name of file to look for
       }
    }
 
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 }
 
 
@@ -2914,6 +3242,26 @@ static struct {
    { HgfsServerRemoveDirNotifyWatch, sizeof (HgfsRequestRemoveWatchV4),            REQ_SYNC},
    { NULL,                       0,                                                REQ_SYNC}, // No Op notify
    { HgfsServerSearchRead,       sizeof (HgfsRequestSearchReadV4),                 REQ_SYNC},
+   { NULL,                       0,                                                REQ_SYNC}, // No Op open V4
+   { NULL,                       0,                                                REQ_SYNC}, // No Op enumerate streams V4
+   { NULL,                       0,                                                REQ_SYNC}, // No Op getattr V4
+   { NULL,                       0,                                                REQ_SYNC}, // No Op setattr V4
+   { NULL,                       0,                                                REQ_SYNC}, // No Op delete V4
+   { NULL,                       0,                                                REQ_SYNC}, // No Op linkmove V4
+   { NULL,                       0,                                                REQ_SYNC}, // No Op fsctl V4
+   { NULL,                       0,                                                REQ_SYNC}, // No Op access check V4
+   { NULL,                       0,                                                REQ_SYNC}, // No Op fsync V4
+   { NULL,                       0,                                                REQ_SYNC}, // No Op query volume V4
+   { NULL,                       0,                                                REQ_SYNC}, // No Op oplock acquire V4
+   { HgfsServerOplockBreakAck,   sizeof (HgfsReplyOplockBreakV4),                  REQ_SYNC},
+   { NULL,                       0,                                                REQ_SYNC}, // No Op lock byte range V4
+   { NULL,                       0,                                                REQ_SYNC}, // No Op unlock byte range V4
+   { NULL,                       0,                                                REQ_SYNC}, // No Op query EAs V4
+   { NULL,                       0,                                                REQ_SYNC}, // No Op set EAs V4
+   { HgfsServerCompound,         sizeof (HgfsRequestCompoundV4),                   REQ_SYNC},
+   { HgfsServerCopyFile,         sizeof (HgfsRequestCopyFileV4),                   REQ_ASYNC},
+   { HgfsServerSeekExtent,       sizeof (HgfsRequestSeekExtentV4),                 REQ_ASYNC},
+   { HgfsServerAllocate,         sizeof (HgfsRequestAllocateV4),                   REQ_ASYNC},
 
 };
 
@@ -2924,6 +3272,7 @@ static struct {
  * HgfsServerInputAllocInit --
  *
  *    Allocates and initializes the input params object with the operation parameters.
+ *    The object comes from the input params pool when it has a free one.
  *
  * Results:
  *    None.
@@ -2949,7 +3298,8 @@ HgfsServerInputAllocInit(HgfsPacket *packet,                        // IN: packe
 {
    HgfsInputParam *localParams;
 
-   localParams = Util_SafeCalloc(1, sizeof *localParams);
+   localParams = HgfsBufferPool_Get(&gHgfsInputParamPool);
+   memset(localParams, 0, sizeof *localParams);
 
    localParams->packet = packet;
    localParams->request = request;
@@ -2961,6 +3311,7 @@ HgfsServerInputAllocInit(HgfsPacket *packet,                        // IN: packe
    localParams->op = requestOp;
    localParams->payload = requestOpArgs;
    localParams->payloadSize = requestOpArgsSize;
+   localParams->startTime = Hostinfo_SystemTimerUS();
 
    if (NULL != localParams->payload) {
       localParams->payloadOffset = (char *)localParams->payload -
@@ -2976,6 +3327,7 @@ HgfsServerInputAllocInit(HgfsPacket *packet,                        // IN: packe
  * HgfsServerInputExit --
  *
  *    Tearsdown and frees the input params object with the operation parameters.
+ *    The object goes back to the input params pool unless it is full.
  *
  * Results:
  *    None.
@@ -2993,7 +3345,7 @@ HgfsServerInputExit(HgfsInputParam *params)                        // IN: packet
       HgfsServerSessionPut(params->session);
    }
    HgfsServerTransportSessionPut(params->transportSession);
-   free(params);
+   HgfsBufferPool_Put(&gHgfsInputParamPool, params);
 }
 
 
@@ -3193,90 +3545,49 @@ HgfsServerGetReplyHeaderSize(Bool sessionEnabled,     // IN: session based reque
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsServerCompleteRequest --
+ * HgfsServerOpStatsUpdate --
  *
- *    Performs all necessary action which needed for completing HGFS request:
- *       1. Sends reply to the guest.
- *       2. Release allocated objects, mapped guest memory.
- *       3. Dereference objects that were referenced.
+ *    Accounts a completed request in a set of operation counters.
  *
  * Results:
- *    None.
+ *    None
  *
  * Side effects:
- *    Reference to Session is dropped.
+ *    None
  *
  *-----------------------------------------------------------------------------
  */
 
 static void
-HgfsServerCompleteRequest(HgfsInternalStatus status,   // IN: Status of the request
-                          size_t replyPayloadSize,     // IN: sizeof the reply payload
-                          HgfsInputParam *input)       // IN/OUT: request context
+HgfsServerOpStatsUpdate(HgfsOpStats *stats,   // IN/OUT: op counters
+                        Bool failed,          // IN: request failed
+                        uint64 bytes,         // IN: bytes transferred
+                        uint64 usecs)         // IN: request latency
 {
-   void *reply;
-   size_t replySize;
-   size_t replyTotalSize;
-   size_t replyHeaderSize;
-   uint64 replySessionId;
+   uint32 bucket = 0;
 
-   if (HGFS_ERROR_SUCCESS == status) {
-      HGFS_ASSERT_INPUT(input);
-   } else {
-      ASSERT(input);
-   }
-
-   replySessionId =  (NULL != input->session) ? input->session->sessionId
-                                              : HGFS_INVALID_SESSION_ID;
-   replyHeaderSize = HgfsServerGetReplyHeaderSize(input->sessionEnabled,
-                                                  input->op);
-
-   if (replyHeaderSize != 0) {
-      replySize = replyHeaderSize + replyPayloadSize;
-   } else {
-      /*
-       * For pre-V3 header is included in the payload size.
-       * If we want to send just an error result then HgfsReply
-       * only size is required.
-       *
-       * XXX - all callers should be verified that the reply payload
-       * size for V1 and V2 should be correct (mininum HgfsReply size).
-       */
-      replySize = MAX(replyPayloadSize, sizeof (HgfsReply));
-   }
-
-   reply = HSPU_GetReplyPacket(input->packet,
-                               input->transportSession->channelCbTable,
-                               replySize,
-                               &replyTotalSize);
-
-   ASSERT(reply && (replySize <= replyTotalSize));
-   if (!HgfsPackReplyHeader(status, replyPayloadSize, input->sessionEnabled, replySessionId,
-                           input->id, input->op, HGFS_PACKET_FLAG_REPLY, replyTotalSize,
-                           reply)) {
-      Log("%s: Error packing header!\n", __FUNCTION__);
-      goto exit;
+   if (usecs != 0) {
+      bucket = MIN(mssb64_0(usecs) + 1, HGFS_SERVER_LATENCY_BUCKETS - 1);
    }
 
-   if (!HgfsPacketSend(input->packet,
-                       input->transportSession,
-                       input->session,
-                       0)) {
-      /* Send failed. Drop the reply. */
-      Log("%s: Error sending reply\n", __FUNCTION__);
+   Atomic_Inc64(&stats->count);
+   if (failed) {
+      Atomic_Inc64(&stats->errors);
    }
-
-exit:
-   HgfsServerInputExit(input);
+   Atomic_Add64(&stats->bytes, bytes);
+   Atomic_Add64(&stats->totalUsecs, usecs);
+   Atomic_Inc64(&stats->latency[bucket]);
 }
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsServerProcessRequest --
+ * HgfsServerOpStatsRecord --
  *
- *    Dispatch an incoming packet (in packetIn) to a handler function.
+ *    Accounts a request being completed in the counters of its operation,
+ *    globally and for its session. The bytes counted are the request, the
+ *    reply and the data buffer, if any.
  *
  * Results:
  *    None
@@ -3288,29 +3599,232 @@ exit:
  */
 
 static void
-HgfsServerProcessRequest(void *context)
+HgfsServerOpStatsRecord(HgfsInternalStatus status,   // IN: Status of the request
+                        size_t replySize,            // IN: Size of the reply
+                        HgfsInputParam *input)       // IN: request context
 {
-   HgfsInputParam *input = (HgfsInputParam *)context;
-   if (!input->request) {
-      input->request = HSPU_GetMetaPacket(input->packet,
-                                          &input->requestSize,
-                                          input->transportSession->channelCbTable);
+   Bool failed = HGFS_ERROR_SUCCESS != status;
+   uint64 bytes = input->requestSize + replySize;
+   uint64 usecs = Hostinfo_SystemTimerUS() - input->startTime;
+
+   if (input->op >= HGFS_OP_MAX) {
+      /* Bad requests are replied to but not accounted. */
+      return;
    }
 
-   input->payload = (char *)input->request + input->payloadOffset;
-   (*handlers[input->op].handler)(input);
+   if (NULL != input->packet) {
+      bytes += input->packet->dataPacketDataSize;
+   }
+
+   HgfsServerOpStatsUpdate(&gHgfsOpStats[input->op], failed, bytes, usecs);
+   if (NULL != input->session) {
+      HgfsServerOpStatsUpdate(&input->session->opStats[input->op], failed,
+                              bytes, usecs);
+   }
 }
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsServerSessionReceive --
+ * HgfsServerOpStatsRead --
  *
- *    Dispatch an incoming packet (in packetIn) to a handler function.
+ *    Takes a snapshot of a set of operation counters. The counters are read
+ *    one by one while requests complete, so they are not exactly consistent
+ *    with each other.
  *
- *    This function cannot fail; if something goes wrong, it returns
- *    a packet containing only a reply header with error code.
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerOpStatsRead(HgfsOpStats *stats,           // IN: op counters
+                      HgfsServerOpStats *snapshot)  // OUT: counter values
+{
+   uint32 i;
+
+   snapshot->count = Atomic_Read64(&stats->count);
+   snapshot->errors = Atomic_Read64(&stats->errors);
+   snapshot->bytes = Atomic_Read64(&stats->bytes);
+   snapshot->totalUsecs = Atomic_Read64(&stats->totalUsecs);
+   for (i = 0; i < HGFS_SERVER_LATENCY_BUCKETS; i++) {
+      snapshot->latency[i] = Atomic_Read64(&stats->latency[i]);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerOpStatsLog --
+ *
+ *    Logs the operation counters which have seen any request.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerOpStatsLog(const char *owner,    // IN: whose counters these are
+                     HgfsOpStats *stats)   // IN: counters of all the ops
+{
+   uint32 op;
+
+   for (op = 0; op < HGFS_OP_MAX; op++) {
+      HgfsServerOpStats snapshot;
+
+      HgfsServerOpStatsRead(&stats[op], &snapshot);
+      if (snapshot.count == 0) {
+         continue;
+      }
+      LOG(4, "%s: op %u: %"FMT64"u requests, %"FMT64"u errors, "
+          "%"FMT64"u bytes, avg %"FMT64"u us, p50 %"FMT64"u us, "
+          "p99 %"FMT64"u us\n", owner, op, snapshot.count, snapshot.errors,
+          snapshot.bytes, snapshot.totalUsecs / snapshot.count,
+          HgfsServer_OpStatsPercentile(&snapshot, 50),
+          HgfsServer_OpStatsPercentile(&snapshot, 99));
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerCompleteRequest --
+ *
+ *    Performs all necessary action which needed for completing HGFS request:
+ *       1. Sends reply to the guest.
+ *       2. Release allocated objects, mapped guest memory.
+ *       3. Dereference objects that were referenced.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Reference to Session is dropped.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerCompleteRequest(HgfsInternalStatus status,   // IN: Status of the request
+                          size_t replyPayloadSize,     // IN: sizeof the reply payload
+                          HgfsInputParam *input)       // IN/OUT: request context
+{
+   void *reply;
+   size_t replySize;
+   size_t replyTotalSize;
+   size_t replyHeaderSize;
+   uint64 replySessionId;
+
+   if (HGFS_ERROR_SUCCESS == status) {
+      HGFS_ASSERT_INPUT(input);
+   } else {
+      ASSERT(input);
+   }
+
+   replySessionId =  (NULL != input->session) ? input->session->sessionId
+                                              : HGFS_INVALID_SESSION_ID;
+   replyHeaderSize = HgfsServerGetReplyHeaderSize(input->sessionEnabled,
+                                                  input->op);
+
+   if (replyHeaderSize != 0) {
+      replySize = replyHeaderSize + replyPayloadSize;
+   } else {
+      /*
+       * For pre-V3 header is included in the payload size.
+       * If we want to send just an error result then HgfsReply
+       * only size is required.
+       *
+       * XXX - all callers should be verified that the reply payload
+       * size for V1 and V2 should be correct (mininum HgfsReply size).
+       */
+      replySize = MAX(replyPayloadSize, sizeof (HgfsReply));
+   }
+
+   HgfsServerOpStatsRecord(status, replySize, input);
+
+   reply = HSPU_GetReplyPacket(input->packet,
+                               input->transportSession->channelCbTable,
+                               replySize,
+                               &replyTotalSize);
+
+   ASSERT(reply && (replySize <= replyTotalSize));
+   if (!HgfsPackReplyHeader(status, replyPayloadSize, input->sessionEnabled, replySessionId,
+                           input->id, input->op, HGFS_PACKET_FLAG_REPLY, replyTotalSize,
+                           reply)) {
+      Log("%s: Error packing header!\n", __FUNCTION__);
+      goto exit;
+   }
+
+   if (input->compoundEntry) {
+      /* The compound request collects the reply from the packet. */
+      goto exit;
+   }
+
+   if (!HgfsPacketSend(input->packet,
+                       input->transportSession,
+                       input->session,
+                       0)) {
+      /* Send failed. Drop the reply. */
+      Log("%s: Error sending reply\n", __FUNCTION__);
+   }
+
+exit:
+   HgfsServerInputExit(input);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerProcessRequest --
+ *
+ *    Dispatch an incoming packet (in packetIn) to a handler function.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerProcessRequest(void *context)
+{
+   HgfsInputParam *input = (HgfsInputParam *)context;
+   if (!input->request) {
+      input->request = HSPU_GetMetaPacket(input->packet,
+                                          &input->requestSize,
+                                          input->transportSession->channelCbTable);
+   }
+
+   input->payload = (char *)input->request + input->payloadOffset;
+   (*handlers[input->op].handler)(input);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerSessionReceive --
+ *
+ *    Dispatch an incoming packet (in packetIn) to a handler function.
+ *
+ *    This function cannot fail; if something goes wrong, it returns
+ *    a packet containing only a reply header with error code.
  *
  *    The handler function can send the reply packet either using
  *    HgfsPacketSend helper functions. This function would return error
@@ -3381,7 +3895,6 @@ HgfsServerSessionReceive(HgfsPacket *packet,      // IN: Hgfs Packet
          }
          if (0 != (packet->state & HGFS_STATE_ASYNC_REQUEST)) {
             LOG(4, "%s: %d: @@Async\n", __FUNCTION__, __LINE__);
-#ifndef VMX86_TOOLS
             /*
              * Asynchronous processing is supported by the transport.
              * We can release mappings here and reacquire when needed.
@@ -3391,11 +3904,17 @@ HgfsServerSessionReceive(HgfsPacket *packet,      // IN: Hgfs Packet
             HgfsServerAsyncInfoIncCount(&input->session->asyncRequestsInfo);
 
             if (gHgfsThreadpoolActive) {
-               if (!HgfsThreadpool_QueueWorkItem(HgfsServerProcessRequest, input)) {
+               /*
+                * The threadpool refuses work when it is deactivated or its
+                * queues are full: process inline, throttling the client.
+                */
+               if (!HgfsThreadpool_QueueWorkItem(HgfsServerProcessRequest,
+                                                 input, input->session)) {
                   LOG(4, "%s: %d: failed to queue item.\n", __FUNCTION__, __LINE__);
                   HgfsServerProcessRequest(input);
                }
             } else {
+#ifndef VMX86_TOOLS
                 /* Remove pending requests during poweroff. */
                 Poll_Callback(POLL_CS_MAIN,
                               POLL_FLAG_REMOVE_AT_POWEROFF,
@@ -3404,11 +3923,12 @@ HgfsServerSessionReceive(HgfsPacket *packet,      // IN: Hgfs Packet
                               POLL_REALTIME,
                               1000,
                               NULL);
-            }
 #else
-            /* Tools code should never process request async. */
-            ASSERT(0);
+                /* Tools only process requests async through the threadpool. */
+                ASSERT(0);
+                HgfsServerProcessRequest(input);
 #endif
+            }
          } else {
             LOG(4, "%s: %d: ##Sync\n", __FUNCTION__, __LINE__);
             HgfsServerProcessRequest(input);
@@ -3977,6 +4497,10 @@ HgfsServer_InitState(const HgfsServerCallbacks **callbackTable,   // IN/OUT: our
    gHgfsSharedFoldersLock = MXUser_CreateExclLock("sharedFoldersLock",
                                                   RANK_hgfsSharedFolders);
 
+   HgfsBufferPool_Init(&gHgfsInputParamPool, "hgfsInputParamPoolLock",
+                       sizeof (HgfsInputParam), HGFS_INPUT_PARAM_POOL_MAX);
+   HSPU_InitReplyPools();
+
    if (!HgfsPlatformInit()) {
       LOG(4, "Could not initialize server platform specific \n");
       result = FALSE;
@@ -3990,7 +4514,8 @@ HgfsServer_InitState(const HgfsServerCallbacks **callbackTable,   // IN/OUT: our
          Log("%s: initialized notification %s.\n", __FUNCTION__,
              (gHgfsDirNotifyActive ? "active" : "inactive"));
       }
-      if (0 != (gHgfsCfgSettings.flags & HGFS_CONFIG_OPLOCK_MONITOR_ENABLED)) {
+      if (   0 != (gHgfsCfgSettings.flags & HGFS_CONFIG_OPLOCK_ENABLED)
+          || 0 != (gHgfsCfgSettings.flags & HGFS_CONFIG_OPLOCK_MONITOR_ENABLED)) {
          if (!HgfsServerOplockInit()) {
             Log("%s: failed to init oplock module.\n", __FUNCTION__);
             HgfsServerOplockDestroy();
@@ -4000,7 +4525,8 @@ HgfsServer_InitState(const HgfsServerCallbacks **callbackTable,   // IN/OUT: our
       }
       if (0 != (gHgfsCfgSettings.flags & HGFS_CONFIG_THREADPOOL_ENABLED)) {
          gHgfsThreadpoolActive =
-            HgfsThreadpool_Init() == HGFS_STATUS_SUCCESS;
+            HgfsThreadpool_Init(gHgfsCfgSettings.numThreadpoolWorkers) ==
+               HGFS_STATUS_SUCCESS;
          Log("%s: initialized threadpool %s.\n", __FUNCTION__,
              (gHgfsThreadpoolActive ? "active" : "inactive"));
       }
@@ -4070,6 +4596,15 @@ HgfsServer_ExitState(void)
       Log("%s: exit threadpool - inactive.\n", __FUNCTION__);
    }
 
+   LOG(4, "%s: read %"FMT64"u bytes (%"FMT64"u zero copy, %"FMT64"u copied), "
+       "wrote %"FMT64"u bytes\n", __FUNCTION__,
+       Atomic_Read64(&gHgfsReadBytes), Atomic_Read64(&gHgfsReadZeroCopyBytes),
+       Atomic_Read64(&gHgfsReadCopiedBytes), Atomic_Read64(&gHgfsWriteBytes));
+   HgfsServerOpStatsLog(__FUNCTION__, gHgfsOpStats);
+
+   HgfsBufferPool_Exit(&gHgfsInputParamPool);
+   HSPU_ExitReplyPools();
+
    HgfsPlatformDestroy();
 
    /*
@@ -4630,7 +5165,6 @@ HgfsServerAsyncInfoDecCount(HgfsAsyncRequestInfo *info) // IN/OUT: info
 }
 
 
-#ifndef VMX86_TOOLS
 /*
  *-----------------------------------------------------------------------------
  *
@@ -4653,7 +5187,6 @@ HgfsServerAsyncInfoIncCount(HgfsAsyncRequestInfo *info) // IN/OUT: info
 {
    Atomic_Inc(&info->requestCount);
 }
-#endif // VMX86_TOOLS
 
 
 /*
@@ -4697,11 +5230,11 @@ HgfsServerAllocateSession(HgfsTransportSessionInfo *transportSession, // IN:
    session->fileIOLock = MXUser_CreateExclLock("HgfsFileIOLock",
                                                RANK_hgfsFileIOLock);
 
-   session->nodeArrayLock = MXUser_CreateExclLock("HgfsNodeArrayLock",
-                                                  RANK_hgfsNodeArrayLock);
+   session->nodeArrayLock = MXUser_CreateRWLock("HgfsNodeArrayLock",
+                                                RANK_hgfsNodeArrayLock);
 
-   session->searchArrayLock = MXUser_CreateExclLock("HgfsSearchArrayLock",
-                                                    RANK_hgfsSearchArrayLock);
+   session->searchArrayLock = MXUser_CreateRWLock("HgfsSearchArrayLock",
+                                                  RANK_hgfsSearchArrayLock);
 
    session->sessionId = HgfsGenerateSessionId();
    session->state = HGFS_SESSION_STATE_OPEN;
@@ -4721,10 +5254,13 @@ HgfsServerAllocateSession(HgfsTransportSessionInfo *transportSession, // IN:
    /*
     * If the server is enabled for processing oplocks and the client
     * is requesting to use them, then report back to the client oplocks
-    * are enabled by propagating the session flag.
+    * are enabled by propagating the session flag. Breaking an oplock needs
+    * a request sent by the server, which only shared memory channels allow.
     */
    if ((0 != (createSessionInfo.flags & HGFS_SESSION_OPLOCK_ENABLED)) &&
-       (0 != (gHgfsCfgSettings.flags & HGFS_CONFIG_OPLOCK_ENABLED))) {
+       (0 != (gHgfsCfgSettings.flags & HGFS_CONFIG_OPLOCK_ENABLED)) &&
+       (0 != (transportSession->channelCapabilities.flags &
+              HGFS_CHANNEL_SHARED_MEM))) {
       session->flags |= HGFS_SESSION_OPLOCK_ENABLED;
    }
 
@@ -4748,6 +5284,8 @@ HgfsServerAllocateSession(HgfsTransportSessionInfo *transportSession, // IN:
       DblLnkLst_LinkLast(&session->nodeFreeList, &session->nodeArray[i].links);
    }
 
+   HgfsNodeIndexRebuild(session);
+
    /*
     * Initialize the search handling components.
     */
@@ -4818,6 +5356,11 @@ HgfsServerAllocateSession(HgfsTransportSessionInfo *transportSession, // IN:
 
       HgfsServerSetSessionCapability(HGFS_OP_SEARCH_READ_V4,
                                      HGFS_OP_CAPFLAG_IS_SUPPORTED, session);
+
+      if (0 != (session->flags & HGFS_SESSION_OPLOCK_ENABLED)) {
+         HgfsServerSetSessionCapability(HGFS_OP_OPLOCK_BREAK_V4,
+                                        HGFS_OP_CAPFLAG_IS_SUPPORTED, session);
+      }
    }
 
    if (0 != (gHgfsCfgSettings.flags & HGFS_CONFIG_OPLOCK_MONITOR_ENABLED)) {
@@ -4993,9 +5536,10 @@ HgfsServerExitSessionInternal(HgfsSessionInfo *session)    // IN: session contex
       HgfsNotify_RemoveSessionSubscribers(session);
    }
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
 
    Log("%s: teardown session %p id 0x%"FMT64"x\n", __FUNCTION__, session, session->sessionId);
+   HgfsServerOpStatsLog(__FUNCTION__, session->opStats);
 
    /* Recycle all nodes that are still in use, then destroy the node pool. */
    for (i = 0; i < session->numNodes; i++) {
@@ -5011,15 +5555,18 @@ HgfsServerExitSessionInternal(HgfsSessionInfo *session)    // IN: session contex
    }
    free(session->nodeArray);
    session->nodeArray = NULL;
+   free(session->nodeHandleIndex);
+   session->nodeHandleIndex = NULL;
+   session->numNodeHandleBuckets = 0;
 
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    /*
     * Recycle all searches that are still in use, then destroy the
     * search pool.
     */
 
-   MXUser_AcquireExclLock(session->searchArrayLock);
+   MXUser_AcquireForWrite(session->searchArrayLock);
 
    for (i = 0; i < session->numSearches; i++) {
       if (DblLnkLst_IsLinked(&session->searchArray[i].links)) {
@@ -5030,15 +5577,17 @@ HgfsServerExitSessionInternal(HgfsSessionInfo *session)    // IN: session contex
    free(session->searchArray);
    session->searchArray = NULL;
 
-   MXUser_ReleaseExclLock(session->searchArrayLock);
+   MXUser_ReleaseRWLock(session->searchArrayLock);
 
-   if (gHgfsThreadpoolActive) {
-      HgfsThreadpool_Deactivate();
-   }
+   /*
+    * No need to drain the threadpool here: each queued request holds a
+    * session reference, so none can be pending once the last one is gone.
+    * This may also run on a worker thread, which must not wait for itself.
+    */
 
    /* Teardown the locks for the sessions and destroy itself. */
-   MXUser_DestroyExclLock(session->nodeArrayLock);
-   MXUser_DestroyExclLock(session->searchArrayLock);
+   MXUser_DestroyRWLock(session->nodeArrayLock);
+   MXUser_DestroyRWLock(session->searchArrayLock);
    MXUser_DestroyExclLock(session->fileIOLock);
 
    /* Teardown the async request info.*/
@@ -5096,6 +5645,149 @@ HgfsServer_SetHandleCounter(uint32 newHandleCounter)
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServer_GetIoStats --
+ *
+ *    Return the data throughput counters of the server: the bytes read and
+ *    written for clients since the server was loaded, and how the read data
+ *    reached the guest buffers.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsServer_GetIoStats(HgfsServerIoStats *stats)  // OUT: throughput counters
+{
+   stats->readBytes = Atomic_Read64(&gHgfsReadBytes);
+   stats->readZeroCopyBytes = Atomic_Read64(&gHgfsReadZeroCopyBytes);
+   stats->readCopiedBytes = Atomic_Read64(&gHgfsReadCopiedBytes);
+   stats->writeBytes = Atomic_Read64(&gHgfsWriteBytes);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServer_GetOpStats --
+ *
+ *    Return the counters of an operation for all sessions since the server
+ *    was loaded. Ops are numbered as HgfsOp, callers can enumerate them from
+ *    0 until this fails.
+ *
+ * Results:
+ *    TRUE if the operation is known, FALSE otherwise.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsServer_GetOpStats(uint32 op,                  // IN: operation
+                      HgfsServerOpStats *stats)   // OUT: counters
+{
+   if (op >= HGFS_OP_MAX) {
+      return FALSE;
+   }
+
+   HgfsServerOpStatsRead(&gHgfsOpStats[op], stats);
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServer_GetPoolStats --
+ *
+ *    Return the counters of a recycled buffer pool since the server state
+ *    was initialized.
+ *
+ * Results:
+ *    TRUE if the pool is known, FALSE otherwise.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsServer_GetPoolStats(uint32 pool,                  // IN: HgfsServerPool
+                        HgfsServerPoolStats *stats)   // OUT: counters
+{
+   switch (pool) {
+   case HGFS_SERVER_POOL_INPUT_PARAMS:
+      HgfsBufferPool_GetStats(&gHgfsInputParamPool, stats);
+      return TRUE;
+   case HGFS_SERVER_POOL_REPLIES:
+      return HSPU_GetReplyPoolStats(0, stats);
+   case HGFS_SERVER_POOL_LARGE_REPLIES:
+      return HSPU_GetReplyPoolStats(1, stats);
+   default:
+      return FALSE;
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServer_OpStatsPercentile --
+ *
+ *    Estimate a latency percentile from an operation's latency histogram.
+ *
+ * Results:
+ *    The upper bound in microseconds of the histogram bucket holding the
+ *    percentile, or of the last bucket's lower bound if it falls in the
+ *    open ended bucket. 0 if there are no requests.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+uint64
+HgfsServer_OpStatsPercentile(const HgfsServerOpStats *stats,  // IN: counters
+                             uint32 percentile)               // IN: 0 - 100
+{
+   uint64 total = 0;
+   uint64 wanted;
+   uint64 seen = 0;
+   uint32 i;
+
+   for (i = 0; i < HGFS_SERVER_LATENCY_BUCKETS; i++) {
+      total += stats->latency[i];
+   }
+   if (total == 0) {
+      return 0;
+   }
+
+   /* The rank of the percentile request, rounded up. */
+   wanted = (total * MIN(percentile, 100) + 99) / 100;
+   wanted = MAX(wanted, 1);
+
+   for (i = 0; i < HGFS_SERVER_LATENCY_BUCKETS - 1; i++) {
+      seen += stats->latency[i];
+      if (seen >= wanted) {
+         break;
+      }
+   }
+
+   return CONST64U(1) << MIN(i, HGFS_SERVER_LATENCY_BUCKETS - 2);
+}
+
+
 /*
  *----------------------------------------------------------------------------
  *
@@ -5295,7 +5987,7 @@ HgfsInvalidateSessionObjects(DblLnkLst_Links *shares,  // IN: List of new shares
    ASSERT(session->searchArray);
    LOG(4, "%s: Beginning\n", __FUNCTION__);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
 
    /*
     * Iterate over each node, skipping those that are unused. For each node,
@@ -5337,9 +6029,9 @@ HgfsInvalidateSessionObjects(DblLnkLst_Links *shares,  // IN: List of new shares
       }
    }
 
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
-   MXUser_AcquireExclLock(session->searchArrayLock);
+   MXUser_AcquireForWrite(session->searchArrayLock);
 
    /*
     * Iterate over each search, skipping those that are on the free list. For
@@ -5379,7 +6071,7 @@ HgfsInvalidateSessionObjects(DblLnkLst_Links *shares,  // IN: List of new shares
       }
    }
 
-   MXUser_ReleaseExclLock(session->searchArrayLock);
+   MXUser_ReleaseRWLock(session->searchArrayLock);
 
    HgfsCache* caches[] = {session->symlinkCache, session->fileAttrCache };
    for (i = 0; i < sizeof(caches) / sizeof(caches[0]); i++) {
@@ -5710,6 +6402,7 @@ HgfsServerGetLocalNameInfo(const char *cpName,      // IN:  Cross-platform filen
    uint32 startIndex = 0;
    HgfsShareOptions shareOptions;
    HgfsSymlinkCacheEntry *entry;
+   HgfsSymlinkCacheEntry cachedEntry;
 
    ASSERT(cpName);
    ASSERT(bufOut);
@@ -5933,8 +6626,9 @@ HgfsServerGetLocalNameInfo(const char *cpName,      // IN:  Cross-platform filen
    if (!HgfsServerPolicy_IsShareOptionSet(shareOptions,
                                           HGFS_SHARE_FOLLOW_SYMLINKS)) {
       if (NULL != session->symlinkCache &&
-          HgfsCache_Get(session->symlinkCache, myBufOut, (void **)&entry)) {
-         nameStatus = entry->nameStatus;
+          HgfsCache_GetCopy(session->symlinkCache, myBufOut,
+                            &cachedEntry, sizeof cachedEntry)) {
+         nameStatus = cachedEntry.nameStatus;
       } else {
          /*
           * Verify that either the path is same as share path or the path until
@@ -6077,14 +6771,14 @@ HgfsServerDirDumpDents(HgfsHandle searchHandle,  // IN: Handle to dump dents fro
 {
    HgfsSearch *search;
 
-   MXUser_AcquireExclLock(session->searchArrayLock);
+   MXUser_AcquireForRead(session->searchArrayLock);
 
    search = HgfsSearchHandle2Search(searchHandle, session);
    if (search != NULL) {
       HgfsPlatformDirDumpDents(search);
    }
 
-   MXUser_ReleaseExclLock(session->searchArrayLock);
+   MXUser_ReleaseRWLock(session->searchArrayLock);
 }
 #endif
 
@@ -6131,7 +6825,7 @@ HgfsServerSearchRealDir(char const *baseDir,      // IN: Directory to search
    ASSERT(handle);
    ASSERT(shareName);
 
-   MXUser_AcquireExclLock(session->searchArrayLock);
+   MXUser_AcquireForWrite(session->searchArrayLock);
 
    search = HgfsAddNewSearch(baseDir, DIRECTORY_SEARCH_TYPE_DIR, shareName,
                              rootDir, session);
@@ -6154,8 +6848,8 @@ HgfsServerSearchRealDir(char const *baseDir,      // IN: Directory to search
    followSymlinks = HgfsServerPolicy_IsShareOptionSet(configOptions,
                                                       HGFS_SHARE_FOLLOW_SYMLINKS);
 
-   status = HgfsPlatformScandir(baseDir, baseDirLen, followSymlinks,
-                                &search->dents, &search->numDents);
+   status = HgfsPlatformScandirOpen(baseDir, baseDirLen, followSymlinks,
+                                    session, search);
    if (HGFS_ERROR_SUCCESS != status) {
       LOG(4, "%s: couldn't scandir\n", __FUNCTION__);
       HgfsRemoveSearchInternal(search, session);
@@ -6165,7 +6859,7 @@ HgfsServerSearchRealDir(char const *baseDir,      // IN: Directory to search
    *handle = HgfsSearch2SearchHandle(search);
 
   out:
-   MXUser_ReleaseExclLock(session->searchArrayLock);
+   MXUser_ReleaseRWLock(session->searchArrayLock);
 
    return status;
 }
@@ -6207,7 +6901,7 @@ HgfsServerSearchVirtualDir(HgfsServerResEnumGetFunc getName,      // IN: Name en
    ASSERT(cleanupName);
    ASSERT(handle);
 
-   MXUser_AcquireExclLock(session->searchArrayLock);
+   MXUser_AcquireForWrite(session->searchArrayLock);
 
    search = HgfsAddNewSearch("", type, "", "", session);
    if (!search) {
@@ -6231,7 +6925,7 @@ HgfsServerSearchVirtualDir(HgfsServerResEnumGetFunc getName,      // IN: Name en
    *handle = HgfsSearch2SearchHandle(search);
 
   out:
-   MXUser_ReleaseExclLock(session->searchArrayLock);
+   MXUser_ReleaseRWLock(session->searchArrayLock);
 
    return status;
 }
@@ -6272,7 +6966,7 @@ HgfsServerRestartSearchVirtualDir(HgfsServerResEnumGetFunc getName,      // IN:
    ASSERT(cleanupName);
    ASSERT(searchHandle);
 
-   MXUser_AcquireExclLock(session->searchArrayLock);
+   MXUser_AcquireForWrite(session->searchArrayLock);
 
    vdirSearch = HgfsSearchHandle2Search(searchHandle, session);
    if (NULL == vdirSearch) {
@@ -6299,7 +6993,7 @@ HgfsServerRestartSearchVirtualDir(HgfsServerResEnumGetFunc getName,      // IN:
    vdirSearch->flags &= ~HGFS_SEARCH_FLAG_READ_ALL_ENTRIES;
 
 exit:
-   MXUser_ReleaseExclLock(session->searchArrayLock);
+   MXUser_ReleaseRWLock(session->searchArrayLock);
 
    LOG(4, "%s: refreshing dents return %d\n", __FUNCTION__, status);
    return status;
@@ -6331,9 +7025,9 @@ HgfsRemoveFromCache(HgfsHandle handle,        // IN: Hgfs handle to the node
 {
    Bool removed = FALSE;
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
    removed = HgfsRemoveFromCacheInternal(handle, session);
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return removed;
 }
@@ -6346,6 +7040,10 @@ HgfsRemoveFromCache(HgfsHandle handle,        // IN: Hgfs handle to the node
  *
  *    Grab a lock and call HgfsIsCachedInternal.
  *
+ *    Requests on a file usually come in runs, so the node is often the most
+ *    recently used already: that needs no update to the cache list and is
+ *    checked under the read lock first.
+ *
  * Results:
  *    TRUE if the node is found in the cache.
  *    FALSE if the node is not in the cache.
@@ -6360,11 +7058,23 @@ Bool
 HgfsIsCached(HgfsHandle handle,         // IN: Structure representing file node
              HgfsSessionInfo *session)  // IN: Session info
 {
+   HgfsFileNode *node;
    Bool cached = FALSE;
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
-   cached = HgfsIsCachedInternal(handle, session);
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
+   node = HgfsHandle2FileNode(handle, session);
+   if (node != NULL &&
+       node->state == FILENODE_STATE_IN_USE_CACHED &&
+       session->nodeCachedList.prev == &node->links) {
+      cached = TRUE;
+   }
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
+
+   if (!cached) {
+      MXUser_AcquireForWrite(session->nodeArrayLock);
+      cached = HgfsIsCachedInternal(handle, session);
+      MXUser_ReleaseRWLock(session->nodeArrayLock);
+   }
 
    return cached;
 }
@@ -6473,9 +7183,9 @@ HgfsAddToCache(HgfsHandle handle,        // IN: HGFS file handle
 {
    Bool added = FALSE;
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
    added = HgfsAddToCacheInternal(handle, session);
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return added;
 }
@@ -6539,14 +7249,14 @@ HgfsCreateAndCacheFileNode(HgfsFileOpenInfo *openInfo, // IN: Open info struct
       sharedFolderOpen = TRUE;
    }
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
 
    node = HgfsAddNewFileNode(openInfo, localId, fileDesc, append, len,
                              openInfo->cpName, sharedFolderOpen, session);
 
    if (node == NULL) {
       LOG(4, "%s: Failed to add new node.\n", __FUNCTION__);
-      MXUser_ReleaseExclLock(session->nodeArrayLock);
+      MXUser_ReleaseRWLock(session->nodeArrayLock);
 
       HgfsPlatformCloseFile(fileDesc, NULL);
       return FALSE;
@@ -6558,12 +7268,12 @@ HgfsCreateAndCacheFileNode(HgfsFileOpenInfo *openInfo, // IN: Open info struct
       HgfsPlatformCloseFile(fileDesc, NULL);
 
       LOG(4, "%s: Failed to add node to the cache.\n", __FUNCTION__);
-      MXUser_ReleaseExclLock(session->nodeArrayLock);
+      MXUser_ReleaseRWLock(session->nodeArrayLock);
 
       return FALSE;
    }
 
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    /* Only after everything is successful, save the handle in the open info. */
    openInfo->file = handle;
@@ -6755,6 +7465,7 @@ HgfsServerRead(HgfsInputParam *input)  // IN: Input params
    size_t replyPayloadSize = 0;
    size_t replyReadSize = 0;
    size_t replyReadDataSize = 0;
+   uint32 actualSize = 0;
    void *replyRead;
 
    HGFS_ASSERT_INPUT(input);
@@ -6802,13 +7513,36 @@ HgfsServerRead(HgfsInputParam *input)  // IN: Input params
           * same buffer as the reply arguments.
           */
          if (readUseDataBuffer) {
+            HgfsVmxIov *dataIov;
+            uint32 dataIovCount;
+
+            /*
+             * A data buffer spanning several guest iovs is read into directly
+             * rather than into a contiguous buffer that is then copied out.
+             */
+            dataIov = HSPU_GetDataPacketIov(input->packet, BUF_WRITEABLE,
+                                            input->transportSession->channelCbTable,
+                                            &dataIovCount);
+            if (dataIov != NULL && dataIovCount > 1) {
+               status = HgfsPlatformReadFileIov(readFd, input->session, offset,
+                                                requiredSize, dataIov, dataIovCount,
+                                                &actualSize);
+               if (HGFS_ERROR_SUCCESS == status) {
+                  reply->reserved = 0;
+                  reply->actualSize = actualSize;
+                  replyPayloadSize = sizeof *reply;
+                  HSPU_SetDataPacketSize(input->packet, reply->actualSize);
+                  Atomic_Add64(&gHgfsReadZeroCopyBytes, actualSize);
+                  Atomic_Add64(&gHgfsReadBytes, actualSize);
+               }
+               break;
+            }
             payload = HSPU_GetDataPacketBuf(input->packet, BUF_WRITEABLE,
                                             input->transportSession->channelCbTable);
          } else {
             payload = &reply->payload[0];
          }
          if (payload) {
-            uint32 actualSize = 0;
             status = HgfsPlatformReadFile(readFd, input->session, offset,
                                           requiredSize, payload,
                                           &actualSize);
@@ -6819,9 +7553,15 @@ HgfsServerRead(HgfsInputParam *input)  // IN: Input params
 
                if (readUseDataBuffer) {
                   HSPU_SetDataPacketSize(input->packet, reply->actualSize);
+                  if (input->packet->dataPacketIsAllocated) {
+                     Atomic_Add64(&gHgfsReadCopiedBytes, actualSize);
+                  } else {
+                     Atomic_Add64(&gHgfsReadZeroCopyBytes, actualSize);
+                  }
                } else {
                   replyPayloadSize += reply->actualSize;
                }
+               Atomic_Add64(&gHgfsReadBytes, actualSize);
             }
          } else {
             status = HGFS_ERROR_PROTOCOL;
@@ -6831,7 +7571,6 @@ HgfsServerRead(HgfsInputParam *input)  // IN: Input params
          break;
       }
    case HGFS_OP_READ: {
-         uint32 actualSize = 0;
          HgfsReplyRead *reply = replyRead;
 
          status = HgfsPlatformReadFile(readFd, input->session, offset, requiredSize,
@@ -6839,6 +7578,7 @@ HgfsServerRead(HgfsInputParam *input)  // IN: Input params
          if (HGFS_ERROR_SUCCESS == status) {
             reply->actualSize = actualSize;
             replyPayloadSize = sizeof *reply + reply->actualSize;
+            Atomic_Add64(&gHgfsReadBytes, actualSize);
          } else {
             LOG(4, "%s: V1 Failed to read-> %d.\n", __FUNCTION__, status);
          }
@@ -6849,6 +7589,17 @@ HgfsServerRead(HgfsInputParam *input)  // IN: Input params
       break;
    }
 
+   if (HGFS_ERROR_SUCCESS == status) {
+      HgfsReadAhead readAhead;
+
+      /* Get the host reading ahead of clients streaming through the file. */
+      if (   HgfsHandleTrackRead(file, input->session, offset, actualSize,
+                                 &readAhead)
+          && readAhead.action != HGFS_READ_AHEAD_NONE) {
+         HgfsPlatformReadAhead(readFd, &readAhead);
+      }
+   }
+
 exit:
    HgfsServerCompleteRequest(status, replyPayloadSize, input);
 }
@@ -7097,6 +7848,7 @@ HgfsServerWrite(HgfsInputParam *input)  // IN: Input params
       if (HGFS_ERROR_SUCCESS != status) {
          goto exit;
       }
+      Atomic_Add64(&gHgfsWriteBytes, writtenSize);
    }
 
    if (!HgfsPackWriteReply(input->packet, input->request, input->op,
@@ -7109,6 +7861,117 @@ exit:
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerSeekExtent --
+ *
+ *    Handle a Seek Extent request: find the next data or hole of an open
+ *    file so clients can skip the holes of sparse files.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerSeekExtent(HgfsInputParam *input)  // IN: Input params
+{
+   HgfsHandle file;
+   HgfsSeekExtentType type;
+   uint64 offset;
+   uint64 extentOffset = HGFS_SEEK_EXTENT_NONE;
+   fileDesc fd;
+   HgfsInternalStatus status;
+   size_t replyPayloadSize = 0;
+
+   HGFS_ASSERT_INPUT(input);
+
+   if (!HgfsUnpackSeekExtentRequest(input->payload, input->payloadSize,
+                                    input->op, &file, &type, &offset)) {
+      status = HGFS_ERROR_PROTOCOL;
+      goto exit;
+   }
+
+   status = HgfsPlatformGetFd(file, input->session, FALSE, &fd);
+   if (HGFS_ERROR_SUCCESS != status) {
+      LOG(4, "%s: Could not get file descriptor\n", __FUNCTION__);
+      goto exit;
+   }
+
+   status = HgfsPlatformSeekExtent(fd, type, offset, &extentOffset);
+   if (HGFS_ERROR_SUCCESS == status) {
+      if (!HgfsPackSeekExtentReply(input->packet, input->request, input->op,
+                                   extentOffset, &replyPayloadSize,
+                                   input->session)) {
+         status = HGFS_ERROR_INTERNAL;
+      }
+   }
+
+exit:
+   HgfsServerCompleteRequest(status, replyPayloadSize, input);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerAllocate --
+ *
+ *    Handle an Allocate request: allocate the storage of a byte range of an
+ *    open file, or punch a hole in it.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerAllocate(HgfsInputParam *input)  // IN: Input params
+{
+   HgfsHandle file;
+   HgfsAllocateFlags flags;
+   uint64 offset;
+   uint64 length;
+   fileDesc fd;
+   HgfsInternalStatus status;
+   size_t replyPayloadSize = 0;
+
+   HGFS_ASSERT_INPUT(input);
+
+   if (!HgfsUnpackAllocateRequest(input->payload, input->payloadSize,
+                                  input->op, &file, &flags, &offset, &length)) {
+      status = HGFS_ERROR_PROTOCOL;
+      goto exit;
+   }
+
+   status = HgfsPlatformGetFd(file, input->session, FALSE, &fd);
+   if (HGFS_ERROR_SUCCESS != status) {
+      LOG(4, "%s: Could not get file descriptor\n", __FUNCTION__);
+      goto exit;
+   }
+
+   status = HgfsPlatformAllocate(fd, flags, offset, length);
+   if (HGFS_ERROR_SUCCESS == status) {
+      if (!HgfsPackAllocateReply(input->packet, input->request, input->op,
+                                 &replyPayloadSize, input->session)) {
+         status = HGFS_ERROR_INTERNAL;
+      }
+   }
+
+exit:
+   HgfsServerCompleteRequest(status, replyPayloadSize, input);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -7582,20 +8445,153 @@ HgfsValidateRenameFile(Bool useHandle,            // IN:
       }
    }
 
-   return status;
+   return status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerRename --
+ *
+ *    Handle a Rename request.
+ *
+ *    Simply converts the new and old names to local filenames, calls
+ *    platform specific function to rename/move the file, and returns an
+ *    appropriate response to the driver.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerRename(HgfsInputParam *input)  // IN: Input params
+{
+   char *utf8OldName = NULL;
+   size_t utf8OldNameLen;
+   char *utf8NewName = NULL;
+   size_t utf8NewNameLen;
+   const char *cpOldName;
+   size_t cpOldNameLen;
+   const char *cpNewName;
+   size_t cpNewNameLen;
+   HgfsInternalStatus status;
+#ifdef _WIN32
+   fileDesc srcFileDesc = INVALID_HANDLE_VALUE;
+   fileDesc targetFileDesc = INVALID_HANDLE_VALUE;
+#else
+   fileDesc srcFileDesc = -1;
+   fileDesc targetFileDesc = -1;
+#endif
+   HgfsHandle srcFile;
+   HgfsHandle targetFile;
+   HgfsRenameHint hints;
+   uint32 oldCaseFlags;
+   uint32 newCaseFlags;
+   HgfsShareInfo shareInfo;
+   size_t replyPayloadSize = 0;
+
+   HGFS_ASSERT_INPUT(input);
+
+   if (HgfsUnpackRenameRequest(input->payload, input->payloadSize, input->op, &cpOldName,
+                               &cpOldNameLen, &cpNewName, &cpNewNameLen,
+                               &hints, &srcFile, &targetFile, &oldCaseFlags,
+                               &newCaseFlags)) {
+      status = HgfsValidateRenameFile((hints & HGFS_RENAME_HINT_USE_SRCFILE_DESC) != 0,
+                                      srcFile,
+                                      cpOldName,
+                                      cpOldNameLen,
+                                      oldCaseFlags,
+                                      input->session,
+                                      &srcFileDesc,
+                                      &shareInfo,
+                                      &utf8OldName,
+                                      &utf8OldNameLen);
+      if (HGFS_ERROR_SUCCESS == status) {
+         /*
+          * Renaming a file requires both read and write permssions for the
+          * original file.
+          * However the error code must be different depending on the existence
+          * of the file with the same name.
+          */
+         if (!shareInfo.writePermissions || !shareInfo.readPermissions) {
+            status = HgfsPlatformFileExists(utf8OldName);
+            if (HGFS_ERROR_SUCCESS == status) {
+               status = HGFS_ERROR_ACCESS_DENIED;
+            }
+            LOG(4, "HgfsServerRename: failed access check, error %d\n", status);
+         } else {
+            status =
+               HgfsValidateRenameFile((hints & HGFS_RENAME_HINT_USE_TARGETFILE_DESC) != 0,
+                                      targetFile,
+                                      cpNewName,
+                                      cpNewNameLen,
+                                      newCaseFlags,
+                                      input->session,
+                                      &targetFileDesc,
+                                      &shareInfo,
+                                      &utf8NewName,
+                                      &utf8NewNameLen);
+            if (HGFS_ERROR_SUCCESS == status) {
+               /*
+                * Renaming a file requires both read and write permssions for
+                * the target directory.
+                * However the error code must be different depending on the existence
+                * of the target directory - if the destination directory exists then
+                * ERROR_ACCESS_DENIED should be returned regardless if the destination
+                * file exists.
+                */
+               if (!shareInfo.writePermissions || !shareInfo.readPermissions) {
+                  status = HgfsPlatformFileExists(utf8NewName);
+                  if (HGFS_ERROR_SUCCESS == status ||
+                      HGFS_ERROR_FILE_NOT_FOUND == status) {
+                     status = HGFS_ERROR_ACCESS_DENIED;
+                  }
+                  LOG(4, "HgfsServerRename: failed access check, error %d\n", status);
+               }
+            }
+         }
+      }
+   } else {
+      status = HGFS_ERROR_PROTOCOL;
+   }
+
+   /* If all pre-conditions are met go ahead with actual rename. */
+   if (HGFS_ERROR_SUCCESS == status) {
+      status = HgfsPlatformRename(utf8OldName, srcFileDesc, utf8NewName,
+         targetFileDesc, hints);
+      if (HGFS_ERROR_SUCCESS == status) {
+         /* Update all file nodes that refer to this file to contain the new name. */
+         HgfsUpdateNodeNames(utf8OldName, utf8NewName, input->session);
+         if (!HgfsPackRenameReply(input->packet, input->request, input->op,
+                                  &replyPayloadSize, input->session)) {
+            status = HGFS_ERROR_INTERNAL;
+         }
+      }
+   }
+
+   free(utf8OldName);
+   free(utf8NewName);
+
+   HgfsServerCompleteRequest(status, replyPayloadSize, input);
 }
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsServerRename --
+ * HgfsServerCopyFile --
  *
- *    Handle a Rename request.
+ *    Handle a Copy File request.
  *
- *    Simply converts the new and old names to local filenames, calls
- *    platform specific function to rename/move the file, and returns an
- *    appropriate response to the driver.
+ *    Validates the source and target the same way as a rename, except that
+ *    the source only needs read and the target write permissions, then calls
+ *    the platform specific function to copy the file data within the host.
  *
  * Results:
  *    None.
@@ -7607,16 +8603,16 @@ HgfsValidateRenameFile(Bool useHandle,            // IN:
  */
 
 static void
-HgfsServerRename(HgfsInputParam *input)  // IN: Input params
-{
-   char *utf8OldName = NULL;
-   size_t utf8OldNameLen;
-   char *utf8NewName = NULL;
-   size_t utf8NewNameLen;
-   const char *cpOldName;
-   size_t cpOldNameLen;
-   const char *cpNewName;
-   size_t cpNewNameLen;
+HgfsServerCopyFile(HgfsInputParam *input)  // IN: Input params
+{
+   char *utf8SrcName = NULL;
+   size_t utf8SrcNameLen;
+   char *utf8TargetName = NULL;
+   size_t utf8TargetNameLen;
+   const char *cpSrcName;
+   size_t cpSrcNameLen;
+   const char *cpTargetName;
+   size_t cpTargetNameLen;
    HgfsInternalStatus status;
 #ifdef _WIN32
    fileDesc srcFileDesc = INVALID_HANDLE_VALUE;
@@ -7627,70 +8623,67 @@ HgfsServerRename(HgfsInputParam *input)  // IN: Input params
 #endif
    HgfsHandle srcFile;
    HgfsHandle targetFile;
-   HgfsRenameHint hints;
-   uint32 oldCaseFlags;
-   uint32 newCaseFlags;
+   HgfsCopyFileHint hints;
+   uint32 srcCaseFlags;
+   uint32 targetCaseFlags;
    HgfsShareInfo shareInfo;
+   uint64 bytesCopied = 0;
    size_t replyPayloadSize = 0;
 
    HGFS_ASSERT_INPUT(input);
 
-   if (HgfsUnpackRenameRequest(input->payload, input->payloadSize, input->op, &cpOldName,
-                               &cpOldNameLen, &cpNewName, &cpNewNameLen,
-                               &hints, &srcFile, &targetFile, &oldCaseFlags,
-                               &newCaseFlags)) {
-      status = HgfsValidateRenameFile((hints & HGFS_RENAME_HINT_USE_SRCFILE_DESC) != 0,
+   if (HgfsUnpackCopyFileRequest(input->payload, input->payloadSize, input->op,
+                                 &cpSrcName, &cpSrcNameLen, &cpTargetName,
+                                 &cpTargetNameLen, &hints, &srcFile, &targetFile,
+                                 &srcCaseFlags, &targetCaseFlags)) {
+      status = HgfsValidateRenameFile((hints & HGFS_COPY_FILE_HINT_USE_SRCFILE_DESC) != 0,
                                       srcFile,
-                                      cpOldName,
-                                      cpOldNameLen,
-                                      oldCaseFlags,
+                                      cpSrcName,
+                                      cpSrcNameLen,
+                                      srcCaseFlags,
                                       input->session,
                                       &srcFileDesc,
                                       &shareInfo,
-                                      &utf8OldName,
-                                      &utf8OldNameLen);
+                                      &utf8SrcName,
+                                      &utf8SrcNameLen);
       if (HGFS_ERROR_SUCCESS == status) {
          /*
-          * Renaming a file requires both read and write permssions for the
-          * original file.
+          * Copying a file requires read permissions for the source file.
           * However the error code must be different depending on the existence
           * of the file with the same name.
           */
-         if (!shareInfo.writePermissions || !shareInfo.readPermissions) {
-            status = HgfsPlatformFileExists(utf8OldName);
+         if (!shareInfo.readPermissions) {
+            status = HgfsPlatformFileExists(utf8SrcName);
             if (HGFS_ERROR_SUCCESS == status) {
                status = HGFS_ERROR_ACCESS_DENIED;
             }
-            LOG(4, "HgfsServerRename: failed access check, error %d\n", status);
+            LOG(4, "%s: failed source access check, error %d\n", __FUNCTION__,
+                status);
          } else {
             status =
-               HgfsValidateRenameFile((hints & HGFS_RENAME_HINT_USE_TARGETFILE_DESC) != 0,
+               HgfsValidateRenameFile((hints & HGFS_COPY_FILE_HINT_USE_TARGETFILE_DESC) != 0,
                                       targetFile,
-                                      cpNewName,
-                                      cpNewNameLen,
-                                      newCaseFlags,
+                                      cpTargetName,
+                                      cpTargetNameLen,
+                                      targetCaseFlags,
                                       input->session,
                                       &targetFileDesc,
                                       &shareInfo,
-                                      &utf8NewName,
-                                      &utf8NewNameLen);
-            if (HGFS_ERROR_SUCCESS == status) {
+                                      &utf8TargetName,
+                                      &utf8TargetNameLen);
+            if (HGFS_ERROR_SUCCESS == status && !shareInfo.writePermissions) {
                /*
-                * Renaming a file requires both read and write permssions for
-                * the target directory.
-                * However the error code must be different depending on the existence
-                * of the target directory - if the destination directory exists then
-                * ERROR_ACCESS_DENIED should be returned regardless if the destination
-                * file exists.
+                * Copying a file requires write permissions for the target.
+                * If the destination directory exists then ERROR_ACCESS_DENIED
+                * should be returned regardless if the destination file exists.
                 */
-               if (!shareInfo.writePermissions || !shareInfo.readPermissions) {
-                  status = HgfsPlatformFileExists(utf8NewName);
-                  if (HGFS_ERROR_SUCCESS == status ||
-                      HGFS_ERROR_FILE_NOT_FOUND == status) {
-                     status = HGFS_ERROR_ACCESS_DENIED;
-                  }
-                  LOG(4, "HgfsServerRename: failed access check, error %d\n", status);
+               status = HgfsPlatformFileExists(utf8TargetName);
+               if (HGFS_ERROR_SUCCESS == status ||
+                   HGFS_ERROR_FILE_NOT_FOUND == status) {
+                  status = HGFS_ERROR_ACCESS_DENIED;
                }
+               LOG(4, "%s: failed target access check, error %d\n", __FUNCTION__,
+                   status);
             }
          }
       }
@@ -7698,22 +8691,21 @@ HgfsServerRename(HgfsInputParam *input)  // IN: Input params
       status = HGFS_ERROR_PROTOCOL;
    }
 
-   /* If all pre-conditions are met go ahead with actual rename. */
+   /* If all pre-conditions are met go ahead with actual copy. */
    if (HGFS_ERROR_SUCCESS == status) {
-      status = HgfsPlatformRename(utf8OldName, srcFileDesc, utf8NewName,
-         targetFileDesc, hints);
+      status = HgfsPlatformCopyFile(utf8SrcName, utf8TargetName, hints,
+                                    &bytesCopied);
       if (HGFS_ERROR_SUCCESS == status) {
-         /* Update all file nodes that refer to this file to contain the new name. */
-         HgfsUpdateNodeNames(utf8OldName, utf8NewName, input->session);
-         if (!HgfsPackRenameReply(input->packet, input->request, input->op,
-                                  &replyPayloadSize, input->session)) {
+         if (!HgfsPackCopyFileReply(input->packet, input->request, input->op,
+                                    bytesCopied, &replyPayloadSize,
+                                    input->session)) {
             status = HGFS_ERROR_INTERNAL;
          }
       }
    }
 
-   free(utf8OldName);
-   free(utf8NewName);
+   free(utf8SrcName);
+   free(utf8TargetName);
 
    HgfsServerCompleteRequest(status, replyPayloadSize, input);
 }
@@ -8060,6 +9052,63 @@ HgfsServerServerLockChange(HgfsInputParam *input)  // IN: Input params
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerOplockBreakAck --
+ *
+ *    Handle the client acknowledgement of an oplock break sent by
+ *    HgfsServerOplockBreakSend. It contains the oplock the client is now in.
+ *    Since the break could have actually been a downgrade, the client may
+ *    keep a shared oplock: HgfsAckOplockBreak makes sure that such a
+ *    transition is legal and updates the server lock.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerOplockBreakAck(HgfsInputParam *input)  // IN: Input params
+{
+   HgfsInternalStatus status;
+   HgfsHandle file;
+   HgfsLockType replyLock;
+   ServerLockData lockData;
+   void *fileCtx;
+
+   HGFS_ASSERT_INPUT(input);
+
+   if (HgfsUnpackOplockBreakAckReply(input->payload, input->payloadSize,
+                                     input->op, &file, &replyLock)) {
+      memset(&lockData, 0, sizeof lockData);
+      lockData.session = input->session;
+
+      /*
+       * Do not reopen the file if it is no longer cached: the open would wait
+       * for the break being acknowledged. Closing it released the lock anyway.
+       */
+      if (   HgfsIsCached(file, input->session)
+          && HgfsHandle2FileDesc(file, input->session, &lockData.fileDesc,
+                                 &fileCtx)) {
+         HgfsAckOplockBreak(&lockData, replyLock);
+         status = HGFS_ERROR_SUCCESS;
+      } else {
+         LOG(4, "%s: Could not get file descriptor\n", __FUNCTION__);
+         status = HGFS_ERROR_INVALID_HANDLE;
+      }
+   } else {
+      status = HGFS_ERROR_PROTOCOL;
+   }
+
+   HgfsServerCompleteRequest(status, 0, input);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -8406,6 +9455,274 @@ HgfsServerRemoveDirNotifyWatch(HgfsInputParam *input)  // IN: Input params
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerCompoundReplyCapacity --
+ *
+ *    Find the largest reply the transport can carry for a request.
+ *
+ * Results:
+ *    Size of the largest reply, header included, bounded by the packet size
+ *    negotiated for the session.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static size_t
+HgfsServerCompoundReplyCapacity(HgfsInputParam *input)  // IN: Input params
+{
+   size_t capacity;
+
+   if (input->packet->replyPacket != NULL) {
+      /* Pre-allocated reply buffer (as used by the backdoor). */
+      capacity = input->packet->replyPacketSize;
+   } else if (input->transportSession->channelCbTable->getWriteVa != NULL) {
+      /* No reply buffer (as used by the VMCI) reuse the metapacket buffer. */
+      capacity = input->packet->metaPacketSize;
+   } else {
+      /* No reply buffer but we will allocate the size required. */
+      capacity = HGFS_LARGE_PACKET_MAX;
+   }
+
+   /* The client cannot receive more than the packet size it negotiated. */
+   return MIN(capacity, input->session->maxPacketSize);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerCompoundEntry --
+ *
+ *    Process one sub-request of a compound request and pack its reply entry.
+ *
+ *    The sub-request is run by the regular handler of its operation, on a
+ *    private packet holding a copy of the compound header and the sub-request
+ *    arguments. The reply buffer of that packet is sized to what is left of
+ *    the compound reply, so that handlers validate their reply against it, and
+ *    the reply is collected from it instead of being sent.
+ *
+ * Results:
+ *    TRUE if the sub-request was processed and its reply entry packed, FALSE
+ *    if there is no room left in the compound reply.
+ *
+ * Side effects:
+ *    The handle returned by a successful open is recorded in openHandle.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsServerCompoundEntry(HgfsInputParam *input,     // IN: compound input params
+                        uint32 index,              // IN: sub-request index
+                        HgfsOp op,                 // IN: sub-request operation
+                        uint32 flags,              // IN: sub-request flags
+                        const void *args,          // IN: sub-request arguments
+                        size_t argsSize,           // IN: size of the arguments
+                        HgfsHandle *openHandle,    // IN/OUT: last opened handle
+                        void *replyEntry,          // OUT: packed reply entry
+                        size_t replyEntryMaxSize,  // IN: room for the reply entry
+                        size_t *replyEntrySize,    // OUT: size of the reply entry
+                        HgfsStatus *entryStatus)   // OUT: sub-request status
+{
+   HgfsPacket *subPacket;
+   HgfsHeader *subRequest;
+   const HgfsHeader *subReply;
+   HgfsInputParam *subInput;
+   size_t subRequestSize = sizeof *subRequest + argsSize;
+   const void *replyArgs = NULL;
+   size_t replyArgsSize = 0;
+   HgfsStatus status;
+
+   if (replyEntryMaxSize < sizeof (HgfsCompoundReplyEntryV4)) {
+      return FALSE;
+   }
+
+   subRequest = Util_SafeMalloc(subRequestSize);
+   *subRequest = *(const HgfsHeader *)input->request;
+   subRequest->op = op;
+   subRequest->packetSize = subRequestSize;
+   memcpy(subRequest + 1, args, argsSize);
+
+   subPacket = NULL;
+   if (   (flags & HGFS_COMPOUND_ENTRY_USE_OPEN_HANDLE) != 0
+       && (   *openHandle == HGFS_INVALID_HANDLE
+           || !HgfsPackCompoundEntryHandle(op, *openHandle, argsSize,
+                                           subRequest + 1))) {
+      status = HgfsConvertFromInternalStatus(HGFS_ERROR_INVALID_HANDLE);
+   } else if (subRequestSize < handlers[op].minReqSize) {
+      status = HgfsConvertFromInternalStatus(HGFS_ERROR_PROTOCOL);
+   } else {
+      subPacket = Util_SafeCalloc(1, sizeof *subPacket);
+      subPacket->metaPacket = subRequest;
+      subPacket->metaPacketSize = subRequestSize;
+      subPacket->metaPacketDataSize = subRequestSize;
+      subPacket->replyPacketSize = sizeof *subReply + replyEntryMaxSize -
+                                   sizeof (HgfsCompoundReplyEntryV4);
+      subPacket->replyPacket = Util_SafeMalloc(subPacket->replyPacketSize);
+
+      HgfsServerSessionGet(input->session);
+      HgfsServerTransportSessionGet(input->transportSession);
+      HgfsServerInputAllocInit(subPacket,
+                               input->transportSession,
+                               input->session,
+                               subRequest,
+                               subRequestSize,
+                               TRUE,
+                               input->id,
+                               op,
+                               argsSize,
+                               subRequest + 1,
+                               &subInput);
+      subInput->compoundEntry = TRUE;
+
+      /* Completes the sub-request, releasing subInput. */
+      (*handlers[op].handler)(subInput);
+
+      subReply = subPacket->replyPacket;
+      ASSERT(subPacket->replyPacketDataSize >= sizeof *subReply);
+      status = subReply->status;
+      replyArgs = subReply + 1;
+      replyArgsSize = subPacket->replyPacketDataSize - sizeof *subReply;
+
+      if (   HGFS_OP_OPEN_V3 == op
+          && HGFS_STATUS_SUCCESS == status
+          && replyArgsSize >= sizeof (HgfsReplyOpenV3)) {
+         *openHandle = ((const HgfsReplyOpenV3 *)replyArgs)->file;
+      }
+   }
+
+   LOG(4, "%s: entry %u op %d status %u\n", __FUNCTION__, index, op, status);
+
+   *replyEntrySize = HgfsPackCompoundReplyEntry(op, index, status,
+                                                replyArgs, replyArgsSize,
+                                                replyEntryMaxSize, replyEntry);
+   ASSERT(*replyEntrySize != 0);
+   *entryStatus = status;
+
+   if (subPacket != NULL) {
+      free(subPacket->replyPacket);
+      free(subPacket);
+   }
+   free(subRequest);
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerCompound --
+ *
+ *    Handle a compound request: process its sub-requests in order and reply
+ *    with all their replies at once.
+ *
+ *    Processing stops at the first sub-request that fails, except for later
+ *    sub-requests flagged to always run, such as a close of a file the
+ *    compound opened.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerCompound(HgfsInputParam *input)  // IN: Input params
+{
+   HgfsInternalStatus status = HGFS_ERROR_SUCCESS;
+   size_t replyPayloadSize = 0;
+   uint32 numEntries;
+   const void *entries;
+   size_t entriesSize;
+   const void *entry;
+   size_t remainingSize;
+   HgfsOp op;
+   uint32 flags;
+   const void *args;
+   size_t argsSize;
+   char *replyEntries = NULL;
+   size_t replyEntriesMaxSize;
+   size_t replyEntriesSize = 0;
+   uint32 numReplyEntries = 0;
+   HgfsHandle openHandle = HGFS_INVALID_HANDLE;
+   Bool failed = FALSE;
+   uint32 i;
+
+   HGFS_ASSERT_INPUT(input);
+
+   if (!input->sessionEnabled ||
+       !HgfsUnpackCompoundRequest(input->payload, input->payloadSize, input->op,
+                                  &numEntries, &entries, &entriesSize)) {
+      status = HGFS_ERROR_PROTOCOL;
+      goto exit;
+   }
+
+   /* Validate all the entries before running any of them. */
+   for (i = 0, entry = entries, remainingSize = entriesSize; i < numEntries; i++) {
+      if (!HgfsUnpackCompoundEntry(&entry, &remainingSize, &op, &flags,
+                                   &args, &argsSize)) {
+         status = HGFS_ERROR_PROTOCOL;
+         goto exit;
+      }
+   }
+
+   replyEntriesMaxSize = HgfsServerCompoundReplyCapacity(input);
+   if (replyEntriesMaxSize < sizeof (HgfsHeader) + sizeof (HgfsReplyCompoundV4)) {
+      status = HGFS_ERROR_INVALID_PARAMETER;
+      goto exit;
+   }
+   replyEntriesMaxSize -= sizeof (HgfsHeader) + sizeof (HgfsReplyCompoundV4);
+   replyEntries = Util_SafeMalloc(replyEntriesMaxSize);
+
+   for (i = 0, entry = entries, remainingSize = entriesSize; i < numEntries; i++) {
+      HgfsStatus entryStatus;
+      size_t replyEntrySize;
+
+      HgfsUnpackCompoundEntry(&entry, &remainingSize, &op, &flags, &args,
+                              &argsSize);
+
+      if (failed && (flags & HGFS_COMPOUND_ENTRY_ALWAYS) == 0) {
+         continue;
+      }
+
+      if (!HgfsServerCompoundEntry(input, i, op, flags, args, argsSize,
+                                   &openHandle,
+                                   replyEntries + replyEntriesSize,
+                                   replyEntriesMaxSize - replyEntriesSize,
+                                   &replyEntrySize, &entryStatus)) {
+         LOG(4, "%s: no room to reply to entry %u\n", __FUNCTION__, i);
+         failed = TRUE;
+         continue;
+      }
+
+      numReplyEntries++;
+      replyEntriesSize += replyEntrySize;
+      if (HGFS_STATUS_SUCCESS != entryStatus) {
+         failed = TRUE;
+      }
+   }
+
+   if (!HgfsPackCompoundReply(input->packet, input->request, input->op,
+                              numReplyEntries, replyEntries, replyEntriesSize,
+                              &replyPayloadSize, input->session)) {
+      status = HGFS_ERROR_INTERNAL;
+   }
+
+exit:
+   free(replyEntries);
+   HgfsServerCompleteRequest(status, replyPayloadSize, input);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -8442,6 +9759,7 @@ HgfsServerGetattr(HgfsInputParam *input)  // IN: Input params
    size_t replyPayloadSize = 0;
    HgfsSessionInfo *session;
    HgfsFileAttrCacheEntry *entry;
+   HgfsFileAttrCacheEntry cachedEntry;
 
    HGFS_ASSERT_INPUT(input);
 
@@ -8459,9 +9777,9 @@ HgfsServerGetattr(HgfsInputParam *input)  // IN: Input params
          found = HgfsGetNodeCopy(file, session, TRUE, &node);
 
          if (found && NULL != session->fileAttrCache &&
-             HgfsCache_Get(session->fileAttrCache, node.utf8Name,
-                           (void **)&entry)) {
-            attr = entry->attr;
+             HgfsCache_GetCopy(session->fileAttrCache, node.utf8Name,
+                               &cachedEntry, sizeof cachedEntry)) {
+            attr = cachedEntry.attr;
             status = HGFS_ERROR_SUCCESS;
          } else {
             targetNameLen = 0;
@@ -8514,9 +9832,9 @@ HgfsServerGetattr(HgfsInputParam *input)  // IN: Input params
             ASSERT(localName);
 
             if (NULL != session->fileAttrCache &&
-                HgfsCache_Get(session->fileAttrCache, localName,
-                              (void **)&entry)) {
-               attr = entry->attr;
+                HgfsCache_GetCopy(session->fileAttrCache, localName,
+                                  &cachedEntry, sizeof cachedEntry)) {
+               attr = cachedEntry.attr;
                status = HGFS_ERROR_SUCCESS;
             } else {
                /* Get the config options. */
@@ -9343,6 +10661,7 @@ HgfsServerSearchRead(HgfsInputParam *input)  // IN: Input params
                }
             }
 
+            HgfsPlatformScandirClose(&search);
             free(search.utf8Dir);
             free(search.utf8ShareName);
 
@@ -9683,6 +11002,73 @@ exit:
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerOplockBreakSend --
+ *
+ *    Build an oplock break request for the file and queue it to be sent to
+ *    the client. The client acknowledges it with HGFS_OP_OPLOCK_BREAK_V4,
+ *    see HgfsServerOplockBreakAck.
+ *
+ * Results:
+ *    TRUE if the request was sent, FALSE otherwise.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsServerOplockBreakSend(HgfsSessionInfo *session,  // IN: session info
+                          HgfsHandle file,           // IN: file to break
+                          HgfsLockType newLock)      // IN: lock to break to
+{
+   HgfsPacket *packet;
+   HgfsHeader *packetHeader;
+   size_t sizeNeeded;
+
+   LOG(4, "%s: Entered hnd %u lock %d\n", __FUNCTION__, file, newLock);
+
+   if (session->state == HGFS_SESSION_STATE_CLOSED) {
+      LOG(4, "%s: session has been closed drop the break %"FMT64"x\n",
+          __FUNCTION__, session->sessionId);
+      return FALSE;
+   }
+
+   sizeNeeded = HgfsPackGetOplockBreakSize();
+
+   /*
+    * As for the notifications, the packet and metapacket share a single
+    * buffer released at the send complete callback.
+    */
+   packet = Util_SafeCalloc(1, sizeof *packet + sizeNeeded);
+   packetHeader = (HgfsHeader *)((char *)packet + sizeof *packet);
+   packet->metaPacketSize = sizeNeeded;
+   packet->metaPacketDataSize = packet->metaPacketSize;
+   packet->metaPacket = packetHeader;
+
+   if (!HgfsPackOplockBreakRequest(packetHeader, file, newLock,
+                                   session->sessionId, &sizeNeeded)) {
+      LOG(4, "%s: failed to pack oplock break request\n", __FUNCTION__);
+      free(packet);
+      return FALSE;
+   }
+
+   if (!HgfsPacketSend(packet,
+                       session->transportSession,
+                       session,
+                       0)) {
+      LOG(4, "%s: failed to send oplock break to the client\n", __FUNCTION__);
+      free(packet);
+      return FALSE;
+   }
+
+   return TRUE;
+}
+
+
 /*
  * more testing
  */
@@ -174,6 +174,37 @@ typedef struct HgfsShareInfo {
    HgfsSharedFolderHandle handle;
 } HgfsShareInfo;
 
+/*
+ * Read access pattern of a file node, tracked to drive host readahead for
+ * clients streaming through a file.
+ */
+typedef struct HgfsReadPattern {
+   /* Offset following the previous read. */
+   uint64 nextOffset;
+
+   /* End of the range already advised to the host as needed soon. */
+   uint64 aheadEnd;
+
+   /* Number of consecutive reads continuing the previous one. */
+   uint32 sequentialReads;
+
+   /* Readahead window in bytes, zero while access is not sequential. */
+   uint32 window;
+} HgfsReadPattern;
+
+typedef enum {
+   HGFS_READ_AHEAD_NONE,    /* Nothing to do. */
+   HGFS_READ_AHEAD_START,   /* Access became sequential, start readahead. */
+   HGFS_READ_AHEAD_EXTEND,  /* Extend the readahead of a sequential stream. */
+   HGFS_READ_AHEAD_STOP,    /* Access turned random, back off. */
+} HgfsReadAheadAction;
+
+typedef struct HgfsReadAhead {
+   HgfsReadAheadAction action;
+   uint64 offset;           /* Range to read ahead for START and EXTEND. */
+   uint64 length;
+} HgfsReadAhead;
+
 /*
  * This struct represents a file on the local filesystem that has been
  * opened by a remote client. We store the name of the local file and
@@ -193,6 +224,9 @@ typedef struct HgfsFileNode {
    /* HGFS handle uniquely identifying this node. */
    HgfsHandle handle;
 
+   /* Index of the next node in the same handle index bucket. */
+   uint32 handleIndexNext;
+
    /* Local filename (in UTF8) */
    char *utf8Name;
 
@@ -226,6 +260,9 @@ typedef struct HgfsFileNode {
    /* File flags - see below. */
    uint32 flags;
 
+   /* Read access pattern for the host readahead. */
+   HgfsReadPattern readPattern;
+
    /*
     * Context as required by some file operations. Eg: BackupWrite on
     * Windows: BackupWrite requires the caller to hold on to a pointer
@@ -283,6 +320,20 @@ typedef struct HgfsSearch {
    /* Number of dents */
    uint32 numDents;
 
+   /*
+    * Streaming searches (HGFS_SEARCH_FLAG_STREAMING) keep the directory open
+    * and hold only a window of its entries: dents holds the entries from
+    * index dentsBase on, and further entries are read from dirFd as the
+    * client reads on.
+    */
+   fileDesc dirFd;
+
+   /* Index of the entry held in dents[0]. */
+   uint32 dentsBase;
+
+   /* Last use of dirFd, in searchDirUseClock ticks of the session. */
+   uint32 dirLastUse;
+
    /*
     * What type of search is this (what objects does it track)? This is
     * important to know so we can do the right kind of stat operation later
@@ -298,6 +349,12 @@ typedef struct HgfsSearch {
 
 /* TRUE if opened in append mode */
 #define HGFS_SEARCH_FLAG_READ_ALL_ENTRIES      (1 << 0)
+/* The entries are read from the open directory as the client reads on. */
+#define HGFS_SEARCH_FLAG_STREAMING             (1 << 1)
+/* A streaming search has read the last entry of the directory. */
+#define HGFS_SEARCH_FLAG_STREAM_EOF            (1 << 2)
+/* A streaming search follows symlinks when it reopens its directory. */
+#define HGFS_SEARCH_FLAG_FOLLOW_SYMLINKS       (1 << 3)
 
 /* HgfsSessionInfo flags. */
 typedef enum {
@@ -318,6 +375,18 @@ typedef struct HgfsAsyncRequestInfo {
    MXUserCondVar  *requestCountIsZero;
 } HgfsAsyncRequestInfo;
 
+/*
+ * Counters of one operation, see HgfsServerOpStats. Updated by concurrent
+ * requests hence atomic.
+ */
+typedef struct HgfsOpStats {
+   Atomic_uint64 count;
+   Atomic_uint64 errors;
+   Atomic_uint64 bytes;
+   Atomic_uint64 totalUsecs;
+   Atomic_uint64 latency[HGFS_SERVER_LATENCY_BUCKETS];
+} HgfsOpStats;
+
 typedef struct HgfsSessionInfo {
 
    DblLnkLst_Links links;
@@ -349,10 +418,11 @@ typedef struct HgfsSessionInfo {
    /*
     ** START NODE ARRAY **************************************************
     *
-    * Lock for the following 6 fields: the node array,
-    * counters and lists for this session.
+    * Lock for the following 8 fields: the node array, its handle
+    * index, counters and lists for this session. Lookups that leave the
+    * nodes and the lists unchanged take it for read and run concurrently.
     */
-   MXUserExclLock *nodeArrayLock;
+   MXUserRWLock *nodeArrayLock;
 
    /* Open file nodes of this session. */
    HgfsFileNode *nodeArray;
@@ -360,6 +430,15 @@ typedef struct HgfsSessionInfo {
    /* Number of nodes in the nodeArray. */
    uint32 numNodes;
 
+   /*
+    * Handle index: buckets of nodeArray indices chained through
+    * HgfsFileNode.handleIndexNext, so lookups by handle are O(1).
+    */
+   uint32 *nodeHandleIndex;
+
+   /* Number of buckets in the handle index (always a power of 2). */
+   uint32 numNodeHandleBuckets;
+
    /* Free list of file nodes. LIFO to be cache-friendly. */
    DblLnkLst_Links nodeFreeList;
 
@@ -377,9 +456,10 @@ typedef struct HgfsSessionInfo {
     ** START SEARCH ARRAY ************************************************
     *
     * Lock for the following three fields: for the search array
-    * and it's counter and list, for this session.
+    * and it's counter and list, for this session. Taken for read by
+    * lookups that leave the searches unchanged.
     */
-   MXUserExclLock *searchArrayLock;
+   MXUserRWLock *searchArrayLock;
 
    /* Directory entry cache for this session. */
    HgfsSearch *searchArray;
@@ -389,6 +469,9 @@ typedef struct HgfsSessionInfo {
 
    /* Free list of searches. LIFO. */
    DblLnkLst_Links searchFreeList;
+
+   /* Clock ordering the uses of the directories open by streaming searches. */
+   uint32 searchDirUseClock;
    /** END SEARCH ARRAY ****************************************************/
 
    /* Array of session specific capabiities. */
@@ -396,6 +479,9 @@ typedef struct HgfsSessionInfo {
 
    uint32 numberOfCapabilities;
 
+   /* Per operation counters of this session. */
+   HgfsOpStats opStats[HGFS_OP_MAX];
+
    /* Asynchronous request handling. */
    HgfsAsyncRequestInfo asyncRequestsInfo;
 
@@ -658,6 +744,17 @@ HgfsIsCached(HgfsHandle handle,         // IN: Hgfs handle of the node
 Bool
 HgfsIsServerLockAllowed(HgfsSessionInfo *session);  // IN: session info
 
+void
+HgfsServerSessionGet(HgfsSessionInfo *session);     // IN: session info
+
+void
+HgfsServerSessionPut(HgfsSessionInfo *session);     // IN: session info
+
+Bool
+HgfsServerOplockBreakSend(HgfsSessionInfo *session, // IN: session info
+                          HgfsHandle file,          // IN: file to break
+                          HgfsLockType newLock);    // IN: lock to break to
+
 Bool
 HgfsHandle2FileDesc(HgfsHandle handle,        // IN: Hgfs file handle
                     HgfsSessionInfo *session, // IN: session info
@@ -724,6 +821,13 @@ HgfsHandleIsSequentialOpen(HgfsHandle handle,        // IN:  Hgfs file handle
                            HgfsSessionInfo *session, // IN: session info
                            Bool *sequentialOpen);    // OUT: If open was sequential
 
+Bool
+HgfsHandleTrackRead(HgfsHandle handle,        // IN: Hgfs file handle
+                    HgfsSessionInfo *session, // IN: session info
+                    uint64 offset,            // IN: offset of the read
+                    uint32 size,              // IN: bytes read
+                    HgfsReadAhead *readAhead);// OUT: readahead to issue
+
 Bool
 HgfsHandleIsSharedFolderOpen(HgfsHandle handle,        // IN:  Hgfs file handle
                              HgfsSessionInfo *session, // IN: session info
@@ -756,6 +860,10 @@ HgfsInternalStatus
 HgfsPlatformCloseFile(fileDesc fileDesc,            // IN: OS handle of the file
                       void *fileCtx);               // IN: file context
 Bool
+HgfsPlatformParkFile(fileDesc fileDesc,            // IN: OS handle of the file
+                     const char *localName,        // IN: local name of the file
+                     uint32 mode);                 // IN: access mode of the file
+Bool
 HgfsPlatformDoFilenameLookup(void);
 HgfsNameStatus
 HgfsPlatformFilenameLookup(const char *sharePath,             // IN: share path in question
@@ -803,6 +911,17 @@ HgfsPlatformScandir(char const *baseDir,             // IN: Directory to search
                     struct DirectoryEntry ***dents,  // OUT: Array of DirectoryEntrys
                     int *numDents);                  // OUT: Number of DirectoryEntrys
 HgfsInternalStatus
+HgfsPlatformScandirOpen(char const *baseDir,             // IN: Directory to search in
+                        size_t baseDirLen,               // IN: Length of directory
+                        Bool followSymlinks,             // IN: followSymlinks config option
+                        HgfsSessionInfo *session,        // IN: Session info
+                        HgfsSearch *search);             // IN/OUT: search to set up
+void
+HgfsPlatformScandirClose(HgfsSearch *search);            // IN/OUT: search
+void
+HgfsPlatformScandirCopy(HgfsSearch const *search,        // IN: search
+                        HgfsSearch *copy);               // OUT: copy of the search
+HgfsInternalStatus
 HgfsPlatformScanvdir(HgfsServerResEnumGetFunc enumNamesGet,   // IN: Function to get name
                      HgfsServerResEnumInitFunc enumNamesInit, // IN: Setup function
                      HgfsServerResEnumExitFunc enumNamesExit, // IN: Cleanup function
@@ -836,6 +955,17 @@ HgfsPlatformReadFile(fileDesc readFile,           // IN: file descriptor
                      void* payload,               // OUT: buffer for the read data
                      uint32 *actualSize);         // OUT: actual length read
 HgfsInternalStatus
+HgfsPlatformReadFileIov(fileDesc readFile,           // IN: file descriptor
+                        HgfsSessionInfo *session,    // IN: session info
+                        uint64 offset,               // IN: file offset to read from
+                        uint32 requiredSize,         // IN: length of data to read
+                        HgfsVmxIov *iov,             // IN: mapped buffers for the data
+                        uint32 iovCount,             // IN: number of mapped buffers
+                        uint32 *actualSize);         // OUT: actual length read
+void
+HgfsPlatformReadAhead(fileDesc readFile,              // IN: file descriptor
+                      const HgfsReadAhead *readAhead);// IN: readahead to issue
+HgfsInternalStatus
 HgfsPlatformWriteFile(fileDesc writeFile,          // IN: file descriptor
                       HgfsSessionInfo *session,    // IN: session info
                       uint64 writeOffset,          // IN: file offset to write to
@@ -881,6 +1011,21 @@ HgfsPlatformRename(char *localSrcName,     // IN: local path to source file
                    fileDesc targetFile,    // IN: target file handle
                    HgfsRenameHint hints);  // IN: rename hints
 HgfsInternalStatus
+HgfsPlatformCopyFile(char *localSrcName,      // IN: local path to source file
+                     char *localTargetName,   // IN: local path to target file
+                     HgfsCopyFileHint hints,  // IN: copy hints
+                     uint64 *bytesCopied);    // OUT: size of the copied data
+HgfsInternalStatus
+HgfsPlatformSeekExtent(fileDesc file,              // IN: file descriptor
+                       HgfsSeekExtentType type,    // IN: data or hole
+                       uint64 offset,              // IN: offset to look from
+                       uint64 *extentOffset);      // OUT: extent found or NONE
+HgfsInternalStatus
+HgfsPlatformAllocate(fileDesc file,                // IN: file descriptor
+                     HgfsAllocateFlags flags,      // IN: allocate flags
+                     uint64 offset,                // IN: range start
+                     uint64 length);               // IN: range length
+HgfsInternalStatus
 HgfsPlatformCreateDir(HgfsCreateDirInfo *info,  // IN: direcotry properties
                       char *utf8Name);          // IN: full path for the new directory
 HgfsInternalStatus
@@ -935,6 +1080,12 @@ HSPU_GetDataPacketBuf(HgfsPacket *packet,                   // IN/OUT: Hgfs Pack
                       MappingType mappingType,              // IN: Readable/ Writeable ?
                       HgfsServerChannelCallbacks *chanCb);  // IN: Channel callbacks
 
+HgfsVmxIov *
+HSPU_GetDataPacketIov(HgfsPacket *packet,                   // IN/OUT: Hgfs Packet
+                      MappingType mappingType,              // IN: Readable/ Writeable ?
+                      HgfsServerChannelCallbacks *chanCb,   // IN: Channel callbacks
+                      uint32 *iovCount);                    // OUT: mapped iov count
+
 void
 HSPU_SetDataPacketSize(HgfsPacket *packet,            // IN/OUT: Hgfs Packet
                        size_t dataSize);              // IN: data size
@@ -969,4 +1120,14 @@ HSPU_GetReplyPacket(HgfsPacket *packet,                  // IN/OUT: Hgfs Packet
 void
 HSPU_PutReplyPacket(HgfsPacket *packet,                  // IN/OUT: Hgfs Packet
                     HgfsServerChannelCallbacks *chanCb); // IN: Channel callbacks
+
+void
+HSPU_InitReplyPools(void);
+
+void
+HSPU_ExitReplyPools(void);
+
+Bool
+HSPU_GetReplyPoolStats(uint32 index,                     // IN: reply pool
+                       HgfsServerPoolStats *stats);      // OUT: pool counters
 #endif /* __HGFS_SERVER_INT_H__ */
@@ -44,6 +44,9 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <sys/resource.h> // for getrlimit
+#include <sys/uio.h>      // for readv/preadv
+#include <limits.h>       // for IOV_MAX
+#include <sys/ioctl.h>    // for FICLONE
 
 #if defined(__FreeBSD__)
 #   include <sys/param.h>
@@ -56,6 +59,8 @@
 #include "hgfsServerPolicy.h" // for security policy
 #include "hgfsServerInt.h"
 #include "hgfsServerOplock.h"
+#include "hgfsCache.h"
+#include "hashTable.h"
 #include "hgfsEscape.h"
 #include "err.h"
 #include "str.h"
@@ -67,13 +72,27 @@
 #include "su.h"
 #include "codeset.h"
 #include "unicodeOperations.h"
+#include "unicodeTransforms.h"
 #include "userlock.h"
+#include "mutexRankLib.h"
 
 #if defined(__linux__) && !defined(SYS_getdents64)
 /* For DT_UNKNOWN */
 #   include <dirent.h>
 #endif
 
+#if defined(__linux__) && !defined(FICLONE)
+/* From linux/fs.h, which conflicts with the libc headers on older guests. */
+#   define FICLONE _IOW(0x94, 9, int)
+#endif
+
+#if defined(__linux__) && !defined(FALLOC_FL_PUNCH_HOLE)
+#   include <linux/falloc.h>
+#endif
+
+/* Buffer size for copying file data when the kernel cannot do it for us. */
+#define HGFS_COPY_FILE_BUFFER_SIZE (256 * 1024)
+
 #ifndef VMX86_TOOLS
 #   include "config.h"
 #endif
@@ -314,10 +333,92 @@ static const int HgfsServerOpenMode[] = {
    O_RDWR,
 };
 
+/*
+ * Identity of a directory, used to validate the case index cache below: the
+ * contents of a directory changed if its modification time did, and it
+ * was renamed if its attribute change time did.
+ */
+typedef struct HgfsDirIdentity {
+   dev_t dev;
+   ino_t ino;
+   uint64 writeTime;
+   uint64 attrChangeTime;
+} HgfsDirIdentity;
+
+/*
+ * Cache of case folded directory indexes for the case insensitive lookups.
+ *
+ * An index maps the case folded names of a directory to the actual names,
+ * so a lookup is a hash table hit instead of a scan of the directory. It
+ * is valid while the identity of the directory is unchanged. Indexes of
+ * directories modified too recently to be told apart from a later
+ * modification by their timestamps are not cached.
+ */
+#define HGFS_CASE_INDEX_MAX_DIRS       64
+#define HGFS_CASE_INDEX_MAX_BYTES      (4 * 1024 * 1024)
+#define HGFS_CASE_INDEX_RACY_WINDOW    (2 * 10000000ULL) /* 2s, NT time. */
+
+/*
+ * Directories kept open by the streaming searches of a session. Past this,
+ * the least recently used search closes its directory and reopens it when
+ * it is read again.
+ */
+#define HGFS_SEARCH_MAX_OPEN_DIRS      64
+
+/*
+ * Guest buffers described on the stack by a vectored read before falling back
+ * to an allocated iovec array (a 64KB read over 4KB pages needs 16 or 17).
+ */
+#define HGFS_READ_IOV_LOCAL            32
+#ifndef IOV_MAX
+#define IOV_MAX                        1024
+#endif
+
+typedef struct HgfsCaseIndex {
+   HgfsDirIdentity dir;
+   HashTable *names;          /* Folded name -> actual name. */
+} HgfsCaseIndex;
+
+static HgfsCache *gHgfsCaseIndexCache = NULL;
+static MXUserExclLock *gHgfsCaseIndexLock = NULL;
+
+/*
+ * Cache of the descriptors of closed read only files, by local name.
+ *
+ * Opening a file costs an open(2) and an fstat(2), closing it a close(2).
+ * The descriptor of a node opened read only, without a server lock, is
+ * parked here when the node is closed or leaves the node cache. A later
+ * read only open of the same name takes it back if a stat(2) of the name
+ * still finds the same file with the same attribute change time: the file
+ * and its permissions are unchanged, so the checks of open(2) still hold.
+ */
+#define HGFS_FD_CACHE_MAX_FDS          32
+
+typedef struct HgfsParkedFd {
+   fileDesc fd;
+   dev_t dev;
+   ino_t ino;
+   uint64 attrChangeTime;
+} HgfsParkedFd;
+
+static HgfsCache *gHgfsFdCache = NULL;
+static MXUserExclLock *gHgfsFdCacheLock = NULL;
+
 /* Local functions. */
 static HgfsInternalStatus HgfsGetattrResolveAlias(char const *fileName,
                                                   char **targetName);
 
+static Bool HgfsGetDirIdentity(const char *dirName,
+                               HgfsDirIdentity *identity);
+static Bool HgfsDirIdentityEqual(const HgfsDirIdentity *a,
+                                 const HgfsDirIdentity *b);
+static void HgfsCaseIndexFree(void *data);
+static void HgfsFdCacheClose(void *data);
+static fileDesc HgfsFdCacheTake(const char *localName,
+                                Bool followSymlinks,
+                                struct stat *fileStat);
+static void HgfsFdCacheDrop(const char *localName);
+
 static void HgfsStatToFileAttr(struct stat *stats,
                                uint64 *creationTime,
                                HgfsFileAttrInfo *attr);
@@ -556,6 +657,21 @@ HgfsServerGetOpenFlags(HgfsOpenFlags flagsIn, // IN
 Bool
 HgfsPlatformInit(void)
 {
+   gHgfsCaseIndexCache = HgfsCache_Alloc(HgfsCaseIndexFree);
+   if (gHgfsCaseIndexCache != NULL) {
+      HgfsCache_SetLimits(gHgfsCaseIndexCache, HGFS_CASE_INDEX_MAX_DIRS,
+                          HGFS_CASE_INDEX_MAX_BYTES);
+      gHgfsCaseIndexLock = MXUser_CreateExclLock("HgfsCaseIndexLock",
+                                                 RANK_hgfsCaseIndexLock);
+   }
+
+   gHgfsFdCache = HgfsCache_Alloc(HgfsFdCacheClose);
+   if (gHgfsFdCache != NULL) {
+      HgfsCache_SetLimits(gHgfsFdCache, HGFS_FD_CACHE_MAX_FDS,
+                          HGFS_CACHE_MAX_BYTES);
+      gHgfsFdCacheLock = MXUser_CreateExclLock("HgfsFdCacheLock",
+                                               RANK_hgfsFdCacheLock);
+   }
    return TRUE;
 }
 
@@ -579,6 +695,15 @@ HgfsPlatformInit(void)
 void
 HgfsPlatformDestroy(void)
 {
+   HgfsCache_Destroy(gHgfsCaseIndexCache);
+   gHgfsCaseIndexCache = NULL;
+   MXUser_DestroyExclLock(gHgfsCaseIndexLock);
+   gHgfsCaseIndexLock = NULL;
+
+   HgfsCache_Destroy(gHgfsFdCache);
+   gHgfsFdCache = NULL;
+   MXUser_DestroyExclLock(gHgfsFdCacheLock);
+   gHgfsFdCacheLock = NULL;
 }
 
 
@@ -655,6 +780,9 @@ HgfsInternalStatus
 HgfsPlatformCloseFile(fileDesc fileDesc, // IN: File descriptor
                       void *fileCtx)     // IN: File context
 {
+   /* Closing the file releases its lease, if any: stop tracking it first. */
+   HgfsRemoveServerLock(fileDesc);
+
    if (close(fileDesc) != 0) {
       int error = errno;
 
@@ -667,6 +795,186 @@ HgfsPlatformCloseFile(fileDesc fileDesc, // IN: File descriptor
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformParkFile --
+ *
+ *    Keep the descriptor of a file being closed in the descriptor cache
+ *    instead of closing it, if it was opened read only and the file still
+ *    exists.
+ *
+ * Results:
+ *    TRUE if the descriptor is kept: it must not be closed.
+ *    FALSE otherwise: it must be closed with HgfsPlatformCloseFile.
+ *
+ * Side effects:
+ *    The descriptor parked for the same name before is closed.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsPlatformParkFile(fileDesc fileDesc,      // IN: File descriptor
+                     const char *localName,  // IN: Local name of the file
+                     uint32 mode)            // IN: Access mode it was opened in
+{
+   struct stat fileStat;
+   HgfsFileAttrInfo attr;
+   uint64 creationTime = 0;
+   HgfsParkedFd *parked;
+
+   if (gHgfsFdCache == NULL || (mode & O_ACCMODE) != O_RDONLY ||
+       fstat(fileDesc, &fileStat) != 0 ||
+       !S_ISREG(fileStat.st_mode) || fileStat.st_nlink == 0) {
+      return FALSE;
+   }
+
+   HgfsRemoveServerLock(fileDesc);
+
+   HgfsStatToFileAttr(&fileStat, &creationTime, &attr);
+   parked = Util_SafeMalloc(sizeof *parked);
+   parked->fd = fileDesc;
+   parked->dev = fileStat.st_dev;
+   parked->ino = fileStat.st_ino;
+   parked->attrChangeTime = attr.attrChangeTime;
+
+   MXUser_AcquireExclLock(gHgfsFdCacheLock);
+   HgfsCache_Put(gHgfsFdCache, localName, parked);
+   MXUser_ReleaseExclLock(gHgfsFdCacheLock);
+
+   LOG(4, "%s: parked fd %d of \"%s\"\n", __FUNCTION__, fileDesc, localName);
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsFdCacheClose --
+ *
+ *    Descriptor cache remove LRU callback: closes a parked descriptor.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsFdCacheClose(void *data)  // IN
+{
+   HgfsParkedFd *parked = data;
+
+   close(parked->fd);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsFdCacheTake --
+ *
+ *    Take the descriptor parked for a local name out of the descriptor
+ *    cache, if the name still refers to the same, unchanged, file.
+ *
+ * Results:
+ *    The descriptor, with the stat of the name in fileStat, or -1 if none
+ *    is parked or the parked one is stale.
+ *
+ * Side effects:
+ *    A stale descriptor is closed.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static fileDesc
+HgfsFdCacheTake(const char *localName,  // IN: Local name of the file
+                Bool followSymlinks,    // IN: Stat the target of a symlink
+                struct stat *fileStat)  // OUT: Stat of the name
+{
+   HgfsParkedFd parked;
+   HgfsFileAttrInfo attr;
+   uint64 creationTime = 0;
+   Bool found = FALSE;
+   int ret;
+
+   if (gHgfsFdCache == NULL) {
+      return -1;
+   }
+
+   MXUser_AcquireExclLock(gHgfsFdCacheLock);
+   if (HgfsCache_GetCopy(gHgfsFdCache, localName, &parked, sizeof parked)) {
+      /* Invalidating does not close the descriptor, which is ours now. */
+      HgfsCache_Invalidate(gHgfsFdCache, localName);
+      found = TRUE;
+   }
+   MXUser_ReleaseExclLock(gHgfsFdCacheLock);
+
+   if (!found) {
+      return -1;
+   }
+
+   ret = followSymlinks ? Posix_Stat(localName, fileStat) :
+                          Posix_Lstat(localName, fileStat);
+   if (ret == 0) {
+      HgfsStatToFileAttr(fileStat, &creationTime, &attr);
+      if (fileStat->st_dev == parked.dev && fileStat->st_ino == parked.ino &&
+          attr.attrChangeTime == parked.attrChangeTime) {
+         return parked.fd;
+      }
+   }
+
+   LOG(4, "%s: parked fd %d of \"%s\" is stale\n", __FUNCTION__, parked.fd,
+       localName);
+   close(parked.fd);
+   return -1;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsFdCacheDrop --
+ *
+ *    Close the descriptor parked for a local name which is deleted or
+ *    renamed, so that it does not keep the file around.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsFdCacheDrop(const char *localName)  // IN: Local name of the file
+{
+   HgfsParkedFd parked;
+   Bool found = FALSE;
+
+   if (gHgfsFdCache == NULL) {
+      return;
+   }
+
+   MXUser_AcquireExclLock(gHgfsFdCacheLock);
+   if (HgfsCache_GetCopy(gHgfsFdCache, localName, &parked, sizeof parked)) {
+      HgfsCache_Invalidate(gHgfsFdCache, localName);
+      found = TRUE;
+   }
+   MXUser_ReleaseExclLock(gHgfsFdCacheLock);
+
+   if (found) {
+      close(parked.fd);
+   }
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -810,8 +1118,26 @@ HgfsPlatformGetFd(HgfsHandle hgfsHandle,    // IN:  HGFS file handle
 
    /*
     * If we got here then the file was either not in the cache or needs
-    * reopening. This means we need to open a file. But first, verify
-    * that the file we intend to open isn't stale.
+    * reopening. A read only node can take back the descriptor it parked
+    * when it left the cache, if the file is unchanged.
+    */
+   if (!append && node.mode == O_RDONLY) {
+      struct stat nodeStat;
+
+      newFd = HgfsFdCacheTake(node.utf8Name, TRUE, &nodeStat);
+      if (newFd >= 0) {
+         if (nodeStat.st_dev == node.localId.volumeId &&
+             nodeStat.st_ino == node.localId.fileId) {
+            goto update;
+         }
+         close(newFd);
+         newFd = -1;
+      }
+   }
+
+   /*
+    * Otherwise we need to open a file. But first, verify that the file we
+    * intend to open isn't stale.
     */
    status = HgfsCheckFileNode(node.utf8Name, &node.localId);
    if (status != 0) {
@@ -842,6 +1168,7 @@ HgfsPlatformGetFd(HgfsHandle hgfsHandle,    // IN:  HGFS file handle
       goto exit;
    }
 
+  update:
    /*
     * Update the original node with the new value of the file desc.
     * This call might fail if the node is not used anymore.
@@ -1040,6 +1367,25 @@ HgfsPlatformValidateOpen(HgfsFileOpenInfo *openInfo, // IN: Open info struct
       }
    }
 
+   /*
+    * A plain read only open can reuse the descriptor parked for the file
+    * by an earlier close. Sequential opens read from the current offset
+    * of the descriptor, so they always get a new one.
+    */
+   fd = -1;
+   if (openMode == O_RDONLY &&
+       (openFlags & (O_APPEND | O_CREAT | O_TRUNC)) == 0 &&
+       (HGFS_OPEN_MODE_FLAGS(openInfo->mode) & HGFS_OPEN_SEQUENTIAL) == 0) {
+      fd = HgfsFdCacheTake(openInfo->utf8Name,
+                           (openFlags & O_NOFOLLOW) == 0,
+                           &fileStat);
+   }
+   if (fd >= 0) {
+      LOG(4, "%s: reusing fd %d of \"%s\"\n", __FUNCTION__, fd,
+          openInfo->utf8Name);
+      goto opened;
+   }
+
    /*
     * Try to open the file with the requested mode, flags and permissions.
     */
@@ -1070,6 +1416,7 @@ HgfsPlatformValidateOpen(HgfsFileOpenInfo *openInfo, // IN: Open info struct
       goto exit;
    }
 
+  opened:
    /* Set the rest of the Windows specific attributes if necessary. */
    if (needToSetAttribute) {
       HgfsSetHiddenXAttr(openInfo->utf8Name,
@@ -1405,80 +1752,77 @@ HgfsGetHiddenAttr(char const *fileName,         // IN:  Input filename
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsConvertComponentCase --
+ * HgfsCaseIndexFree --
  *
- *    Do a case insensitive search of a directory for the specified entry. If
- *    a matching entry is found, return it in the convertedComponent argument.
+ *    Remove LRU callback of the case index cache: free the name table of an
+ *    index. The cache frees the index itself.
  *
  * Results:
- *    On Success:
- *    Returns 0 and the converted component name in the argument convertedComponent.
- *    The length for the convertedComponent is returned in convertedComponentSize.
+ *    None.
  *
- *    On Failure:
- *    Non-zero errno return, with convertedComponent and convertedComponentSize
- *    set to NULL and 0 respectively.
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsCaseIndexFree(void *data)  // IN
+{
+   HgfsCaseIndex *index = data;
+
+   HashTable_Free(index->names);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCaseIndexBuild --
+ *
+ *    Read a directory and build the index of its entries by case folded
+ *    name. If several entries fold to the same name, the first one read
+ *    wins, as with a scan of the directory.
+ *
+ * Results:
+ *    0 on success with the index returned in index and its approximate
+ *    size in indexBytes, errno otherwise.
  *
  * Side effects:
- *    On success, allocated memory is returned in convertedComponent and needs
- *    to be freed.
+ *    None.
  *
  *-----------------------------------------------------------------------------
  */
 
 static int
-HgfsConvertComponentCase(char *currentComponent,           // IN
-                         const char *dirPath,              // IN
-                         const char **convertedComponent,  // OUT
-                         size_t *convertedComponentSize)   // OUT
+HgfsCaseIndexBuild(const char *dirPath,     // IN
+                   HgfsCaseIndex **index,   // OUT
+                   size_t *indexBytes)      // OUT
 {
    struct dirent *dirent;
-   DIR *dir = NULL;
-   char *dentryName;
-   size_t dentryNameLen;
-   char *myConvertedComponent = NULL;
-   size_t myConvertedComponentSize;
-   int ret;
-
-   ASSERT(currentComponent);
-   ASSERT(dirPath);
-   ASSERT(convertedComponent);
-   ASSERT(convertedComponentSize);
+   DIR *dir;
+   HashTable *names;
+   size_t bytes = sizeof **index;
+   uint32 numEntries = 0;
 
-   /* Open the specified directory. */
    dir = Posix_OpenDir(dirPath);
    if (!dir) {
-      ret = errno;
-      goto exit;
+      return errno;
    }
 
-   /*
-    * Unicode_CompareIgnoreCase crashes with invalid unicode strings,
-    * validate it before passing it to Unicode_* functions.
-    */
-   if (!Unicode_IsBufferValid(currentComponent, -1, STRING_ENCODING_UTF8)) {
-      /* Invalid unicode string, return failure. */
-      ret = EINVAL;
-      goto exit;
-   }
+   names = HashTable_Alloc(1024, HASH_STRING_KEY | HASH_FLAG_COPYKEY, free);
 
-   /*
-    * Read all of the directory entries. For each one, convert the name
-    * to lower case and then compare it to the lower case component.
-    */
    while ((dirent = readdir(dir))) {
+      char *dentryName = dirent->d_name;
+      size_t dentryNameLen = strlen(dentryName);
       char *dentryNameU;
-      int cmpResult;
-
-      dentryName = dirent->d_name;
-      dentryNameLen = strlen(dentryName);
+      char *foldedName;
+      char *name;
 
       /*
-       * Unicode_CompareIgnoreCase crashes with invalid unicode strings,
-       * validate and convert it appropriately before passing it to Unicode_*
-       * functions.
+       * Unicode_FoldCase crashes with invalid unicode strings, validate and
+       * convert it appropriately before passing it to Unicode_* functions.
        */
-
       if (!Unicode_IsBufferValid(dentryName, dentryNameLen,
                                  STRING_ENCODING_DEFAULT)) {
          /* Invalid unicode string, skip the entry. */
@@ -1486,104 +1830,254 @@ HgfsConvertComponentCase(char *currentComponent,           // IN
       }
 
       dentryNameU = Unicode_Alloc(dentryName, STRING_ENCODING_DEFAULT);
-
-      cmpResult = Unicode_CompareIgnoreCase(currentComponent, dentryNameU);
+      foldedName = Unicode_FoldCase(dentryNameU);
       free(dentryNameU);
 
-      if (cmpResult == 0) {
-         /*
-          * The current directory entry is a case insensitive match to
-          * the specified component. Malloc and copy the current directory entry.
-          */
-         myConvertedComponentSize = dentryNameLen + 1;
-         myConvertedComponent = malloc(myConvertedComponentSize);
-         if (myConvertedComponent == NULL) {
-            ret = errno;
-            LOG(4, "%s: failed to malloc myConvertedComponent.\n",
-                __FUNCTION__);
-            goto exit;
-         }
-         Str_Strcpy(myConvertedComponent, dentryName, myConvertedComponentSize);
-
-         /* Success. Cleanup and exit. */
-         ret = 0;
-         *convertedComponentSize = myConvertedComponentSize;
-         *convertedComponent = myConvertedComponent;
-         goto exit;
+      name = Util_SafeStrdup(dentryName);
+      if (HashTable_Insert(names, foldedName, name)) {
+         bytes += strlen(foldedName) + dentryNameLen + 2 + 4 * sizeof (void *);
+         numEntries++;
+      } else {
+         free(name);
       }
+      free(foldedName);
    }
+   closedir(dir);
 
-   /* We didn't find a match. Failure. */
-   ret = ENOENT;
+   LOG(4, "%s: indexed %u entries of %s\n", __FUNCTION__, numEntries, dirPath);
 
-exit:
-   if (dir) {
-      closedir(dir);
-   }
-   if (ret) {
-      *convertedComponent = NULL;
-      *convertedComponentSize = 0;
-   }
-   return ret;
+   *index = Util_SafeCalloc(1, sizeof **index);
+   (*index)->names = names;
+   *indexBytes = bytes;
+   return 0;
 }
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsConstructConvertedPath --
+ * HgfsCaseIndexLookup --
  *
- *    Expand the passed string and append the converted path.
+ *    Look up a case folded name in the index of a directory, building the
+ *    index if there is no valid one cached. The index built is cached if
+ *    the directory was not modified while it was read nor too recently to
+ *    detect a further modification.
  *
  * Results:
- *    Returns 0 if successful, errno on failure. Note that this
- *    function cannot return ENOENT.
+ *    0 if found, with the actual name returned in name, ENOENT if not
+ *    found, other errno on failure.
  *
  * Side effects:
- *    Reallocs the path.
+ *    On success, allocated memory is returned in name and needs to be
+ *    freed.
  *
  *-----------------------------------------------------------------------------
  */
 
 static int
-HgfsConstructConvertedPath(char **path,                 // IN/OUT
-                           size_t *pathSize,            // IN/OUT
-                           char *convertedPath,         // IN
-                           size_t convertedPathSize)    // IN
+HgfsCaseIndexLookup(const char *dirPath,     // IN
+                    const char *foldedName,  // IN
+                    char **name)             // OUT
 {
-   char *p;
-   size_t convertedPathLen = convertedPathSize - 1;
+   HgfsDirIdentity before;
+   HgfsDirIdentity after;
+   HgfsCaseIndex *index;
+   size_t indexBytes;
+   Bool haveIdentity;
+   Bool cacheable = FALSE;
+   char *match;
+   int ret;
 
-   ASSERT(path);
-   ASSERT(*path);
-   ASSERT(convertedPath);
-   ASSERT(pathSize);
+   haveIdentity = gHgfsCaseIndexCache != NULL &&
+                  HgfsGetDirIdentity(dirPath, &before);
 
-   p = realloc(*path, *pathSize + convertedPathLen + sizeof (DIRSEPC));
-   if (!p) {
-      int error = errno;
-      LOG(4, "%s: failed to realloc.\n", __FUNCTION__);
-      return error;
+   if (haveIdentity) {
+      Bool found = FALSE;
+
+      MXUser_AcquireExclLock(gHgfsCaseIndexLock);
+      if (HgfsCache_Get(gHgfsCaseIndexCache, dirPath, (void **)&index) &&
+          HgfsDirIdentityEqual(&index->dir, &before)) {
+         found = TRUE;
+         *name = HashTable_Lookup(index->names, foldedName, (void **)&match) ?
+                 Util_SafeStrdup(match) : NULL;
+      }
+      MXUser_ReleaseExclLock(gHgfsCaseIndexLock);
+
+      if (found) {
+         return *name != NULL ? 0 : ENOENT;
+      }
    }
 
-   *path = p;
-   *pathSize += convertedPathLen + sizeof (DIRSEPC);
+   ret = HgfsCaseIndexBuild(dirPath, &index, &indexBytes);
+   if (ret != 0) {
+      return ret;
+   }
 
-   /* Copy out the converted component to curDir, and free it. */
-   Str_Strncat(p, *pathSize, DIRSEPS, sizeof (DIRSEPS));
-   Str_Strncat(p, *pathSize, convertedPath, convertedPathLen);
-   return 0;
-}
+   *name = HashTable_Lookup(index->names, foldedName, (void **)&match) ?
+           Util_SafeStrdup(match) : NULL;
+   ret = *name != NULL ? 0 : ENOENT;
 
+   if (haveIdentity &&
+       HgfsGetDirIdentity(dirPath, &after) &&
+       HgfsDirIdentityEqual(&before, &after)) {
+      struct timeval tv;
 
-/*
- *-----------------------------------------------------------------------------
- *
- * HgfsCaseInsensitiveLookup --
- *
- *    Do a case insensitive lookup for fileName. Each component past sharePath is
- *    looked-up case-insensitively. Expensive!
- *
+      /*
+       * Timestamps have a limited granularity: a directory modified within
+       * the same tick as its last modification keeps its timestamps. Only
+       * cache the index once the directory has been quiet for a while.
+       */
+      if (gettimeofday(&tv, NULL) == 0) {
+         uint64 now = HgfsConvertToNtTime(tv.tv_sec, tv.tv_usec * 1000);
+
+         cacheable =
+            before.writeTime + HGFS_CASE_INDEX_RACY_WINDOW < now &&
+            before.attrChangeTime + HGFS_CASE_INDEX_RACY_WINDOW < now;
+      }
+   }
+
+   if (cacheable) {
+      index->dir = before;
+      MXUser_AcquireExclLock(gHgfsCaseIndexLock);
+      HgfsCache_PutSized(gHgfsCaseIndexCache, dirPath, index, indexBytes);
+      MXUser_ReleaseExclLock(gHgfsCaseIndexLock);
+   } else {
+      HgfsCaseIndexFree(index);
+      free(index);
+   }
+
+   return ret;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsConvertComponentCase --
+ *
+ *    Do a case insensitive search of a directory for the specified entry. If
+ *    a matching entry is found, return it in the convertedComponent argument.
+ *
+ *    The search uses the cached case folded index of the directory.
+ *
+ * Results:
+ *    On Success:
+ *    Returns 0 and the converted component name in the argument convertedComponent.
+ *    The length for the convertedComponent is returned in convertedComponentSize.
+ *
+ *    On Failure:
+ *    Non-zero errno return, with convertedComponent and convertedComponentSize
+ *    set to NULL and 0 respectively.
+ *
+ * Side effects:
+ *    On success, allocated memory is returned in convertedComponent and needs
+ *    to be freed.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+HgfsConvertComponentCase(char *currentComponent,           // IN
+                         const char *dirPath,              // IN
+                         const char **convertedComponent,  // OUT
+                         size_t *convertedComponentSize)   // OUT
+{
+   char *foldedComponent;
+   char *myConvertedComponent = NULL;
+   int ret;
+
+   ASSERT(currentComponent);
+   ASSERT(dirPath);
+   ASSERT(convertedComponent);
+   ASSERT(convertedComponentSize);
+
+   /*
+    * Unicode_FoldCase crashes with invalid unicode strings,
+    * validate it before passing it to Unicode_* functions.
+    */
+   if (!Unicode_IsBufferValid(currentComponent, -1, STRING_ENCODING_UTF8)) {
+      /* Invalid unicode string, return failure. */
+      ret = EINVAL;
+      goto exit;
+   }
+
+   /*
+    * The guest root share has an empty path, its first components are
+    * looked up in the root directory.
+    */
+   foldedComponent = Unicode_FoldCase(currentComponent);
+   ret = HgfsCaseIndexLookup(*dirPath == '\0' ? DIRSEPS : dirPath,
+                             foldedComponent, &myConvertedComponent);
+   free(foldedComponent);
+
+exit:
+   if (ret) {
+      *convertedComponent = NULL;
+      *convertedComponentSize = 0;
+   } else {
+      *convertedComponent = myConvertedComponent;
+      *convertedComponentSize = strlen(myConvertedComponent) + 1;
+   }
+   return ret;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsConstructConvertedPath --
+ *
+ *    Expand the passed string and append the converted path.
+ *
+ * Results:
+ *    Returns 0 if successful, errno on failure. Note that this
+ *    function cannot return ENOENT.
+ *
+ * Side effects:
+ *    Reallocs the path.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+HgfsConstructConvertedPath(char **path,                 // IN/OUT
+                           size_t *pathSize,            // IN/OUT
+                           char *convertedPath,         // IN
+                           size_t convertedPathSize)    // IN
+{
+   char *p;
+   size_t convertedPathLen = convertedPathSize - 1;
+
+   ASSERT(path);
+   ASSERT(*path);
+   ASSERT(convertedPath);
+   ASSERT(pathSize);
+
+   p = realloc(*path, *pathSize + convertedPathLen + sizeof (DIRSEPC));
+   if (!p) {
+      int error = errno;
+      LOG(4, "%s: failed to realloc.\n", __FUNCTION__);
+      return error;
+   }
+
+   *path = p;
+   *pathSize += convertedPathLen + sizeof (DIRSEPC);
+
+   /* Copy out the converted component to curDir, and free it. */
+   Str_Strncat(p, *pathSize, DIRSEPS, sizeof (DIRSEPS));
+   Str_Strncat(p, *pathSize, convertedPath, convertedPathLen);
+   return 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCaseInsensitiveLookup --
+ *
+ *    Do a case insensitive lookup for fileName. Each component past sharePath is
+ *    looked-up case-insensitively. Expensive!
+ *
  *    NOTE:
  *    shareName is always expected to be a prefix of fileName.
  *
@@ -2361,6 +2855,112 @@ exit:
    return status;
 }
 
+
+#if !defined(__APPLE__)
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsGetattrAt --
+ *
+ *    Directory search counterpart of HgfsPlatformGetattrFromName: gets the
+ *    attributes of an entry of the directory open as dirFd with fstatat and
+ *    the other *at calls, so the kernel resolves only the entry name rather
+ *    than walking the full path again for every entry returned. The full
+ *    name is only used for the hidden attribute, which is name based.
+ *    Symlink targets are not returned, search reads do not ask for them.
+ *
+ * Results:
+ *    Zero on success.
+ *    Non-zero on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsInternalStatus
+HgfsGetattrAt(int dirFd,                       // IN: directory searched
+              char const *entryName,           // IN: entry in the directory
+              char const *fileName,            // IN: full name of the entry
+              HgfsShareOptions configOptions,  // IN: Share config options
+              char *shareName,                 // IN: Share name
+              HgfsFileAttrInfo *attr)          // OUT: Struct to copy into
+{
+   struct stat stats;
+   uint64 creationTime;
+   Bool followSymlinks;
+   int openFlags;
+   int fd;
+
+   ASSERT(entryName);
+   ASSERT(fileName);
+   ASSERT(attr);
+
+   followSymlinks = HgfsServerPolicy_IsShareOptionSet(configOptions,
+                                                      HGFS_SHARE_FOLLOW_SYMLINKS);
+
+   if (fstatat(dirFd, entryName, &stats,
+               followSymlinks ? 0 : AT_SYMLINK_NOFOLLOW) < 0) {
+      HgfsInternalStatus status = errno;
+
+      LOG(4, "%s: error stating \"%s\": %s\n", __FUNCTION__, fileName,
+          Err_Errno2String(status));
+      return status;
+   }
+   creationTime = HgfsGetCreationTime(&stats);
+
+   if (S_ISDIR(stats.st_mode)) {
+      attr->type = HGFS_FILE_TYPE_DIRECTORY;
+   } else if (S_ISLNK(stats.st_mode)) {
+      attr->type = HGFS_FILE_TYPE_SYMLINK;
+   } else {
+      attr->type = HGFS_FILE_TYPE_REGULAR;
+   }
+
+   HgfsStatToFileAttr(&stats, &creationTime, attr);
+   HgfsGetHiddenAttr(fileName, attr);
+
+   /* As HgfsGetSequentialOnlyFlagFromName, but relative to the directory. */
+   HgfsServerGetOpenFlags(0, &openFlags);
+   if (followSymlinks) {
+      openFlags &= ~O_NOFOLLOW;
+   }
+   fd = openat(dirFd, entryName, openFlags | O_RDONLY);
+   if (fd >= 0) {
+      HgfsGetSequentialOnlyFlagFromFd(fd, attr);
+      close(fd);
+   } else {
+      LOG(4, "%s: Couldn't open the file \"%s\"\n", __FUNCTION__, fileName);
+   }
+
+   /* Get effective permissions if we can, as HgfsEffectivePermissions. */
+   if (!(S_ISLNK(stats.st_mode))) {
+      HgfsOpenMode shareMode;
+      HgfsNameStatus nameStatus;
+
+      nameStatus = HgfsServerPolicy_GetShareMode(shareName, strlen(shareName),
+                                                 &shareMode);
+      if (nameStatus == HGFS_NAME_STATUS_COMPLETE) {
+         attr->effectivePerms = 0;
+         if (faccessat(dirFd, entryName, R_OK, 0) == 0) {
+            attr->effectivePerms |= HGFS_PERM_READ;
+         }
+         if (faccessat(dirFd, entryName, X_OK, 0) == 0) {
+            attr->effectivePerms |= HGFS_PERM_EXEC;
+         }
+         if (shareMode != HGFS_OPEN_MODE_READ_ONLY &&
+             faccessat(dirFd, entryName, W_OK, 0) == 0) {
+            attr->effectivePerms |= HGFS_PERM_WRITE;
+         }
+         attr->mask |= HGFS_ATTR_VALID_EFFECTIVE_PERMS;
+      }
+   }
+
+   return 0;
+}
+#endif
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -3454,73 +4054,365 @@ HgfsConvertToUtf8FormC(char *buffer,         // IN/OUT: name to normalize
 }
 
 
+#if !defined(__APPLE__)
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsPlatformGetDirEntry --
+ * HgfsSearchLimitOpenDirs --
  *
- *    Returns the directory entry (or a copy) at the given index. If remove is set
- *    to TRUE, the existing result is also pruned and the remaining results
- *    are shifted up in the result array.
+ *    Makes room for one more directory open by a streaming search of the
+ *    session: if HGFS_SEARCH_MAX_OPEN_DIRS are open, the least recently used
+ *    one is closed. Its search keeps streaming and reopens the directory
+ *    when it is read again.
+ *    Note: this must be called with the session search lock acquired for
+ *    write.
  *
  * Results:
- *    HGFS_ERROR_SUCCESS or an appropriate error code.
+ *    None.
  *
  * Side effects:
- *    None.
+ *    May close the directory of another search.
  *
  *-----------------------------------------------------------------------------
  */
 
-HgfsInternalStatus
-HgfsPlatformGetDirEntry(HgfsSearch *search,               // IN: search
-                        HgfsSessionInfo *session,         // IN: Session info
-                        uint32 index,                     // IN: Offset to retrieve at
-                        Bool remove,                      // IN: If true, removes the result
-                        struct DirectoryEntry **dirEntry) // OUT: dirent
+static void
+HgfsSearchLimitOpenDirs(HgfsSessionInfo *session)   // IN: session info
 {
-   DirectoryEntry *dent = NULL;
-   HgfsInternalStatus status = HGFS_ERROR_SUCCESS;
+   HgfsSearch *lru = NULL;
+   uint32 numOpen = 0;
+   uint32 i;
 
-   if (index >= search->numDents) {
-      goto out;
-   }
-
-   /* If we're not removing the result, we need to make a copy of it. */
-   if (remove) {
-      /*
-       * We're going to shift the dents array, overwriting the dent pointer at
-       * offset, so first we need to save said pointer so that we can return it
-       * later to the caller.
-       */
-      dent = search->dents[index];
+   for (i = 0; i < session->numSearches; i++) {
+      HgfsSearch *search = &session->searchArray[i];
 
-      if (index < search->numDents - 1) {
-         /* Shift up the remaining results */
-         memmove(&search->dents[index], &search->dents[index + 1],
-                 (search->numDents - (index + 1)) * sizeof search->dents[0]);
+      if (DblLnkLst_IsLinked(&search->links) ||
+          (search->flags & HGFS_SEARCH_FLAG_STREAMING) == 0 ||
+          search->dirFd < 0) {
+         continue;
+      }
+      numOpen++;
+      if (lru == NULL ||
+          (int32)(search->dirLastUse - lru->dirLastUse) < 0) {
+         lru = search;
       }
+   }
 
-      /* Decrement the number of results */
-      search->numDents--;
-   } else {
-      DirectoryEntry *originalDent;
-      size_t nameLen;
+   if (numOpen < HGFS_SEARCH_MAX_OPEN_DIRS) {
+      return;
+   }
 
-      originalDent = search->dents[index];
-      ASSERT(originalDent);
+   LOG(4, "%s: closing \"%s\", %u directories open\n", __FUNCTION__,
+       lru->utf8Dir, numOpen);
+   if (close(lru->dirFd) < 0) {
+      LOG(4, "%s: error in close: %d (%s)\n", __FUNCTION__, errno,
+          Err_Errno2String(errno));
+   }
+   lru->dirFd = -1;
+}
 
-      nameLen = strlen(originalDent->d_name);
-      /*
-       * Make sure the name will not overrun the d_name buffer, the end of
-       * which is also the end of the DirectoryEntry.
-       */
-      ASSERT(offsetof(DirectoryEntry, d_name) + nameLen < originalDent->d_reclen);
 
-      dent = malloc(originalDent->d_reclen);
-      if (dent == NULL) {
-         status = HGFS_ERROR_NOT_ENOUGH_MEMORY;
-         goto out;
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsSearchOpenDir --
+ *
+ *    Opens the directory of a streaming search, within the limit of
+ *    directories open by the session.
+ *    Note: this must be called with the session search lock acquired for
+ *    write.
+ *
+ * Results:
+ *    HGFS_ERROR_SUCCESS or an appropriate error code.
+ *
+ * Side effects:
+ *    The directory is read from its beginning.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsInternalStatus
+HgfsSearchOpenDir(char const *baseDir,        // IN: directory searched
+                  HgfsSessionInfo *session,   // IN: session info
+                  HgfsSearch *search)         // IN/OUT: streaming search
+{
+   int openFlags = O_NONBLOCK | O_RDONLY | O_DIRECTORY | O_NOFOLLOW;
+   int fd;
+
+   /* Follow symlinks if config option is set. */
+   if ((search->flags & HGFS_SEARCH_FLAG_FOLLOW_SYMLINKS) != 0) {
+      openFlags &= ~O_NOFOLLOW;
+   }
+
+   HgfsSearchLimitOpenDirs(session);
+
+   /* We want a directory. No FIFOs. Symlinks only if config option is set. */
+   fd = Posix_Open(baseDir, openFlags);
+   if (fd < 0) {
+      HgfsInternalStatus status = errno;
+
+      LOG(4, "%s: error in open: %d (%s)\n", __FUNCTION__, status,
+          Err_Errno2String(status));
+      return status;
+   }
+
+   search->dirFd = fd;
+   search->dirLastUse = session->searchDirUseClock++;
+
+   return HGFS_ERROR_SUCCESS;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsSearchDropDents --
+ *
+ *    Frees the window of directory entries held by a streaming search.
+ *    The entries which follow are the next ones read from the directory.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsSearchDropDents(HgfsSearch *search)   // IN/OUT: streaming search
+{
+   uint32 i;
+
+   for (i = 0; i < search->numDents; i++) {
+      free(search->dents[i]);
+   }
+   free(search->dents);
+   search->dents = NULL;
+   search->dentsBase += search->numDents;
+   search->numDents = 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsSearchStreamDents --
+ *
+ *    Makes sure a streaming search holds the directory entry at index,
+ *    reading further batches of entries from the open directory as needed.
+ *    Only a single batch is held at a time, so the memory used by a search
+ *    does not depend on the size of the directory. An index before the
+ *    entries held rewinds the directory and reads it from the beginning.
+ *    Note: this must be called with the session search lock acquired.
+ *
+ * Results:
+ *    HGFS_ERROR_SUCCESS or an appropriate error code. Running out of
+ *    entries is not an error.
+ *
+ * Side effects:
+ *    Reads the directory.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsInternalStatus
+HgfsSearchStreamDents(HgfsSearch *search,         // IN/OUT: streaming search
+                      HgfsSessionInfo *session,   // IN: session info
+                      uint32 index)               // IN: entry wanted
+{
+   /* Same batch size as HgfsPlatformScandir. */
+   char buffer[8192];
+   HgfsInternalStatus status = HGFS_ERROR_SUCCESS;
+
+   ASSERT((search->flags & HGFS_SEARCH_FLAG_STREAMING) != 0);
+
+   if (search->dirFd < 0 &&
+       (index < search->dentsBase ||
+        (index >= search->dentsBase + search->numDents &&
+         (search->flags & HGFS_SEARCH_FLAG_STREAM_EOF) == 0))) {
+      /*
+       * The directory was closed to honour the limit of open directories.
+       * The reopened directory is read from its beginning, as on a rewind.
+       */
+      LOG(4, "%s: reopening \"%s\" for entry %u\n", __FUNCTION__,
+          search->utf8Dir, index);
+      status = HgfsSearchOpenDir(search->utf8Dir, session, search);
+      if (status != HGFS_ERROR_SUCCESS) {
+         return status;
+      }
+      HgfsSearchDropDents(search);
+      search->dentsBase = 0;
+      search->flags &= ~HGFS_SEARCH_FLAG_STREAM_EOF;
+   } else if (search->dirFd >= 0) {
+      search->dirLastUse = session->searchDirUseClock++;
+   }
+
+   if (index < search->dentsBase) {
+      LOG(4, "%s: rewinding \"%s\" for entry %u\n", __FUNCTION__,
+          search->utf8Dir, index);
+      if (lseek(search->dirFd, 0, SEEK_SET) < 0) {
+         status = errno;
+         LOG(4, "%s: error in lseek: %d (%s)\n", __FUNCTION__, status,
+             Err_Errno2String(status));
+         return status;
+      }
+      HgfsSearchDropDents(search);
+      search->dentsBase = 0;
+      search->flags &= ~HGFS_SEARCH_FLAG_STREAM_EOF;
+   }
+
+   while (index >= search->dentsBase + search->numDents &&
+          (search->flags & HGFS_SEARCH_FLAG_STREAM_EOF) == 0) {
+      DirectoryEntry **newDents;
+      uint32 numNewDents = 0;
+      size_t offset;
+      int result;
+
+      result = getdents(search->dirFd, (void *)buffer, sizeof buffer);
+      if (result < 0) {
+         status = errno;
+         LOG(4, "%s: error in getdents: %d (%s)\n", __FUNCTION__, status,
+             Err_Errno2String(status));
+         break;
+      }
+      if (result == 0) {
+         /* Keep the last batch, the final entries are still wanted. */
+         search->flags |= HGFS_SEARCH_FLAG_STREAM_EOF;
+         break;
+      }
+
+      /* Count the entries so the array is sized once per batch. */
+      for (offset = 0; offset < result; ) {
+         DirectoryEntry *newDent = (DirectoryEntry *)(buffer + offset);
+
+         ASSERT(newDent->d_reclen <= result - offset);
+         offset += newDent->d_reclen;
+         numNewDents++;
+      }
+
+      newDents = malloc(numNewDents * sizeof *newDents);
+      if (newDents == NULL) {
+         status = ENOMEM;
+         break;
+      }
+
+      HgfsSearchDropDents(search);
+      search->dents = newDents;
+
+      for (offset = 0; offset < result; ) {
+         DirectoryEntry *newDent = (DirectoryEntry *)(buffer + offset);
+
+         offset += newDent->d_reclen;
+
+         /* Names that can't be converted are discarded, as in HgfsPlatformScandir. */
+         if (!HgfsConvertToUtf8FormC(newDent->d_name,
+                                     newDent->d_reclen -
+                                     offsetof(DirectoryEntry, d_name))) {
+            continue;
+         }
+
+         newDents[search->numDents] = malloc(newDent->d_reclen);
+         if (newDents[search->numDents] == NULL) {
+            status = ENOMEM;
+            break;
+         }
+         memcpy(newDents[search->numDents], newDent, newDent->d_reclen);
+         search->numDents++;
+      }
+
+      if (status != HGFS_ERROR_SUCCESS) {
+         break;
+      }
+   }
+
+   return status;
+}
+#endif
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformGetDirEntry --
+ *
+ *    Returns the directory entry (or a copy) at the given index. If remove is set
+ *    to TRUE, the existing result is also pruned and the remaining results
+ *    are shifted up in the result array.
+ *
+ * Results:
+ *    HGFS_ERROR_SUCCESS or an appropriate error code.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsInternalStatus
+HgfsPlatformGetDirEntry(HgfsSearch *search,               // IN: search
+                        HgfsSessionInfo *session,         // IN: Session info
+                        uint32 index,                     // IN: Offset to retrieve at
+                        Bool remove,                      // IN: If true, removes the result
+                        struct DirectoryEntry **dirEntry) // OUT: dirent
+{
+   DirectoryEntry *dent = NULL;
+   HgfsInternalStatus status = HGFS_ERROR_SUCCESS;
+
+#if !defined(__APPLE__)
+   if ((search->flags & HGFS_SEARCH_FLAG_STREAMING) != 0) {
+      status = HgfsSearchStreamDents(search, session, index);
+      if (status != HGFS_ERROR_SUCCESS) {
+         goto out;
+      }
+      if (index < search->dentsBase) {
+         goto out;
+      }
+      /* From here on the index is relative to the entries held. */
+      index -= search->dentsBase;
+   }
+#endif
+
+   if (index >= search->numDents) {
+      goto out;
+   }
+
+   /* If we're not removing the result, we need to make a copy of it. */
+   if (remove) {
+      /*
+       * We're going to shift the dents array, overwriting the dent pointer at
+       * offset, so first we need to save said pointer so that we can return it
+       * later to the caller.
+       */
+      dent = search->dents[index];
+
+      if (index < search->numDents - 1) {
+         /* Shift up the remaining results */
+         memmove(&search->dents[index], &search->dents[index + 1],
+                 (search->numDents - (index + 1)) * sizeof search->dents[0]);
+      }
+
+      /* Decrement the number of results */
+      search->numDents--;
+   } else {
+      DirectoryEntry *originalDent;
+      size_t nameLen;
+
+      originalDent = search->dents[index];
+      ASSERT(originalDent);
+
+      nameLen = strlen(originalDent->d_name);
+      /*
+       * Make sure the name will not overrun the d_name buffer, the end of
+       * which is also the end of the DirectoryEntry.
+       */
+      ASSERT(offsetof(DirectoryEntry, d_name) + nameLen < originalDent->d_reclen);
+
+      dent = malloc(originalDent->d_reclen);
+      if (dent == NULL) {
+         status = HGFS_ERROR_NOT_ENOUGH_MEMORY;
+         goto out;
       }
 
       /*
@@ -3617,6 +4509,15 @@ HgfsPlatformSetDirEntry(HgfsSearch *search,              // IN: partially valid
                LOG(4, "%s: Reusing existing oplocked handle "
                    "to avoid oplock break deadlock\n", __FUNCTION__);
                status = HgfsPlatformGetattrFromFd(fileDesc, session, entryAttr);
+            } else if ((search->flags & HGFS_SEARCH_FLAG_STREAMING) != 0) {
+#if defined(__APPLE__)
+               NOT_REACHED();
+#else
+               /* Stat relative to the searched directory, see HgfsGetattrAt. */
+               status = HgfsGetattrAt(search->dirFd, dirEntry->d_name, fullName,
+                                      configOptions, search->utf8ShareName,
+                                      entryAttr);
+#endif
             } else {
                status = HgfsPlatformGetattrFromName(fullName, configOptions,
                                                     search->utf8ShareName,
@@ -3915,6 +4816,144 @@ HgfsPlatformScandir(char const *baseDir,            // IN: Directory to search i
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformScandirOpen --
+ *
+ *    Sets up a search on a real directory. Rather than read the whole
+ *    directory up front as HgfsPlatformScandir does, the directory is opened
+ *    the same way and kept open in the search, whose entries are then read
+ *    batch by batch as the client reads on (see HgfsSearchStreamDents).
+ *    A session keeps at most HGFS_SEARCH_MAX_OPEN_DIRS directories open,
+ *    the least recently used ones are closed and reopened on demand.
+ *    Note: this must be called with the session search lock acquired for
+ *    write.
+ *
+ *    On Mac OS, where there is no getdents, the entries are read up front.
+ *
+ * Results:
+ *    Zero on success.
+ *    Non-zero on error.
+ *
+ * Side effects:
+ *    Opens the directory, which HgfsPlatformScandirClose closes.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsInternalStatus
+HgfsPlatformScandirOpen(char const *baseDir,        // IN: Directory to search in
+                        size_t baseDirLen,          // IN: Ignored
+                        Bool followSymlinks,        // IN: followSymlinks config option
+                        HgfsSessionInfo *session,   // IN: Session info
+                        HgfsSearch *search)         // IN/OUT: search to set up
+{
+#if defined(__APPLE__)
+   return HgfsPlatformScandir(baseDir, baseDirLen, followSymlinks,
+                              &search->dents, &search->numDents);
+#else
+   HgfsInternalStatus status;
+
+   search->dirFd = -1;
+   search->flags &= ~HGFS_SEARCH_FLAG_FOLLOW_SYMLINKS;
+   if (followSymlinks) {
+      search->flags |= HGFS_SEARCH_FLAG_FOLLOW_SYMLINKS;
+   }
+
+   status = HgfsSearchOpenDir(baseDir, session, search);
+   if (status != HGFS_ERROR_SUCCESS) {
+      return status;
+   }
+
+   search->dents = NULL;
+   search->numDents = 0;
+   search->dentsBase = 0;
+   search->flags |= HGFS_SEARCH_FLAG_STREAMING;
+   search->flags &= ~HGFS_SEARCH_FLAG_STREAM_EOF;
+
+   return HGFS_ERROR_SUCCESS;
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformScandirCopy --
+ *
+ *    Gives a copy of a streaming search its own descriptor for the searched
+ *    directory, so that the entry attributes can be read relative to it
+ *    without holding the session search lock. The copy holds no entries.
+ *    Note: this must be called with the session search lock acquired.
+ *
+ * Results:
+ *    None. If the search has its directory closed or the descriptor can't be
+ *    duplicated the copy is not streaming, and attributes are read by name.
+ *
+ * Side effects:
+ *    The copy must be released with HgfsPlatformScandirClose.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsPlatformScandirCopy(HgfsSearch const *search,   // IN: search
+                        HgfsSearch *copy)           // OUT: copy of the search
+{
+   copy->flags &= ~(HGFS_SEARCH_FLAG_STREAMING | HGFS_SEARCH_FLAG_STREAM_EOF);
+   copy->dirFd = -1;
+
+   if ((search->flags & HGFS_SEARCH_FLAG_STREAMING) == 0 ||
+       search->dirFd < 0) {
+      return;
+   }
+
+   copy->dirFd = dup(search->dirFd);
+   if (copy->dirFd < 0) {
+      LOG(4, "%s: error in dup: %d (%s)\n", __FUNCTION__, errno,
+          Err_Errno2String(errno));
+      return;
+   }
+   copy->flags |= HGFS_SEARCH_FLAG_STREAMING;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformScandirClose --
+ *
+ *    Closes the directory kept open by a streaming search. Does nothing for
+ *    other searches.
+ *    Note: this must be called with the session search lock acquired.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsPlatformScandirClose(HgfsSearch *search)   // IN/OUT: search
+{
+   if ((search->flags & HGFS_SEARCH_FLAG_STREAMING) == 0) {
+      return;
+   }
+
+   if (search->dirFd >= 0 && close(search->dirFd) < 0) {
+      LOG(4, "%s: error in close: %d (%s)\n", __FUNCTION__, errno,
+          Err_Errno2String(errno));
+   }
+   search->dirFd = -1;
+   search->flags &= ~(HGFS_SEARCH_FLAG_STREAMING | HGFS_SEARCH_FLAG_STREAM_EOF |
+                      HGFS_SEARCH_FLAG_FOLLOW_SYMLINKS);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -4191,42 +5230,243 @@ HgfsPlatformReadFile(fileDesc file,               // IN: file descriptor
 
    MXUser_AcquireExclLock(session->fileIOLock);
 
-   if (sequentialOpen) {
-      error = 0; // No error from seek
-   } else {
-#   ifdef __linux__
-      {
-         uint64 res;
-#      if !defined(VM_X86_64)
-         error = _llseek(file, offset >> 32, offset & 0xFFFFFFFF, &res, 0);
-#      else
-         error = llseek(file, offset >> 32, offset & 0xFFFFFFFF, &res, 0);
-#      endif
+   if (sequentialOpen) {
+      error = 0; // No error from seek
+   } else {
+#   ifdef __linux__
+      {
+         uint64 res;
+#      if !defined(VM_X86_64)
+         error = _llseek(file, offset >> 32, offset & 0xFFFFFFFF, &res, 0);
+#      else
+         error = llseek(file, offset >> 32, offset & 0xFFFFFFFF, &res, 0);
+#      endif
+      }
+#   else
+      error = lseek(file, offset, 0);
+#   endif
+   }
+
+   if (error >= 0) {
+      error = read(file, payload, requiredSize);
+   } else {
+      LOG(4, "%s: could not seek to %"FMT64"u: %s\n", __FUNCTION__,
+         offset, Err_Errno2String(status));
+   }
+
+   MXUser_ReleaseExclLock(session->fileIOLock);
+#endif
+   if (error < 0) {
+      status = errno;
+      LOG(4, "%s: error reading from file: %s\n", __FUNCTION__,
+          Err_Errno2String(status));
+   } else {
+      LOG(4, "%s: read %d bytes\n", __FUNCTION__, error);
+      *actualSize = error;
+   }
+
+   return status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformReadFileIov --
+ *
+ *    Reads data from a file directly into an array of mapped guest buffers
+ *    with a single vectored read, so no intermediate buffer or copy is needed.
+ *    The read stops early at end of file.
+ *
+ * Results:
+ *    Zero on success.
+ *    Non-zero on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsInternalStatus
+HgfsPlatformReadFileIov(fileDesc file,               // IN: file descriptor
+                        HgfsSessionInfo *session,    // IN: session info
+                        uint64 offset,               // IN: file offset to read from
+                        uint32 requiredSize,         // IN: length of data to read
+                        HgfsVmxIov *iov,             // IN: mapped buffers for the data
+                        uint32 iovCount,             // IN: number of mapped buffers
+                        uint32 *actualSize)          // OUT: actual length read
+{
+   struct iovec localVec[HGFS_READ_IOV_LOCAL];
+   struct iovec *vec = localVec;
+   HgfsInternalStatus status = 0;
+   HgfsHandle handle;
+   Bool sequentialOpen;
+   uint32 vecCount;
+   uint32 vecIndex;
+   uint32 remaining;
+   uint32 totalRead = 0;
+
+   ASSERT(session);
+   ASSERT(iov != NULL && iovCount != 0);
+
+   LOG(4, "%s: read fh %u, offset %"FMT64"u, count %u, iovs %u\n", __FUNCTION__,
+       file, offset, requiredSize, iovCount);
+
+   if (!HgfsFileDesc2Handle(file, session, &handle)) {
+      LOG(4, "%s: Could not get file handle\n", __FUNCTION__);
+      return EBADF;
+   }
+
+   if (!HgfsHandleIsSequentialOpen(handle, session, &sequentialOpen)) {
+      LOG(4, "%s: Could not get sequenial open status\n", __FUNCTION__);
+      return EBADF;
+   }
+
+   if (iovCount > ARRAYSIZE(localVec)) {
+      vec = Util_SafeMalloc(iovCount * sizeof *vec);
+   }
+
+   /* Describe only as much of the guest buffers as the request needs. */
+   for (vecCount = 0, remaining = requiredSize;
+        vecCount < iovCount && remaining > 0;
+        vecCount++) {
+      vec[vecCount].iov_base = iov[vecCount].va;
+      vec[vecCount].iov_len = MIN(iov[vecCount].len, remaining);
+      remaining -= vec[vecCount].iov_len;
+   }
+
+#if !defined(__linux__) && !defined(__APPLE__)
+   /*
+    * Seek to the offset and read from the file. Grab the IO lock to make
+    * this and the subsequent reads atomic.
+    */
+   MXUser_AcquireExclLock(session->fileIOLock);
+
+   if (!sequentialOpen && lseek(file, offset, SEEK_SET) < 0) {
+      status = errno;
+      LOG(4, "%s: could not seek to %"FMT64"u: %s\n", __FUNCTION__,
+          offset, Err_Errno2String(status));
+      vecCount = 0;
+   }
+   sequentialOpen = TRUE;
+#endif
+
+   /* Read in batches of at most IOV_MAX buffers until done or end of file. */
+   for (vecIndex = 0; vecIndex < vecCount; ) {
+      uint32 batchCount = MIN(vecCount - vecIndex, IOV_MAX);
+      size_t batchSize = 0;
+      ssize_t result;
+      uint32 i;
+
+      for (i = vecIndex; i < vecIndex + batchCount; i++) {
+         batchSize += vec[i].iov_len;
+      }
+
+      if (sequentialOpen) {
+         result = readv(file, &vec[vecIndex], batchCount);
+      } else {
+#if defined(__linux__)
+         result = preadv(file, &vec[vecIndex], batchCount, offset + totalRead);
+#else
+         /* No preadv here: issue a pread per buffer, still without copying. */
+         result = 0;
+         for (i = vecIndex; i < vecIndex + batchCount; i++) {
+            ssize_t partial = pread(file, vec[i].iov_base, vec[i].iov_len,
+                                    offset + totalRead + result);
+            if (partial < 0) {
+               result = result == 0 ? -1 : result;
+               break;
+            }
+            result += partial;
+            if ((size_t)partial < vec[i].iov_len) {
+               break;
+            }
+         }
+#endif
+      }
+
+      if (result < 0) {
+         status = errno;
+         LOG(4, "%s: error reading from file: %s\n", __FUNCTION__,
+             Err_Errno2String(status));
+         break;
+      }
+
+      totalRead += result;
+      if ((size_t)result < batchSize) {
+         /* Short read: end of file. */
+         break;
+      }
+      vecIndex += batchCount;
+   }
+
+#if !defined(__linux__) && !defined(__APPLE__)
+   MXUser_ReleaseExclLock(session->fileIOLock);
+#endif
+
+   if (vec != localVec) {
+      free(vec);
+   }
+
+   if (status == 0) {
+      LOG(4, "%s: read %u bytes\n", __FUNCTION__, totalRead);
+      *actualSize = totalRead;
+   }
+
+   return status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformReadAhead --
+ *
+ *    Advise the host of the access pattern of a file being read so that it
+ *    reads ahead of a client streaming through the file, or stops doing so
+ *    once the access turns random.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Host page cache readahead may be started.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsPlatformReadAhead(fileDesc file,                   // IN: file descriptor
+                      const HgfsReadAhead *readAhead)  // IN: readahead to issue
+{
+#if defined(__linux__)
+   int error = 0;
+
+   switch (readAhead->action) {
+   case HGFS_READ_AHEAD_START:
+      /* Also makes the kernel use a larger readahead window of its own. */
+      error = posix_fadvise(file, 0, 0, POSIX_FADV_SEQUENTIAL);
+      /* Fall through. */
+   case HGFS_READ_AHEAD_EXTEND:
+      if (error == 0) {
+         error = posix_fadvise(file, readAhead->offset, readAhead->length,
+                               POSIX_FADV_WILLNEED);
       }
-#   else
-      error = lseek(file, offset, 0);
-#   endif
+      break;
+   case HGFS_READ_AHEAD_STOP:
+      error = posix_fadvise(file, 0, 0, POSIX_FADV_NORMAL);
+      break;
+   default:
+      break;
    }
 
-   if (error >= 0) {
-      error = read(file, payload, requiredSize);
-   } else {
-      LOG(4, "%s: could not seek to %"FMT64"u: %s\n", __FUNCTION__,
-         offset, Err_Errno2String(status));
+   if (error != 0) {
+      /* Purely advisory. */
+      LOG(4, "%s: fadvise %d failed: %s\n", __FUNCTION__, readAhead->action,
+          Err_Errno2String(error));
    }
-
-   MXUser_ReleaseExclLock(session->fileIOLock);
 #endif
-   if (error < 0) {
-      status = errno;
-      LOG(4, "%s: error reading from file: %s\n", __FUNCTION__,
-          Err_Errno2String(status));
-   } else {
-      LOG(4, "%s: read %d bytes\n", __FUNCTION__, error);
-      *actualSize = error;
-   }
-
-   return status;
 }
 
 
@@ -4543,6 +5783,7 @@ HgfsPlatformDeleteFileByName(char const *utf8Name) // IN: full file path in uf8
    HgfsInternalStatus status;
 
    LOG(4, "%s: unlinking \"%s\"\n", __FUNCTION__, utf8Name);
+   HgfsFdCacheDrop(utf8Name);
    status = Posix_Unlink(utf8Name);
    if (status) {
       status = errno;
@@ -4744,6 +5985,8 @@ HgfsPlatformRename(char *localSrcName,     // IN: local path to source file
 
    LOG(4, "%s: renaming \"%s\" to \"%s\"\n", __FUNCTION__,
        localSrcName, localTargetName);
+   HgfsFdCacheDrop(localSrcName);
+   HgfsFdCacheDrop(localTargetName);
    status = Posix_Rename(localSrcName, localTargetName);
    if (status) {
       status = errno;
@@ -4755,6 +5998,226 @@ exit:
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCopyFileInKernel --
+ *
+ *    Copies the rest of the source file into the target file without the
+ *    data passing through user space, with copy_file_range(2), which also
+ *    shares the extents on file systems that support it. If the kernel or
+ *    file system does not support copy_file_range before anything has been
+ *    copied, an FICLONE reflink of the whole file is tried instead.
+ *
+ * Results:
+ *    0 on success.
+ *    ENOTSUP if neither is supported for these files: the caller should copy
+ *    the rest of the data itself.
+ *    POSIX error code otherwise.
+ *
+ * Side effects:
+ *    The file offsets of both files are advanced past the copied data.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsInternalStatus
+HgfsCopyFileInKernel(int srcFd,            // IN: source file
+                     int targetFd,         // IN: target file
+                     uint64 *bytesCopied)  // IN/OUT: data copied so far
+{
+#if defined(__linux__)
+#   if defined(SYS_copy_file_range)
+   for (;;) {
+      ssize_t result = syscall(SYS_copy_file_range, srcFd, NULL, targetFd,
+                               NULL, (size_t)1 << 30, 0);
+
+      if (result > 0) {
+         *bytesCopied += result;
+         continue;
+      }
+      if (0 == result) {
+         return 0;
+      }
+      if (EINTR == errno) {
+         continue;
+      }
+      if (   ENOSYS != errno && EXDEV != errno && EOPNOTSUPP != errno
+          && EINVAL != errno) {
+         return errno;
+      }
+      LOG(4, "%s: copy_file_range not supported: %s\n", __FUNCTION__,
+          Err_Errno2String(errno));
+      break;
+   }
+#   endif
+
+   if (0 == *bytesCopied) {
+      struct stat srcStat;
+
+      if (   0 == ioctl(targetFd, FICLONE, srcFd)
+          && 0 == fstat(srcFd, &srcStat)) {
+         /* A clone leaves the offsets alone, the caller only needs the size. */
+         *bytesCopied = srcStat.st_size;
+         return 0;
+      }
+      LOG(4, "%s: reflink not supported: %s\n", __FUNCTION__,
+          Err_Errno2String(errno));
+   }
+#endif
+
+   return ENOTSUP;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformCopyFile --
+ *
+ *    POSIX version of the function that copies a file. The data is copied
+ *    within the kernel when possible, otherwise with a read/write loop.
+ *    Symbolic links are never followed for either file.
+ *
+ * Results:
+ *    0 on success, POSIX error code otherwise.
+ *
+ * Side effects:
+ *    The target file is created or truncated. A target file created by a
+ *    copy which fails is removed.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsInternalStatus
+HgfsPlatformCopyFile(char *localSrcName,      // IN: local path to source file
+                     char *localTargetName,   // IN: local path to target file
+                     HgfsCopyFileHint hints,  // IN: copy hints
+                     uint64 *bytesCopied)     // OUT: size of the copied data
+{
+   HgfsInternalStatus status;
+   struct stat srcStat;
+   struct stat targetStat;
+   int targetFlags = O_WRONLY | O_CREAT | O_NONBLOCK | O_NOFOLLOW;
+   int srcFd;
+   int targetFd = -1;
+   Bool targetCreated = FALSE;
+   char *buffer = NULL;
+
+   *bytesCopied = 0;
+
+   LOG(4, "%s: copying \"%s\" to \"%s\"\n", __FUNCTION__,
+       localSrcName, localTargetName);
+
+   srcFd = Posix_Open(localSrcName, O_RDONLY | O_NONBLOCK | O_NOFOLLOW);
+   if (-1 == srcFd || -1 == fstat(srcFd, &srcStat)) {
+      status = errno;
+      goto exit;
+   }
+   if (!S_ISREG(srcStat.st_mode)) {
+      status = S_ISDIR(srcStat.st_mode) ? EISDIR : EINVAL;
+      goto exit;
+   }
+
+   /*
+    * Try to create the target first, to know whether a failed copy should
+    * remove it or leave an existing file behind.
+    */
+   targetFd = Posix_Open(localTargetName, targetFlags | O_EXCL,
+                         srcStat.st_mode & 0777);
+   if (-1 != targetFd) {
+      targetCreated = TRUE;
+   } else if (EEXIST == errno &&
+              !(hints & HGFS_COPY_FILE_HINT_NO_REPLACE_EXISTING)) {
+      targetFd = Posix_Open(localTargetName, targetFlags,
+                            srcStat.st_mode & 0777);
+   }
+   if (-1 == targetFd || -1 == fstat(targetFd, &targetStat)) {
+      status = errno;
+      goto exit;
+   }
+
+   /* Truncating a file onto itself would lose its data. */
+   if (   srcStat.st_dev == targetStat.st_dev
+       && srcStat.st_ino == targetStat.st_ino) {
+      status = EINVAL;
+      goto exit;
+   }
+   if (!S_ISREG(targetStat.st_mode)) {
+      status = S_ISDIR(targetStat.st_mode) ? EISDIR : EINVAL;
+      goto exit;
+   }
+   if (-1 == ftruncate(targetFd, 0)) {
+      status = errno;
+      goto exit;
+   }
+
+   status = HgfsCopyFileInKernel(srcFd, targetFd, bytesCopied);
+   if (ENOTSUP != status) {
+      goto exit;
+   }
+
+   buffer = Util_SafeMalloc(HGFS_COPY_FILE_BUFFER_SIZE);
+   status = 0;
+   for (;;) {
+      ssize_t bytesRead = read(srcFd, buffer, HGFS_COPY_FILE_BUFFER_SIZE);
+      ssize_t offset = 0;
+
+      if (-1 == bytesRead) {
+         if (EINTR == errno) {
+            continue;
+         }
+         status = errno;
+         break;
+      }
+      if (0 == bytesRead) {
+         break;
+      }
+      while (offset < bytesRead) {
+         ssize_t bytesWritten = write(targetFd, buffer + offset,
+                                      bytesRead - offset);
+
+         if (-1 == bytesWritten) {
+            if (EINTR == errno) {
+               continue;
+            }
+            status = errno;
+            goto exit;
+         }
+         offset += bytesWritten;
+         *bytesCopied += bytesWritten;
+      }
+   }
+
+exit:
+   if (status) {
+      LOG(4, "%s: error: %s\n", __FUNCTION__, Err_Errno2String(status));
+   }
+   if (status && targetCreated) {
+      struct stat createdStat;
+      struct stat nameStat;
+
+      /* Only remove the file created above, not one that replaced it since. */
+      if (   0 == fstat(targetFd, &createdStat)
+          && 0 == Posix_Lstat(localTargetName, &nameStat)
+          && nameStat.st_dev == createdStat.st_dev
+          && nameStat.st_ino == createdStat.st_ino
+          && 0 != Posix_Unlink(localTargetName)) {
+         LOG(4, "%s: failed to remove \"%s\": %s\n", __FUNCTION__,
+             localTargetName, Err_Errno2String(errno));
+      }
+   }
+   free(buffer);
+   if (-1 != targetFd) {
+      close(targetFd);
+   }
+   if (-1 != srcFd) {
+      close(srcFd);
+   }
+   return status;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -4860,6 +6323,72 @@ HgfsPlatformSymlinkCreate(char *localSymlinkName,   // IN: symbolic link file na
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsGetDirIdentity --
+ *
+ *      Get the identity of the directory a path leads to, following
+ *      symlinks.
+ *
+ * Results:
+ *      TRUE on success, FALSE if the path could not be stat'ed or is not a
+ *      directory.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+HgfsGetDirIdentity(const char *dirName,        // IN
+                   HgfsDirIdentity *identity)  // OUT
+{
+   struct stat stats;
+   HgfsFileAttrInfo attr;
+   uint64 creationTime = 0;
+
+   if (Posix_Stat(dirName, &stats) != 0 || !S_ISDIR(stats.st_mode)) {
+      return FALSE;
+   }
+
+   HgfsStatToFileAttr(&stats, &creationTime, &attr);
+   identity->dev = stats.st_dev;
+   identity->ino = stats.st_ino;
+   identity->writeTime = attr.writeTime;
+   identity->attrChangeTime = attr.attrChangeTime;
+   return TRUE;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsDirIdentityEqual --
+ *
+ *      Compare two directory identities.
+ *
+ * Results:
+ *      TRUE if they are the same, FALSE otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+HgfsDirIdentityEqual(const HgfsDirIdentity *a,  // IN
+                     const HgfsDirIdentity *b)  // IN
+{
+   return a->dev == b->dev &&
+          a->ino == b->ino &&
+          a->writeTime == b->writeTime &&
+          a->attrChangeTime == b->attrChangeTime;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -4985,7 +6514,6 @@ HgfsPlatformPathHasSymlink(const char *fileName,      // IN
       nameStatus = HGFS_NAME_STATUS_ACCESS_DENIED;
       LOG(4, "%s: resolved parent do not match, parent: %s, resolved: %s#\n",
           __FUNCTION__, fileDirName, resolvedFileDirPath);
-      goto exit;
    }
 
 exit:
@@ -4995,6 +6523,127 @@ exit:
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformSeekExtent --
+ *
+ *    POSIX version of the function that finds the next data or hole of a
+ *    file, with lseek(2) SEEK_DATA and SEEK_HOLE. The file offset is used by
+ *    the sequential open handles so it is restored afterwards.
+ *
+ *    File systems without sparse file support report the whole file as data,
+ *    followed by a hole at the end of file.
+ *
+ * Results:
+ *    0 on success, POSIX error code otherwise. extentOffset is
+ *    HGFS_SEEK_EXTENT_NONE if there is no such extent.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsInternalStatus
+HgfsPlatformSeekExtent(fileDesc file,              // IN: file descriptor
+                       HgfsSeekExtentType type,    // IN: data or hole
+                       uint64 offset,              // IN: offset to look from
+                       uint64 *extentOffset)       // OUT: extent found or NONE
+{
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+   HgfsInternalStatus status = 0;
+   off_t savedOffset;
+   off_t result;
+
+   ASSERT(extentOffset);
+
+   *extentOffset = HGFS_SEEK_EXTENT_NONE;
+   if (offset > MAX_INT64) {
+      return EINVAL;
+   }
+
+   savedOffset = lseek(file, 0, SEEK_CUR);
+   if (-1 == savedOffset) {
+      return errno;
+   }
+
+   result = lseek(file, (off_t)offset,
+                  HGFS_SEEK_EXTENT_DATA == type ? SEEK_DATA : SEEK_HOLE);
+   if (-1 != result) {
+      *extentOffset = result;
+   } else if (ENXIO != errno) {
+      status = errno;
+   }
+
+   if (-1 == lseek(file, savedOffset, SEEK_SET)) {
+      LOG(4, "%s: failed to restore the file offset, error %d\n",
+          __FUNCTION__, errno);
+   }
+
+   LOG(4, "%s: %s from %"FMT64"u -> %"FMT64"u, status %d\n", __FUNCTION__,
+       HGFS_SEEK_EXTENT_DATA == type ? "data" : "hole", offset,
+       *extentOffset, status);
+   return status;
+#else
+   return EOPNOTSUPP;
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformAllocate --
+ *
+ *    POSIX version of the function that allocates, or with PUNCH_HOLE
+ *    deallocates, the storage of a byte range of a file with fallocate(2).
+ *
+ * Results:
+ *    0 on success, POSIX error code otherwise. EOPNOTSUPP if the host or the
+ *    file system does not support the request.
+ *
+ * Side effects:
+ *    Without KEEP_SIZE the file grows to cover the range.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsInternalStatus
+HgfsPlatformAllocate(fileDesc file,                // IN: file descriptor
+                     HgfsAllocateFlags flags,      // IN: allocate flags
+                     uint64 offset,                // IN: range start
+                     uint64 length)                // IN: range length
+{
+#if defined(__linux__)
+   int mode = 0;
+
+   if (0 != (flags & ~(HGFS_ALLOCATE_KEEP_SIZE | HGFS_ALLOCATE_PUNCH_HOLE))) {
+      return EOPNOTSUPP;
+   }
+   if (offset > MAX_INT64 || length == 0 || length > MAX_INT64 - offset) {
+      return EINVAL;
+   }
+
+   if (0 != (flags & HGFS_ALLOCATE_KEEP_SIZE)) {
+      mode |= FALLOC_FL_KEEP_SIZE;
+   }
+   if (0 != (flags & HGFS_ALLOCATE_PUNCH_HOLE)) {
+      mode |= FALLOC_FL_PUNCH_HOLE;
+   }
+
+   LOG(4, "%s: mode %#x range %"FMT64"u + %"FMT64"u\n", __FUNCTION__, mode,
+       offset, length);
+   if (-1 == fallocate(file, mode, (off_t)offset, (off_t)length)) {
+      return errno;
+   }
+   return 0;
+#else
+   return EOPNOTSUPP;
+#endif
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -143,8 +143,7 @@ HgfsServerOplockIsInited(void)
  * HgfsHandle2ServerLock --
  *
  *    Retrieve the serverlock information for the file node that corresponds to
- *    the specified hgfs handle. If the server is not compiled with oplock
- *    support, we always return TRUE and HGFS_LOCK_NONE.
+ *    the specified hgfs handle.
  *
  * Results:
  *    TRUE if the hgfs handle is valid and the lock was retrieved successfully.
@@ -161,34 +160,19 @@ HgfsHandle2ServerLock(HgfsHandle handle,        // IN: Hgfs file handle
                       HgfsSessionInfo *session, // IN: Session info
                       HgfsLockType *lock)       // OUT: Server lock
 {
-#ifdef HGFS_OPLOCKS
-   Bool found = FALSE;
-   HgfsFileNode *fileNode;
+   HgfsFileNode fileNode;
 
    ASSERT(lock);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
-   fileNode = HgfsHandle2FileNode(handle, session);
-   if (fileNode == NULL) {
-      goto exit;
+   if (!HgfsGetNodeCopy(handle, session, FALSE, &fileNode)) {
+      return FALSE;
    }
 
-   *lock = fileNode->serverLock;
-   found = TRUE;
-
-exit:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
-
-   return found;
-#else
-   *lock = HGFS_LOCK_NONE;
+   *lock = fileNode.serverLock;
    return TRUE;
-#endif
 }
 
 
-
-
 /*
  *-----------------------------------------------------------------------------
  *
@@ -222,7 +206,7 @@ HgfsFileHasServerLock(const char *utf8Name,             // IN: Name in UTF8
    ASSERT(session);
    ASSERT(session->nodeArray);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
 
    for (i = 0; i < session->numNodes; i++) {
       HgfsFileNode *existingFileNode = &session->nodeArray[i];
@@ -238,7 +222,7 @@ HgfsFileHasServerLock(const char *utf8Name,             // IN: Name in UTF8
       }
    }
 
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return found;
 #else
@@ -248,159 +232,61 @@ HgfsFileHasServerLock(const char *utf8Name,             // IN: Name in UTF8
 
 
 
-#ifdef HGFS_OPLOCKS
-/*
- *-----------------------------------------------------------------------------
- *
- * HgfsServerOplockBreakReply --
- *
- *      The client was sent an oplock break request, and responded with this
- *      reply. It contains the oplock status that the client is now in. Since
- *      the break could have actually been a degrade, it is well within the
- *      client's rights to transition to a non-broken state. We need to make
- *      sure that such a transition was legal, acknowledge the brea
- *      appropriately, and update our own state.
- *
- * Results:
- *      None.
- *
- * Side effects:
- *      None.
- *
- *-----------------------------------------------------------------------------
- */
-
-void
-HgfsServerOplockBreakReply(const unsigned char *packetIn, // IN: Reply packet
-                           unsigned int packetSize,       // IN: Size of packet
-                           void *clientData)              // IN: From request
-{
-   HgfsReplyServerLockChange *reply;
-   ServerLockData *lockData = clientData;
-
-   ASSERT(packetIn);
-   ASSERT(clientData);
-
-   if (packetSize < sizeof *reply) {
-      return;
-   }
-   reply = (HgfsReplyServerLockChange *)packetIn;
-
-   /*
-    * XXX: It should be safe to ignore the status and id from the actual
-    * HgfsReply. The only information we need to properly acknowledge the break
-    * is the original fd and the new lease, which, in the case of a degrade,
-    * is double checked in HgfsAckOplockBreak, so we'd be safe from a garbage
-    * value.
-    */
-   HgfsAckOplockBreak(lockData, reply->serverLock);
-}
-
-
 /*
  *-----------------------------------------------------------------------------
  *
  * HgfsServerOplockBreak --
  *
- *      When the host FS needs to break the oplock so that another client
- *      can open the file, it signals the event in the overlapped structure
- *      that we used to request an oplock.
- *      This sets off the following chains of events:
+ *      The host FS needs to break the oplock so that another opener can have
+ *      the file. This sets off the following chain of events:
  *      1. Send the oplock break request to the guest.
- *      2. Once the guest acknowledges the oplock break, the completion
- *      routine GuestRpcServerRequestCallback will fire, causing
- *      HgfsServerOplockBreakReply to also fire, which will break the oplock
- *      on the host FS.
+ *      2. Once the guest acknowledges the oplock break, HgfsAckOplockBreak
+ *      downgrades or releases the oplock on the host FS.
+ *
+ *      If the break cannot be sent, it is acknowledged right away.
  *
  * Results:
  *      None.
  *
  * Side effects:
- *      If successful, allocates memory for the rpc request.
+ *      None.
  *
  *-----------------------------------------------------------------------------
  */
 
 void
-HgfsServerOplockBreak(ServerLockData *lockData)
+HgfsServerOplockBreak(ServerLockData *lockData)  // IN: lock and break to
 {
    HgfsHandle hgfsHandle;
-   char *requestBuffer = NULL;
-   HgfsRequestServerLockChange *request;
    HgfsLockType lock;
 
    LOG(4, "%s: entered\n", __FUNCTION__);
 
    /*
-    * XXX: Just because the file in not in the cache on the server,
-    * does not mean it was closed on the client. It is possible that
-    * we closed the file on the server because we ran out of space
-    * in cache. That's why for now as long as a file has a lock,
-    * we don't remove it from the node cache. This should be fixed.
-    *
-    * In any case, none of these cache-related failures should cause us to ack
-    * the oplock break locally. That is because if the file wasn't in the
-    * cache, or it had no lock, chances are someone else (maybe the VCPU
-    * thread) broke the oplock and/or closed the file.
+    * If the file is not in the cache, or has no lock, the client closed it
+    * or a previous break already released the lock: nothing to tell it.
     */
-
-   if (!HgfsFileDesc2Handle(lockData->fileDesc, &hgfsHandle)) {
+   if (!HgfsFileDesc2Handle(lockData->fileDesc, lockData->session,
+                            &hgfsHandle)) {
       LOG(4, "%s: file is not in the cache\n", __FUNCTION__);
-      goto free_and_exit;
+      goto ack_and_exit;
    }
 
-   if (!HgfsHandle2ServerLock(hgfsHandle, &lock)) {
+   if (!HgfsHandle2ServerLock(hgfsHandle, lockData->session, &lock)) {
       LOG(4, "%s: could not retrieve node's lock info.\n", __FUNCTION__);
-      goto free_and_exit;
+      goto ack_and_exit;
    }
 
    if (lock == HGFS_LOCK_NONE) {
       LOG(4, "%s: the file does not have a server lock.\n", __FUNCTION__);
-      goto free_and_exit;
-   }
-
-   /*
-    * We need to setup the entire request here. The command prefix will be
-    * added later, so save some space for it.
-    *
-    * XXX: This should probably go into a common allocation function that
-    * other out-of-band requests can use.
-    */
-
-   requestBuffer = malloc(sizeof *request + HGFS_CLIENT_CMD_LEN);
-   if (requestBuffer == NULL) {
-      LOG(4, "%s: could not allocate memory.\n", __FUNCTION__);
       goto ack_and_exit;
    }
 
-   /* Save space for the command prefix. */
-   request = (HgfsRequestServerLockChange *)
-      (requestBuffer + HGFS_CLIENT_CMD_LEN);
-   request->header.op = HGFS_OP_SERVER_LOCK_CHANGE;
-   request->header.id = 0; /* XXX */
-   request->file = hgfsHandle;
-   request->newServerLock = lockData->serverLock;
-
-   /*
-    * Just send the request size for our actual request; our callee will
-    * write in the command prefix and modify the request size appropriately.
-    *
-    * If for some reason we fail, we'll acknowledge the oplock break
-    * immediately.
-    */
-
-   if (HgfsServerManager_SendRequest(requestBuffer, sizeof *request,
-                                     HgfsServerOplockBreakReply, lockData)) {
+   if (HgfsServerOplockBreakSend(lockData->session, hgfsHandle,
+                                 lockData->serverLock)) {
       return;
    }
-   free(requestBuffer);
 
   ack_and_exit:
    HgfsAckOplockBreak(lockData, HGFS_LOCK_NONE);
-
-   return;
-
-  free_and_exit:
-   free(lockData);
 }
-#endif
@@ -59,6 +59,7 @@ Bool HgfsFileHasServerLock(const char *utf8Name,
 Bool HgfsAcquireServerLock(fileDesc fileDesc,
                            HgfsSessionInfo *session,
                            HgfsLockType *serverLock);
+void HgfsRemoveServerLock(fileDesc fileDesc);
 
 
 #endif // ifndef _HGFS_SERVER_OPLOCK_H_
@@ -33,10 +33,10 @@
 #include "hgfsServerInt.h" // for common server types e.g. HgfsSessionInfo
 
 /*
- * Does this platform have oplock support? We define it here to avoid long
- * ifdefs all over the code. For now, Linux and Windows hosts only.
- *
- * XXX: Just kidding, no oplock support yet.
+ * Does the server need to guard against breaking its own oplocks? We define
+ * it here to avoid long ifdefs all over the code. Windows oplocks break on
+ * rename and delete, Linux leases only on open and truncate, so Linux does
+ * not need it.
  */
 #if 0
 #define HGFS_OPLOCKS
@@ -92,7 +92,6 @@ HgfsAcquireAIOServerLock(fileDesc fileDesc,
 void
 HgfsRemoveAIOServerLock(fileDesc fileDesc);
 
-#ifdef HGFS_OPLOCKS
 void
 HgfsServerOplockBreak(ServerLockData *data);
 
@@ -100,6 +99,4 @@ void
 HgfsAckOplockBreak(ServerLockData *lockData,
                    HgfsLockType replyLock);
 
-#endif
-
 #endif // ifndef _HGFS_SERVER_OPLOCKINT_H_
@@ -20,56 +20,93 @@
  * hgfsServerOplockLinux.c --
  *
  *      HGFS server opportunistic lock support for the Linux platform.
+ *
+ *      Oplocks are file leases (F_SETLEASE). The kernel signals a lease
+ *      break with SIGIO, whose handler only wakes the lease thread through
+ *      a pipe. The thread then finds the leases with a break pending using
+ *      F_GETLEASE, so that merged signals do not lose breaks, and delivers
+ *      the breaks without the lease lock held:
+ *      - leases taken for the oplock monitor are released at once and the
+ *        monitor callback is called to drop whatever was cached;
+ *      - leases granted to clients are broken by sending the client an
+ *        oplock break request. The lease is downgraded or released when the
+ *        client acknowledges the break, or by the kernel after
+ *        /proc/sys/fs/lease-break-time if it never does.
  */
 
 
+#define _GNU_SOURCE // for F_SETLEASE, F_SETSIG and pipe2()
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/poll.h>
 
 #include "vmware.h"
 #include "err.h"
+#include "hashTable.h"
+#include "mutexRankLib.h"
+#include "userlock.h"
+#include "util.h"
 #include "hgfsServerInt.h"
+#include "hgfsServerOplock.h"
 #include "hgfsServerOplockInt.h"
 
-#ifdef HGFS_OPLOCKS
-#   include <signal.h>
-#   include "sig.h"
-#endif
-
 
 /*
  * Local data
  */
 
-/*
- * Global data
- */
+typedef struct HgfsLease {
+   ServerLockData lockData;     /* Holder, serverLock is the lease held. */
+   HgfsLockType breakLock;      /* Lock to break to, if breaking. */
+   Bool breaking;               /* Break delivered, not acknowledged yet. */
+} HgfsLease;
+
+typedef struct HgfsLeaseState {
+   MXUserExclLock *lock;        /* Protects leases and exiting. */
+   HashTable *leases;           /* fd -> HgfsLease. */
+   int wakeFds[2];              /* Written to by the SIGIO handler. */
+   pthread_t thread;
+   Bool threadRunning;
+   Bool exiting;                /* Lease thread should terminate. */
+   struct sigaction oldAction;  /* SIGIO action to restore. */
+} HgfsLeaseState;
+
+/* Breaks collected by the lease thread, delivered without the lock held. */
+typedef struct HgfsLeaseBreaks {
+   ServerLockData *breaks;
+   uint32 numBreaks;
+   uint32 maxBreaks;
+} HgfsLeaseBreaks;
+
+#define AS_KEY(_x)  ((const void *)(uintptr_t)(_x))
+
+static HgfsLeaseState *gHgfsLeases = NULL;
+
+/* The SIGIO handler's copy of the pipe write end. */
+static volatile int gHgfsLeaseWakeFd = -1;
 
 
 /*
  * Local functions
  */
 
-#ifdef HGFS_OPLOCKS
-static void HgfsServerSigOplockBreak(int sigNum,
-                                     siginfo_t *info,
-                                     ucontext_t *u,
-                                     void *clientData);
-#endif
-
-
 
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsPlatformOplockInit --
+ * HgfsLeaseType --
  *
- *      Set up any state needed to start Linux HGFS server oplock support.
+ *      Convert a server lock to the lease type used for it.
  *
  * Results:
- *      TRUE always.
+ *      F_RDLCK, F_WRLCK or F_UNLCK.
  *
  * Side effects:
  *      None.
@@ -77,23 +114,27 @@ static void HgfsServerSigOplockBreak(int sigNum,
  *-----------------------------------------------------------------------------
  */
 
-Bool
-HgfsPlatformOplockInit(void)
+static int
+HgfsLeaseType(HgfsLockType serverLock)  // IN:
 {
-#ifdef HGFS_OPLOCKS
-   /* Register a signal handler to catch oplock break signals. */
-   Sig_Callback(SIGIO, SIG_SAFE, HgfsServerSigOplockBreak, NULL);
-#endif
-   return TRUE;
+   switch (serverLock) {
+   case HGFS_LOCK_NONE:
+      return F_UNLCK;
+   case HGFS_LOCK_SHARED:
+      return F_RDLCK;
+   default:
+      return F_WRLCK;
+   }
 }
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsPlatformOplockDestroy --
+ * HgfsLeaseSignalHandler --
  *
- *      Tear down any state used for Linux HGFS server.
+ *      SIGIO handler: wake the lease thread. Only async-signal-safe calls
+ *      may be made here.
  *
  * Results:
  *      None.
@@ -104,25 +145,38 @@ HgfsPlatformOplockInit(void)
  *-----------------------------------------------------------------------------
  */
 
-void
-HgfsPlatformOplockDestroy(void)
+static void
+HgfsLeaseSignalHandler(int sigNum,       // IN: Signal number
+                       siginfo_t *info,  // IN: Additional info about signal
+                       void *context)    // IN: Interrupted context
 {
-#ifdef HGFS_OPLOCKS
-   /* Tear down oplock state, so we no longer catch signals. */
-   Sig_Callback(SIGIO, SIG_NOHANDLER, NULL, NULL);
-#endif
+   int savedErrno = errno;
+   int fd = gHgfsLeaseWakeFd;
+   char c = 0;
+
+   if (fd >= 0) {
+      /* A full pipe already has a wake up pending. */
+      if (write(fd, &c, sizeof c) < 0) {
+      }
+   }
+   errno = savedErrno;
 }
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsRemoveAIOServerLock --
+ * HgfsLeaseCheckBreak --
  *
- *      Remove an oplock for an open file.
+ *      HashTable_ForEach callback: if the lease has a break pending, mark it
+ *      breaking and queue the break for delivery. A monitor lease is released
+ *      right away so that the opener does not wait for the callback. A client
+ *      lease holds a session reference until the break has been sent.
+ *
+ *      The lease lock must be held.
  *
  * Results:
- *      None.
+ *      0 to continue the iteration.
  *
  * Side effects:
  *      None.
@@ -130,90 +184,160 @@ HgfsPlatformOplockDestroy(void)
  *-----------------------------------------------------------------------------
  */
 
-void
-HgfsRemoveAIOServerLock(fileDesc fileDesc)  // IN:
+static int
+HgfsLeaseCheckBreak(const char *key,     // IN: file descriptor
+                    void *value,         // IN: HgfsLease
+                    void *clientData)    // IN/OUT: HgfsLeaseBreaks
 {
+   HgfsLease *lease = value;
+   HgfsLeaseBreaks *pending = clientData;
+   ServerLockData *lockData = &lease->lockData;
+   int newLease;
+
+   if (lease->breaking) {
+      return 0;
+   }
+
+   /*
+    * According to locks.c in kernel source, doing F_GETLEASE when a lease
+    * break is pending will return the new lease we should use. It'll be
+    * F_RDLCK if we can downgrade, or F_UNLCK if we should break altogether.
+    */
+   newLease = fcntl(lockData->fileDesc, F_GETLEASE);
+   if (newLease == -1) {
+      int error = errno;
+      Log("%s: Could not get lease for fd %d: %s\n", __FUNCTION__,
+          lockData->fileDesc, Err_Errno2String(error));
+      newLease = F_UNLCK;
+   } else if (newLease == HgfsLeaseType(lockData->serverLock)) {
+      return 0;
+   }
+
+   LOG(4, "%s: Break pending for fd %d\n", __FUNCTION__, lockData->fileDesc);
+   lease->breaking = TRUE;
+   lease->breakLock = newLease == F_RDLCK ? HGFS_LOCK_SHARED : HGFS_LOCK_NONE;
+
+   if (lockData->callback != NULL) {
+      fcntl(lockData->fileDesc, F_SETLEASE, F_UNLCK);
+      lockData->serverLock = HGFS_LOCK_NONE;
+   } else {
+      HgfsServerSessionGet(lockData->session);
+   }
+
+   if (pending->numBreaks == pending->maxBreaks) {
+      pending->maxBreaks = MAX(16, 2 * pending->maxBreaks);
+      pending->breaks = Util_SafeRealloc(pending->breaks,
+                                         pending->maxBreaks *
+                                         sizeof *pending->breaks);
+   }
+   pending->breaks[pending->numBreaks] = *lockData;
+   pending->breaks[pending->numBreaks].serverLock = lease->breakLock;
+   pending->numBreaks++;
+
+   return 0;
 }
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsAcquireAIOServerLock --
+ * HgfsLeaseThread --
  *
- *    Acquire an oplock for an open file and register the break oplock event.
+ *      Lease thread main loop: wait for SIGIO to wake us, then deliver the
+ *      pending lease breaks.
  *
  * Results:
- *    TRUE on success. serverLock contains the type of the lock acquired.
- *    FALSE on failure. serverLock is HGFS_LOCK_NONE.
+ *      NULL.
  *
  * Side effects:
- *    None.
+ *      None.
  *
  *-----------------------------------------------------------------------------
  */
 
-Bool
-HgfsAcquireAIOServerLock(fileDesc fileDesc,            // IN:
-                         HgfsSessionInfo *session,     // IN: Session info
-                         HgfsLockType *serverLock,     // IN/OUT: Oplock asked for/granted
-                         HgfsOplockCallback callback,  // IN: call back
-                         void *data)                   // IN: parameter for call back
+static void *
+HgfsLeaseThread(void *data)  // IN: lease state
 {
-   return FALSE;
+   HgfsLeaseState *state = data;
+   HgfsLeaseBreaks pending;
+
+   memset(&pending, 0, sizeof pending);
+
+   for (;;) {
+      struct pollfd fds[1];
+      char drain[64];
+      uint32 i;
+
+      fds[0].fd = state->wakeFds[0];
+      fds[0].events = POLLIN;
+      if (poll(fds, ARRAYSIZE(fds), -1) < 0) {
+         if (errno != EINTR) {
+            Log("%s: poll failed: %d\n", __FUNCTION__, errno);
+         }
+         continue;
+      }
+      while (read(state->wakeFds[0], drain, sizeof drain) > 0) {
+      }
+
+      MXUser_AcquireExclLock(state->lock);
+      if (state->exiting) {
+         MXUser_ReleaseExclLock(state->lock);
+         break;
+      }
+      pending.numBreaks = 0;
+      HashTable_ForEach(state->leases, HgfsLeaseCheckBreak, &pending);
+      MXUser_ReleaseExclLock(state->lock);
+
+      for (i = 0; i < pending.numBreaks; i++) {
+         ServerLockData *lockData = &pending.breaks[i];
+
+         if (lockData->callback != NULL) {
+            lockData->callback(lockData->session, lockData->data);
+         } else {
+            HgfsServerOplockBreak(lockData);
+            HgfsServerSessionPut(lockData->session);
+         }
+      }
+   }
+
+   free(pending.breaks);
+   return NULL;
 }
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsAcquireServerLock --
+ * HgfsLeaseAcquire --
  *
- *    Acquire a lease for the open file. Typically we try and get the exact
- *    lease desired, but if the client asked for HGFS_LOCK_OPPORTUNISTIC, we'll
+ *    Take a lease on the open file. Typically we try and get the exact lease
+ *    desired, but if the client asked for HGFS_LOCK_OPPORTUNISTIC, we'll
  *    take the "best" lease we can get.
  *
  * Results:
  *    TRUE on success. serverLock contains the type of the lock acquired.
  *    FALSE on failure. serverLock is HGFS_LOCK_NONE.
  *
- *    XXX: This function has the potential to return per-platform error codes,
- *    but since it is opportunistic by nature, it isn't necessary to do so.
- *
  * Side effects:
  *    None.
  *
  *-----------------------------------------------------------------------------
  */
 
-Bool
-HgfsAcquireServerLock(fileDesc fileDesc,            // IN: OS handle
-                      HgfsSessionInfo *session,     // IN: session info
-                      HgfsLockType *serverLock)     // IN/OUT: Oplock asked for/granted
+static Bool
+HgfsLeaseAcquire(fileDesc fileDesc,         // IN: OS handle
+                 HgfsLockType *serverLock)  // IN/OUT: Oplock asked for/granted
 {
-#ifdef HGFS_OPLOCKS
-   HgfsLockType desiredLock;
-   int leaseType, error;
-
-   ASSERT(serverLock);
-   ASSERT(session);
-
-   desiredLock = *serverLock;
+   HgfsLockType desiredLock = *serverLock;
+   int leaseType;
+   int error;
 
-   if (desiredLock == HGFS_LOCK_NONE) {
-      return TRUE;
-   }
-
-   if (!HgfsIsServerLockAllowed(session)) {
-      return FALSE;
-   }
+   *serverLock = HGFS_LOCK_NONE;
 
    /*
     * First tell the kernel which signal to send us. SIGIO is already the
     * default, but if we skip this step, we won't get the siginfo_t when
-    * a lease break occurs.
-    *
-    * XXX: Do I need to do fcntl(fileDesc, F_SETOWN, getpid())?
+    * a lease break occurs. The lease owner is set by F_SETLEASE itself.
     */
    if (fcntl(fileDesc, F_SETSIG, SIGIO)) {
       error = errno;
@@ -257,7 +381,7 @@ HgfsAcquireServerLock(fileDesc fileDesc,            // IN: OS handle
          error = errno;
          LOG(4, "%s: Could not get %s lease for fd %d: %s\n",
              __FUNCTION__, leaseType == F_WRLCK ? "write" : "read",
-             fileDesc, Err_Errno2String(errno));
+             fileDesc, Err_Errno2String(error));
 
          return FALSE;
       }
@@ -268,80 +392,174 @@ HgfsAcquireServerLock(fileDesc fileDesc,            // IN: OS handle
        leaseType == F_WRLCK ? "write" : "read", fileDesc);
    *serverLock = leaseType == F_WRLCK ? HGFS_LOCK_EXCLUSIVE : HGFS_LOCK_SHARED;
    return TRUE;
-#else
-   return FALSE;
-#endif
 }
 
 
-#ifdef HGFS_OPLOCKS
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsAckOplockBreak --
+ * HgfsLeaseRegister --
+ *
+ *    Track a lease just taken so that its break gets delivered.
+ *
+ * Results:
+ *    TRUE on success.
+ *    FALSE if the lease module is not set up or the lease table is full; the
+ *    lease is released.
+ *
+ * Side effects:
+ *    None.
  *
- *    Platform-dependent implementation of oplock break acknowledgement.
- *    This function gets called when the oplock break rpc command is completed.
- *    The rpc oplock break command (HgfsServerOplockBreak) is in hgfsServer.c
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsLeaseRegister(fileDesc fileDesc,            // IN: OS handle
+                  HgfsSessionInfo *session,     // IN: session info
+                  HgfsLockType serverLock,      // IN: lease held
+                  HgfsOplockCallback callback,  // IN: monitor call back or NULL
+                  void *data)                   // IN: parameter for call back
+{
+   HgfsLease *lease;
+   Bool registered = FALSE;
+
+   lease = Util_SafeCalloc(1, sizeof *lease);
+   lease->lockData.fileDesc = fileDesc;
+   lease->lockData.session = session;
+   lease->lockData.serverLock = serverLock;
+   lease->lockData.callback = callback;
+   lease->lockData.data = data;
+
+   MXUser_AcquireExclLock(gHgfsLeases->lock);
+   if (HashTable_GetNumElements(gHgfsLeases->leases) < HGFS_OPLOCK_MAX_COUNT) {
+      registered = HashTable_Insert(gHgfsLeases->leases, AS_KEY(fileDesc),
+                                    lease);
+   }
+   MXUser_ReleaseExclLock(gHgfsLeases->lock);
+
+   if (!registered) {
+      LOG(4, "%s: Could not track the lease for fd %d\n", __FUNCTION__,
+          fileDesc);
+      fcntl(fileDesc, F_SETLEASE, F_UNLCK);
+      free(lease);
+   }
+   return registered;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformOplockInit --
  *
- *    On Linux, we use fcntl() to downgrade the lease. Then we update the node
- *    cache, free the clientData, and call it a day.
+ *      Set up any state needed to start Linux HGFS server oplock support:
+ *      the lease table, the SIGIO handler and the lease thread.
  *
  * Results:
- *    None
+ *      TRUE on success, FALSE on failure.
  *
  * Side effects:
- *    None
+ *      Installs a SIGIO handler.
  *
  *-----------------------------------------------------------------------------
  */
 
-void
-HgfsAckOplockBreak(ServerLockData *lockData, // IN: server lock info
-                   HgfsLockType replyLock)   // IN: client has this lock
+Bool
+HgfsPlatformOplockInit(void)
 {
-   int fileDesc, newLock;
-   HgfsLockType actualLock;
+   HgfsLeaseState *state;
+   struct sigaction action;
+   int err;
 
-   ASSERT(lockData);
-   fileDesc = lockData->fileDesc;
-   LOG(4, "%s: Acknowledging break on fd %d\n", __FUNCTION__, fileDesc);
+   ASSERT(gHgfsLeases == NULL);
 
-   /*
-    * The Linux server supports lock downgrading. We only downgrade to a shared
-    * lock if our previous call to fcntl() said we could, and if the client
-    * wants to downgrade to a shared lock. Otherwise, we break altogether.
-    */
-   if (lockData->serverLock == HGFS_LOCK_SHARED &&
-       replyLock == HGFS_LOCK_SHARED) {
-      newLock = F_RDLCK;
-      actualLock = replyLock;
-   } else {
-      newLock = F_UNLCK;
-      actualLock = HGFS_LOCK_NONE;
+   state = Util_SafeCalloc(1, sizeof *state);
+   if (pipe2(state->wakeFds, O_NONBLOCK | O_CLOEXEC) < 0) {
+      Log("%s: failed to create the wake pipe: %d\n", __FUNCTION__, errno);
+      free(state);
+      return FALSE;
+   }
+   state->lock = MXUser_CreateExclLock("HgfsOplockLock", RANK_hgfsOplockLock);
+   state->leases = HashTable_Alloc(HGFS_OPLOCK_MAX_COUNT, HASH_INT_KEY, free);
+
+   memset(&action, 0, sizeof action);
+   action.sa_sigaction = HgfsLeaseSignalHandler;
+   action.sa_flags = SA_SIGINFO | SA_RESTART;
+   sigemptyset(&action.sa_mask);
+   gHgfsLeaseWakeFd = state->wakeFds[1];
+   sigaction(SIGIO, &action, &state->oldAction);
+
+   gHgfsLeases = state;
+
+   err = pthread_create(&state->thread, NULL, HgfsLeaseThread, state);
+   if (err != 0) {
+      Log("%s: failed to start the lease thread: %d\n", __FUNCTION__, err);
+      HgfsPlatformOplockDestroy();
+      return FALSE;
    }
+   state->threadRunning = TRUE;
 
-   /* Downgrade or acknowledge the break altogether. */
-   if (fcntl(fileDesc, F_SETLEASE, newLock) == -1) {
-      int error = errno;
-      Log("%s: Could not break lease on fd %d: %s\n",
-          __FUNCTION__, fileDesc, Err_Errno2String(error));
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformOplockDestroy --
+ *
+ *      Tear down any state used for Linux HGFS server.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Restores the previous SIGIO action.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsPlatformOplockDestroy(void)
+{
+   HgfsLeaseState *state = gHgfsLeases;
+   char c = 0;
+
+   if (state == NULL) {
+      return;
    }
 
-   /* Cleanup. */
-   HgfsUpdateNodeServerLock(fileDesc, actualLock);
-   free(lockData);
+   if (state->threadRunning) {
+      MXUser_AcquireExclLock(state->lock);
+      state->exiting = TRUE;
+      MXUser_ReleaseExclLock(state->lock);
+      if (write(state->wakeFds[1], &c, sizeof c) < 0) {
+         Log("%s: failed to wake the lease thread: %d\n", __FUNCTION__, errno);
+      }
+      pthread_join(state->thread, NULL);
+      state->threadRunning = FALSE;
+   }
+
+   /* Tear down oplock state, so we no longer catch signals. */
+   sigaction(SIGIO, &state->oldAction, NULL);
+   gHgfsLeaseWakeFd = -1;
+   gHgfsLeases = NULL;
+
+   HashTable_Free(state->leases);
+   MXUser_DestroyExclLock(state->lock);
+   close(state->wakeFds[0]);
+   close(state->wakeFds[1]);
+   free(state);
 }
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsServerSigOplockBreak --
+ * HgfsRemoveAIOServerLock --
  *
- *      Handle a pending oplock break. Called from the VMX poll loop context.
- *      All we really do is set up the state for an oplock break and call
- *      HgfsServerOplockBreak which will do the rest of the work.
+ *      Remove an oplock for an open file taken by HgfsAcquireAIOServerLock,
+ *      and close the file.
  *
  * Results:
  *      None.
@@ -352,77 +570,214 @@ HgfsAckOplockBreak(ServerLockData *lockData, // IN: server lock info
  *-----------------------------------------------------------------------------
  */
 
-static void
-HgfsServerSigOplockBreak(int sigNum,       // IN: Signal number
-                         siginfo_t *info,  // IN: Additional info about signal
-                         ucontext_t *u,    // IN: Interrupted context (regs etc)
-                         void *clientData) // IN: Ignored
+void
+HgfsRemoveAIOServerLock(fileDesc fileDesc)  // IN:
 {
-   ServerLockData *lockData;
-   int newLease, fd;
-   HgfsLockType newServerLock;
+   /* Closing the file stops tracking and releases the lease. */
+   HgfsPlatformCloseFile(fileDesc, NULL);
+}
 
-   ASSERT(sigNum == SIGIO);
-   ASSERT(info);
-   ASSERT(clientData == NULL);
 
-   fd = info->si_fd;
-   LOG(4, "%s: Received SIGIO for fd %d\n", __FUNCTION__, fd);
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsAcquireAIOServerLock --
+ *
+ *    Acquire an oplock for an open file and register the break oplock event.
+ *    The callback is called from the lease thread when the lease breaks; the
+ *    lease is already released by then. The file must be closed with
+ *    HgfsRemoveAIOServerLock.
+ *
+ * Results:
+ *    TRUE on success. serverLock contains the type of the lock acquired.
+ *    FALSE on failure. serverLock is HGFS_LOCK_NONE.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
 
-   /*
-    * We've got all we need from the signal handler, let it continue handling
-    * signals of this type.
-    */
-   Sig_Continue(sigNum);
+Bool
+HgfsAcquireAIOServerLock(fileDesc fileDesc,            // IN:
+                         HgfsSessionInfo *session,     // IN: Session info
+                         HgfsLockType *serverLock,     // IN/OUT: Oplock asked for/granted
+                         HgfsOplockCallback callback,  // IN: call back
+                         void *data)                   // IN: parameter for call back
+{
+   ASSERT(serverLock);
+   ASSERT(callback);
 
-   /*
-    * According to locks.c in kernel source, doing F_GETLEASE when a lease
-    * break is pending will return the new lease we should use. It'll be
-    * F_RDLCK if we can downgrade, or F_UNLCK if we should break altogether.
-    */
-   newLease = fcntl(fd, F_GETLEASE);
-   if (newLease == F_RDLCK) {
-      newServerLock = HGFS_LOCK_SHARED;
-   } else if (newLease == F_UNLCK) {
-      newServerLock = HGFS_LOCK_NONE;
-   } else if (newLease == -1) {
-      int error = errno;
-      Log("%s: Could not get old lease for fd %d: %s\n", __FUNCTION__,
-          fd, Err_Errno2String(error));
-      goto error;
-   } else {
-      Log("%s: Unexpected reply to get lease for fd %d: %d\n",
-          __FUNCTION__, fd, newLease);
-      goto error;
+   if (gHgfsLeases == NULL) {
+      *serverLock = HGFS_LOCK_NONE;
+      return FALSE;
    }
 
-   /*
-    * Setup a ServerLockData struct so that we can make use of
-    * HgfsServerOplockBreak which does the heavy lifting of discovering which
-    * HGFS handle we're interested in breaking, sending the break, receiving
-    * the acknowledgement, and firing the platform-specific acknowledgement
-    * function (where we'll downgrade the lease).
-    */
-   lockData = malloc(sizeof *lockData);
-   if (lockData) {
-      lockData->fileDesc = fd;
-      lockData->serverLock = newServerLock;
-      lockData->event = 0; // not needed
+   if (   !HgfsLeaseAcquire(fileDesc, serverLock)
+       || !HgfsLeaseRegister(fileDesc, session, *serverLock, callback, data)) {
+      *serverLock = HGFS_LOCK_NONE;
+      return FALSE;
+   }
+   return TRUE;
+}
 
-      /*
-       * Relinquish control of this data. It'll get freed later, when the RPC
-       * command completes.
-       */
-      HgfsServerOplockBreak(lockData);
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsAcquireServerLock --
+ *
+ *    Acquire a lease for a file opened by a client, if the session has
+ *    oplocks enabled and there is room for another locked node.
+ *
+ * Results:
+ *    TRUE on success. serverLock contains the type of the lock acquired.
+ *    FALSE on failure. serverLock is HGFS_LOCK_NONE.
+ *
+ *    XXX: This function has the potential to return per-platform error codes,
+ *    but since it is opportunistic by nature, it isn't necessary to do so.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsAcquireServerLock(fileDesc fileDesc,            // IN: OS handle
+                      HgfsSessionInfo *session,     // IN: session info
+                      HgfsLockType *serverLock)     // IN/OUT: Oplock asked for/granted
+{
+   ASSERT(serverLock);
+   ASSERT(session);
+
+   if (*serverLock == HGFS_LOCK_NONE) {
+      return TRUE;
+   }
+
+   if (   gHgfsLeases == NULL
+       || (session->flags & HGFS_SESSION_OPLOCK_ENABLED) == 0
+       || !HgfsIsServerLockAllowed(session)) {
+      *serverLock = HGFS_LOCK_NONE;
+      return FALSE;
+   }
+
+   if (   !HgfsLeaseAcquire(fileDesc, serverLock)
+       || !HgfsLeaseRegister(fileDesc, session, *serverLock, NULL, NULL)) {
+      *serverLock = HGFS_LOCK_NONE;
+      return FALSE;
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsRemoveServerLock --
+ *
+ *    Stop tracking the lease of a file that is about to be closed. Closing
+ *    the file releases the lease.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsRemoveServerLock(fileDesc fileDesc)  // IN: OS handle
+{
+   HgfsLeaseState *state = gHgfsLeases;
+
+   if (state == NULL) {
       return;
+   }
+
+   MXUser_AcquireExclLock(state->lock);
+   HashTable_Delete(state->leases, AS_KEY(fileDesc));
+   MXUser_ReleaseExclLock(state->lock);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsAckOplockBreak --
+ *
+ *    Platform-dependent implementation of oplock break acknowledgement,
+ *    called when the client acknowledges a break or changes its lock.
+ *
+ *    On Linux, we use fcntl() to downgrade the lease. We only downgrade to a
+ *    shared lock if the pending break allows it and the client wants to
+ *    downgrade to a shared lock. Otherwise, we break altogether. Then we
+ *    update the node cache.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsAckOplockBreak(ServerLockData *lockData, // IN: server lock info
+                   HgfsLockType replyLock)   // IN: client has this lock
+{
+   HgfsLeaseState *state = gHgfsLeases;
+   int fileDesc;
+   HgfsLease *lease;
+   HgfsLockType allowedLock;
+   HgfsLockType actualLock = HGFS_LOCK_NONE;
+
+   ASSERT(lockData);
+   fileDesc = lockData->fileDesc;
+   LOG(4, "%s: Acknowledging break on fd %d\n", __FUNCTION__, fileDesc);
+
+   if (state == NULL) {
+      goto exit;
+   }
+
+   MXUser_AcquireExclLock(state->lock);
+   if (   !HashTable_Lookup(state->leases, AS_KEY(fileDesc), (void **)&lease)
+       || lease->lockData.callback != NULL
+       || lease->lockData.session != lockData->session) {
+      MXUser_ReleaseExclLock(state->lock);
+      goto exit;
+   }
+
+   allowedLock = lease->breaking ? lease->breakLock : lease->lockData.serverLock;
+   if (replyLock == HGFS_LOCK_NONE || allowedLock == HGFS_LOCK_NONE) {
+      actualLock = HGFS_LOCK_NONE;
+   } else if (replyLock == HGFS_LOCK_SHARED || allowedLock == HGFS_LOCK_SHARED) {
+      actualLock = HGFS_LOCK_SHARED;
+   } else {
+      actualLock = lease->lockData.serverLock;
+   }
+
+   /* Downgrade or acknowledge the break altogether. */
+   if (   actualLock != HGFS_LOCK_NONE
+       && fcntl(fileDesc, F_SETLEASE, HgfsLeaseType(actualLock)) == -1) {
+      actualLock = HGFS_LOCK_NONE;
+   }
+   if (actualLock == HGFS_LOCK_NONE) {
+      if (fcntl(fileDesc, F_SETLEASE, F_UNLCK) == -1) {
+         int error = errno;
+         Log("%s: Could not break lease on fd %d: %s\n",
+             __FUNCTION__, fileDesc, Err_Errno2String(error));
+      }
+      HashTable_Delete(state->leases, AS_KEY(fileDesc));
    } else {
-      Log("%s: Could not allocate memory for lease break on behalf of fd %d\n",
-          __FUNCTION__, fd);
+      lease->lockData.serverLock = actualLock;
+      lease->breaking = FALSE;
    }
+   MXUser_ReleaseExclLock(state->lock);
 
-  error:
-   /* Clean up as best we can. */
-   fcntl(fd, F_SETLEASE, F_UNLCK);
-   HgfsUpdateNodeServerLock(fd, HGFS_LOCK_NONE);
+exit:
+   HgfsUpdateNodeServerLock(fileDesc, lockData->session, actualLock);
 }
-#endif /* HGFS_OPLOCKS */
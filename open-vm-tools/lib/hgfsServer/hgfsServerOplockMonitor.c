@@ -56,6 +56,7 @@
 typedef struct {
    DblLnkLst_Links links;
    uint64 handle;
+   HgfsSessionInfo *session;
    HgfsOplockCallback callback;
    void *data;
 } oplockMonitorCallbackList;
@@ -175,6 +176,32 @@ HgfsOplockMonitorDestroy(void)
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsOplockMonitorIsData --
+ *
+ *    HashTable_ForEach callback: check if the monitor data is the value of
+ *    the entry.
+ *
+ * Results:
+ *    Non-zero if it is, to stop the iteration.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+HgfsOplockMonitorIsData(const char *key,    // IN: file name
+                        void *value,        // IN: oplockMonitorData
+                        void *clientData)   // IN: oplockMonitorData to find
+{
+   return value == clientData;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -182,7 +209,9 @@ HgfsOplockMonitorDestroy(void)
  *
  *    A callback function that called when the target file/directory is
  *    changed.
- *    Calls the caller provided callback.
+ *    Calls the caller provided callbacks, each with the session that asked
+ *    for the monitor. The monitor may have been cancelled concurrently, so
+ *    the data is only used if still in gOplockMonitorMap.
  *
  * Results:
  *    None.
@@ -201,13 +230,14 @@ HgfsOplockMonitorFileChangeCallback(HgfsSessionInfo *session,   // IN:
 
    ASSERT(monitorData);
    MXUser_AcquireExclLock(oplockMonitorLock);
-   if (HashTable_Lookup(gOplockMonitorMap, monitorData->utf8Name, NULL)) {
+   if (HashTable_ForEach(gOplockMonitorMap, HgfsOplockMonitorIsData,
+                         monitorData)) {
       DblLnkLst_Links *link, *nextLink;
       DblLnkLst_ForEachSafe(link, nextLink, &monitorData->callbackList) {
          oplockMonitorCallbackList *callbackItem = DblLnkLst_Container(link,
                                                    oplockMonitorCallbackList,
                                                    links);
-         callbackItem->callback(session, callbackItem->data);
+         callbackItem->callback(callbackItem->session, callbackItem->data);
          /*
           * callbackItem->data has been freed in the user callback.
           */
@@ -290,6 +320,7 @@ HgfsOplockMonitorFileChange(char *utf8Name,             // IN: Name in UTF8
       handle = (HOM_HANDLE)callbackItem;
       DblLnkLst_Init(&callbackItem->links);
       callbackItem->handle = handle;
+      callbackItem->session = session;
       callbackItem->callback = callback;
       callbackItem->data = data;
       DblLnkLst_LinkLast(&monitorData->callbackList,
@@ -337,6 +368,7 @@ HgfsOplockMonitorFileChange(char *utf8Name,             // IN: Name in UTF8
    handle = (HOM_HANDLE)callbackItem;
    DblLnkLst_Init(&callbackItem->links);
    callbackItem->handle = handle;
+   callbackItem->session = session;
    callbackItem->callback = callback;
    callbackItem->data = data;
    DblLnkLst_LinkLast(&monitorData->callbackList,
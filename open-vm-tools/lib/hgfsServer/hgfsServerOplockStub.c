@@ -0,0 +1,201 @@
+/*********************************************************
+ * Copyright (C) 2012-2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * hgfsServerOplockStub.c --
+ *
+ *	Stubs for opportunistic lock support, used on platforms without
+ *	file leases.
+ */
+
+#include <stdio.h>
+
+#include "vmware.h"
+#include "hgfsServerInt.h"
+#include "hgfsServerOplock.h"
+#include "hgfsServerOplockInt.h"
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformOplockInit --
+ *
+ *      Set up any state needed to start HGFS server oplock support.
+ *
+ * Results:
+ *      FALSE, oplocks are not supported.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsPlatformOplockInit(void)
+{
+   return FALSE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformOplockDestroy --
+ *
+ *      Tear down any oplock state used for HGFS server.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsPlatformOplockDestroy(void)
+{
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsRemoveAIOServerLock --
+ *
+ *      Remove an oplock for an open file and close the file.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsRemoveAIOServerLock(fileDesc fileDesc)  // IN:
+{
+   HgfsPlatformCloseFile(fileDesc, NULL);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsAcquireAIOServerLock --
+ *
+ *      Acquire an oplock for an open file and register the break oplock event.
+ *
+ * Results:
+ *      FALSE, serverLock is HGFS_LOCK_NONE.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsAcquireAIOServerLock(fileDesc fileDesc,            // IN:
+                         HgfsSessionInfo *session,     // IN: Session info
+                         HgfsLockType *serverLock,     // IN/OUT: Oplock asked for/granted
+                         HgfsOplockCallback callback,  // IN: call back
+                         void *data)                   // IN: parameter for call back
+{
+   *serverLock = HGFS_LOCK_NONE;
+   return FALSE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsAcquireServerLock --
+ *
+ *      Acquire an oplock for a file opened by a client.
+ *
+ * Results:
+ *      FALSE, serverLock is HGFS_LOCK_NONE.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsAcquireServerLock(fileDesc fileDesc,            // IN: OS handle
+                      HgfsSessionInfo *session,     // IN: session info
+                      HgfsLockType *serverLock)     // IN/OUT: Oplock asked for/granted
+{
+   *serverLock = HGFS_LOCK_NONE;
+   return FALSE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsRemoveServerLock --
+ *
+ *      Release the oplock of a file about to be closed.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsRemoveServerLock(fileDesc fileDesc)  // IN: OS handle
+{
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsAckOplockBreak --
+ *
+ *      Acknowledge an oplock break. No oplock is ever granted, so just
+ *      make sure the node has none.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsAckOplockBreak(ServerLockData *lockData, // IN: server lock info
+                   HgfsLockType replyLock)   // IN: client has this lock
+{
+   HgfsUpdateNodeServerLock(lockData->fileDesc, lockData->session,
+                            HGFS_LOCK_NONE);
+}
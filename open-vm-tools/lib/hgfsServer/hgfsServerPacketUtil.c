@@ -29,6 +29,17 @@
 #include "hgfsServer.h"
 #include "hgfsServerInt.h"
 #include "util.h"
+#include "hgfsBufferPool.h"
+
+/*
+ * Free reply buffers kept at most by each reply pool, see HSPUReplyPool.
+ * The large pool holds fewer as its buffers are ten times bigger.
+ */
+#define HSPU_REPLY_POOL_MAX         64
+#define HSPU_LARGE_REPLY_POOL_MAX   16
+
+/* Pools of allocated reply buffers, smallest buffer size first. */
+static HgfsBufferPool gHspuReplyPools[2];
 
 static void *HSPUGetBuf(HgfsServerChannelCallbacks *chanCb,
                         MappingType mappingType,
@@ -182,6 +193,116 @@ exit:
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HSPU_InitReplyPools --
+ *
+ *    Initialize the pools of allocated reply buffers.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HSPU_InitReplyPools(void)
+{
+   HgfsBufferPool_Init(&gHspuReplyPools[0], "hgfsReplyPoolLock",
+                       HGFS_PACKET_MAX, HSPU_REPLY_POOL_MAX);
+   HgfsBufferPool_Init(&gHspuReplyPools[1], "hgfsLargeReplyPoolLock",
+                       HGFS_LARGE_PACKET_MAX, HSPU_LARGE_REPLY_POOL_MAX);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HSPU_ExitReplyPools --
+ *
+ *    Free the pooled reply buffers.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HSPU_ExitReplyPools(void)
+{
+   uint32 i;
+
+   for (i = 0; i < ARRAYSIZE(gHspuReplyPools); i++) {
+      HgfsBufferPool_Exit(&gHspuReplyPools[i]);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HSPU_GetReplyPoolStats --
+ *
+ *    Get the counters of a reply pool, pools are numbered from the smallest
+ *    buffer size.
+ *
+ * Results:
+ *    TRUE if the pool exists, FALSE otherwise.
+ *
+ * Side effects:
+ *    None.
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HSPU_GetReplyPoolStats(uint32 index,                 // IN: reply pool
+                       HgfsServerPoolStats *stats)   // OUT: pool counters
+{
+   if (index >= ARRAYSIZE(gHspuReplyPools)) {
+      return FALSE;
+   }
+
+   HgfsBufferPool_GetStats(&gHspuReplyPools[index], stats);
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HSPUReplyPool --
+ *
+ *    Find the pool with the smallest buffers which fit a reply.
+ *
+ * Results:
+ *    The pool, or NULL if the reply is larger than any pooled buffer or the
+ *    pools were never initialized.
+ *
+ * Side effects:
+ *    None.
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsBufferPool *
+HSPUReplyPool(size_t replySize)   // IN: reply buffer size
+{
+   uint32 i;
+
+   for (i = 0; i < ARRAYSIZE(gHspuReplyPools); i++) {
+      if (replySize <= gHspuReplyPools[i].bufferSize) {
+         return &gHspuReplyPools[i];
+      }
+   }
+   return NULL;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -245,11 +366,18 @@ HSPU_GetReplyPacket(HgfsPacket *packet,                  // IN/OUT: Hgfs Packet
       }
    } else {
       /* For sockets channel we always need to allocate buffer */
+      HgfsBufferPool *pool = HSPUReplyPool(replyDataSize);
+
       LOG(10, "%s Allocating reply packet\n", __FUNCTION__);
-      packet->replyPacket = Util_SafeMalloc(replyDataSize);
+      if (NULL != pool) {
+         packet->replyPacket = HgfsBufferPool_Get(pool);
+         packet->replyPacketSize = pool->bufferSize;
+      } else {
+         packet->replyPacket = Util_SafeMalloc(replyDataSize);
+         packet->replyPacketSize = replyDataSize;
+      }
       packet->replyPacketIsAllocated = TRUE;
       packet->replyPacketDataSize = replyDataSize;
-      packet->replyPacketSize = replyDataSize;
    }
 
    *replyPacketSize = packet->replyPacketSize;
@@ -282,8 +410,15 @@ HSPU_PutReplyPacket(HgfsPacket *packet,                  // IN/OUT: Hgfs Packet
     * put on the metapacket.
     */
    if (packet->replyPacketIsAllocated) {
+      HgfsBufferPool *pool = HSPUReplyPool(packet->replyPacketSize);
+
       LOG(10, "%s Freeing reply packet", __FUNCTION__);
-      free(packet->replyPacket);
+      /* Any buffer of a pool size can go to the pool, allocated there or not. */
+      if (NULL != pool && pool->bufferSize == packet->replyPacketSize) {
+         HgfsBufferPool_Put(pool, packet->replyPacket);
+      } else {
+         free(packet->replyPacket);
+      }
       packet->replyPacketIsAllocated = FALSE;
       packet->replyPacket = NULL;
       packet->replyPacketSize = 0;
@@ -404,6 +539,89 @@ HSPU_GetDataPacketBuf(HgfsPacket *packet,                   // IN/OUT: Hgfs Pack
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HSPU_GetDataPacketIov --
+ *
+ *    Get the data packet of an hgfs packet as the array of guest mapped iovs
+ *    rather than as a contiguous buffer. This lets the caller transfer the data
+ *    directly to or from guest memory, avoiding the bounce buffer and copy that
+ *    HSPU_GetDataPacketBuf uses when the data spans several iovs.
+ *
+ *    The mappings are released by HSPU_PutDataPacketBuf as usual.
+ *
+ * Results:
+ *    Pointer to the first mapped iov of the data packet and the number of
+ *    mapped iovs, or NULL if the data packet could not be mapped or was already
+ *    obtained as an allocated contiguous buffer.
+ *
+ * Side effects:
+ *    Guest mappings are established.
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsVmxIov *
+HSPU_GetDataPacketIov(HgfsPacket *packet,                   // IN/OUT: Hgfs Packet
+                      MappingType mappingType,              // IN: Writeable/Readable
+                      HgfsServerChannelCallbacks *chanCb,   // IN: Channel callbacks
+                      uint32 *iovCount)                     // OUT: mapped iov count
+{
+   HgfsChannelMapVirtAddrFunc mapVa;
+   uint32 iovMapped = 0;
+
+   *iovCount = 0;
+
+   if (packet->dataPacket != NULL) {
+      if (packet->dataPacketIsAllocated) {
+         return NULL;
+      }
+      *iovCount = packet->dataPacketMappedIov;
+      return &packet->iov[packet->dataPacketIovIndex];
+   }
+
+   if (packet->dataPacketSize == 0 || chanCb == NULL) {
+      return NULL;
+   }
+
+   if (mappingType == BUF_WRITEABLE ||
+       mappingType == BUF_READWRITEABLE) {
+      mapVa = chanCb->getWriteVa;
+   } else {
+      ASSERT(mappingType == BUF_READABLE);
+      mapVa = chanCb->getReadVa;
+   }
+
+   /* Looks like we are in the middle of poweroff. */
+   if (mapVa == NULL) {
+      return NULL;
+   }
+
+   if (!HSPUMapBuf(mapVa,
+                   chanCb->putVa,
+                   packet->dataPacketSize,
+                   packet->dataPacketIovIndex,
+                   packet->iovCount,
+                   packet->iov,
+                   &iovMapped)) {
+      /* Guest probably passed us bad physical address */
+      return NULL;
+   }
+
+   /*
+    * Record the mappings as a non-allocated data packet so that the put
+    * releases them without copying anything back.
+    */
+   packet->dataMappingType = mappingType;
+   packet->dataPacket = packet->iov[packet->dataPacketIovIndex].va;
+   packet->dataPacketIsAllocated = FALSE;
+   packet->dataPacketMappedIov = iovMapped;
+
+   *iovCount = iovMapped;
+   return &packet->iov[packet->dataPacketIovIndex];
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -120,6 +120,10 @@ static HgfsOpCapability hgfsDefaultCapabilityTable[] =
    {HGFS_OP_UNLOCK_BYTE_RANGE_V4,  HGFS_OP_CAPFLAG_NOT_SUPPORTED},
    {HGFS_OP_QUERY_EAS_V4,          HGFS_OP_CAPFLAG_NOT_SUPPORTED},
    {HGFS_OP_SET_EAS_V4,            HGFS_OP_CAPFLAG_NOT_SUPPORTED},
+   {HGFS_OP_COMPOUND_V4,           HGFS_OP_CAPFLAG_IS_SUPPORTED},
+   {HGFS_OP_COPY_FILE_V4,          HGFS_OP_CAPFLAG_IS_SUPPORTED},
+   {HGFS_OP_SEEK_EXTENT_V4,        HGFS_OP_CAPFLAG_IS_SUPPORTED},
+   {HGFS_OP_ALLOCATE_V4,           HGFS_OP_CAPFLAG_IS_SUPPORTED},
 };
 
 
@@ -6224,3 +6228,594 @@ HgfsPackChangeNotificationRequest(void *packet,                    // IN/OUT: Hg
 exit:
    return result;
 }
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsUnpackCompoundRequest --
+ *
+ *    Unpack hgfs compound request V4.
+ *
+ * Results:
+ *    TRUE on success.
+ *    FALSE on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsUnpackCompoundRequest(const void *packet,      // IN: HGFS packet
+                          size_t packetSize,       // IN: request packet size
+                          HgfsOp op,               // IN: requested operation
+                          uint32 *numEntries,      // OUT: number of sub-requests
+                          const void **entries,    // OUT: first sub-request entry
+                          size_t *entriesSize)     // OUT: size of all the entries
+{
+   const HgfsRequestCompoundV4 *requestV4 = packet;
+
+   ASSERT(packet);
+   ASSERT(numEntries);
+   ASSERT(entries);
+   ASSERT(entriesSize);
+
+   if (HGFS_OP_COMPOUND_V4 != op || packetSize < sizeof *requestV4) {
+      LOG(4, "%s: Error decoding HGFS packet\n", __FUNCTION__);
+      return FALSE;
+   }
+
+   if (0 == requestV4->numEntries ||
+       requestV4->numEntries > HGFS_COMPOUND_MAX_ENTRIES) {
+      LOG(4, "%s: Invalid number of entries %u\n", __FUNCTION__,
+          requestV4->numEntries);
+      return FALSE;
+   }
+
+   *numEntries = requestV4->numEntries;
+   *entries = requestV4 + 1;
+   *entriesSize = packetSize - sizeof *requestV4;
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsUnpackCompoundEntry --
+ *
+ *    Unpack the next sub-request entry of an hgfs compound request V4 and
+ *    advance past it.
+ *
+ *    The sub-request arguments are not validated here, the handler of the
+ *    sub-request unpacks them as for a standalone request.
+ *
+ * Results:
+ *    TRUE on success.
+ *    FALSE on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsUnpackCompoundEntry(const void **entries,    // IN/OUT: sub-request entry
+                        size_t *entriesSize,     // IN/OUT: size of the entries
+                        HgfsOp *op,              // OUT: sub-request operation
+                        uint32 *flags,           // OUT: sub-request flags
+                        const void **args,       // OUT: sub-request arguments
+                        size_t *argsSize)        // OUT: size of the arguments
+{
+   const HgfsCompoundRequestEntryV4 *entry = *entries;
+
+   if (*entriesSize < sizeof *entry ||
+       *entriesSize - sizeof *entry < entry->size) {
+      LOG(4, "%s: Error decoding HGFS packet\n", __FUNCTION__);
+      return FALSE;
+   }
+
+   switch (entry->op) {
+   case HGFS_OP_OPEN_V3:
+   case HGFS_OP_GETATTR_V3:
+   case HGFS_OP_READ_V3:
+   case HGFS_OP_CLOSE_V3:
+      break;
+   default:
+      LOG(4, "%s: Unsupported sub-request op %d\n", __FUNCTION__, entry->op);
+      return FALSE;
+   }
+
+   *op = entry->op;
+   *flags = entry->flags;
+   *args = entry + 1;
+   *argsSize = entry->size;
+
+   *entries = (const char *)(entry + 1) + entry->size;
+   *entriesSize -= sizeof *entry + entry->size;
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPackCompoundEntryHandle --
+ *
+ *    Set the file handle a compound sub-request operates on, for sub-requests
+ *    flagged to use the handle returned by an earlier open of the compound.
+ *
+ * Results:
+ *    TRUE on success.
+ *    FALSE if the sub-request arguments are too small or take no handle.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsPackCompoundEntryHandle(HgfsOp op,          // IN: sub-request operation
+                            HgfsHandle file,    // IN: file handle to use
+                            size_t argsSize,    // IN: size of the arguments
+                            void *args)         // IN/OUT: sub-request arguments
+{
+   switch (op) {
+   case HGFS_OP_READ_V3: {
+      HgfsRequestReadV3 *request = args;
+
+      if (argsSize < sizeof *request) {
+         return FALSE;
+      }
+      request->file = file;
+      return TRUE;
+   }
+   case HGFS_OP_CLOSE_V3: {
+      HgfsRequestCloseV3 *request = args;
+
+      if (argsSize < sizeof *request) {
+         return FALSE;
+      }
+      request->file = file;
+      return TRUE;
+   }
+   case HGFS_OP_GETATTR_V3: {
+      HgfsRequestGetattrV3 *request = args;
+
+      if (argsSize < sizeof *request) {
+         return FALSE;
+      }
+      request->hints |= HGFS_ATTR_HINT_USE_FILE_DESC;
+      request->fileName.flags |= HGFS_FILE_NAME_USE_FILE_DESC;
+      request->fileName.fid = file;
+      return TRUE;
+   }
+   default:
+      return FALSE;
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPackCompoundReplyEntry --
+ *
+ *    Pack a sub-reply entry of an hgfs compound reply V4 into the buffer.
+ *
+ * Results:
+ *    Size of the packed entry, zero if it does not fit the buffer.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+size_t
+HgfsPackCompoundReplyEntry(HgfsOp op,               // IN: sub-request operation
+                           uint32 index,            // IN: sub-request index
+                           HgfsStatus status,       // IN: sub-request status
+                           const void *replyArgs,   // IN: sub-reply arguments
+                           size_t replyArgsSize,    // IN: size of the arguments
+                           size_t bufferSize,       // IN: size of the buffer
+                           void *buffer)            // OUT: packed entry
+{
+   HgfsCompoundReplyEntryV4 *entry = buffer;
+
+   if (bufferSize < sizeof *entry ||
+       bufferSize - sizeof *entry < replyArgsSize) {
+      return 0;
+   }
+
+   entry->op = op;
+   entry->index = index;
+   entry->size = (uint32)replyArgsSize;
+   entry->status = status;
+   if (replyArgsSize != 0) {
+      memcpy(entry + 1, replyArgs, replyArgsSize);
+   }
+   return sizeof *entry + replyArgsSize;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPackCompoundReply --
+ *
+ *    Pack hgfs compound reply V4 from the already packed sub-reply entries.
+ *
+ * Results:
+ *    TRUE if successfully allocated reply request, FALSE otherwise.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsPackCompoundReply(HgfsPacket *packet,        // IN/OUT: Hgfs Packet
+                      const void *packetHeader,  // IN: packet header
+                      HgfsOp op,                 // IN: operation code
+                      uint32 numEntries,         // IN: number of sub-replies
+                      const void *entries,       // IN: packed sub-replies
+                      size_t entriesSize,        // IN: size of the sub-replies
+                      size_t *payloadSize,       // OUT: size of packet
+                      HgfsSessionInfo *session)  // IN: Session info
+{
+   Bool result = TRUE;
+   HgfsReplyCompoundV4 *reply;
+
+   HGFS_ASSERT_PACK_PARAMS;
+
+   *payloadSize = 0;
+
+   if (HGFS_OP_COMPOUND_V4 != op) {
+      NOT_REACHED();
+      result = FALSE;
+   } else {
+      reply = HgfsAllocInitReply(packet, packetHeader,
+                                 sizeof *reply + entriesSize, session);
+      reply->numEntries = numEntries;
+      reply->reserved1 = 0;
+      reply->reserved = 0;
+      memcpy(reply + 1, entries, entriesSize);
+      *payloadSize = sizeof *reply + entriesSize;
+   }
+   return result;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsUnpackCopyFileRequest --
+ *
+ *    Unpack hgfs copy file request and return the source and target names
+ *    or handles. Hints holds flags to specify a handle or name for the
+ *    source and target files. Names are packed as for a V3 rename.
+ *
+ * Results:
+ *    TRUE on success.
+ *    FALSE on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsUnpackCopyFileRequest(const void *packet,         // IN: request packet
+                          size_t packetSize,          // IN: request packet size
+                          HgfsOp op,                  // IN: requested operation
+                          const char **cpSrcName,     // OUT: copy src
+                          size_t *cpSrcNameLen,       // OUT: copy src size
+                          const char **cpTargetName,  // OUT: copy dst
+                          size_t *cpTargetNameLen,    // OUT: copy dst size
+                          HgfsCopyFileHint *hints,    // OUT: copy hints
+                          HgfsHandle *srcFile,        // OUT: src file handle
+                          HgfsHandle *targetFile,     // OUT: target file handle
+                          uint32 *srcCaseFlags,       // OUT: source case flags
+                          uint32 *targetCaseFlags)    // OUT: dest. case flags
+{
+   const HgfsRequestCopyFileV4 *requestV4 = packet;
+   const HgfsFileNameV3 *targetName;
+   size_t extra;
+   Bool useHandle;
+
+   ASSERT(packet);
+   ASSERT(cpSrcName);
+   ASSERT(cpSrcNameLen);
+   ASSERT(cpTargetName);
+   ASSERT(cpTargetNameLen);
+   ASSERT(hints);
+   ASSERT(srcFile);
+   ASSERT(targetFile);
+   ASSERT(srcCaseFlags);
+   ASSERT(targetCaseFlags);
+
+   LOG(4, "%s: HGFS_OP_COPY_FILE_V4\n", __FUNCTION__);
+
+   if (HGFS_OP_COPY_FILE_V4 != op || packetSize < sizeof *requestV4) {
+      LOG(4, "%s: Error decoding HGFS packet\n", __FUNCTION__);
+      return FALSE;
+   }
+   extra = packetSize - sizeof *requestV4;
+
+   /* Only the name/handle selection comes from the guest as is. */
+   *hints = requestV4->hints & HGFS_COPY_FILE_HINT_NO_REPLACE_EXISTING;
+
+   if (!HgfsUnpackFileNameV3(&requestV4->srcName,
+                             extra,
+                             &useHandle,
+                             cpSrcName,
+                             cpSrcNameLen,
+                             srcFile,
+                             srcCaseFlags)) {
+      LOG(4, "%s: Error decoding HGFS packet\n", __FUNCTION__);
+      return FALSE;
+   }
+   if (useHandle) {
+      *hints |= HGFS_COPY_FILE_HINT_USE_SRCFILE_DESC;
+      targetName = &requestV4->targetName;
+   } else {
+      targetName = (const HgfsFileNameV3 *)(requestV4->srcName.name + 1 +
+                                            *cpSrcNameLen);
+      extra -= *cpSrcNameLen;
+   }
+   if (!HgfsUnpackFileNameV3(targetName,
+                             extra,
+                             &useHandle,
+                             cpTargetName,
+                             cpTargetNameLen,
+                             targetFile,
+                             targetCaseFlags)) {
+      LOG(4, "%s: Error decoding HGFS packet\n", __FUNCTION__);
+      return FALSE;
+   }
+   if (useHandle) {
+      *hints |= HGFS_COPY_FILE_HINT_USE_TARGETFILE_DESC;
+   }
+
+   LOG(8, "%s: unpacking HGFS_OP_COPY_FILE_V4 -> success\n", __FUNCTION__);
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPackCopyFileReply --
+ *
+ *    Pack hgfs copy file reply.
+ *
+ * Results:
+ *    TRUE if valid op and reply set, FALSE otherwise.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsPackCopyFileReply(HgfsPacket *packet,        // IN/OUT: Hgfs Packet
+                      const void *packetHeader,  // IN: packet header
+                      HgfsOp op,                 // IN: requested operation
+                      uint64 bytesCopied,        // IN: size of the copied data
+                      size_t *payloadSize,       // OUT: size of packet
+                      HgfsSessionInfo *session)  // IN: Session info
+{
+   Bool result = TRUE;
+   HgfsReplyCopyFileV4 *reply;
+
+   HGFS_ASSERT_PACK_PARAMS;
+
+   *payloadSize = 0;
+
+   if (HGFS_OP_COPY_FILE_V4 != op) {
+      NOT_REACHED();
+      result = FALSE;
+   } else {
+      reply = HgfsAllocInitReply(packet, packetHeader, sizeof *reply, session);
+      reply->bytesCopied = bytesCopied;
+      reply->reserved = 0;
+      *payloadSize = sizeof *reply;
+   }
+   return result;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsUnpackSeekExtentRequest --
+ *
+ *    Unpack hgfs seek extent request and return the file handle, the kind of
+ *    extent to look for and the offset to look from.
+ *
+ * Results:
+ *    TRUE on success.
+ *    FALSE on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsUnpackSeekExtentRequest(const void *packet,         // IN: request packet
+                            size_t packetSize,          // IN: request packet size
+                            HgfsOp op,                  // IN: requested operation
+                            HgfsHandle *file,           // OUT: file handle
+                            HgfsSeekExtentType *type,   // OUT: data or hole
+                            uint64 *offset)             // OUT: offset to look from
+{
+   const HgfsRequestSeekExtentV4 *requestV4 = packet;
+
+   ASSERT(packet);
+   ASSERT(file);
+   ASSERT(type);
+   ASSERT(offset);
+
+   LOG(4, "%s: HGFS_OP_SEEK_EXTENT_V4\n", __FUNCTION__);
+
+   if (HGFS_OP_SEEK_EXTENT_V4 != op || packetSize < sizeof *requestV4) {
+      LOG(4, "%s: Error decoding HGFS packet\n", __FUNCTION__);
+      return FALSE;
+   }
+   if (HGFS_SEEK_EXTENT_DATA != requestV4->type &&
+       HGFS_SEEK_EXTENT_HOLE != requestV4->type) {
+      LOG(4, "%s: Invalid extent type %u\n", __FUNCTION__, requestV4->type);
+      return FALSE;
+   }
+
+   *file = requestV4->file;
+   *type = requestV4->type;
+   *offset = requestV4->offset;
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPackSeekExtentReply --
+ *
+ *    Pack hgfs seek extent reply.
+ *
+ * Results:
+ *    TRUE if valid op and reply set, FALSE otherwise.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsPackSeekExtentReply(HgfsPacket *packet,        // IN/OUT: Hgfs Packet
+                        const void *packetHeader,  // IN: packet header
+                        HgfsOp op,                 // IN: requested operation
+                        uint64 extentOffset,       // IN: extent found or NONE
+                        size_t *payloadSize,       // OUT: size of packet
+                        HgfsSessionInfo *session)  // IN: Session info
+{
+   Bool result = TRUE;
+   HgfsReplySeekExtentV4 *reply;
+
+   HGFS_ASSERT_PACK_PARAMS;
+
+   *payloadSize = 0;
+
+   if (HGFS_OP_SEEK_EXTENT_V4 != op) {
+      NOT_REACHED();
+      result = FALSE;
+   } else {
+      reply = HgfsAllocInitReply(packet, packetHeader, sizeof *reply, session);
+      reply->offset = extentOffset;
+      reply->reserved = 0;
+      *payloadSize = sizeof *reply;
+   }
+   return result;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsUnpackAllocateRequest --
+ *
+ *    Unpack hgfs allocate request and return the file handle, the allocate
+ *    flags and the byte range.
+ *
+ * Results:
+ *    TRUE on success.
+ *    FALSE on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsUnpackAllocateRequest(const void *packet,         // IN: request packet
+                          size_t packetSize,          // IN: request packet size
+                          HgfsOp op,                  // IN: requested operation
+                          HgfsHandle *file,           // OUT: file handle
+                          HgfsAllocateFlags *flags,   // OUT: allocate flags
+                          uint64 *offset,             // OUT: range start
+                          uint64 *length)             // OUT: range length
+{
+   const HgfsRequestAllocateV4 *requestV4 = packet;
+
+   ASSERT(packet);
+   ASSERT(file);
+   ASSERT(flags);
+   ASSERT(offset);
+   ASSERT(length);
+
+   LOG(4, "%s: HGFS_OP_ALLOCATE_V4\n", __FUNCTION__);
+
+   if (HGFS_OP_ALLOCATE_V4 != op || packetSize < sizeof *requestV4) {
+      LOG(4, "%s: Error decoding HGFS packet\n", __FUNCTION__);
+      return FALSE;
+   }
+
+   *file = requestV4->file;
+   *flags = requestV4->flags;
+   *offset = requestV4->offset;
+   *length = requestV4->length;
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPackAllocateReply --
+ *
+ *    Pack hgfs allocate reply.
+ *
+ * Results:
+ *    TRUE if valid op and reply set, FALSE otherwise.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsPackAllocateReply(HgfsPacket *packet,        // IN/OUT: Hgfs Packet
+                      const void *packetHeader,  // IN: packet header
+                      HgfsOp op,                 // IN: requested operation
+                      size_t *payloadSize,       // OUT: size of packet
+                      HgfsSessionInfo *session)  // IN: Session info
+{
+   Bool result = TRUE;
+   HgfsReplyAllocateV4 *reply;
+
+   HGFS_ASSERT_PACK_PARAMS;
+
+   *payloadSize = 0;
+
+   if (HGFS_OP_ALLOCATE_V4 != op) {
+      NOT_REACHED();
+      result = FALSE;
+   } else {
+      reply = HgfsAllocInitReply(packet, packetHeader, sizeof *reply, session);
+      reply->reserved = 0;
+      *payloadSize = sizeof *reply;
+   }
+   return result;
+}
@@ -350,6 +350,106 @@ HgfsPackChangeNotificationRequest(void *packet,                    // IN/OUT: Hg
                                   uint32 notifyFlags,              // IN: notify flags
                                   HgfsSessionInfo *session,        // IN: session
                                   size_t *bufferSize);             // IN/OUT: packet size
+size_t
+HgfsPackGetOplockBreakSize(void);
+Bool
+HgfsPackOplockBreakRequest(void *packet,                    // IN/OUT: Hgfs Packet
+                           HgfsHandle fileId,               // IN: file ID
+                           HgfsLockType serverLock,         // IN: lock type
+                           uint64 sessionId,                // IN: session ID
+                           size_t *bufferSize);             // IN/OUT: size of packet
+Bool
+HgfsUnpackOplockBreakAckReply(const void *packet,            // IN: HGFS packet
+                              size_t packetSize,             // IN: reply packet size
+                              HgfsOp op,                     // IN: operation version
+                              HgfsHandle *fileId,            // OUT: file Id to remove
+                              HgfsLockType *serverLock);     // OUT: lock type
+
+Bool
+HgfsUnpackCompoundRequest(const void *packet,      // IN: HGFS packet
+                          size_t packetSize,       // IN: request packet size
+                          HgfsOp op,               // IN: requested operation
+                          uint32 *numEntries,      // OUT: number of sub-requests
+                          const void **entries,    // OUT: first sub-request entry
+                          size_t *entriesSize);    // OUT: size of all the entries
+Bool
+HgfsUnpackCompoundEntry(const void **entries,    // IN/OUT: sub-request entry
+                        size_t *entriesSize,     // IN/OUT: size of the entries
+                        HgfsOp *op,              // OUT: sub-request operation
+                        uint32 *flags,           // OUT: sub-request flags
+                        const void **args,       // OUT: sub-request arguments
+                        size_t *argsSize);       // OUT: size of the arguments
+Bool
+HgfsPackCompoundEntryHandle(HgfsOp op,          // IN: sub-request operation
+                            HgfsHandle file,    // IN: file handle to use
+                            size_t argsSize,    // IN: size of the arguments
+                            void *args);        // IN/OUT: sub-request arguments
+size_t
+HgfsPackCompoundReplyEntry(HgfsOp op,               // IN: sub-request operation
+                           uint32 index,            // IN: sub-request index
+                           HgfsStatus status,       // IN: sub-request status
+                           const void *replyArgs,   // IN: sub-reply arguments
+                           size_t replyArgsSize,    // IN: size of the arguments
+                           size_t bufferSize,       // IN: size of the buffer
+                           void *buffer);           // OUT: packed entry
+Bool
+HgfsPackCompoundReply(HgfsPacket *packet,        // IN/OUT: Hgfs Packet
+                      const void *packetHeader,  // IN: packet header
+                      HgfsOp op,                 // IN: operation code
+                      uint32 numEntries,         // IN: number of sub-replies
+                      const void *entries,       // IN: packed sub-replies
+                      size_t entriesSize,        // IN: size of the sub-replies
+                      size_t *payloadSize,       // OUT: size of packet
+                      HgfsSessionInfo *session); // IN: Session info
+
+Bool
+HgfsUnpackCopyFileRequest(const void *packet,         // IN: request packet
+                          size_t packetSize,          // IN: request packet size
+                          HgfsOp op,                  // IN: requested operation
+                          const char **cpSrcName,     // OUT: copy src
+                          size_t *cpSrcNameLen,       // OUT: copy src size
+                          const char **cpTargetName,  // OUT: copy dst
+                          size_t *cpTargetNameLen,    // OUT: copy dst size
+                          HgfsCopyFileHint *hints,    // OUT: copy hints
+                          HgfsHandle *srcFile,        // OUT: src file handle
+                          HgfsHandle *targetFile,     // OUT: target file handle
+                          uint32 *srcCaseFlags,       // OUT: source case flags
+                          uint32 *targetCaseFlags);   // OUT: dest. case flags
+Bool
+HgfsPackCopyFileReply(HgfsPacket *packet,        // IN/OUT: Hgfs Packet
+                      const void *packetHeader,  // IN: packet header
+                      HgfsOp op,                 // IN: requested operation
+                      uint64 bytesCopied,        // IN: size of the copied data
+                      size_t *payloadSize,       // OUT: size of packet
+                      HgfsSessionInfo *session); // IN: Session info
+Bool
+HgfsUnpackSeekExtentRequest(const void *packet,         // IN: request packet
+                            size_t packetSize,          // IN: request packet size
+                            HgfsOp op,                  // IN: requested operation
+                            HgfsHandle *file,           // OUT: file handle
+                            HgfsSeekExtentType *type,   // OUT: data or hole
+                            uint64 *offset);            // OUT: offset to look from
+Bool
+HgfsPackSeekExtentReply(HgfsPacket *packet,        // IN/OUT: Hgfs Packet
+                        const void *packetHeader,  // IN: packet header
+                        HgfsOp op,                 // IN: requested operation
+                        uint64 extentOffset,       // IN: extent found or NONE
+                        size_t *payloadSize,       // OUT: size of packet
+                        HgfsSessionInfo *session); // IN: Session info
+Bool
+HgfsUnpackAllocateRequest(const void *packet,         // IN: request packet
+                          size_t packetSize,          // IN: request packet size
+                          HgfsOp op,                  // IN: requested operation
+                          HgfsHandle *file,           // OUT: file handle
+                          HgfsAllocateFlags *flags,   // OUT: allocate flags
+                          uint64 *offset,             // OUT: range start
+                          uint64 *length);            // OUT: range length
+Bool
+HgfsPackAllocateReply(HgfsPacket *packet,        // IN/OUT: Hgfs Packet
+                      const void *packetHeader,  // IN: packet header
+                      HgfsOp op,                 // IN: requested operation
+                      size_t *payloadSize,       // OUT: size of packet
+                      HgfsSessionInfo *session); // IN: Session info
 
 
 #endif // ifndef _HGFS_SERVER_PARAMETERS_H_
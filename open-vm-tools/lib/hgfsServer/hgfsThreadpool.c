@@ -0,0 +1,522 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * hgfsThreadpool.c --
+ *
+ *	POSIX threadpool used by the HGFS server to process asynchronous
+ *	requests.
+ *
+ *	Work items are queued per session. Sessions with pending items are
+ *	kept on a ready list which the workers service round robin, one item
+ *	at a time, so a session flooding the server with slow requests cannot
+ *	starve the others. The number of queued items is bounded both in total
+ *	and per session; items over the limit are refused and the caller
+ *	processes them inline, which throttles the client naturally.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "vmware.h"
+#include "vm_basic_types.h"
+#include "dbllnklst.h"
+#include "hashTable.h"
+#include "mutexRankLib.h"
+#include "userlock.h"
+#include "util.h"
+
+#include "hgfsProto.h"
+#include "hgfsServer.h"
+#include "hgfsServerInt.h"
+#include "hgfsThreadpool.h"
+
+#define AS_KEY(_x)  ((const void *)(uintptr_t)(_x))
+
+/* Number of buckets of the session queue hash table. */
+#define HGFS_THREADPOOL_SESSION_BUCKETS 64
+
+/* A queued work item. */
+typedef struct HgfsThreadpoolItem {
+   DblLnkLst_Links links;              /* Session queue links. */
+   HgfsThreadpoolWorkItem workItem;    /* Function to run. */
+   void *data;                         /* Argument of workItem. */
+} HgfsThreadpoolItem;
+
+/* The queued work items of a session. Exists only while non-empty. */
+typedef struct HgfsThreadpoolQueue {
+   DblLnkLst_Links links;              /* Ready list links. */
+   HgfsSessionInfo *session;           /* Owning session (hash key). */
+   DblLnkLst_Links items;              /* FIFO of HgfsThreadpoolItem. */
+   uint32 depth;                       /* Number of items. */
+} HgfsThreadpoolQueue;
+
+typedef struct HgfsThreadpool {
+   MXUserExclLock *lock;               /* Protects all of the below. */
+   MXUserCondVar *workAvailable;       /* Signalled when items are queued. */
+   MXUserCondVar *idle;                /* Signalled when all work is done. */
+   DblLnkLst_Links readyQueues;        /* Session queues, round robin. */
+   HashTable *sessionQueues;           /* HgfsSessionInfo * -> queue. */
+   pthread_t workers[HGFS_THREADPOOL_MAX_COUNT];
+   uint32 numWorkers;                  /* Configured number of workers. */
+   uint32 numRunning;                  /* Number of workers started. */
+   Bool active;                        /* Accepting new work items. */
+   Bool exiting;                       /* Workers should terminate. */
+   HgfsThreadpoolStats stats;
+} HgfsThreadpool;
+
+static HgfsThreadpool *gHgfsThreadpool = NULL;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpoolDequeue --
+ *
+ *    Take the next work item, round robin between the sessions.
+ *
+ *    The threadpool lock must be held and there must be queued work.
+ *
+ * Results:
+ *    The work item, which the caller must free.
+ *
+ * Side effects:
+ *    The session queue is moved to the end of the ready list, or freed if it
+ *    has become empty.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsThreadpoolItem *
+HgfsThreadpoolDequeue(HgfsThreadpool *pool) // IN/OUT
+{
+   HgfsThreadpoolQueue *queue;
+   HgfsThreadpoolItem *item;
+
+   ASSERT(DblLnkLst_IsLinked(&pool->readyQueues));
+
+   queue = DblLnkLst_Container(pool->readyQueues.next,
+                               HgfsThreadpoolQueue, links);
+   ASSERT(queue->depth > 0);
+
+   item = DblLnkLst_Container(queue->items.next, HgfsThreadpoolItem, links);
+   DblLnkLst_Unlink1(&item->links);
+   queue->depth--;
+   pool->stats.queueDepth--;
+
+   DblLnkLst_Unlink1(&queue->links);
+   if (queue->depth > 0) {
+      DblLnkLst_LinkLast(&pool->readyQueues, &queue->links);
+   } else {
+      HashTable_Delete(pool->sessionQueues, AS_KEY(queue->session));
+      pool->stats.numSessionQueues--;
+      free(queue);
+   }
+
+   return item;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpoolWorker --
+ *
+ *    Worker thread main loop: run queued work items until the threadpool
+ *    exits. Queued work is always drained before a worker terminates.
+ *
+ * Results:
+ *    NULL.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void *
+HgfsThreadpoolWorker(void *data) // IN: threadpool
+{
+   HgfsThreadpool *pool = data;
+
+   MXUser_AcquireExclLock(pool->lock);
+   for (;;) {
+      HgfsThreadpoolItem *item;
+
+      while (!DblLnkLst_IsLinked(&pool->readyQueues) && !pool->exiting) {
+         MXUser_WaitCondVarExclLock(pool->lock, pool->workAvailable);
+      }
+
+      if (!DblLnkLst_IsLinked(&pool->readyQueues)) {
+         break;
+      }
+
+      item = HgfsThreadpoolDequeue(pool);
+      pool->stats.numBusyWorkers++;
+      MXUser_ReleaseExclLock(pool->lock);
+
+      item->workItem(item->data);
+      free(item);
+
+      MXUser_AcquireExclLock(pool->lock);
+      pool->stats.numBusyWorkers--;
+      pool->stats.numCompleted++;
+      if (   pool->stats.queueDepth == 0
+          && pool->stats.numBusyWorkers == 0) {
+         MXUser_BroadcastCondVar(pool->idle);
+      }
+   }
+   MXUser_ReleaseExclLock(pool->lock);
+
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpoolStopWorkers --
+ *
+ *    Stop and reap all the worker threads once they have drained the queue.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsThreadpoolStopWorkers(HgfsThreadpool *pool) // IN/OUT
+{
+   uint32 numRunning;
+   uint32 i;
+
+   MXUser_AcquireExclLock(pool->lock);
+   pool->active = FALSE;
+   pool->exiting = TRUE;
+   numRunning = pool->numRunning;
+   MXUser_BroadcastCondVar(pool->workAvailable);
+   MXUser_ReleaseExclLock(pool->lock);
+
+   for (i = 0; i < numRunning; i++) {
+      pthread_join(pool->workers[i], NULL);
+   }
+
+   MXUser_AcquireExclLock(pool->lock);
+   pool->numRunning = 0;
+   pool->stats.numWorkers = 0;
+   pool->exiting = FALSE;
+   MXUser_ReleaseExclLock(pool->lock);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpool_Init --
+ *
+ *    Initialization of the threadpool component. The worker threads are
+ *    started on the first activation.
+ *
+ * Results:
+ *    0 if success, error code otherwise.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsInternalStatus
+HgfsThreadpool_Init(uint32 numWorkers) // IN: number of workers, 0 for default
+{
+   HgfsThreadpool *pool;
+
+   ASSERT(gHgfsThreadpool == NULL);
+
+   if (numWorkers == 0) {
+      numWorkers = HGFS_THREADPOOL_DEFAULT_COUNT;
+   }
+
+   pool = Util_SafeCalloc(1, sizeof *pool);
+   pool->lock = MXUser_CreateExclLock("HgfsThreadpoolLock",
+                                      RANK_hgfsThreadpoolLock);
+   pool->workAvailable = MXUser_CreateCondVarExclLock(pool->lock);
+   pool->idle = MXUser_CreateCondVarExclLock(pool->lock);
+   DblLnkLst_Init(&pool->readyQueues);
+   pool->sessionQueues = HashTable_Alloc(HGFS_THREADPOOL_SESSION_BUCKETS,
+                                         HASH_INT_KEY, NULL);
+   pool->numWorkers = MIN(numWorkers, HGFS_THREADPOOL_MAX_COUNT);
+
+   gHgfsThreadpool = pool;
+
+   Log("%s: threadpool with %u workers\n", __FUNCTION__, pool->numWorkers);
+   return HGFS_ERROR_SUCCESS;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpool_Activate --
+ *
+ *    Activate the threadpool: start the worker threads if they are not
+ *    running yet and accept new work items.
+ *
+ * Results:
+ *    TRUE if at least one worker is running, FALSE otherwise.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsThreadpool_Activate(void)
+{
+   HgfsThreadpool *pool = gHgfsThreadpool;
+   Bool result;
+
+   ASSERT(pool != NULL);
+
+   MXUser_AcquireExclLock(pool->lock);
+
+   while (pool->numRunning < pool->numWorkers) {
+      int err = pthread_create(&pool->workers[pool->numRunning], NULL,
+                               HgfsThreadpoolWorker, pool);
+      if (err != 0) {
+         Log("%s: failed to start worker %u: %d\n", __FUNCTION__,
+             pool->numRunning, err);
+         break;
+      }
+      pool->numRunning++;
+   }
+   pool->stats.numWorkers = pool->numRunning;
+
+   result = pool->numRunning > 0;
+   pool->active = result;
+
+   MXUser_ReleaseExclLock(pool->lock);
+
+   return result;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpool_Deactivate --
+ *
+ *    Deactivate the threadpool: refuse new work items and wait until all
+ *    the queued and running work items are done. The workers are kept for
+ *    a later reactivation.
+ *
+ *    Must not be called from a work item.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsThreadpool_Deactivate(void)
+{
+   HgfsThreadpool *pool = gHgfsThreadpool;
+
+   ASSERT(pool != NULL);
+
+   MXUser_AcquireExclLock(pool->lock);
+   pool->active = FALSE;
+   while (pool->stats.queueDepth > 0 || pool->stats.numBusyWorkers > 0) {
+      MXUser_WaitCondVarExclLock(pool->lock, pool->idle);
+   }
+   MXUser_ReleaseExclLock(pool->lock);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpool_Exit --
+ *
+ *    Exit for the threadpool component: drain the queue, stop the workers
+ *    and free the threadpool.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsThreadpool_Exit(void)
+{
+   HgfsThreadpool *pool = gHgfsThreadpool;
+
+   if (pool == NULL) {
+      return;
+   }
+
+   HgfsThreadpoolStopWorkers(pool);
+
+   ASSERT(!DblLnkLst_IsLinked(&pool->readyQueues));
+   ASSERT(HashTable_GetNumElements(pool->sessionQueues) == 0);
+
+   Log("%s: queued %"FMT64"u, completed %"FMT64"u, rejected %"FMT64"u, "
+       "max queue depth %u\n", __FUNCTION__, pool->stats.numQueued,
+       pool->stats.numCompleted, pool->stats.numRejected,
+       pool->stats.maxQueueDepth);
+
+   HashTable_Free(pool->sessionQueues);
+   MXUser_DestroyCondVar(pool->idle);
+   MXUser_DestroyCondVar(pool->workAvailable);
+   MXUser_DestroyExclLock(pool->lock);
+   free(pool);
+
+   gHgfsThreadpool = NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpool_QueueWorkItem --
+ *
+ *    Queue a work item on behalf of a session, to be executed by the next
+ *    available worker.
+ *
+ * Results:
+ *    TRUE if the work item is queued successfully,
+ *    FALSE if the work item is not queued: the threadpool is inactive or
+ *    the total or session queue depth limit has been reached. The caller
+ *    then remains responsible for executing the work item.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsThreadpool_QueueWorkItem(HgfsThreadpoolWorkItem workItem, // IN
+                             void *data,                      // IN
+                             HgfsSessionInfo *session)        // IN
+{
+   HgfsThreadpool *pool = gHgfsThreadpool;
+   HgfsThreadpoolQueue *queue = NULL;
+   HgfsThreadpoolItem *item;
+   Bool queued = FALSE;
+
+   ASSERT(pool != NULL);
+   ASSERT(workItem != NULL);
+
+   item = Util_SafeMalloc(sizeof *item);
+   DblLnkLst_Init(&item->links);
+   item->workItem = workItem;
+   item->data = data;
+
+   MXUser_AcquireExclLock(pool->lock);
+
+   if (   !pool->active
+       || pool->stats.queueDepth >= HGFS_THREADPOOL_MAX_QUEUE_DEPTH) {
+      goto exit;
+   }
+
+   if (HashTable_Lookup(pool->sessionQueues, AS_KEY(session),
+                        (void **)&queue)) {
+      if (queue->depth >= HGFS_THREADPOOL_MAX_SESSION_QUEUE_DEPTH) {
+         goto exit;
+      }
+   } else {
+      queue = Util_SafeMalloc(sizeof *queue);
+      DblLnkLst_Init(&queue->links);
+      DblLnkLst_Init(&queue->items);
+      queue->session = session;
+      queue->depth = 0;
+      HashTable_Insert(pool->sessionQueues, AS_KEY(session), queue);
+      DblLnkLst_LinkLast(&pool->readyQueues, &queue->links);
+      pool->stats.numSessionQueues++;
+   }
+
+   DblLnkLst_LinkLast(&queue->items, &item->links);
+   queue->depth++;
+   pool->stats.queueDepth++;
+   pool->stats.numQueued++;
+   if (pool->stats.queueDepth > pool->stats.maxQueueDepth) {
+      pool->stats.maxQueueDepth = pool->stats.queueDepth;
+   }
+   MXUser_SignalCondVar(pool->workAvailable);
+   queued = TRUE;
+
+exit:
+   if (!queued) {
+      pool->stats.numRejected++;
+   }
+   MXUser_ReleaseExclLock(pool->lock);
+
+   if (!queued) {
+      free(item);
+   }
+
+   return queued;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpool_GetStats --
+ *
+ *    Get a snapshot of the threadpool statistics.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsThreadpool_GetStats(HgfsThreadpoolStats *stats) // OUT
+{
+   HgfsThreadpool *pool = gHgfsThreadpool;
+
+   ASSERT(stats != NULL);
+
+   if (pool == NULL) {
+      memset(stats, 0, sizeof *stats);
+      return;
+   }
+
+   MXUser_AcquireExclLock(pool->lock);
+   *stats = pool->stats;
+   MXUser_ReleaseExclLock(pool->lock);
+}
@@ -36,14 +36,39 @@
  */
 #define HGFS_THREADPOOL_MAX_COUNT 10
 
+/* Worker count used when the server configuration does not specify one. */
+#define HGFS_THREADPOOL_DEFAULT_COUNT 4
+
+/*
+ * Bounds on the number of queued (not yet running) work items, in total and
+ * per session. Work items beyond these are refused and the caller is
+ * expected to process them inline.
+ */
+#define HGFS_THREADPOOL_MAX_QUEUE_DEPTH          256
+#define HGFS_THREADPOOL_MAX_SESSION_QUEUE_DEPTH  64
+
 typedef void(*HgfsThreadpoolWorkItem)(void *data);
 
-HgfsInternalStatus HgfsThreadpool_Init(void);
+typedef struct HgfsThreadpoolStats {
+   uint32 numWorkers;        /* Number of worker threads running. */
+   uint32 numBusyWorkers;    /* Number of workers executing an item. */
+   uint32 queueDepth;        /* Number of items waiting for a worker. */
+   uint32 maxQueueDepth;     /* High-water mark of queueDepth. */
+   uint32 numSessionQueues;  /* Number of sessions with items waiting. */
+   uint64 numQueued;         /* Total number of items accepted. */
+   uint64 numCompleted;      /* Total number of items executed. */
+   uint64 numRejected;       /* Total number of items refused. */
+} HgfsThreadpoolStats;
+
+HgfsInternalStatus HgfsThreadpool_Init(uint32 numWorkers);
 
 Bool HgfsThreadpool_Activate(void);
 void HgfsThreadpool_Deactivate(void);
 
 void HgfsThreadpool_Exit(void);
-Bool HgfsThreadpool_QueueWorkItem(HgfsThreadpoolWorkItem workItem, void *data);
+Bool HgfsThreadpool_QueueWorkItem(HgfsThreadpoolWorkItem workItem,
+                                  void *data,
+                                  HgfsSessionInfo *session);
+void HgfsThreadpool_GetStats(HgfsThreadpoolStats *stats);
 
 #endif // _HGFS_THREADPOOL_H
@@ -22,6 +22,8 @@
  *	Stubs for threadpool support, used to build guest components.
  */
 
+#include <string.h>
+
 #include "vmware.h"
 #include "vm_basic_types.h"
 #include "util.h"
@@ -47,7 +49,7 @@
  */
 
 HgfsInternalStatus
-HgfsThreadpool_Init(void)
+HgfsThreadpool_Init(uint32 numWorkers) // IN: number of worker threads
 {
    return HGFS_ERROR_NOT_SUPPORTED;
 }
@@ -139,8 +141,32 @@ HgfsThreadpool_Exit(void)
 
 Bool
 HgfsThreadpool_QueueWorkItem(HgfsThreadpoolWorkItem workItem, // IN
-                             void *data)                      // IN
+                             void *data,                      // IN
+                             HgfsSessionInfo *session)        // IN
 {
    return FALSE;
 }
 
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpool_GetStats --
+ *
+ *    Get the threadpool statistics.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsThreadpool_GetStats(HgfsThreadpoolStats *stats) // OUT
+{
+   memset(stats, 0, sizeof *stats);
+}
+
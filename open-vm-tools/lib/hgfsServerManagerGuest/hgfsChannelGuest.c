@@ -96,9 +96,23 @@ static HgfsChannelData gHgfsChannels[] = {
    { "guest", &gGuestBackdoorOps, 0, NULL, NULL, {0} },
 };
 
+/*
+ * The guest only serves the backdoor channel, which is synchronous: the
+ * reply must be in the packet before the RPC returns. It does not have the
+ * HGFS_CHANNEL_ASYNC capability, so the server never dispatches requests
+ * to its threadpool here and HGFS_CONFIG_THREADPOOL_ENABLED is not set.
+ *
+ * Neither does it have HGFS_CHANNEL_SHARED_MEM, which the server needs to
+ * send oplock break requests, so no oplocks are granted to guest clients
+ * whatever the configuration. HGFS_CONFIG_OPLOCK_ENABLED and
+ * HGFS_CONFIG_OPLOCK_MONITOR_ENABLED are not set either: the monitor would
+ * take leases and handle SIGIO in the tools service process only to feed
+ * the per-session symlink and attribute caches.
+ */
 static HgfsServerConfig gHgfsGuestCfgSettings = {
    (HGFS_CONFIG_SHARE_ALL_HOST_DRIVES_ENABLED | HGFS_CONFIG_VOL_INFO_MIN),
-   HGFS_MAX_CACHED_FILENODES
+   HGFS_MAX_CACHED_FILENODES,
+   0
 };
 
 /* HGFS server info state. Referenced by each separate channel that uses it. */
@@ -342,6 +342,10 @@ static Bool
 HgfsChannelGuestConnConnect(HgfsGuestConn *connData)  // IN: our connection data
 {
    Bool result;
+   /*
+    * No HGFS_CHANNEL_ASYNC: the TCLO RPC carrying a request returns its
+    * reply, so requests cannot complete after the receive callback.
+    */
    static HgfsServerChannelData HgfsBdCapData = {
       0,
       HGFS_LARGE_PACKET_MAX
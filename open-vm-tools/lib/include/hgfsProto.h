@@ -147,6 +147,18 @@ typedef enum {
    HGFS_OP_QUERY_EAS_V4,          /* Query extended attributes. */
    HGFS_OP_SET_EAS_V4,            /* Add or modify extended attributes. */
 
+   /*
+    * Extensions of the open-vm-tools server. Their values are simply the
+    * next free ones after HGFS_OP_SET_EAS_V4, in the order they were added,
+    * and hosts which predate them do not know them. A server which handles
+    * them lists them with HGFS_OP_CAPFLAG_IS_SUPPORTED in its create session
+    * reply, and a client must not send them to a server which did not.
+    */
+   HGFS_OP_COMPOUND_V4,           /* Sequence of requests in a single packet. */
+   HGFS_OP_COPY_FILE_V4,          /* Copy a file on the server. */
+   HGFS_OP_SEEK_EXTENT_V4,        /* Find the next data or hole of a file. */
+   HGFS_OP_ALLOCATE_V4,           /* Allocate or punch a hole in a file. */
+
    HGFS_OP_MAX,                   /* Dummy op, must be last in enum */
    HGFS_OP_NEW_HEADER = 0xff,     /* Header op, must be unique, distinguishes packet headers. */
 } HgfsOp;
@@ -2451,4 +2463,143 @@ typedef struct HgfsReplyDeleteFileV4 {
 } HgfsReplyDeleteFileV4;
 #pragma pack(pop)
 
+/*
+ * A compound request carries a sequence of V3 sub-requests which the server
+ * processes in order, returning all their replies in a single reply, so that
+ * for example opening, getting the attributes of, reading and closing a small
+ * file takes one round trip rather than four. Supported sub-requests are
+ * HGFS_OP_OPEN_V3, HGFS_OP_GETATTR_V3, HGFS_OP_READ_V3 and HGFS_OP_CLOSE_V3.
+ *
+ * Each sub-request entry is followed by its V3 request arguments. A sub-request
+ * flagged with HGFS_COMPOUND_ENTRY_USE_OPEN_HANDLE uses the file handle returned
+ * by the last open of the compound in place of the one in its arguments.
+ *
+ * Processing stops at the first sub-request that fails, except that later
+ * sub-requests flagged HGFS_COMPOUND_ENTRY_ALWAYS (e.g. a close) still run.
+ * The reply holds an entry, followed by its V3 reply arguments, for each
+ * sub-request processed; the index identifies the sub-request.
+ */
+
+#define HGFS_COMPOUND_MAX_ENTRIES            16
+
+#define HGFS_COMPOUND_ENTRY_USE_OPEN_HANDLE  (1 << 0)
+#define HGFS_COMPOUND_ENTRY_ALWAYS           (1 << 1)
+
+#pragma pack(push, 1)
+typedef struct HgfsCompoundRequestEntryV4 {
+   HgfsOp op;                /* Sub-request operation. */
+   uint32 flags;             /* Flags described above. */
+   uint32 size;              /* Size of the request arguments that follow. */
+   uint32 reserved;          /* Reserved for future use */
+} HgfsCompoundRequestEntryV4;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct HgfsRequestCompoundV4 {
+   uint32 numEntries;        /* Number of sub-request entries that follow. */
+   uint32 reserved1;         /* Reserved for future use */
+   uint64 reserved;          /* Reserved for future use */
+} HgfsRequestCompoundV4;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct HgfsCompoundReplyEntryV4 {
+   HgfsOp op;                /* Sub-request operation. */
+   uint32 index;             /* Index of the sub-request in the request. */
+   uint32 size;              /* Size of the reply arguments that follow. */
+   uint32 status;            /* Result of the sub-request. */
+} HgfsCompoundReplyEntryV4;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct HgfsReplyCompoundV4 {
+   uint32 numEntries;        /* Number of sub-reply entries that follow. */
+   uint32 reserved1;         /* Reserved for future use */
+   uint64 reserved;          /* Reserved for future use */
+} HgfsReplyCompoundV4;
+#pragma pack(pop)
+
+/*
+ * Server side file copy. The server copies the source file contents into the
+ * target file, creating it if needed, without the data crossing the transport.
+ * As for a rename, either file may be given by name or by an open handle and
+ * the names are packed one after the other.
+ */
+
+typedef uint32 HgfsCopyFileHint;
+#define HGFS_COPY_FILE_HINT_USE_SRCFILE_DESC     (1 << 0)
+#define HGFS_COPY_FILE_HINT_USE_TARGETFILE_DESC  (1 << 1)
+#define HGFS_COPY_FILE_HINT_NO_REPLACE_EXISTING  (1 << 2)
+
+#pragma pack(push, 1)
+typedef struct HgfsRequestCopyFileV4 {
+   HgfsCopyFileHint hints;
+   uint32 reserved1;             /* Reserved for future use */
+   uint64 reserved;              /* Reserved for future use */
+   HgfsFileNameV3 srcName;
+   HgfsFileNameV3 targetName;
+} HgfsRequestCopyFileV4;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct HgfsReplyCopyFileV4 {
+   uint64 bytesCopied;           /* Size of the copied data. */
+   uint64 reserved;              /* Reserved for future use */
+} HgfsReplyCopyFileV4;
+#pragma pack(pop)
+
+/*
+ * Sparse file extents. Seek extent finds the offset of the first data or hole
+ * at or after the given offset of an open file, as lseek(2) with SEEK_DATA or
+ * SEEK_HOLE does. HGFS_SEEK_EXTENT_NONE is returned when there is no data at
+ * or after the offset, or when the offset is at or past the end of the file.
+ */
+
+typedef uint32 HgfsSeekExtentType;
+#define HGFS_SEEK_EXTENT_DATA    0
+#define HGFS_SEEK_EXTENT_HOLE    1
+
+#define HGFS_SEEK_EXTENT_NONE    MAX_UINT64
+
+#pragma pack(push, 1)
+typedef struct HgfsRequestSeekExtentV4 {
+   HgfsHandle file;              /* Opaque file ID used by the server */
+   HgfsSeekExtentType type;
+   uint64 offset;                /* Offset to start looking from */
+   uint64 reserved;              /* Reserved for future use */
+} HgfsRequestSeekExtentV4;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct HgfsReplySeekExtentV4 {
+   uint64 offset;                /* Start of the extent found, or NONE. */
+   uint64 reserved;              /* Reserved for future use */
+} HgfsReplySeekExtentV4;
+#pragma pack(pop)
+
+/*
+ * Allocate the storage of a byte range of an open file, or with PUNCH_HOLE
+ * deallocate it, as fallocate(2) does. PUNCH_HOLE requires KEEP_SIZE.
+ */
+
+typedef uint32 HgfsAllocateFlags;
+#define HGFS_ALLOCATE_KEEP_SIZE    (1 << 0)
+#define HGFS_ALLOCATE_PUNCH_HOLE   (1 << 1)
+
+#pragma pack(push, 1)
+typedef struct HgfsRequestAllocateV4 {
+   HgfsHandle file;              /* Opaque file ID used by the server */
+   HgfsAllocateFlags flags;
+   uint64 offset;
+   uint64 length;
+   uint64 reserved;              /* Reserved for future use */
+} HgfsRequestAllocateV4;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct HgfsReplyAllocateV4 {
+   uint64 reserved;              /* Reserved for future use */
+} HgfsReplyAllocateV4;
+#pragma pack(pop)
+
 #endif /* _HGFS_PROTO_H_ */
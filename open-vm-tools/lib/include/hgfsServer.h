@@ -131,6 +131,7 @@ typedef uint32 HgfsConfigFlags;
 typedef struct HgfsServerConfig {
    HgfsConfigFlags flags;
    uint32 maxCachedOpenNodes;
+   uint32 numThreadpoolWorkers;  /* 0 selects the threadpool default. */
 }HgfsServerConfig;
 
 /*
@@ -223,6 +224,59 @@ Bool HgfsServer_ShareAccessCheck(HgfsOpenMode accessMode,
 uint32 HgfsServer_GetHandleCounter(void);
 void HgfsServer_SetHandleCounter(uint32 newHandleCounter);
 
+/* Data throughput counters, in bytes since the server was loaded. */
+typedef struct HgfsServerIoStats {
+   uint64 readBytes;          /* Data read for clients. */
+   uint64 readZeroCopyBytes;  /* Read directly into the guest buffers. */
+   uint64 readCopiedBytes;    /* Read via an intermediate buffer and copied. */
+   uint64 writeBytes;         /* Data written for clients. */
+} HgfsServerIoStats;
+
+void HgfsServer_GetIoStats(HgfsServerIoStats *stats);
+
+/*
+ * Per operation counters, since the server was loaded. Latencies are kept as
+ * a histogram of power of 2 microsecond buckets: bucket 0 counts requests
+ * completed in under 1us, bucket n those completed in [2^(n-1), 2^n) us and
+ * the last bucket is open ended.
+ */
+#define HGFS_SERVER_LATENCY_BUCKETS 24
+
+typedef struct HgfsServerOpStats {
+   uint64 count;        /* Requests completed. */
+   uint64 errors;       /* Requests completed with an error status. */
+   uint64 bytes;        /* Request and reply bytes, data buffers included. */
+   uint64 totalUsecs;   /* Sum of the request latencies. */
+   uint64 latency[HGFS_SERVER_LATENCY_BUCKETS];
+} HgfsServerOpStats;
+
+Bool HgfsServer_GetOpStats(uint32 op, HgfsServerOpStats *stats);
+uint64 HgfsServer_OpStatsPercentile(const HgfsServerOpStats *stats,
+                                    uint32 percentile);
+
+/*
+ * Recycled buffer pools: the request input parameters and the reply buffers
+ * allocated for channels which cannot reply in place (e.g. sockets). Replies
+ * up to HGFS_PACKET_MAX and HGFS_LARGE_PACKET_MAX use separate pools.
+ */
+typedef enum {
+   HGFS_SERVER_POOL_INPUT_PARAMS,
+   HGFS_SERVER_POOL_REPLIES,
+   HGFS_SERVER_POOL_LARGE_REPLIES,
+   HGFS_SERVER_POOL_MAX
+} HgfsServerPool;
+
+typedef struct HgfsServerPoolStats {
+   uint64 allocs;       /* Buffers handed out. */
+   uint64 hits;         /* Buffers handed out from the pool. */
+   uint64 frees;        /* Buffers given back. */
+   uint64 drops;        /* Buffers given back to a full pool, hence freed. */
+   uint32 numFree;      /* Buffers currently in the pool. */
+   uint32 highWater;    /* Most buffers ever in the pool. */
+} HgfsServerPoolStats;
+
+Bool HgfsServer_GetPoolStats(uint32 pool, HgfsServerPoolStats *stats);
+
 #if defined(__cplusplus)
 }  // extern "C"
 #endif
@@ -65,6 +65,11 @@ extern "C" {
 #define RANK_hgfsNodeArrayLock       (RANK_libLockBase + 0x4070)
 #define RANK_hgfsActivateLock        (RANK_libLockBase + 0x4080)
 #define RANK_hgfsThreadpoolLock      (RANK_libLockBase + 0x4090)
+#define RANK_hgfsCaseIndexLock       (RANK_libLockBase + 0x4098)
+#define RANK_hgfsFdCacheLock         (RANK_libLockBase + 0x409c)
+#define RANK_hgfsCacheLock           (RANK_libLockBase + 0x40a0)
+#define RANK_hgfsOplockLock          (RANK_libLockBase + 0x40b0)
+#define RANK_hgfsBufferPoolLock      (RANK_libLockBase + 0x40c0)
 
 #define RANK_nfcLibAioCtxLock        (RANK_libLockBase + 0x4300)
 
@@ -32,6 +32,7 @@
 #define G_LOG_DOMAIN "hgfsd"
 
 #include "hgfs.h"
+#include "hgfsServer.h"
 #include "hgfsServerManager.h"
 #include "vm_basic_defs.h"
 #include "vm_assert.h"
@@ -91,6 +92,46 @@ HgfsServerShutdown(gpointer src,
 }
 
 
+/**
+ * Logs the HGFS server per operation counters and latency percentiles.
+ *
+ * @param[in]  src      The source object.
+ * @param[in]  ctx      Unused.
+ * @param[in]  data     Unused.
+ */
+
+static void
+HgfsServerDumpState(gpointer src,
+                    ToolsAppCtx *ctx,
+                    gpointer data)
+{
+   HgfsServerIoStats ioStats;
+   HgfsServerOpStats opStats;
+   uint32 op;
+
+   HgfsServer_GetIoStats(&ioStats);
+   ToolsCore_LogState(TOOLS_STATE_LOG_PLUGIN,
+                      "HGFS read %"FMT64"u bytes, wrote %"FMT64"u bytes\n",
+                      ioStats.readBytes, ioStats.writeBytes);
+
+   for (op = 0; HgfsServer_GetOpStats(op, &opStats); op++) {
+      if (opStats.count == 0) {
+         continue;
+      }
+      ToolsCore_LogState(TOOLS_STATE_LOG_PLUGIN,
+                         "HGFS op %u: %"FMT64"u requests, %"FMT64"u errors, "
+                         "%"FMT64"u bytes, avg %"FMT64"u us, "
+                         "p50 %"FMT64"u us, p90 %"FMT64"u us, "
+                         "p99 %"FMT64"u us\n",
+                         op, opStats.count, opStats.errors, opStats.bytes,
+                         opStats.totalUsecs / opStats.count,
+                         HgfsServer_OpStatsPercentile(&opStats, 50),
+                         HgfsServer_OpStatsPercentile(&opStats, 90),
+                         HgfsServer_OpStatsPercentile(&opStats, 99));
+   }
+}
+
+
 /**
  * Handles hgfs requests.
  *
@@ -1137,6 +1178,7 @@ ToolsOnLoad(ToolsAppCtx *ctx)
       };
       ToolsPluginSignalCb sigs[] = {
          { TOOLS_CORE_SIG_CAPABILITIES, HgfsServerCapReg, &regData },
+         { TOOLS_CORE_SIG_DUMP_STATE, HgfsServerDumpState, NULL },
          { TOOLS_CORE_SIG_SHUTDOWN, HgfsServerShutdown, &regData }
       };
       ToolsAppReg regs[] = {
@@ -0,0 +1,1746 @@
+/*********************************************************
+ * Copyright (c) 2026 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * hgfsServerBench.c --
+ *
+ *    In-process benchmark for the HGFS server. Requests are handed to a
+ *    server session set up as the guest backdoor channel sets up its own:
+ *    same server configuration, same synchronous channel capabilities and
+ *    same packet layout, so no hypervisor is needed. The guest channel itself
+ *    is not used because it keeps a single reply buffer for all its callers,
+ *    while the contention workload sends requests from several threads at
+ *    once. Synthetic workloads run against a scratch directory of the host
+ *    file system, which the guest server policy exposes through its "root"
+ *    share. The requests sent can be recorded to a trace and replayed later.
+ *
+ *    For each workload the number of requests, requests per second and the
+ *    latency percentiles of the requests are reported. With -l the MXUser
+ *    statistics of the server locks, acquisitions, contention and held
+ *    times, are reported at the end; only statistics builds collect them.
+ *
+ *    Trace format: a header (HgfsBenchTraceHeader) followed by one record per
+ *    request, a uint32 size then the request packet. Replies are not kept.
+ *    Replaying a trace needs the files it refers to, so record with -k to
+ *    keep the scratch directory. The requests of the contention workload are
+ *    not recorded, their order is not reproducible.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "vm_basic_types.h"
+#include "vm_basic_defs.h"
+#include "vm_assert.h"
+#include "hgfs.h"
+#include "hgfsProto.h"
+#include "hgfsServer.h"
+#include "hgfsServerPolicy.h"
+#include "cpName.h"
+#include "hostinfo.h"
+#include "str.h"
+#include "userlock.h"
+
+#define HGFS_BENCH_TRACE_MAGIC      0x31435254u  /* "TRC1" */
+#define HGFS_BENCH_DEFAULT_FILES    1000
+#define HGFS_BENCH_DEFAULT_ITERS    10
+#define HGFS_BENCH_DEFAULT_SIZE     (64 * 1024 * 1024)
+#define HGFS_BENCH_DEFAULT_IO_SIZE  (64 * 1024)
+#define HGFS_BENCH_SMALL_FILE_SIZE  4096
+#define HGFS_BENCH_STATS_LINE_MAX   4096
+#define HGFS_BENCH_DEFAULT_THREADS  4
+#define HGFS_BENCH_MAX_THREADS      64
+
+typedef struct HgfsBenchTraceHeader {
+   uint32 magic;
+   uint32 handleCounter;   /* Server handle counter when recording began. */
+} HgfsBenchTraceHeader;
+
+/* A sender of requests, with its own buffers and statistics. */
+typedef struct HgfsBenchClient {
+   uint32 requestId;
+   uint64 errors;
+   uint64 *latencies;               /* Microseconds, one per request. */
+   size_t numLatencies;
+   size_t maxLatencies;
+
+   char request[HGFS_LARGE_PACKET_MAX];
+   char reply[HGFS_LARGE_PACKET_MAX];
+   size_t replySize;
+} HgfsBenchClient;
+
+typedef struct HgfsBenchThread {
+   pthread_t thread;
+   uint32 index;
+   Bool success;
+   HgfsBenchClient client;
+} HgfsBenchThread;
+
+typedef struct HgfsBenchState {
+   const HgfsServerCallbacks *serverCb;
+   HgfsServerMgrCallbacks mgrCb;
+   HgfsServerChannelCallbacks channelCb;
+   void *session;                   /* Server transport session. */
+
+   char *dir;                       /* Scratch directory, absolute. */
+   uint32 numFiles;
+   uint32 iterations;
+   uint64 fileSize;
+   uint32 ioSize;
+   uint32 numThreads;               /* Threads of the contention workload. */
+   Bool keepFiles;
+   Bool lockStats;                  /* Report the MXUser lock statistics. */
+   FILE *trace;                     /* Requests are recorded if set. */
+
+   HgfsBenchClient client;          /* Sender of the other workloads. */
+} HgfsBenchState;
+
+static HgfsBenchState gBench;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchRecordLatency --
+ *
+ *    Keeps a request latency of a client for the percentiles of the current
+ *    workload.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    May grow the latency array.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsBenchRecordLatency(HgfsBenchClient *client,   // IN/OUT: sender
+                       uint64 usecs)              // IN: request latency
+{
+   if (client->numLatencies == client->maxLatencies) {
+      client->maxLatencies = MAX(client->maxLatencies * 2, 4096);
+      client->latencies = realloc(client->latencies,
+                                  client->maxLatencies * sizeof *client->latencies);
+      if (client->latencies == NULL) {
+         fprintf(stderr, "Out of memory\n");
+         exit(1);
+      }
+   }
+   client->latencies[client->numLatencies++] = usecs;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchChannelSend --
+ *
+ *    Channel send callback of the server session. As on the guest backdoor
+ *    channel the reply is already in the client buffer, its size in the
+ *    packet, so there is only the packet to complete.
+ *
+ * Results:
+ *    Always TRUE.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchChannelSend(void *conn,            // IN: unused
+                     HgfsPacket *packet,    // IN/OUT: request packet
+                     HgfsSendFlags flags)   // IN: send flags
+{
+   if (!(flags & HGFS_SEND_NO_COMPLETE)) {
+      gBench.serverCb->session.sendComplete(packet, gBench.session);
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchProcess --
+ *
+ *    Hands a request packet to the server and times it, packed as the guest
+ *    backdoor channel packs it. The reply is left in the client buffer.
+ *
+ * Results:
+ *    TRUE if the server replied, FALSE otherwise.
+ *
+ * Side effects:
+ *    Records the requests of gBench.client to the trace, if any.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchProcess(HgfsBenchClient *client,   // IN/OUT: sender
+                 char const *packetIn,      // IN: request packet
+                 uint32 packetSize)         // IN: request packet size
+{
+   HgfsPacket packet;
+   VmTimeType start;
+
+   if (gBench.trace != NULL && client == &gBench.client &&
+       (fwrite(&packetSize, sizeof packetSize, 1, gBench.trace) != 1 ||
+        fwrite(packetIn, packetSize, 1, gBench.trace) != 1)) {
+      fprintf(stderr, "Failed to write the trace: %s\n", strerror(errno));
+      exit(1);
+   }
+
+   memset(&packet, 0, sizeof packet);
+   packet.iov[0].va = (void *)packetIn;
+   packet.iov[0].len = packetSize;
+   packet.iovCount = 1;
+   packet.metaPacket = (void *)packetIn;
+   packet.metaPacketDataSize = packetSize;
+   packet.metaPacketSize = packetSize;
+   packet.replyPacket = client->reply;
+   packet.replyPacketSize = sizeof client->reply;
+   packet.state |= HGFS_STATE_CLIENT_REQUEST;
+
+   start = Hostinfo_SystemTimerUS();
+   gBench.serverCb->session.receive(&packet, gBench.session);
+   HgfsBenchRecordLatency(client, Hostinfo_SystemTimerUS() - start);
+
+   client->replySize = packet.replyPacketDataSize;
+   if (client->replySize < sizeof (HgfsReply)) {
+      client->errors++;
+      return FALSE;
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchArgs --
+ *
+ *    The arguments of the request being built, following its header.
+ *
+ * Results:
+ *    Pointer to the request arguments.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void *
+HgfsBenchArgs(HgfsBenchClient *client)   // IN: sender
+{
+   return client->request + sizeof (HgfsRequest);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchSend --
+ *
+ *    Sends the request built in the client buffer: fills in its header and
+ *    checks the reply status.
+ *
+ * Results:
+ *    Pointer to the reply arguments on success, NULL on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void *
+HgfsBenchSend(HgfsBenchClient *client,   // IN/OUT: sender
+              HgfsOp op,                 // IN: request op
+              size_t argsSize)           // IN: size of the request arguments
+{
+   HgfsRequest *header = (HgfsRequest *)client->request;
+   HgfsReply *reply = (HgfsReply *)client->reply;
+
+   header->id = client->requestId++;
+   header->op = op;
+
+   if (!HgfsBenchProcess(client, client->request, sizeof *header + argsSize)) {
+      return NULL;
+   }
+   if (reply->status != HGFS_STATUS_SUCCESS) {
+      client->errors++;
+      return NULL;
+   }
+   return reply + 1;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchFileName --
+ *
+ *    Fills in a request file name for a file of the scratch directory, or
+ *    the directory itself if name is NULL.
+ *
+ * Results:
+ *    The size of the name after the HgfsFileNameV3, 0 on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static size_t
+HgfsBenchFileName(HgfsBenchClient *client,    // IN: sender
+                  char const *name,           // IN: file name, optional
+                  HgfsFileNameV3 *fileName)   // OUT: request file name
+{
+   char path[PATH_MAX];
+   size_t room = client->request + sizeof client->request - fileName->name;
+   int length;
+
+   /* The guest policy root share maps the host root. */
+   Str_Sprintf(path, sizeof path, "/%s%s%s%s", HGFS_SERVER_POLICY_ROOT_SHARE_NAME,
+               gBench.dir, name != NULL ? "/" : "", name != NULL ? name : "");
+   length = CPName_ConvertTo(path, room, fileName->name);
+   if (length < 0) {
+      fprintf(stderr, "Cannot convert \"%s\"\n", path);
+      return 0;
+   }
+
+   fileName->length = length;
+   fileName->flags = 0;
+   fileName->caseType = HGFS_FILE_NAME_CASE_SENSITIVE;
+   fileName->fid = HGFS_INVALID_HANDLE;
+   return length;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchOpen --
+ *
+ *    Opens a file of the scratch directory.
+ *
+ * Results:
+ *    TRUE on success, FALSE on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchOpen(HgfsBenchClient *client,   // IN/OUT: sender
+              char const *name,       // IN: file name
+              HgfsOpenMode mode,      // IN: access mode
+              HgfsOpenFlags flags,    // IN: open flags
+              HgfsHandle *file)       // OUT: file handle
+{
+   HgfsRequestOpenV3 *request = HgfsBenchArgs(client);
+   HgfsReplyOpenV3 *reply;
+   size_t nameSize;
+
+   memset(request, 0, sizeof *request);
+   request->mask = HGFS_OPEN_VALID_MODE | HGFS_OPEN_VALID_FLAGS |
+                   HGFS_OPEN_VALID_OWNER_PERMS | HGFS_OPEN_VALID_FILE_NAME;
+   request->mode = mode;
+   request->flags = flags;
+   request->ownerPerms = HGFS_PERM_READ | HGFS_PERM_WRITE;
+   nameSize = HgfsBenchFileName(client, name, &request->fileName);
+   if (nameSize == 0) {
+      return FALSE;
+   }
+
+   reply = HgfsBenchSend(client, HGFS_OP_OPEN_V3, sizeof *request + nameSize);
+   if (reply == NULL) {
+      return FALSE;
+   }
+   *file = reply->file;
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchClose --
+ *
+ *    Closes a file handle.
+ *
+ * Results:
+ *    TRUE on success, FALSE on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchClose(HgfsBenchClient *client,   // IN/OUT: sender
+               HgfsHandle file)   // IN: file handle
+{
+   HgfsRequestCloseV3 *request = HgfsBenchArgs(client);
+
+   memset(request, 0, sizeof *request);
+   request->file = file;
+   return HgfsBenchSend(client, HGFS_OP_CLOSE_V3, sizeof *request) != NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchRead --
+ *
+ *    Reads from an open file.
+ *
+ * Results:
+ *    Bytes read, or -1 on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int64
+HgfsBenchRead(HgfsBenchClient *client,   // IN/OUT: sender
+              HgfsHandle file,   // IN: file handle
+              uint64 offset,     // IN: file offset
+              uint32 size)       // IN: bytes wanted
+{
+   HgfsRequestReadV3 *request = HgfsBenchArgs(client);
+   HgfsReplyReadV3 *reply;
+
+   memset(request, 0, sizeof *request);
+   request->file = file;
+   request->offset = offset;
+   request->requiredSize = size;
+
+   reply = HgfsBenchSend(client, HGFS_OP_READ_V3, sizeof *request);
+   if (reply == NULL) {
+      return -1;
+   }
+   return reply->actualSize;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchGetattr --
+ *
+ *    Gets the attributes of an open file if file is a valid handle, of a
+ *    file of the scratch directory by name otherwise. A name is looked up
+ *    with the case sensitivity given.
+ *
+ * Results:
+ *    TRUE on success, FALSE on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchGetattr(HgfsBenchClient *client,   // IN/OUT: sender
+                 char const *name,        // IN: file name, if no handle
+                 HgfsHandle file,         // IN: file handle or HGFS_INVALID_HANDLE
+                 HgfsCaseType caseType)   // IN: name case sensitivity
+{
+   HgfsRequestGetattrV3 *request = HgfsBenchArgs(client);
+   size_t nameSize = 0;
+
+   memset(request, 0, sizeof *request);
+   if (file != HGFS_INVALID_HANDLE) {
+      request->hints = HGFS_ATTR_HINT_USE_FILE_DESC;
+      request->fileName.flags = HGFS_FILE_NAME_USE_FILE_DESC;
+      request->fileName.fid = file;
+   } else {
+      nameSize = HgfsBenchFileName(client, name, &request->fileName);
+      if (nameSize == 0) {
+         return FALSE;
+      }
+      request->fileName.caseType = caseType;
+   }
+
+   return HgfsBenchSend(client, HGFS_OP_GETATTR_V3,
+                        sizeof *request + nameSize) != NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchWrite --
+ *
+ *    Writes a pattern to an open file.
+ *
+ * Results:
+ *    Bytes written, or -1 on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int64
+HgfsBenchWrite(HgfsBenchClient *client,   // IN/OUT: sender
+               HgfsHandle file,   // IN: file handle
+               uint64 offset,     // IN: file offset
+               uint32 size)       // IN: bytes to write
+{
+   HgfsRequestWriteV3 *request = HgfsBenchArgs(client);
+   HgfsReplyWriteV3 *reply;
+
+   memset(request, 0, sizeof *request);
+   request->file = file;
+   request->offset = offset;
+   request->requiredSize = size;
+   memset(request->payload, 'h', size);
+
+   reply = HgfsBenchSend(client, HGFS_OP_WRITE_V3, sizeof *request - 1 + size);
+   if (reply == NULL) {
+      return -1;
+   }
+   return reply->actualSize;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchRename --
+ *
+ *    Renames a file of the scratch directory.
+ *
+ * Results:
+ *    TRUE on success, FALSE on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchRename(HgfsBenchClient *client,   // IN/OUT: sender
+                char const *oldName,   // IN: current name
+                char const *newName)   // IN: new name
+{
+   HgfsRequestRenameV3 *request = HgfsBenchArgs(client);
+   HgfsFileNameV3 *newFileName;
+   size_t oldSize;
+   size_t newSize;
+
+   memset(request, 0, sizeof *request);
+   oldSize = HgfsBenchFileName(client, oldName, &request->oldName);
+   if (oldSize == 0) {
+      return FALSE;
+   }
+
+   /* The new name follows the old one, see HgfsUnpackRenamePayloadV3. */
+   newFileName = (HgfsFileNameV3 *)(request->oldName.name + oldSize + 1);
+   newSize = HgfsBenchFileName(client, newName, newFileName);
+   if (newSize == 0) {
+      return FALSE;
+   }
+
+   return HgfsBenchSend(client, HGFS_OP_RENAME_V3,
+                        sizeof *request + oldSize + newSize) != NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchListDir --
+ *
+ *    Enumerates the scratch directory with a search.
+ *
+ * Results:
+ *    Number of entries, or -1 on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int64
+HgfsBenchListDir(HgfsBenchClient *client)   // IN/OUT: sender
+{
+   HgfsRequestSearchOpenV3 *openRequest = HgfsBenchArgs(client);
+   HgfsRequestSearchReadV3 *readRequest = HgfsBenchArgs(client);
+   HgfsRequestSearchCloseV3 *closeRequest = HgfsBenchArgs(client);
+   HgfsReplySearchOpenV3 *openReply;
+   HgfsHandle search;
+   int64 entries = 0;
+   size_t nameSize;
+
+   memset(openRequest, 0, sizeof *openRequest);
+   nameSize = HgfsBenchFileName(client, NULL, &openRequest->dirName);
+   if (nameSize == 0) {
+      return -1;
+   }
+   openReply = HgfsBenchSend(client, HGFS_OP_SEARCH_OPEN_V3,
+                             sizeof *openRequest + nameSize);
+   if (openReply == NULL) {
+      return -1;
+   }
+   search = openReply->search;
+
+   for (;;) {
+      HgfsReplySearchReadV3 *readReply;
+      HgfsDirEntry *dirent;
+
+      memset(readRequest, 0, sizeof *readRequest);
+      readRequest->search = search;
+      readRequest->offset = entries;
+      readReply = HgfsBenchSend(client, HGFS_OP_SEARCH_READ_V3,
+                                sizeof *readRequest);
+      if (readReply == NULL) {
+         entries = -1;
+         break;
+      }
+      /* Version 3 replies end the directory with an entry without name. */
+      dirent = (HgfsDirEntry *)readReply->payload;
+      if (readReply->count == 0 || dirent->fileName.length == 0) {
+         break;
+      }
+      entries += readReply->count;
+   }
+
+   memset(closeRequest, 0, sizeof *closeRequest);
+   closeRequest->search = search;
+   if (HgfsBenchSend(client, HGFS_OP_SEARCH_CLOSE_V3,
+                     sizeof *closeRequest) == NULL) {
+      entries = -1;
+   }
+   return entries;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchCreateFile --
+ *
+ *    Creates a file of the scratch directory directly, outside the
+ *    measured requests.
+ *
+ * Results:
+ *    TRUE on success, FALSE on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchCreateFile(char const *name,   // IN: file name
+                    uint64 size)        // IN: file size
+{
+   char path[PATH_MAX];
+   char buffer[HGFS_BENCH_DEFAULT_IO_SIZE];
+   uint64 written = 0;
+   int fd;
+
+   Str_Sprintf(path, sizeof path, "%s/%s", gBench.dir, name);
+   fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (fd < 0) {
+      fprintf(stderr, "Cannot create \"%s\": %s\n", path, strerror(errno));
+      return FALSE;
+   }
+
+   memset(buffer, 'h', sizeof buffer);
+   while (written < size) {
+      ssize_t result = write(fd, buffer, MIN(sizeof buffer, size - written));
+
+      if (result <= 0) {
+         fprintf(stderr, "Cannot write \"%s\": %s\n", path, strerror(errno));
+         close(fd);
+         return FALSE;
+      }
+      written += result;
+   }
+   close(fd);
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchCreateFiles --
+ *
+ *    Creates the numbered small files used by several workloads.
+ *
+ * Results:
+ *    TRUE on success, FALSE on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchCreateFiles(void)
+{
+   uint32 i;
+
+   for (i = 0; i < gBench.numFiles; i++) {
+      char name[32];
+
+      Str_Sprintf(name, sizeof name, "file%u", i);
+      if (!HgfsBenchCreateFile(name, HGFS_BENCH_SMALL_FILE_SIZE)) {
+         return FALSE;
+      }
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchSmallFiles --
+ *
+ *    Small file workload: open, read and close each small file.
+ *
+ * Results:
+ *    TRUE on success, FALSE on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchSmallFiles(HgfsBenchClient *client)   // IN/OUT: sender
+{
+   uint32 iter;
+   uint32 i;
+
+   for (iter = 0; iter < gBench.iterations; iter++) {
+      for (i = 0; i < gBench.numFiles; i++) {
+         char name[32];
+         HgfsHandle file;
+
+         Str_Sprintf(name, sizeof name, "file%u", i);
+         if (!HgfsBenchOpen(client, name, HGFS_OPEN_MODE_READ_ONLY, HGFS_OPEN,
+                            &file)) {
+            return FALSE;
+         }
+         HgfsBenchRead(client, file, 0, HGFS_BENCH_SMALL_FILE_SIZE);
+         HgfsBenchClose(client, file);
+      }
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchHandles --
+ *
+ *    Open handle workload: keeps every small file open, then gets the
+ *    attributes of and reads each of them through its handle. Each request
+ *    looks its handle up among all the open nodes of the session.
+ *
+ * Results:
+ *    TRUE on success, FALSE on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchHandles(HgfsBenchClient *client)   // IN/OUT: sender
+{
+   HgfsHandle *files;
+   Bool success = TRUE;
+   uint32 opened;
+   uint32 iter;
+   uint32 i;
+
+   files = calloc(MAX(gBench.numFiles, 1), sizeof *files);
+   if (files == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      return FALSE;
+   }
+
+   for (opened = 0; opened < gBench.numFiles; opened++) {
+      char name[32];
+
+      Str_Sprintf(name, sizeof name, "file%u", opened);
+      if (!HgfsBenchOpen(client, name, HGFS_OPEN_MODE_READ_ONLY, HGFS_OPEN,
+                         &files[opened])) {
+         success = FALSE;
+         break;
+      }
+   }
+
+   for (iter = 0; success && iter < gBench.iterations; iter++) {
+      for (i = 0; i < opened; i++) {
+         HgfsBenchGetattr(client, NULL, files[i], HGFS_FILE_NAME_DEFAULT_CASE);
+         HgfsBenchRead(client, files[i], 0, HGFS_BENCH_SMALL_FILE_SIZE);
+      }
+   }
+
+   for (i = 0; i < opened; i++) {
+      HgfsBenchClose(client, files[i]);
+   }
+   free(files);
+   return success;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchCaseless --
+ *
+ *    Case insensitive lookup workload: gets the attributes of each small
+ *    file by a name that differs from the actual one in case, so that the
+ *    server has to look the name up in the scratch directory.
+ *
+ * Results:
+ *    TRUE on success, FALSE on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchCaseless(HgfsBenchClient *client)   // IN/OUT: sender
+{
+   uint32 iter;
+   uint32 i;
+
+   for (iter = 0; iter < gBench.iterations; iter++) {
+      for (i = 0; i < gBench.numFiles; i++) {
+         char name[32];
+
+         Str_Sprintf(name, sizeof name, "FILE%u", i);
+         if (!HgfsBenchGetattr(client, name, HGFS_INVALID_HANDLE,
+                               HGFS_FILE_NAME_CASE_INSENSITIVE)) {
+            return FALSE;
+         }
+      }
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchSeqRead --
+ *
+ *    Large sequential read workload.
+ *
+ * Results:
+ *    TRUE on success, FALSE on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchSeqRead(HgfsBenchClient *client)   // IN/OUT: sender
+{
+   uint32 iter;
+
+   for (iter = 0; iter < gBench.iterations; iter++) {
+      HgfsHandle file;
+      uint64 offset = 0;
+
+      if (!HgfsBenchOpen(client, "large", HGFS_OPEN_MODE_READ_ONLY, HGFS_OPEN,
+                         &file)) {
+         return FALSE;
+      }
+      while (offset < gBench.fileSize) {
+         int64 result = HgfsBenchRead(client, file, offset, gBench.ioSize);
+
+         if (result <= 0) {
+            break;
+         }
+         offset += result;
+      }
+      HgfsBenchClose(client, file);
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchSeqWrite --
+ *
+ *    Large sequential write workload.
+ *
+ * Results:
+ *    TRUE on success, FALSE on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchSeqWrite(HgfsBenchClient *client)   // IN/OUT: sender
+{
+   uint32 iter;
+
+   for (iter = 0; iter < gBench.iterations; iter++) {
+      HgfsHandle file;
+      uint64 offset = 0;
+
+      if (!HgfsBenchOpen(client, "large", HGFS_OPEN_MODE_WRITE_ONLY,
+                         HGFS_OPEN_CREATE_EMPTY, &file)) {
+         return FALSE;
+      }
+      while (offset < gBench.fileSize) {
+         int64 result = HgfsBenchWrite(client, file, offset,
+                                       MIN(gBench.ioSize,
+                                           gBench.fileSize - offset));
+
+         if (result <= 0) {
+            break;
+         }
+         offset += result;
+      }
+      HgfsBenchClose(client, file);
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchReadDir --
+ *
+ *    Directory enumeration workload.
+ *
+ * Results:
+ *    TRUE on success, FALSE on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchReadDir(HgfsBenchClient *client)   // IN/OUT: sender
+{
+   uint32 iter;
+
+   for (iter = 0; iter < gBench.iterations; iter++) {
+      if (HgfsBenchListDir(client) < 0) {
+         return FALSE;
+      }
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchRenames --
+ *
+ *    Rename storm workload: renames every small file away and back.
+ *
+ * Results:
+ *    TRUE on success, FALSE on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchRenames(HgfsBenchClient *client)   // IN/OUT: sender
+{
+   uint32 iter;
+   uint32 i;
+
+   for (iter = 0; iter < gBench.iterations; iter++) {
+      for (i = 0; i < gBench.numFiles; i++) {
+         char name[32];
+         char newName[32];
+
+         Str_Sprintf(name, sizeof name, "file%u", i);
+         Str_Sprintf(newName, sizeof newName, "renamed%u", i);
+         if (!HgfsBenchRename(client, name, newName) ||
+             !HgfsBenchRename(client, newName, name)) {
+            return FALSE;
+         }
+      }
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchContentionThread --
+ *
+ *    Thread of the contention workload. Each thread opens, gets the
+ *    attributes of, reads and closes its own share of the small files, then
+ *    enumerates the scratch directory. All the threads share the server
+ *    session: opens and closes take its node array lock for writing, handle
+ *    lookups for reading, and searches take its search array lock.
+ *
+ * Results:
+ *    NULL.
+ *
+ * Side effects:
+ *    Sets thread->success.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void *
+HgfsBenchContentionThread(void *data)   // IN/OUT: HgfsBenchThread
+{
+   HgfsBenchThread *thread = data;
+   HgfsBenchClient *client = &thread->client;
+   uint32 iter;
+   uint32 i;
+
+   thread->success = TRUE;
+   for (iter = 0; iter < gBench.iterations; iter++) {
+      for (i = thread->index; i < gBench.numFiles; i += gBench.numThreads) {
+         char name[32];
+         HgfsHandle file;
+
+         Str_Sprintf(name, sizeof name, "file%u", i);
+         if (!HgfsBenchOpen(client, name, HGFS_OPEN_MODE_READ_ONLY, HGFS_OPEN,
+                            &file)) {
+            thread->success = FALSE;
+            return NULL;
+         }
+         HgfsBenchGetattr(client, NULL, file, HGFS_FILE_NAME_DEFAULT_CASE);
+         HgfsBenchRead(client, file, 0, HGFS_BENCH_SMALL_FILE_SIZE);
+         HgfsBenchClose(client, file);
+      }
+      if (HgfsBenchListDir(client) < 0) {
+         thread->success = FALSE;
+         return NULL;
+      }
+   }
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchContention --
+ *
+ *    Contention workload: runs HgfsBenchContentionThread in gBench.numThreads
+ *    threads at once, then gathers their latencies and errors into the
+ *    client so that they are reported as one workload. Run with -l to see
+ *    how long the threads waited for the session locks.
+ *
+ * Results:
+ *    TRUE on success, FALSE on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchContention(HgfsBenchClient *client)   // IN/OUT: sender
+{
+   HgfsBenchThread *threads;
+   Bool success = TRUE;
+   uint32 started;
+   uint32 i;
+
+   threads = calloc(gBench.numThreads, sizeof *threads);
+   if (threads == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      return FALSE;
+   }
+
+   for (started = 0; started < gBench.numThreads; started++) {
+      int error;
+
+      threads[started].index = started;
+      error = pthread_create(&threads[started].thread, NULL,
+                             HgfsBenchContentionThread, &threads[started]);
+      if (error != 0) {
+         fprintf(stderr, "Cannot start a thread: %s\n", strerror(error));
+         success = FALSE;
+         break;
+      }
+   }
+
+   for (i = 0; i < started; i++) {
+      HgfsBenchClient *threadClient = &threads[i].client;
+      size_t j;
+
+      pthread_join(threads[i].thread, NULL);
+      success = success && threads[i].success;
+      for (j = 0; j < threadClient->numLatencies; j++) {
+         HgfsBenchRecordLatency(client, threadClient->latencies[j]);
+      }
+      client->errors += threadClient->errors;
+      free(threadClient->latencies);
+   }
+
+   free(threads);
+   return success;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchReplay --
+ *
+ *    Replays the requests of a trace.
+ *
+ * Results:
+ *    TRUE on success, FALSE on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchReplay(HgfsBenchClient *client,   // IN/OUT: sender
+                char const *traceName)     // IN: trace file
+{
+   HgfsBenchTraceHeader header;
+   Bool success = TRUE;
+   uint32 size;
+   FILE *trace;
+
+   trace = fopen(traceName, "rb");
+   if (trace == NULL) {
+      fprintf(stderr, "Cannot open \"%s\": %s\n", traceName, strerror(errno));
+      return FALSE;
+   }
+
+   if (fread(&header, sizeof header, 1, trace) != 1 ||
+       header.magic != HGFS_BENCH_TRACE_MAGIC) {
+      fprintf(stderr, "\"%s\" is not a trace\n", traceName);
+      fclose(trace);
+      return FALSE;
+   }
+
+   /* Handles in the trace are only valid if numbered as when recorded. */
+   HgfsServer_SetHandleCounter(header.handleCounter);
+
+   while (fread(&size, sizeof size, 1, trace) == 1) {
+      if (size > sizeof client->request ||
+          fread(client->request, size, 1, trace) != 1) {
+         fprintf(stderr, "\"%s\" is truncated\n", traceName);
+         success = FALSE;
+         break;
+      }
+      if (HgfsBenchProcess(client, client->request, size) &&
+          ((HgfsReply *)client->reply)->status != HGFS_STATUS_SUCCESS) {
+         client->errors++;
+      }
+   }
+
+   fclose(trace);
+   return success;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchCompareLatency --
+ *
+ *    qsort comparison of latencies.
+ *
+ * Results:
+ *    <0, 0 or >0.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+HgfsBenchCompareLatency(const void *a,   // IN
+                        const void *b)   // IN
+{
+   uint64 left = *(const uint64 *)a;
+   uint64 right = *(const uint64 *)b;
+
+   return left < right ? -1 : left > right;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchReport --
+ *
+ *    Prints the request rate and latency percentiles of a workload.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Sorts the latencies.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsBenchReport(char const *workload,   // IN: workload name
+                VmTimeType usecs)       // IN: workload run time
+{
+   HgfsBenchClient *client = &gBench.client;
+   size_t n = client->numLatencies;
+
+   if (n == 0) {
+      printf("%-10s no requests\n", workload);
+      return;
+   }
+
+   qsort(client->latencies, n, sizeof *client->latencies,
+         HgfsBenchCompareLatency);
+
+   printf("%-10s %10"FMTSZ"u reqs %10.0f reqs/s  p50 %6"FMT64"u us  "
+          "p90 %6"FMT64"u us  p99 %6"FMT64"u us  max %6"FMT64"u us  "
+          "%"FMT64"u errors\n",
+          workload, n, n * 1000000.0 / MAX(usecs, 1),
+          client->latencies[n / 2], client->latencies[n * 90 / 100],
+          client->latencies[n * 99 / 100], client->latencies[n - 1],
+          client->errors);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchReportServer --
+ *
+ *    Prints the server's own per operation and buffer pool counters.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsBenchReportServer(void)
+{
+   HgfsServerOpStats stats;
+   HgfsServerPoolStats poolStats;
+   uint32 op;
+   uint32 pool;
+
+   printf("\nServer side, per op:\n");
+   for (op = 0; HgfsServer_GetOpStats(op, &stats); op++) {
+      if (stats.count == 0) {
+         continue;
+      }
+      printf("op %3u %10"FMT64"u reqs %6"FMT64"u errors  avg %6"FMT64"u us  "
+             "p50 %6"FMT64"u us  p99 %6"FMT64"u us\n",
+             op, stats.count, stats.errors, stats.totalUsecs / stats.count,
+             HgfsServer_OpStatsPercentile(&stats, 50),
+             HgfsServer_OpStatsPercentile(&stats, 99));
+   }
+
+   printf("\nServer side, buffer pools:\n");
+   for (pool = 0; HgfsServer_GetPoolStats(pool, &poolStats); pool++) {
+      printf("pool %u %10"FMT64"u allocs %10"FMT64"u hits %6"FMT64"u drops  "
+             "high-water %u\n", pool, poolStats.allocs, poolStats.hits,
+             poolStats.drops, poolStats.highWater);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchLockStatsLine --
+ *
+ *    MXUser statistics function: prints a line of lock statistics.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsBenchLockStatsLine(void *context,     // IN: unused
+                       const char *fmt,   // IN: format
+                       va_list ap)        // IN: arguments
+{
+   vprintf(fmt, ap);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchReportLocks --
+ *
+ *    Prints the statistics MXUser collected on the server locks, the node
+ *    and search array locks of the session among them.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsBenchReportLocks(void)
+{
+   printf("\nLock statistics:\n");
+   MXUser_PerLockData();
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchRun --
+ *
+ *    Sets up, runs and reports one workload.
+ *
+ * Results:
+ *    TRUE on success, FALSE on failure.
+ *
+ * Side effects:
+ *    Creates files in the scratch directory.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchRun(char const *workload)   // IN: workload name
+{
+   VmTimeType start;
+   Bool success;
+
+   if (strcmp(workload, "smallfile") == 0 ||
+       strcmp(workload, "handles") == 0 ||
+       strcmp(workload, "readdir") == 0 ||
+       strcmp(workload, "rename") == 0) {
+      success = HgfsBenchCreateFiles();
+   } else if (strcmp(workload, "caseless") == 0) {
+      /*
+       * The server only caches the case folded index of a directory that
+       * has not been modified for a couple of seconds, let the scratch
+       * directory settle so that the lookups, not the rescans, are timed.
+       */
+      success = HgfsBenchCreateFiles();
+      if (success) {
+         sleep(3);
+      }
+   } else if (strcmp(workload, "contention") == 0) {
+      /*
+       * The first request of a transport creates its default session, have
+       * it sent before the threads race to send theirs.
+       */
+      success = HgfsBenchCreateFiles() &&
+                HgfsBenchGetattr(&gBench.client, NULL, HGFS_INVALID_HANDLE,
+                                 HGFS_FILE_NAME_DEFAULT_CASE);
+   } else if (strcmp(workload, "seqread") == 0) {
+      success = HgfsBenchCreateFile("large", gBench.fileSize);
+   } else {
+      success = strcmp(workload, "seqwrite") == 0 ||
+                strncmp(workload, "replay:", 7) == 0;
+   }
+   if (!success) {
+      fprintf(stderr, "Cannot set up workload \"%s\"\n", workload);
+      return FALSE;
+   }
+
+   gBench.client.numLatencies = 0;
+   gBench.client.errors = 0;
+   start = Hostinfo_SystemTimerUS();
+
+   if (strcmp(workload, "smallfile") == 0) {
+      success = HgfsBenchSmallFiles(&gBench.client);
+   } else if (strcmp(workload, "handles") == 0) {
+      success = HgfsBenchHandles(&gBench.client);
+   } else if (strcmp(workload, "caseless") == 0) {
+      success = HgfsBenchCaseless(&gBench.client);
+   } else if (strcmp(workload, "seqread") == 0) {
+      success = HgfsBenchSeqRead(&gBench.client);
+   } else if (strcmp(workload, "seqwrite") == 0) {
+      success = HgfsBenchSeqWrite(&gBench.client);
+   } else if (strcmp(workload, "readdir") == 0) {
+      success = HgfsBenchReadDir(&gBench.client);
+   } else if (strcmp(workload, "rename") == 0) {
+      success = HgfsBenchRenames(&gBench.client);
+   } else if (strcmp(workload, "contention") == 0) {
+      success = HgfsBenchContention(&gBench.client);
+   } else {
+      success = HgfsBenchReplay(&gBench.client, workload + 7);
+   }
+
+   HgfsBenchReport(workload, Hostinfo_SystemTimerUS() - start);
+   return success && gBench.client.errors == 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchStartServer --
+ *
+ *    Starts the server with the guest policy and connects a transport
+ *    session with the configuration and the channel capabilities of the
+ *    guest backdoor channel, see hgfsChannelGuest.c and
+ *    hgfsChannelGuestBd.c.
+ *
+ * Results:
+ *    TRUE on success, FALSE on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchStartServer(void)
+{
+   static HgfsServerConfig config = {
+      (HGFS_CONFIG_SHARE_ALL_HOST_DRIVES_ENABLED | HGFS_CONFIG_VOL_INFO_MIN),
+      HGFS_MAX_CACHED_FILENODES,
+      0
+   };
+   static HgfsServerChannelData capabilities = {
+      0,
+      HGFS_LARGE_PACKET_MAX
+   };
+
+   if (!HgfsServerPolicy_Init(NULL, &gBench.mgrCb.enumResources)) {
+      return FALSE;
+   }
+   if (!HgfsServer_InitState(&gBench.serverCb, &config, &gBench.mgrCb)) {
+      HgfsServerPolicy_Cleanup();
+      return FALSE;
+   }
+
+   gBench.channelCb.send = HgfsBenchChannelSend;
+   if (!gBench.serverCb->session.connect(&gBench, &gBench.channelCb,
+                                         &capabilities, &gBench.session)) {
+      HgfsServer_ExitState();
+      HgfsServerPolicy_Cleanup();
+      return FALSE;
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchStopServer --
+ *
+ *    Disconnects the transport session and stops the server.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsBenchStopServer(void)
+{
+   gBench.serverCb->session.disconnect(gBench.session);
+   gBench.serverCb->session.close(gBench.session);
+   HgfsServer_ExitState();
+   HgfsServerPolicy_Cleanup();
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchCleanup --
+ *
+ *    Removes the files the workloads created in the scratch directory.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsBenchCleanup(void)
+{
+   char path[PATH_MAX];
+   uint32 i;
+
+   for (i = 0; i < gBench.numFiles; i++) {
+      Str_Sprintf(path, sizeof path, "%s/file%u", gBench.dir, i);
+      unlink(path);
+      Str_Sprintf(path, sizeof path, "%s/renamed%u", gBench.dir, i);
+      unlink(path);
+   }
+   Str_Sprintf(path, sizeof path, "%s/large", gBench.dir);
+   unlink(path);
+   rmdir(gBench.dir);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchUsage --
+ *
+ *    Prints the usage.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsBenchUsage(char const *program)   // IN: program name
+{
+   fprintf(stderr,
+           "Usage: %s [options] workload...\n"
+           "Workloads: smallfile handles caseless seqread seqwrite readdir\n"
+           "           rename contention replay:<trace>\n"
+           "  -d <dir>    scratch directory (default: a new one in /tmp)\n"
+           "  -n <files>  number of small files (default %u)\n"
+           "  -i <iters>  iterations of each workload (default %u)\n"
+           "  -s <bytes>  sequential file size (default %u)\n"
+           "  -b <bytes>  sequential request size (default %u)\n"
+           "  -j <count>  threads of the contention workload (default %u)\n"
+           "  -t <trace>  record the requests sent to <trace>\n"
+           "  -l          report the lock statistics (statistics builds)\n"
+           "  -k          keep the scratch files\n",
+           program, HGFS_BENCH_DEFAULT_FILES, HGFS_BENCH_DEFAULT_ITERS,
+           HGFS_BENCH_DEFAULT_SIZE, HGFS_BENCH_DEFAULT_IO_SIZE,
+           HGFS_BENCH_DEFAULT_THREADS);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *    Starts the server, then runs each workload given on the command line.
+ *
+ * Results:
+ *    0 if all the workloads completed without errors, 1 otherwise.
+ *
+ * Side effects:
+ *    Creates and removes files in the scratch directory.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,
+     char *argv[])
+{
+   char dirTemplate[] = "/tmp/hgfsServerBench.XXXXXX";
+   char *traceName = NULL;
+   Bool success = TRUE;
+   int opt;
+   int i;
+
+   gBench.numFiles = HGFS_BENCH_DEFAULT_FILES;
+   gBench.iterations = HGFS_BENCH_DEFAULT_ITERS;
+   gBench.fileSize = HGFS_BENCH_DEFAULT_SIZE;
+   gBench.ioSize = HGFS_BENCH_DEFAULT_IO_SIZE;
+   gBench.numThreads = HGFS_BENCH_DEFAULT_THREADS;
+
+   while ((opt = getopt(argc, argv, "d:n:i:s:b:j:t:lk")) != -1) {
+      switch (opt) {
+      case 'd':
+         gBench.dir = realpath(optarg, NULL);
+         if (gBench.dir == NULL) {
+            fprintf(stderr, "Bad directory \"%s\": %s\n", optarg,
+                    strerror(errno));
+            return 1;
+         }
+         break;
+      case 'n':
+         gBench.numFiles = strtoul(optarg, NULL, 0);
+         break;
+      case 'i':
+         gBench.iterations = strtoul(optarg, NULL, 0);
+         break;
+      case 's':
+         gBench.fileSize = strtoull(optarg, NULL, 0);
+         break;
+      case 'b':
+         gBench.ioSize = strtoul(optarg, NULL, 0);
+         break;
+      case 'j':
+         gBench.numThreads = strtoul(optarg, NULL, 0);
+         break;
+      case 't':
+         traceName = optarg;
+         break;
+      case 'l':
+         gBench.lockStats = TRUE;
+         break;
+      case 'k':
+         gBench.keepFiles = TRUE;
+         break;
+      default:
+         HgfsBenchUsage(argv[0]);
+         return 1;
+      }
+   }
+
+   if (optind == argc || gBench.ioSize == 0 || gBench.ioSize > HGFS_LARGE_IO_MAX ||
+       gBench.numThreads == 0 || gBench.numThreads > HGFS_BENCH_MAX_THREADS) {
+      HgfsBenchUsage(argv[0]);
+      return 1;
+   }
+
+   if (gBench.dir == NULL) {
+      if (mkdtemp(dirTemplate) == NULL) {
+         fprintf(stderr, "Cannot create a scratch directory: %s\n",
+                 strerror(errno));
+         return 1;
+      }
+      gBench.dir = strdup(dirTemplate);
+   }
+
+   if (gBench.lockStats) {
+      /* Locks only collect statistics if set up before they are created. */
+      MXUser_SetStatsFunc(NULL, HGFS_BENCH_STATS_LINE_MAX, TRUE,
+                          HgfsBenchLockStatsLine);
+   }
+
+   if (!HgfsBenchStartServer()) {
+      fprintf(stderr, "Cannot start the HGFS server\n");
+      return 1;
+   }
+
+   if (traceName != NULL) {
+      HgfsBenchTraceHeader header;
+
+      gBench.trace = fopen(traceName, "wb");
+      if (gBench.trace == NULL) {
+         fprintf(stderr, "Cannot create \"%s\": %s\n", traceName,
+                 strerror(errno));
+         return 1;
+      }
+      header.magic = HGFS_BENCH_TRACE_MAGIC;
+      header.handleCounter = HgfsServer_GetHandleCounter();
+      fwrite(&header, sizeof header, 1, gBench.trace);
+   }
+
+   printf("Scratch directory %s\n", gBench.dir);
+   for (i = optind; i < argc; i++) {
+      if (!HgfsBenchRun(argv[i])) {
+         success = FALSE;
+      }
+   }
+   HgfsBenchReportServer();
+   if (gBench.lockStats) {
+      HgfsBenchReportLocks();
+   }
+
+   if (gBench.trace != NULL) {
+      fclose(gBench.trace);
+   }
+   HgfsBenchStopServer();
+
+   if (!gBench.keepFiles) {
+      HgfsBenchCleanup();
+   }
+   free(gBench.client.latencies);
+   free(gBench.dir);
+
+   return success ? 0 : 1;
+}
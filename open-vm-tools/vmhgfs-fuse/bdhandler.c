@@ -20,6 +20,11 @@
  * bdhandler.c --
  *
  * Background thread for handling backdoor requests and replies.
+ *
+ * A backdoor RPC is synchronous: the sender waits for the host reply on
+ * its connection. To keep several requests in flight the channel holds a
+ * small set of connections, opened on demand, and each send uses an idle
+ * one. The channel lock only protects picking the connection.
  */
 
 /* Must come before any kernel header file. */
@@ -34,7 +39,67 @@
 #include "transport.h"
 #include "vm_assert.h"
 
+/* Connections opened at most, the host limits the number of RPC channels. */
+#define HGFS_BD_MAX_CONNS 4
+
+typedef struct HgfsBdConns {
+   RpcOut *out[HGFS_BD_MAX_CONNS];  /* out[0] is opened with the channel. */
+   Bool busy[HGFS_BD_MAX_CONNS];    /* Connection used by a send. */
+   uint32 count;                    /* Connections opened. */
+   uint32 max;                      /* Lowered when opening one fails. */
+   pthread_cond_t idleCond;         /* Signalled when a connection is idle. */
+} HgfsBdConns;
+
 static HgfsTransportChannel bdChannel;
+static HgfsBdConns bdConns;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBdChannelGetConn --
+ *
+ *      Get an idle connection for a send, opening a new one if all are busy
+ *      and the limit is not reached yet. Called with the channel lock held.
+ *
+ * Results:
+ *      Index of the connection, marked busy.
+ *
+ * Side effects:
+ *      May wait for a connection to become idle.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static uint32
+HgfsBdChannelGetConn(HgfsTransportChannel *channel) // IN: Channel
+{
+   HgfsBdConns *conns = channel->priv;
+   uint32 i;
+
+   for (;;) {
+      for (i = 0; i < conns->count; i++) {
+         if (!conns->busy[i]) {
+            conns->busy[i] = TRUE;
+            return i;
+         }
+      }
+
+      if (conns->count < conns->max) {
+         if (HgfsBd_OpenBackdoor(&conns->out[conns->count])) {
+            LOG(8, ("Backdoor connection %u opened.\n", conns->count));
+            i = conns->count++;
+            conns->busy[i] = TRUE;
+            return i;
+         }
+         LOG(4, ("Backdoor connection %u failed, using %u.\n",
+                 conns->count, conns->count));
+         conns->max = conns->count;
+      }
+
+      pthread_cond_wait(&conns->idleCond, &channel->connLock);
+   }
+}
 
 
 /*
@@ -65,10 +130,14 @@ HgfsBdChannelOpen(HgfsTransportChannel *channel) // IN: Channel
       LOG(8, ("Backdoor already connected.\n"));
       break;
    case HGFS_CHANNEL_NOTCONNECTED:
-      if (HgfsBd_OpenBackdoor((RpcOut **)&channel->priv)) {
+      ASSERT(bdConns.count == 0);
+      if (HgfsBd_OpenBackdoor(&bdConns.out[0])) {
          LOG(8, ("Backdoor opened and connected.\n"));
          channel->status = HGFS_CHANNEL_CONNECTED;
-         ASSERT(channel->priv != NULL);
+         channel->priv = &bdConns;
+         bdConns.busy[0] = FALSE;
+         bdConns.count = 1;
+         bdConns.max = HGFS_BD_MAX_CONNS;
       } else {
          LOG(8, ("ERROR: Backdoor cannot connect.\n"));
       }
@@ -105,9 +174,16 @@ static void
 HgfsBdChannelCloseInt(HgfsTransportChannel *channel) // IN: Channel
 {
    if (channel->status == HGFS_CHANNEL_CONNECTED) {
-      ASSERT(channel->priv != NULL);
-      HgfsBd_CloseBackdoor((RpcOut **)&channel->priv);
-      ASSERT(channel->priv == NULL);
+      HgfsBdConns *conns = channel->priv;
+
+      ASSERT(conns != NULL);
+      while (conns->count > 0) {
+         conns->count--;
+         ASSERT(!conns->busy[conns->count]);
+         HgfsBd_CloseBackdoor(&conns->out[conns->count]);
+         ASSERT(conns->out[conns->count] == NULL);
+      }
+      channel->priv = NULL;
       channel->status = HGFS_CHANNEL_NOTCONNECTED;
    }
    LOG(8, ("Backdoor closed.\n"));
@@ -162,6 +238,8 @@ HgfsBdChannelSend(HgfsTransportChannel *channel, // IN: Channel
 {
    char const *replyPacket = NULL;
    size_t payloadSize;
+   HgfsBdConns *conns;
+   uint32 conn;
    int ret;
 
    ASSERT(req);
@@ -176,20 +254,30 @@ HgfsBdChannelSend(HgfsTransportChannel *channel, // IN: Channel
       return -ENOTCONN;
    }
 
+   conns = channel->priv;
+   conn = HgfsBdChannelGetConn(channel);
+   pthread_mutex_unlock(&channel->connLock);
+
    payloadSize = req->payloadSize;
-   LOG(8, ("Backdoor sending.\n"));
-   ret = HgfsBd_Dispatch(channel->priv, HGFS_REQ_PAYLOAD(req), &payloadSize,
+   LOG(8, ("Backdoor sending on connection %u.\n", conn));
+   ret = HgfsBd_Dispatch(conns->out[conn], HGFS_REQ_PAYLOAD(req), &payloadSize,
                          &replyPacket);
    if (ret == 0) {
       LOG(8, ("Backdoor reply received.\n"));
-      /* Request sent successfully. Copy the reply and wake the client. */
+      /*
+       * Request sent successfully. Copy the reply, which is only valid
+       * until the next send on the connection, and wake the client.
+       */
       ASSERT(replyPacket);
-      HgfsCompleteReq(req, replyPacket, payloadSize);
+      HgfsTransportCompleteRequest(req, replyPacket, payloadSize);
    } else {
       /* Map rpc failure to EIO. */
       ret = -EIO;
    }
 
+   pthread_mutex_lock(&channel->connLock);
+   conns->busy[conn] = FALSE;
+   pthread_cond_signal(&conns->idleCond);
    pthread_mutex_unlock(&channel->connLock);
 
    return ret;
@@ -249,6 +337,8 @@ HgfsBdChannelInit(void)
    bdChannel.ops.exit = HgfsBdChannelExit;
    bdChannel.priv = NULL;
    pthread_mutex_init(&bdChannel.connLock, NULL);
+   memset(&bdConns, 0, sizeof bdConns);
+   pthread_cond_init(&bdConns.idleCond, NULL);
    bdChannel.status = HGFS_CHANNEL_NOTCONNECTED;
    return &bdChannel;
 }
@@ -29,7 +29,8 @@
 /*
  * We make the default attribute cache timeout 1 second which is the same
  * as the FUSE driver.
- * This can be overridden with the mount option attr_timeout=T
+ * This can be overridden with the mount option attr_cache_ttl=MS, which
+ * the lists used on Solaris and FreeBSD do not support.
  */
 #define CACHE_TIMEOUT HGFS_DEFAULT_TTL
 #define CACHE_PURGE_TIME 10
@@ -49,13 +50,6 @@ typedef struct HgfsAttrCache {
    char path[0];      /* path of the file corresponding the the attr */
 } HgfsAttrCache;
 
-
-/* Head of the list */
-struct HgfsAttrCache attrList;
-
-/*Lock for accessing the attribute cache*/
-static pthread_mutex_t HgfsAttrCacheLock = PTHREAD_MUTEX_INITIALIZER;
-
 #if !defined(__FreeBSD__) && !defined(__SOLARIS__)
 static void HgfsInvalidateParentsChildren(const char* parent);
 #endif
@@ -69,6 +63,14 @@ static void HgfsInvalidateParentsChildren(const char* parent);
 
 #if defined(__FreeBSD__) || defined(__SOLARIS__)
 
+/* Head of the list */
+struct HgfsAttrCache attrList;
+static uint32 attrListCount;
+static HgfsAttrCacheStats attrListStats;
+
+/*Lock for accessing the attribute cache*/
+static pthread_mutex_t HgfsAttrCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  *----------------------------------------------------------------------
  *
@@ -136,6 +138,12 @@ HgfsGetAttrCache(const char* path,   //IN: Path of file or directory
       }
    }
 
+   if (res == 0) {
+      attrListStats.hits++;
+   } else {
+      attrListStats.misses++;
+   }
+
    pthread_mutex_unlock(&HgfsAttrCacheLock);
    return res;
 }
@@ -186,6 +194,7 @@ HgfsSetAttrCache(const char* path,   //IN: Path of file or directory
    tmp->attr = *attr;
    tmp->changeTime = HGFS_GET_TIME(time(NULL));
    list_add(&tmp->list, &attrList.list);
+   attrListCount++;
    LOG(4, ("cache entry added. path = %s\n", tmp->path));
 
 out:
@@ -194,6 +203,30 @@ out:
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsSetListedAttrCache
+ *
+ *    Updates the list with the attributes of a directory listing entry.
+ *
+ * Results:
+ *    0 on success else negative value on error
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+HgfsSetListedAttrCache(const char* path,   //IN: Path of file or directory
+                       HgfsAttrInfo *attr) //IN: Attribute for a given path
+{
+   return HgfsSetAttrCache(path, attr);
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -221,6 +254,8 @@ HgfsInvalidateAttrCache(const char* path)      //IN: Path to file
       if (strcmp(path, tmp->path) == 0) {
          list_del(&tmp->list);
          free(tmp);
+         attrListCount--;
+         attrListStats.invalidations++;
          break;
       }
    }
@@ -264,6 +299,8 @@ HgfsPurgeCache(void* unused) //IN: Thread argument
          if (diff > CACHE_PURGE_TIME) {
             list_del (&tmp->list);
             free (tmp);
+            attrListCount--;
+            attrListStats.expirations++;
          }
       }
 
@@ -272,17 +309,243 @@ HgfsPurgeCache(void* unused) //IN: Thread argument
    return 0;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsGetAttrCacheStats
+ *
+ *    Get the cache counters.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsGetAttrCacheStats(HgfsAttrCacheStats *stats) //OUT: Counters
+{
+   pthread_mutex_lock(&HgfsAttrCacheLock);
+   *stats = attrListStats;
+   stats->entries = attrListCount;
+   pthread_mutex_unlock(&HgfsAttrCacheLock);
+}
+
 #else
 
+/*
+ * The hash table is split in shards, each with its own lock, hash table
+ * and lists, so threads looking up different paths rarely contend.
+ *
+ * Each shard holds at most its share of the cache size. Eviction gives a
+ * second chance to the entries used since it last passed them: a hit only
+ * marks its entry, so it touches no other entry, and eviction moves the
+ * marked entries it meets back to the head of the list, clearing their
+ * mark, until it meets an unmarked one. Entries expire after the TTL: an expired
+ * entry is dropped when it is looked up, and the purge thread drops the
+ * others oldest first from the age list, stopping at the first one which
+ * has not expired.
+ *
+ * Invalidating a directory does not visit the entries below it. It
+ * records the time of the invalidation for the directory path, and a
+ * lookup checks that none of the parent directories of the path was
+ * invalidated after the entry was cached. The records are kept for one
+ * TTL, after which the entries they invalidate have expired anyway.
+ */
+
+#define HGFS_ATTR_CACHE_SHARDS 16
+
+typedef struct HgfsAttrCacheEntry {
+   HgfsAttrInfo attr;        /* Attribute of a file or directory */
+   uint64 setTime;           /* Time the entry was cached, in ms. */
+   Bool referenced;          /* Used since eviction last passed it. */
+   Bool listed;              /* Cached by a directory listing. */
+   struct list_head lru;     /* Shard eviction list, newest first. */
+   struct list_head age;     /* Shard age list, newest first. */
+   char path[0];             /* Path of the file, the hash table key. */
+} HgfsAttrCacheEntry;
+
+typedef struct HgfsAttrCacheShard {
+   pthread_mutex_t lock;
+   GHashTable *table;
+   struct list_head lru;
+   struct list_head age;
+   uint32 count;
+   HgfsAttrCacheStats stats;
+} HgfsAttrCacheShard;
+
+typedef struct HgfsAttrCacheInval {
+   uint64 time;              /* Time of the invalidation, in ms. */
+   struct list_head age;     /* Invalidation age list, newest first. */
+   char path[0];             /* Directory path, the hash table key. */
+} HgfsAttrCacheInval;
+
+static HgfsAttrCacheShard attrShards[HGFS_ATTR_CACHE_SHARDS];
+static uint32 attrShardSize;
+
+static pthread_rwlock_t attrInvalLock = PTHREAD_RWLOCK_INITIALIZER;
+static GHashTable *attrInvalTable;
+static struct list_head attrInvalList;
+static uint32 attrInvalCount;
+
+static void HgfsPurgeCacheShards(uint64 time);
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsAttrCacheGetShard
+ *
+ *    Get the shard of a path.
+ *
+ * Results:
+ *    The shard.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static HgfsAttrCacheShard *
+HgfsAttrCacheGetShard(const char* path) //IN: Path of file or directory
+{
+   return &attrShards[g_str_hash(path) % HGFS_ATTR_CACHE_SHARDS];
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsAttrCacheRemove
+ *
+ *    Remove an entry from its shard, with the shard lock held.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    Frees the entry.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsAttrCacheRemove(HgfsAttrCacheShard *shard,  //IN: Shard of the entry
+                    HgfsAttrCacheEntry *entry)  //IN: Entry to remove
+{
+   g_hash_table_remove(shard->table, entry->path);
+   list_del(&entry->lru);
+   list_del(&entry->age);
+   shard->count--;
+   free(entry);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsAttrCacheInvalidated
+ *
+ *    Check whether a parent directory of a path was invalidated since a
+ *    time.
+ *
+ * Results:
+ *    TRUE if the entry cached at that time is invalid.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+HgfsAttrCacheInvalidated(const char* path,  //IN: Path of file or directory
+                         uint64 setTime)    //IN: Time the entry was cached
+{
+   char parent[PATH_MAX];
+   Bool invalid = FALSE;
+   size_t len;
+
+   /* Unlocked check, a racing invalidation is not ordered with us anyway. */
+   if (0 == attrInvalCount) {
+      return FALSE;
+   }
+
+   len = Str_Strlen(path, sizeof parent - 1);
+   memcpy(parent, path, len);
+   parent[len] = '\0';
+
+   pthread_rwlock_rdlock(&attrInvalLock);
+   while (len > 0 && !invalid) {
+      HgfsAttrCacheInval *inval;
+
+      /* Strip the last component, keeping "/" for the root. */
+      while (len > 0 && parent[len - 1] != '/') {
+         len--;
+      }
+      if (len == 0) {
+         break;
+      }
+      parent[len > 1 ? len - 1 : len] = '\0';
+
+      inval = g_hash_table_lookup(attrInvalTable, parent);
+      if (inval != NULL && inval->time >= setTime) {
+         invalid = TRUE;
+      }
+      len--;
+   }
+   pthread_rwlock_unlock(&attrInvalLock);
+
+   return invalid;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsAttrCacheExpireInval
+ *
+ *    Drop the invalidation records older than the TTL, with the
+ *    invalidation lock held for writing.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsAttrCacheExpireInval(uint64 now) //IN: Current time, in ms
+{
+   while (!list_empty(&attrInvalList)) {
+      HgfsAttrCacheInval *inval = list_entry(attrInvalList.prev,
+                                             HgfsAttrCacheInval, age);
+
+      if (now - inval->time <= gState->attrCacheTtl) {
+         break;
+      }
+      g_hash_table_remove(attrInvalTable, inval->path);
+      list_del(&inval->age);
+      attrInvalCount--;
+      free(inval);
+   }
+}
 
-GHashTable *g_hash_table;
 
 /*
  *----------------------------------------------------------------------
  *
  * HgfsInitCache
  *
- *    Creates a hash table with string as a key.
+ *    Creates the shards of the cache, with string as a key.
  *
  * Results:
  *    None
@@ -296,7 +559,26 @@ GHashTable *g_hash_table;
 void
 HgfsInitCache()
 {
-   g_hash_table = g_hash_table_new(g_str_hash, g_str_equal);
+   uint32 i;
+
+   attrShardSize = MAX(gState->attrCacheSize / HGFS_ATTR_CACHE_SHARDS, 1);
+   for (i = 0; i < HGFS_ATTR_CACHE_SHARDS; i++) {
+      HgfsAttrCacheShard *shard = &attrShards[i];
+
+      pthread_mutex_init(&shard->lock, NULL);
+      shard->table = g_hash_table_new(g_str_hash, g_str_equal);
+      INIT_LIST_HEAD(&shard->lru);
+      INIT_LIST_HEAD(&shard->age);
+      shard->count = 0;
+      memset(&shard->stats, 0, sizeof shard->stats);
+   }
+
+   attrInvalTable = g_hash_table_new(g_str_hash, g_str_equal);
+   INIT_LIST_HEAD(&attrInvalList);
+   attrInvalCount = 0;
+
+   LOG(4, ("%u entries, TTL %u ms\n", attrShardSize * HGFS_ATTR_CACHE_SHARDS,
+           gState->attrCacheTtl));
 }
 
 
@@ -311,7 +593,7 @@ HgfsInitCache()
  *    0 on success else -1 on error
  *
  * Side effects:
- *    None
+ *    Drops the entry if it expired or was invalidated.
  *
  *----------------------------------------------------------------------
  */
@@ -320,26 +602,46 @@ int
 HgfsGetAttrCache(const char* path,   //IN: Path of file or directory
                  HgfsAttrInfo *attr) //IN: Attribute for a given path
 {
-   HgfsAttrCache *tmp;
+   HgfsAttrCacheShard *shard;
+   HgfsAttrCacheEntry *tmp;
    int res = -1;
 
-   pthread_mutex_lock(&HgfsAttrCacheLock);
+   if (0 == gState->attrCacheTtl) {
+      return res;
+   }
+
+   shard = HgfsAttrCacheGetShard(path);
+   pthread_mutex_lock(&shard->lock);
 
-   tmp = (HgfsAttrCache *)g_hash_table_lookup(g_hash_table, path);
+   tmp = (HgfsAttrCacheEntry *)g_hash_table_lookup(shard->table, path);
    if (tmp != NULL) {
-      int diff;
+      uint64 diff = HgfsGetMonotonicTime() - tmp->setTime;
 
       LOG(4, ("cache hit. path = %s\n", tmp->path));
-
-      diff = (HGFS_GET_TIME(time(NULL)) - tmp->changeTime) / 10000000;
-      LOG(4, ("time since last updated is %d seconds\n", diff));
-      if ( diff <= CACHE_TIMEOUT ) {
+      LOG(4, ("time since last updated is %"FMT64"u ms\n", diff));
+      if (diff > gState->attrCacheTtl) {
+         HgfsAttrCacheRemove(shard, tmp);
+         shard->stats.expirations++;
+      } else if (HgfsAttrCacheInvalidated(path, tmp->setTime)) {
+         HgfsAttrCacheRemove(shard, tmp);
+         shard->stats.invalidations++;
+      } else {
+         tmp->referenced = TRUE;
          *attr = tmp->attr;
          res = 0;
+         if (tmp->listed) {
+            shard->stats.listedHits++;
+         }
       }
    }
 
-   pthread_mutex_unlock(&HgfsAttrCacheLock);
+   if (res == 0) {
+      shard->stats.hits++;
+   } else {
+      shard->stats.misses++;
+   }
+
+   pthread_mutex_unlock(&shard->lock);
    return res;
 }
 
@@ -347,7 +649,7 @@ HgfsGetAttrCache(const char* path,   //IN: Path of file or directory
 /*
  *----------------------------------------------------------------------
  *
- * HgfsSetAttrCache
+ * HgfsAttrCacheSet
  *
  *    Updates the HashTable with the given (key, attr) pair.
  *
@@ -355,28 +657,38 @@ HgfsGetAttrCache(const char* path,   //IN: Path of file or directory
  *    0 on success else negative value on error
  *
  * Side effects:
- *    None
+ *    May evict an entry of the shard.
  *
  *----------------------------------------------------------------------
  */
 
-int
-HgfsSetAttrCache(const char* path,         //IN: Path of file or directory
-                 HgfsAttrInfo *attr)       //IN: Attribute for a given path
+static int
+HgfsAttrCacheSet(const char* path,         //IN: Path of file or directory
+                 HgfsAttrInfo *attr,       //IN: Attribute for a given path
+                 Bool listed)              //IN: From a directory listing
 {
-   HgfsAttrCache *tmp;
+   HgfsAttrCacheShard *shard;
+   HgfsAttrCacheEntry *tmp;
    int res = 0;
 
-   pthread_mutex_lock(&HgfsAttrCacheLock);
+   if (0 == gState->attrCacheTtl) {
+      return res;
+   }
 
-   tmp = (HgfsAttrCache *)g_hash_table_lookup(g_hash_table, path);
+   shard = HgfsAttrCacheGetShard(path);
+   pthread_mutex_lock(&shard->lock);
+
+   tmp = (HgfsAttrCacheEntry *)g_hash_table_lookup(shard->table, path);
    if (tmp != NULL) {
       tmp->attr = *attr;
-      tmp->changeTime = HGFS_GET_TIME(time(NULL));
+      tmp->setTime = HgfsGetMonotonicTime();
+      tmp->referenced = TRUE;
+      tmp->listed = listed;
+      list_move(&tmp->age, &shard->age);
       goto out;
    }
 
-   tmp = malloc(sizeof(HgfsAttrCache) + strlen(path) + 1);
+   tmp = malloc(sizeof(HgfsAttrCacheEntry) + strlen(path) + 1);
    if (tmp == NULL) {
       res = -ENOMEM;
       goto out;
@@ -384,16 +696,84 @@ HgfsSetAttrCache(const char* path,         //IN: Path of file or directory
 
    Str_Strcpy(tmp->path, path, strlen(path) + 1);
    tmp->attr = *attr;
-   tmp->changeTime = HGFS_GET_TIME(time(NULL));
+   tmp->setTime = HgfsGetMonotonicTime();
+   tmp->referenced = FALSE;
+   tmp->listed = listed;
+
+   while (shard->count >= attrShardSize) {
+      HgfsAttrCacheEntry *victim = list_entry(shard->lru.prev,
+                                              HgfsAttrCacheEntry, lru);
+
+      if (victim->referenced) {
+         victim->referenced = FALSE;
+         list_move(&victim->lru, &shard->lru);
+      } else {
+         HgfsAttrCacheRemove(shard, victim);
+         shard->stats.evictions++;
+      }
+   }
 
-   g_hash_table_insert(g_hash_table, (gpointer)tmp->path, (gpointer)tmp);
+   g_hash_table_insert(shard->table, (gpointer)tmp->path, (gpointer)tmp);
+   list_add(&tmp->lru, &shard->lru);
+   list_add(&tmp->age, &shard->age);
+   shard->count++;
 
 out:
-   pthread_mutex_unlock(&HgfsAttrCacheLock);
+   pthread_mutex_unlock(&shard->lock);
    return res;
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsSetAttrCache
+ *
+ *    Updates the HashTable with the given (key, attr) pair.
+ *
+ * Results:
+ *    0 on success else negative value on error
+ *
+ * Side effects:
+ *    May evict an entry of the shard.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+HgfsSetAttrCache(const char* path,         //IN: Path of file or directory
+                 HgfsAttrInfo *attr)       //IN: Attribute for a given path
+{
+   return HgfsAttrCacheSet(path, attr, FALSE);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsSetListedAttrCache
+ *
+ *    Updates the HashTable with the attributes of a directory listing
+ *    entry. The hits on such entries are counted apart, they are the
+ *    getattr requests saved by caching the listings.
+ *
+ * Results:
+ *    0 on success else negative value on error
+ *
+ * Side effects:
+ *    May evict an entry of the shard.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+HgfsSetListedAttrCache(const char* path,   //IN: Path of file or directory
+                       HgfsAttrInfo *attr) //IN: Attribute for a given path
+{
+   return HgfsAttrCacheSet(path, attr, TRUE);
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -413,17 +793,31 @@ out:
 void
 HgfsInvalidateAttrCache(const char* path)      //IN: Path to file
 {
-   HgfsAttrCache *tmp;
+   HgfsAttrCacheShard *shard;
+   HgfsAttrCacheEntry *tmp;
+   Bool children = TRUE;
 
-   pthread_mutex_lock(&HgfsAttrCacheLock);
-   tmp = (HgfsAttrCache *)g_hash_table_lookup(g_hash_table, path);
+   if (0 == gState->attrCacheTtl) {
+      return;
+   }
+
+   /*
+    * An uncached path may be a directory whose entry was evicted while
+    * its children stayed cached, so invalidate its children too.
+    */
+   shard = HgfsAttrCacheGetShard(path);
+   pthread_mutex_lock(&shard->lock);
+   tmp = (HgfsAttrCacheEntry *)g_hash_table_lookup(shard->table, path);
    if (tmp != NULL) {
-      tmp->changeTime = 0;
-      if (tmp->attr.type == HGFS_FILE_TYPE_DIRECTORY) {
-         HgfsInvalidateParentsChildren(tmp->path);
-      }
+      children = (tmp->attr.type == HGFS_FILE_TYPE_DIRECTORY);
+      HgfsAttrCacheRemove(shard, tmp);
+      shard->stats.invalidations++;
+   }
+   pthread_mutex_unlock(&shard->lock);
+
+   if (children) {
+      HgfsInvalidateParentsChildren(path);
    }
-   pthread_mutex_unlock(&HgfsAttrCacheLock);
 }
 
 
@@ -434,7 +828,8 @@ HgfsInvalidateAttrCache(const char* path)      //IN: Path to file
  *
  *    This routine is called by the general function to invalidate a cache
  *    entry. If the entry is a directory this function is called to invalidate
- *    any cached children.
+ *    any cached children, by recording the time of the invalidation for
+ *    the lookups to check.
  *
  * Results:
  *    None
@@ -448,22 +843,113 @@ HgfsInvalidateAttrCache(const char* path)      //IN: Path to file
 static void
 HgfsInvalidateParentsChildren(const char* parent)      //IN: parent
 {
-   gpointer key, value;
-   GHashTableIter iter;
-   size_t parentLen = Str_Strlen(parent, PATH_MAX);
+   HgfsAttrCacheInval *inval;
+   uint64 now = HgfsGetMonotonicTime();
 
    LOG(4, ("Invalidating cache children for parent = %s\n",
            parent));
 
-   g_hash_table_iter_init(&iter, g_hash_table);
+   pthread_rwlock_wrlock(&attrInvalLock);
+
+   inval = g_hash_table_lookup(attrInvalTable, parent);
+   if (inval != NULL) {
+      list_del(&inval->age);
+   } else {
+      inval = malloc(sizeof *inval + strlen(parent) + 1);
+      if (inval == NULL) {
+         /* Cannot record it, drop the whole cache instead. */
+         pthread_rwlock_unlock(&attrInvalLock);
+         HgfsPurgeCacheShards(MAX_UINT64);
+         return;
+      }
+      Str_Strcpy(inval->path, parent, strlen(parent) + 1);
+      g_hash_table_insert(attrInvalTable, (gpointer)inval->path,
+                          (gpointer)inval);
+      attrInvalCount++;
+   }
+   inval->time = now;
+   list_add(&inval->age, &attrInvalList);
+
+   HgfsAttrCacheExpireInval(now);
 
-   while (g_hash_table_iter_next(&iter, &key, &value)) {
-      HgfsAttrCache *child = (HgfsAttrCache *)value;
+   pthread_rwlock_unlock(&attrInvalLock);
+}
 
-      if (Str_Strncasecmp(parent, child->path, parentLen) == 0) {
-         LOG(10, ("Invalidating cache child = %s\n", child->path));
-         child->changeTime = 0;
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsPurgeCacheShards
+ *
+ *    Drop the entries cached at or before a time, oldest first.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsPurgeCacheShards(uint64 time)      //IN: Drop entries cached before it
+{
+   uint32 i;
+
+   for (i = 0; i < HGFS_ATTR_CACHE_SHARDS; i++) {
+      HgfsAttrCacheShard *shard = &attrShards[i];
+
+      pthread_mutex_lock(&shard->lock);
+      while (!list_empty(&shard->age)) {
+         HgfsAttrCacheEntry *tmp = list_entry(shard->age.prev,
+                                              HgfsAttrCacheEntry, age);
+
+         if (tmp->setTime > time) {
+            break;
+         }
+         HgfsAttrCacheRemove(shard, tmp);
+         shard->stats.expirations++;
       }
+      pthread_mutex_unlock(&shard->lock);
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsGetAttrCacheStats
+ *
+ *    Get the sum of the shard counters.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsGetAttrCacheStats(HgfsAttrCacheStats *stats) //OUT: Counters
+{
+   uint32 i;
+
+   memset(stats, 0, sizeof *stats);
+   for (i = 0; i < HGFS_ATTR_CACHE_SHARDS; i++) {
+      HgfsAttrCacheShard *shard = &attrShards[i];
+
+      pthread_mutex_lock(&shard->lock);
+      stats->hits += shard->stats.hits;
+      stats->misses += shard->stats.misses;
+      stats->evictions += shard->stats.evictions;
+      stats->expirations += shard->stats.expirations;
+      stats->invalidations += shard->stats.invalidations;
+      stats->listedHits += shard->stats.listedHits;
+      stats->entries += shard->count;
+      pthread_mutex_unlock(&shard->lock);
    }
 }
 
@@ -473,9 +959,8 @@ HgfsInvalidateParentsChildren(const char* parent)      //IN: parent
  *
  * HgfsPurgeCache
  *
- *    This routine is called by an independent thread to purge the cache,
- *    for performance reasons, the deletion is done in random based
- *    on the order of iteration.
+ *    This routine is called by an independent thread to purge the cache
+ *    of the expired entries, and the expired invalidation records.
  *
  * Results:
  *    None
@@ -489,24 +974,26 @@ HgfsInvalidateParentsChildren(const char* parent)      //IN: parent
 void*
 HgfsPurgeCache(void* unused)      //IN: Thread argument
 {
-   gpointer key, value;
-   GHashTableIter iter;
-
    while (1) {
+      HgfsAttrCacheStats stats;
+      uint64 now;
+
       sleep(CACHE_PURGE_SLEEP_TIME);
 
-      pthread_mutex_lock(&HgfsAttrCacheLock);
+      now = HgfsGetMonotonicTime();
+      HgfsPurgeCacheShards(now - gState->attrCacheTtl);
 
-      if (g_hash_table_size(g_hash_table) >= HASH_THRESHOLD_SIZE) {
-         g_hash_table_iter_init(&iter, g_hash_table);
-         while (g_hash_table_iter_next(&iter, &key, &value) &&
-               (g_hash_table_size(g_hash_table) >= HASH_PURGE_SIZE)) {
-            g_hash_table_iter_remove(&iter);
-            free(value);
-         }
-      }
+      pthread_rwlock_wrlock(&attrInvalLock);
+      HgfsAttrCacheExpireInval(now);
+      pthread_rwlock_unlock(&attrInvalLock);
 
-      pthread_mutex_unlock(&HgfsAttrCacheLock);
+      HgfsGetAttrCacheStats(&stats);
+      LOG(4, ("%u entries, %"FMT64"u hits, %"FMT64"u misses, "
+              "%"FMT64"u evictions, %"FMT64"u expirations, "
+              "%"FMT64"u invalidations, %"FMT64"u hits on listed "
+              "entries\n", stats.entries, stats.hits, stats.misses,
+              stats.evictions, stats.expirations, stats.invalidations,
+              stats.listedHits));
    }
    return 0;
 }
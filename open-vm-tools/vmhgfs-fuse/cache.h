@@ -25,10 +25,31 @@
 #ifndef _HGFS_DRIVER_CACHE_H_
 #define _HGFS_DRIVER_CACHE_H_
 
+/*
+ * Default size and TTL of the attribute cache, see the attr_cache_size and
+ * attr_cache_ttl mount options.
+ */
+#define HGFS_ATTR_CACHE_SIZE_DEFAULT   16384
+#define HGFS_ATTR_CACHE_SIZE_MAX       (1024 * 1024)
+#define HGFS_ATTR_CACHE_TTL_DEFAULT    (HGFS_DEFAULT_TTL * 1000)
+#define HGFS_ATTR_CACHE_TTL_MAX        60000
+
+typedef struct HgfsAttrCacheStats {
+   uint64 hits;
+   uint64 misses;
+   uint64 evictions;        /* Entries dropped for room. */
+   uint64 expirations;      /* Entries dropped after the TTL. */
+   uint64 invalidations;    /* Entries dropped after a change. */
+   uint64 listedHits;       /* Hits on entries cached by a listing. */
+   uint32 entries;
+} HgfsAttrCacheStats;
+
 int HgfsGetAttrCache(const char* path, HgfsAttrInfo *attr);
 int HgfsSetAttrCache(const char* path, HgfsAttrInfo *attr);
+int HgfsSetListedAttrCache(const char* path, HgfsAttrInfo *attr);
 void HgfsInitCache();
 void* HgfsPurgeCache(void*);
 void HgfsInvalidateAttrCache(const char* path);
+void HgfsGetAttrCacheStats(HgfsAttrCacheStats *stats);
 
 #endif
@@ -22,6 +22,7 @@
  */
 
 #include "module.h"
+#include "cache.h"
 #include <fuse_lowlevel.h>
 #include <sys/utsname.h>
 
@@ -76,6 +77,13 @@ const struct fuse_opt vmhgfsOpts[] = {
      VMHGFS_OPT("--loglevel %i",    logLevel, 4),
      VMHGFS_OPT("-l %i",            logLevel, 4),
 #endif
+     VMHGFS_OPT("max_requests=%u",  maxRequests, 0),
+     VMHGFS_OPT("readahead=%u",     readahead, 0),
+     VMHGFS_OPT("writeback=%u",     writebackDelay, 0),
+     VMHGFS_OPT("attr_cache_ttl=%u", attrCacheTtl, 0),
+     VMHGFS_OPT("attr_cache_size=%u", attrCacheSize, 0),
+     VMHGFS_OPT("neg_cache_ttl=%u", negCacheTtl, 0),
+     VMHGFS_OPT("page_cache",       pageCache, 1),
      /* We will change the default value, unless it is specified explicitly. */
 #if FUSE_MAJOR_VERSION != 3
      FUSE_OPT_KEY("big_writes",     KEY_BIG_WRITES),
@@ -124,12 +132,33 @@ Usage(char *prog_name)  // IN
            "                           1 - system OS version is not supported for HGFS FUSE\n"
            "                           2 - system needs FUSE packages for HGFS FUSE\n"
            "\n"
-#ifdef VMX86_DEVEL
            "vmhgfs options:\n"
+           "    -o max_requests=NUM    requests sent to the host at the same time\n"
+           "                           (default: %u, maximum: %u)\n"
+           "    -o readahead=NUM       maximum size chunks read ahead of\n"
+           "                           sequential reads, 0 disables readahead\n"
+           "                           (default: %u, maximum: %u)\n"
+           "    -o writeback=MS        coalesce small writes, written back\n"
+           "                           within MS milliseconds (maximum: %u)\n"
+           "    -o attr_cache_ttl=MS   time attributes are cached, 0 disables\n"
+           "                           the cache (default: %u, maximum: %u)\n"
+           "    -o attr_cache_size=NUM attributes cached at most\n"
+           "                           (default: %u, maximum: %u)\n"
+           "    -o neg_cache_ttl=MS    time missing paths are remembered,\n"
+           "                           0 disables it (default: %u, maximum: %u)\n"
+           "    -o page_cache          keep file data cached by the kernel\n"
+           "                           across opens while the file is unchanged\n"
+#ifdef VMX86_DEVEL
            "    -l   --loglevel NUM    set loglevel=NUM only available in debug build.\n"
-           "\n"
 #endif
-           , prog_name, prog_name, prog_name);
+           "\n"
+           , prog_name, prog_name, prog_name,
+           HGFS_TRANSPORT_WINDOW_DEFAULT, HGFS_TRANSPORT_WINDOW_MAX,
+           HGFS_READAHEAD_DEFAULT, HGFS_READAHEAD_MAX,
+           HGFS_WRITEBACK_DELAY_MAX,
+           HGFS_ATTR_CACHE_TTL_DEFAULT, HGFS_ATTR_CACHE_TTL_MAX,
+           HGFS_ATTR_CACHE_SIZE_DEFAULT, HGFS_ATTR_CACHE_SIZE_MAX,
+           HGFS_NEG_CACHE_TTL_DEFAULT, HGFS_NEG_CACHE_TTL_MAX);
 }
 
 #define LIB_MODULEPATH         "/lib/modules"
@@ -514,6 +543,13 @@ vmhgfsPreprocessArgs(struct fuse_args *outargs)    // IN/OUT
 #ifdef VMX86_DEVEL
    config.logLevel = LOGLEVEL_THRESHOLD;
 #endif
+   config.maxRequests = 0;
+   config.readahead = HGFS_READAHEAD_DEFAULT;
+   config.writebackDelay = 0;
+   config.attrCacheTtl = HGFS_ATTR_CACHE_TTL_DEFAULT;
+   config.attrCacheSize = HGFS_ATTR_CACHE_SIZE_DEFAULT;
+   config.negCacheTtl = HGFS_NEG_CACHE_TTL_DEFAULT;
+   config.pageCache = 0;
 #if defined(__APPLE__) || FUSE_MAJOR_VERSION == 3
    /* osxfuse and fuse3 does not have option 'big_writes'. */
    config.addBigWrites = FALSE;
@@ -529,6 +565,15 @@ vmhgfsPreprocessArgs(struct fuse_args *outargs)    // IN/OUT
 #ifdef VMX86_DEVEL
    LOGLEVEL_THRESHOLD = config.logLevel;
 #endif
+   gState->maxRequests = config.maxRequests;
+   gState->readahead = MIN(config.readahead, HGFS_READAHEAD_MAX);
+   gState->writebackDelay = MIN(config.writebackDelay,
+                                HGFS_WRITEBACK_DELAY_MAX);
+   gState->attrCacheTtl = MIN(config.attrCacheTtl, HGFS_ATTR_CACHE_TTL_MAX);
+   gState->attrCacheSize = MIN(config.attrCacheSize,
+                               HGFS_ATTR_CACHE_SIZE_MAX);
+   gState->negCacheTtl = MIN(config.negCacheTtl, HGFS_NEG_CACHE_TTL_MAX);
+   gState->pageCache = config.pageCache != 0;
    /* Default option changes for vmhgfs fuse client. */
    if (config.addBigWrites) {
       res = fuse_opt_add_arg(outargs, "-obig_writes");
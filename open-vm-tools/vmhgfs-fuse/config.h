@@ -32,6 +32,13 @@ struct vmhgfsConfig {
 #endif
    int addBigWrites;
    int addAllowOther;
+   unsigned int maxRequests;
+   unsigned int readahead;
+   unsigned int writebackDelay;
+   unsigned int attrCacheTtl;
+   unsigned int attrCacheSize;
+   unsigned int negCacheTtl;
+   int pageCache;
 };
 
 int vmhgfsOptProc(void *data, const char *arg,
@@ -22,6 +22,7 @@
  * File operations for the hgfs driver.
  */
 #include "module.h"
+#include "cache.h"
 
 
 #define HGFS_CREATE_DIR_MASK (HGFS_CREATE_DIR_VALID_FILE_NAME | \
@@ -226,6 +227,10 @@ out:
  *    server, while for V3 we may have multiple directory entries. The
  *    number of entries can be read from the reply packet.
  *
+ *    The attributes of each entry are added to the attribute cache, so
+ *    the getattr following a listing needs no request. With plus set,
+ *    they are also passed to filldir for a FUSE readdirplus reply.
+ *
  * Results:
  *    0 on success, anything else on failure.
  *
@@ -237,6 +242,8 @@ out:
 
 static int
 HgfsReadDirFromReply(uint32 *f_pos,     // IN/OUT: Offset
+                     const char *path,  // IN: Path of the directory
+                     Bool plus,         // IN: Fill in all the attributes
                      void *vfsDirent,   // OUT: Buffer to copy dentries into
                      fuse_fill_dir_t filldir, // IN:  Filler function
                      HgfsReq *req,      // IN:  The request containing reply
@@ -249,13 +256,29 @@ HgfsReadDirFromReply(uint32 *f_pos,     // IN/OUT: Offset
    HgfsDirEntry *hgfsDirent = NULL; /* Only for V3. */
    char *escName;                   /* Buffer for escaped version of name */
    size_t escNameLength = NAME_MAX + 1;
+   char *entryPath;                 /* Path of the entry, for the cache */
+   size_t pathLength;
    int result = 0;
 
    ASSERT(req);
+   ASSERT(path);
+
+   pathLength = strlen(path);
+   if (pathLength > 0 && path[pathLength - 1] == '/') {
+      pathLength--;
+   }
+   entryPath = malloc(pathLength + 1 + escNameLength);
+   if (!entryPath) {
+      LOG(4, ("Out of memory allocating entry path buffer.\n"));
+      return  -ENOMEM;
+   }
+   memcpy(entryPath, path, pathLength);
+   entryPath[pathLength] = '/';
 
    escName = malloc(escNameLength);
    if (!escName) {
       LOG(4, ("Out of memory allocating escaped name buffer.\n"));
+      free(entryPath);
       return  -ENOMEM;
    }
 
@@ -389,15 +412,26 @@ HgfsReadDirFromReply(uint32 *f_pos,     // IN/OUT: Offset
          break;
       }
 
+      if (strcmp(escName, ".") != 0 && strcmp(escName, "..") != 0) {
+         memcpy(entryPath + pathLength + 1, escName, fileNameLength + 1);
+         HgfsSetListedAttrCache(entryPath, &attr);
+         HgfsPageCacheUpdate(entryPath, &attr);
+      }
+
       ino = attr.hostFileId;
-      memset(&st, 0, sizeof(st));
-      st.st_blksize = HGFS_BLOCKSIZE;
-      st.st_blocks = HgfsCalcBlockSize(attr.size);
-      st.st_size = attr.size;
-      st.st_ino = ino;
-      st.st_mode = d_type << 12;
+      if (plus) {
+         HgfsAttrToStat(&attr, &st);
+      } else {
+         memset(&st, 0, sizeof(st));
+         st.st_blksize = HGFS_BLOCKSIZE;
+         st.st_blocks = HgfsCalcBlockSize(attr.size);
+         st.st_size = attr.size;
+         st.st_ino = ino;
+         st.st_mode = d_type << 12;
+      }
 #if FUSE_MAJOR_VERSION == 3
-      result = filldir(vfsDirent, escName, &st, 0, 0);
+      result = filldir(vfsDirent, escName, &st, 0,
+                       plus ? FUSE_FILL_DIR_PLUS : 0);
 #else
       result = filldir(vfsDirent, escName, &st, 0);
 #endif
@@ -431,6 +465,7 @@ HgfsReadDirFromReply(uint32 *f_pos,     // IN/OUT: Offset
 
 out:
    free(escName);
+   free(entryPath);
    return result;
 }
 
@@ -541,6 +576,9 @@ HgfsRequestDirEntries(HgfsHandle searchHandle, // IN: Handle to dir
  *       dentries, then readdir should NOT call filldir, and should
  *       return from readdir with a non-error.
  *
+ *    The attributes of the entries are cached, see
+ *    HgfsReadDirFromReply.
+ *
  * Results:
  *    Returns zero if on success, negative error on failure.
  *    (According to /fs/readdir.c, any non-negative return value
@@ -554,6 +592,8 @@ HgfsRequestDirEntries(HgfsHandle searchHandle, // IN: Handle to dir
 
 int
 HgfsReaddir(HgfsHandle handle,        // IN:  Directory handle to read from
+            const char *path,         // IN:  Path of the directory
+            Bool plus,                // IN:  Fill in all the attributes
             void *dirent,             // OUT: Buffer to copy dentries into
             fuse_fill_dir_t filldir)  // IN:  Filler function
 {
@@ -564,6 +604,9 @@ HgfsReaddir(HgfsHandle handle,        // IN:  Directory handle to read from
 
    ASSERT(dirent);
 
+   /* The sizes and times listed must include the buffered writes. */
+   HgfsWritebackFlushDir(path, FALSE);
+
    request = HgfsGetNewRequest();
    if (!request) {
       LOG(4, ("Out of memory while getting new request\n"));
@@ -581,8 +624,8 @@ HgfsReaddir(HgfsHandle handle,        // IN:  Directory handle to read from
          break;
       }
 
-      result = HgfsReadDirFromReply(&f_pos, dirent, filldir, request, opUsed,
-                                    &done);
+      result = HgfsReadDirFromReply(&f_pos, path, plus, dirent, filldir,
+                                    request, opUsed, &done);
 
       LOG(4, ("f_pos = %d\n", f_pos));
       if (result == -ENAMETOOLONG) {
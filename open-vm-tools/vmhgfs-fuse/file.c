@@ -529,7 +529,8 @@ HgfsCreate(const char *path,          //IN: Path to a file
  * HgfsDoRead --
  *
  *    Do one read request. Called by HgfsRead, possibly multiple times
- *    if the size of the read is too big to be handled by one server request.
+ *    if the size of the read is too big to be handled by one server request,
+ *    and by the readahead threads.
  *
  *    We send a "Read" request to the server with the given handle.
  *
@@ -543,7 +544,7 @@ HgfsCreate(const char *path,          //IN: Path to a file
  *----------------------------------------------------------------------------
  */
 
-static int
+int
 HgfsDoRead(HgfsHandle handle,  // IN:  Handle for this file
            char *buf,          // OUT: Buffer to copy data into
            size_t count,       // IN:  Number of bytes to read
@@ -693,19 +694,22 @@ HgfsMaxIOSize(void)
  * HgfsRead --
  *
  *    Called whenever a process reads from a file in our filesystem.
+ *    The start of the read may be served from data read ahead, the rest
+ *    is read from the server.
  *
  * Results:
  *    Returns the number of bytes read on success, or an error on
  *    failure.
  *
  * Side effects:
- *    None
+ *    May start reading ahead of a sequential read.
  *
  *----------------------------------------------------------------------
  */
 
 ssize_t
 HgfsRead(struct fuse_file_info *fi,  // IN:  File info struct
+         const char *path,           // IN:  Absolute path of the file
          char  *buf,                 // OUT: User buffer to copy data into
          size_t count,               // IN:  Number of bytes to read
          loff_t offset)              // IN:  Offset at which to read
@@ -715,6 +719,7 @@ HgfsRead(struct fuse_file_info *fi,  // IN:  File info struct
    loff_t curOffset = offset;
    size_t nextCount, remainingCount = count;
    uint32 maxIOSize = HgfsMaxIOSize();
+   Bool eof;
 
    ASSERT(NULL != fi);
    ASSERT(NULL != buf);
@@ -722,6 +727,18 @@ HgfsRead(struct fuse_file_info *fi,  // IN:  File info struct
    LOG(4, ("Entry(0x%"FMT64"x 0x%"FMTSZ"x bytes @ 0x%"FMT64"x)\n",
            fi->fh, count, offset));
 
+   /* Reads must see the buffered writes, through any handle. */
+   HgfsWritebackFlushPath(path);
+
+   nextCount = HgfsReadaheadGet(fi->fh, path, buffer, remainingCount,
+                                curOffset, maxIOSize, &eof);
+   remainingCount -= nextCount;
+   curOffset += nextCount;
+   buffer += nextCount;
+   if (eof || remainingCount == 0) {
+      goto done;
+   }
+
     do {
       nextCount = (remainingCount > maxIOSize) ? maxIOSize : remainingCount;
       LOG(4, ("Issue DoRead(0x%"FMT64"x 0x%"FMTSZ"x bytes @ 0x%"FMT64"x)\n",
@@ -737,6 +754,10 @@ HgfsRead(struct fuse_file_info *fi,  // IN:  File info struct
 
    } while ((result > 0) && (remainingCount > 0));
 
+   eof = (remainingCount > 0);
+
+  done:
+   HgfsReadaheadNext(fi->fh, curOffset, eof);
   memset(buffer, 0, remainingCount);
 
   out:
@@ -752,7 +773,7 @@ HgfsRead(struct fuse_file_info *fi,  // IN:  File info struct
  *
  *    Do one write request. Called by HgfsWrite, possibly multiple
  *    times if the size of the write is too big to be handled by one server
- *    request.
+ *    request, and to write back the coalesced writes.
  *
  *    We send a "Write" request to the server with the given handle.
  *
@@ -765,7 +786,7 @@ HgfsRead(struct fuse_file_info *fi,  // IN:  File info struct
  *-----------------------------------------------------------------------------
  */
 
-static int
+int
 HgfsDoWrite(HgfsHandle handle,       // IN: Handle for the file
             const char *buf,         // IN: Buffer containing data
             size_t count,            // IN: Number of bytes to write
@@ -878,10 +899,11 @@ out:
  * HgfsWrite --
  *
  *    Called whenever a process writes to a file in our filesystem.
+ *    With write back enabled small writes are only buffered.
  *
  * Results:
  *    Returns the number of bytes written on success, or an error on
- *    failure.
+ *    failure, which may be the error of an earlier buffered write.
  *
  * Side effects:
  *    None
@@ -891,6 +913,7 @@ out:
 
 ssize_t
 HgfsWrite(struct fuse_file_info *fi,  // IN: File info structure
+         const char *path,            // IN: Absolute path of the file
          const char  *buf,            // OUT: User buffer to copy data into
          size_t count,                // IN:  Number of bytes to read
          loff_t offset)               // IN:  Offset at which to read
@@ -908,6 +931,12 @@ HgfsWrite(struct fuse_file_info *fi,  // IN: File info structure
    LOG(6, ("Entry(0x%"FMT64"x off bytes 0x%"FMTSZ"x @ 0x%"FMT64"x)\n",
            fi->fh, count, offset));
 
+   if (HgfsWritebackWrite(fi->fh, path, buf, count, offset, maxIOSize,
+                          &result)) {
+      bytesWritten = (result < 0) ? result : count;
+      goto out;
+   }
+
    do {
       nextCount = (remainingCount > maxIOSize) ? maxIOSize : remainingCount;
       LOG(4, ("Issue DoWrite(0x%"FMT64"x 0x%"FMTSZ"x bytes @ 0x%"FMT64"x)\n",
@@ -929,11 +958,221 @@ HgfsWrite(struct fuse_file_info *fi,  // IN: File info structure
    bytesWritten = count - remainingCount;
 
 out:
+   /*
+    * The data read ahead through any handle of the file is stale, also
+    * chunks queued while the write was sent.
+    */
+   HgfsReadaheadInvalidatePath(path, FALSE);
    LOG(6, ("Exit(0x%"FMTSZ"x)\n", bytesWritten));
    return bytesWritten;
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsSeekExtent --
+ *
+ *    Find the first data or hole of an open file at or after an offset,
+ *    as for lseek SEEK_DATA and SEEK_HOLE. Buffered writes to the file are
+ *    flushed first.
+ *
+ * Results:
+ *    Returns the offset found on success, -ENXIO if there is none, or
+ *    -EOPNOTSUPP if the server cannot look for extents, or a negative
+ *    error on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+loff_t
+HgfsSeekExtent(HgfsHandle handle,         // IN: Handle for the file
+               HgfsSeekExtentType type,   // IN: Data or hole
+               loff_t offset)             // IN: Offset to look from
+{
+   HgfsReq *req;
+   HgfsOp opUsed = hgfsVersionSeekExtent;
+   HgfsRequestSeekExtentV4 *requestV4;
+   HgfsStatus replyStatus;
+   loff_t result;
+
+   LOG(6, ("Entry(handle = %u, type %u @ %#"FMT64"x)\n", handle, type, offset));
+
+   if (opUsed != HGFS_OP_SEEK_EXTENT_V4) {
+      result = -EOPNOTSUPP;
+      goto exit;
+   }
+
+   /* Buffered writes may turn holes into data, the server must have them. */
+   result = HgfsWritebackFlush(handle);
+   if (result < 0) {
+      goto exit;
+   }
+
+   req = HgfsGetNewRequest();
+   if (!req) {
+      LOG(4, ("Out of memory while getting new request\n"));
+      result = -ENOMEM;
+      goto exit;
+   }
+
+   requestV4 = HgfsGetRequestPayload(req);
+   requestV4->file = handle;
+   requestV4->type = type;
+   requestV4->offset = offset;
+   requestV4->reserved = 0;
+   req->payloadSize = sizeof *requestV4 + HgfsGetRequestHeaderSize();
+
+   /* Fill in header here as payloadSize needs to be there. */
+   HgfsPackHeader(req, opUsed);
+
+   /* Send the request and process the reply. */
+   result = HgfsSendRequest(req);
+   if (result == 0) {
+      /* Get the reply. */
+      replyStatus = HgfsGetReplyStatus(req);
+      result = HgfsStatusConvertToLinux(replyStatus);
+
+      switch (result) {
+      case 0: {
+         HgfsReplySeekExtentV4 *replyV4 = HgfsGetReplyPayload(req);
+
+         if (replyV4->offset == HGFS_SEEK_EXTENT_NONE) {
+            result = -ENXIO;
+         } else {
+            result = replyV4->offset;
+         }
+         break;
+      }
+      case -EPROTO:
+         /* The server does not know the op. Do not ask again. */
+         LOG(4, ("Seek extent not supported by the server.\n"));
+         hgfsVersionSeekExtent = HGFS_OP_MAX;
+         result = -EOPNOTSUPP;
+         break;
+      default:
+         LOG(4, ("Server returned error: %"FMT64"d\n", result));
+         break;
+      }
+   } else if (result == -EIO) {
+      LOG(4, ("Timed out. error: %"FMT64"d\n", result));
+   } else {
+      LOG(4, ("Unknown error: %"FMT64"d\n", result));
+   }
+
+   HgfsFreeRequest(req);
+
+exit:
+   LOG(6, ("Exit(%"FMT64"d)\n", result));
+   return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsAllocate --
+ *
+ *    Allocate, or with HGFS_ALLOCATE_PUNCH_HOLE deallocate, the storage
+ *    of a byte range of an open file. Buffered writes to the file are
+ *    flushed first, and the read ahead data of all its open handles is
+ *    dropped after.
+ *
+ * Results:
+ *    Returns zero on success, -EOPNOTSUPP if the server or the host file
+ *    system cannot do it, or a negative error on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+HgfsAllocate(HgfsHandle handle,         // IN: Handle for the file
+             const char *path,          // IN: Absolute path of the file
+             HgfsAllocateFlags flags,   // IN: Allocate flags
+             loff_t offset,             // IN: Range start
+             loff_t length)             // IN: Range length
+{
+   HgfsReq *req;
+   HgfsOp opUsed = hgfsVersionAllocate;
+   HgfsRequestAllocateV4 *requestV4;
+   HgfsStatus replyStatus;
+   int result;
+
+   LOG(6, ("Entry(handle = %u, flags %#x %#"FMT64"x + %#"FMT64"x)\n",
+           handle, flags, offset, length));
+
+   if (opUsed != HGFS_OP_ALLOCATE_V4) {
+      result = -EOPNOTSUPP;
+      goto exit;
+   }
+
+   /* Buffered writes to the range must reach the server first. */
+   result = HgfsWritebackFlush(handle);
+   if (result < 0) {
+      goto exit;
+   }
+
+   req = HgfsGetNewRequest();
+   if (!req) {
+      LOG(4, ("Out of memory while getting new request\n"));
+      result = -ENOMEM;
+      goto exit;
+   }
+
+   requestV4 = HgfsGetRequestPayload(req);
+   requestV4->file = handle;
+   requestV4->flags = flags;
+   requestV4->offset = offset;
+   requestV4->length = length;
+   requestV4->reserved = 0;
+   req->payloadSize = sizeof *requestV4 + HgfsGetRequestHeaderSize();
+
+   /* Fill in header here as payloadSize needs to be there. */
+   HgfsPackHeader(req, opUsed);
+
+   /* Send the request and process the reply. */
+   result = HgfsSendRequest(req);
+   if (result == 0) {
+      /* Get the reply. */
+      replyStatus = HgfsGetReplyStatus(req);
+      result = HgfsStatusConvertToLinux(replyStatus);
+
+      switch (result) {
+      case 0:
+         break;
+      case -EPROTO:
+         /* The server does not know the op. Do not ask again. */
+         LOG(4, ("Allocate not supported by the server.\n"));
+         hgfsVersionAllocate = HGFS_OP_MAX;
+         result = -EOPNOTSUPP;
+         break;
+      default:
+         LOG(4, ("Server returned error: %d\n", result));
+         break;
+      }
+   } else if (result == -EIO) {
+      LOG(4, ("Timed out. error: %d\n", result));
+   } else {
+      LOG(4, ("Unknown error: %d\n", result));
+   }
+
+   HgfsFreeRequest(req);
+
+   /* Read ahead data of the range is stale, whichever handle read it. */
+   HgfsReadaheadInvalidatePath(path, FALSE);
+
+exit:
+   LOG(6, ("Exit(%d)\n", result));
+   return result;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -965,6 +1204,15 @@ HgfsRename(const char* from, const char* to)
    ASSERT(from);
    ASSERT(to);
 
+   /*
+    * The buffers record the paths of their files: write those of the
+    * renamed file, or of the files below the renamed directory, first.
+    */
+   HgfsWritebackFlushPath(from);
+   HgfsWritebackFlushDir(from, TRUE);
+   /* Likewise the read ahead data, which is invalidated by path. */
+   HgfsReadaheadInvalidatePath(from, TRUE);
+
    req = HgfsGetNewRequest();
    if (!req) {
       LOG(4, ("Out of memory while getting new request\n"));
@@ -1393,6 +1641,9 @@ HgfsSetattr(const char* path,       //IN: Path to file
 
    LOG(4, ("Entry(%s)\n", path));
 
+   /* Buffered writes must not land after a truncate or times update. */
+   HgfsWritebackFlushPath(path);
+
    req = HgfsGetNewRequest();
    if (!req) {
       result = -ENOMEM;
@@ -1439,6 +1690,10 @@ retry:
 
 out:
    HgfsFreeRequest(req);
+   if (attr->mask & HGFS_ATTR_VALID_SIZE) {
+      /* Read ahead data past, or up to, the new size is stale. */
+      HgfsReadaheadInvalidatePath(path, FALSE);
+   }
    LOG(6, ("Exit(%d)\n", result));
    return result;
 }
@@ -1470,6 +1725,12 @@ HgfsRelease(HgfsHandle handle)  //IN:File handle to close
 
    LOG(6, ("Entry(handle = %u)\n", handle));
 
+   result = HgfsWritebackRelease(handle);
+   if (result < 0) {
+      LOG(4, ("Write back failed. handle = %u, error = %d\n", handle, result));
+   }
+   HgfsReadaheadRelease(handle);
+
    req = HgfsGetNewRequest();
    if (!req) {
       LOG(4, ("Out of memory while getting new request\n"));
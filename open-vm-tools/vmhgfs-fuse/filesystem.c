@@ -59,6 +59,8 @@ HgfsOp hgfsVersionDeleteDir;
 HgfsOp hgfsVersionRename;
 HgfsOp hgfsVersionQueryVolumeInfo;
 HgfsOp hgfsVersionCreateSymlink;
+HgfsOp hgfsVersionSeekExtent;
+HgfsOp hgfsVersionAllocate;
 
 HgfsFuseState HFState;
 HgfsFuseState *gState = &HFState;
@@ -99,6 +101,9 @@ HgfsResetOps(void)
    hgfsVersionRename          = HGFS_OP_RENAME_V3;
    hgfsVersionQueryVolumeInfo = HGFS_OP_QUERY_VOLUME_INFO_V3;
    hgfsVersionCreateSymlink   = HGFS_OP_CREATE_SYMLINK_V3;
+   /* Optional ops, enabled by HgfsCreateSession if the server has them. */
+   hgfsVersionSeekExtent      = HGFS_OP_MAX;
+   hgfsVersionAllocate        = HGFS_OP_MAX;
 }
 
 
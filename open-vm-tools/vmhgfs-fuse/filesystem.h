@@ -48,6 +48,27 @@ typedef struct HgfsFuseState {
 
    GKeyFile *conf;
 
+   /* Requests in flight at most, 0 for the default, see transport.h. */
+   uint32 maxRequests;
+
+   /* Chunks read ahead of sequential readers, see readahead.h. */
+   uint32 readahead;
+
+   /* Milliseconds small writes may stay buffered, 0 disables buffering. */
+   uint32 writebackDelay;
+
+   /* Attribute cache TTL in ms, 0 disables it, see cache.h. */
+   uint32 attrCacheTtl;
+
+   /* Attribute cache entries at most, see cache.h. */
+   uint32 attrCacheSize;
+
+   /* Milliseconds missing paths are remembered, see negcache.h. */
+   uint32 negCacheTtl;
+
+   /* Keep the kernel cached file data across opens, see pagecache.h. */
+   Bool pageCache;
+
 } HgfsFuseState;
 
 /* Public functions (with respect to the entire module). */
@@ -24,6 +24,7 @@
  */
 
 #include <limits.h>
+#include <time.h>
 #include "module.h"
 #include "cache.h"
 
@@ -457,6 +458,9 @@ HgfsPrivateGetattr(HgfsHandle handle,      // IN: file handle
    ASSERT(attr);
    LOG( 4,("path = %s, handle = %u\n", path, handle));
 
+   /* The size and times must include the buffered writes. */
+   HgfsWritebackFlushPath(path);
+
    req = HgfsGetNewRequest();
    if (!req) {
       LOG(8, ("Out of memory while getting new request\n"));
@@ -670,6 +674,34 @@ HgfsStatusConvertToLinux(HgfsStatus hgfsStatus) // IN: Status code to convert
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsGetMonotonicTime --
+ *
+ *    Get a time for measuring intervals, which does not move with the
+ *    system clock. The coarse clock is cheaper to read and its tick
+ *    resolution is ample for the cache and writeback timeouts.
+ *
+ * Results:
+ *    The time in milliseconds.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+uint64
+HgfsGetMonotonicTime(void)
+{
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+   return (uint64)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -699,6 +731,84 @@ HgfsCalcBlockSize(uint64 tsize)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsAttrToStat --
+ *
+ *    Fill a stat structure from the attributes returned by the server.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsAttrToStat(const HgfsAttrInfo *attr,  // IN: Attributes
+               struct stat *stbuf)        // OUT: Stat structure
+{
+   uint32 d_type;
+
+   memset(stbuf, 0, sizeof *stbuf);
+
+   if (attr->mask & HGFS_ATTR_VALID_SPECIAL_PERMS) {
+      stbuf->st_mode |= (attr->specialPerms << 9);
+   }
+   if (attr->mask & HGFS_ATTR_VALID_OWNER_PERMS) {
+      stbuf->st_mode |= (attr->ownerPerms << 6);
+   }
+   if (attr->mask & HGFS_ATTR_VALID_GROUP_PERMS) {
+      stbuf->st_mode |= (attr->groupPerms << 3);
+   }
+   if (attr->mask & HGFS_ATTR_VALID_OTHER_PERMS) {
+      stbuf->st_mode |= (attr->otherPerms);
+   }
+
+   /* Mask the access mode. */
+   switch (attr->type) {
+   case HGFS_FILE_TYPE_SYMLINK:
+      d_type = DT_LNK;
+      break;
+
+   case HGFS_FILE_TYPE_REGULAR:
+      d_type = DT_REG;
+      break;
+
+   case HGFS_FILE_TYPE_DIRECTORY:
+      d_type = DT_DIR;
+      break;
+
+   default:
+      d_type = DT_UNKNOWN;
+      break;
+   }
+
+   stbuf->st_mode |= d_type << 12;
+   stbuf->st_blksize = HGFS_BLOCKSIZE;
+   stbuf->st_blocks = HgfsCalcBlockSize(attr->size);
+   stbuf->st_size = attr->size;
+   stbuf->st_ino = attr->hostFileId;
+   stbuf->st_nlink = 1;
+   stbuf->st_uid = attr->userId;
+   stbuf->st_gid = attr->groupId;
+   stbuf->st_rdev = 0;
+
+   if (attr->mask & HGFS_ATTR_VALID_ACCESS_TIME) {
+      HGFS_SET_TIME(stbuf->st_atime, attr->accessTime);
+   }
+   if (attr->mask & HGFS_ATTR_VALID_WRITE_TIME) {
+      HGFS_SET_TIME(stbuf->st_mtime, attr->writeTime);
+   }
+   if (attr->mask & HGFS_ATTR_VALID_CHANGE_TIME) {
+      HGFS_SET_TIME(stbuf->st_ctime, attr->attrChangeTime);
+   }
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
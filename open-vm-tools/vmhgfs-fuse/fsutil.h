@@ -71,10 +71,23 @@ HgfsRestoreReadOnly(const char* path,
 
 ssize_t
 HgfsWrite(struct fuse_file_info *fi,
+          const char *path,
           const char  *buf,
           size_t count,
           loff_t offset);
 
+loff_t
+HgfsSeekExtent(HgfsHandle handle,
+               HgfsSeekExtentType type,
+               loff_t offset);
+
+int
+HgfsAllocate(HgfsHandle handle,
+             const char *path,
+             HgfsAllocateFlags flags,
+             loff_t offset,
+             loff_t length);
+
 int
 HgfsRename(const char* from, const char* to);
 
@@ -91,10 +104,23 @@ HgfsCreate(const char *path,
 
 ssize_t
 HgfsRead(struct fuse_file_info *fi,
+         const char *path,
          char  *buf,
          size_t count,
          loff_t offset);
 
+int
+HgfsDoRead(HgfsHandle handle,
+           char *buf,
+           size_t count,
+           loff_t offset);
+
+int
+HgfsDoWrite(HgfsHandle handle,
+            const char *buf,
+            size_t count,
+            loff_t offset);
+
 int
 HgfsSetattr(const char* path,
             HgfsAttrInfo *attr);
@@ -121,6 +147,8 @@ HgfsDirOpen(const char* path, HgfsHandle* handle);
 
 int
 HgfsReaddir(HgfsHandle handle,
+            const char *path,
+            Bool plus,
             void *dirent,
             fuse_fill_dir_t filldir);
 
@@ -142,4 +170,11 @@ HgfsResetOps(void);
 unsigned long
 HgfsCalcBlockSize(uint64 tsize);
 
+void
+HgfsAttrToStat(const HgfsAttrInfo *attr,
+               struct stat *stbuf);
+
+uint64
+HgfsGetMonotonicTime(void);
+
 #endif // _HGFS_DRIVER_FSUTIL_H_
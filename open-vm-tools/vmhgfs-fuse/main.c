@@ -22,11 +22,20 @@
  * Main entry points for fuse file operations for HGFS
  */
 
+#define _GNU_SOURCE // for SEEK_DATA, SEEK_HOLE and FALLOC_FL_*
+
 #include "module.h"
 #include "cache.h"
 #include "filesystem.h"
 #include "file.h"
 
+#if defined(__linux__)
+#include <fcntl.h>
+#if !defined(FALLOC_FL_PUNCH_HOLE)
+#   include <linux/falloc.h>
+#endif
+#endif
+
 /*
  *----------------------------------------------------------------------
  *
@@ -129,7 +138,6 @@ hgfs_getattr(const char *path,    //IN: path of a file/directory
    HgfsHandle fileHandle = HGFS_INVALID_HANDLE;
    HgfsAttrInfo newAttr = {0};
    HgfsAttrInfo *attr = &newAttr;
-   uint32 d_type;
    char *abspath = NULL;
    int res;
 
@@ -141,12 +149,17 @@ hgfs_getattr(const char *path,    //IN: path of a file/directory
 
    res = HgfsGetAttrCache(abspath, attr);
    LOG(4, ("Retrieve attr from cache. result = %d \n", res));
-   if (res != 0) {
+   if (res != 0 && HgfsNegCacheLookup(abspath)) {
+      res = -ENOENT;
+   } else if (res != 0) {
       /* Retrieve new complete attribute settings and update the cache. */
       res = HgfsPrivateGetattr(fileHandle, abspath, attr);
       LOG(4, ("Retrieve attr from server. result = %d \n", res));
       if (res == 0 ) {
          HgfsSetAttrCache(abspath, attr);
+         HgfsPageCacheUpdate(abspath, attr);
+      } else if (res == -ENOENT) {
+         HgfsNegCacheAdd(abspath);
       }
    }
 
@@ -156,59 +169,7 @@ hgfs_getattr(const char *path,    //IN: path of a file/directory
 
    LOG(4, ("fill stat for %s\n", abspath));
 
-   memset(stbuf, 0, sizeof *stbuf);
-
-   if (attr->mask & HGFS_ATTR_VALID_SPECIAL_PERMS) {
-      stbuf->st_mode |= (attr->specialPerms << 9);
-   }
-   if (attr->mask & HGFS_ATTR_VALID_OWNER_PERMS) {
-      stbuf->st_mode |= (attr->ownerPerms << 6);
-   }
-   if (attr->mask & HGFS_ATTR_VALID_GROUP_PERMS) {
-      stbuf->st_mode |= (attr->groupPerms << 3);
-   }
-   if (attr->mask & HGFS_ATTR_VALID_OTHER_PERMS) {
-      stbuf->st_mode |= (attr->otherPerms);
-   }
-
-   /* Mask the access mode. */
-   switch (attr->type) {
-   case HGFS_FILE_TYPE_SYMLINK:
-      d_type = DT_LNK;
-      break;
-
-   case HGFS_FILE_TYPE_REGULAR:
-      d_type = DT_REG;
-      break;
-
-   case HGFS_FILE_TYPE_DIRECTORY:
-      d_type = DT_DIR;
-      break;
-
-   default:
-      d_type = DT_UNKNOWN;
-      break;
-   }
-
-   stbuf->st_mode |= d_type << 12;
-   stbuf->st_blksize = HGFS_BLOCKSIZE;
-   stbuf->st_blocks = HgfsCalcBlockSize(attr->size);
-   stbuf->st_size = attr->size;
-   stbuf->st_ino = attr->hostFileId;
-   stbuf->st_nlink = 1;
-   stbuf->st_uid = attr->userId;
-   stbuf->st_gid = attr->groupId;
-   stbuf->st_rdev = 0;
-
-   if (attr->mask & HGFS_ATTR_VALID_ACCESS_TIME) {
-      HGFS_SET_TIME(stbuf->st_atime, attr->accessTime);
-   }
-   if (attr->mask & HGFS_ATTR_VALID_WRITE_TIME) {
-      HGFS_SET_TIME(stbuf->st_mtime, attr->writeTime);
-   }
-   if (attr->mask & HGFS_ATTR_VALID_CHANGE_TIME) {
-      HGFS_SET_TIME(stbuf->st_ctime, attr->attrChangeTime);
-   }
+   HgfsAttrToStat(attr, stbuf);
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -250,14 +211,18 @@ hgfs_access(const char *path,  //IN: Path to a file.
       goto exit;
    }
 
-   res = HgfsGetAttrCache(path, attr);
+   res = HgfsGetAttrCache(abspath, attr);
    LOG(4, ("Retrieve attr from cache. result = %d \n", res));
-   if (res != 0) {
+   if (res != 0 && HgfsNegCacheLookup(abspath)) {
+      res = -ENOENT;
+   } else if (res != 0) {
       /* Retrieve new complete attribute settings and update the cache. */
       res = HgfsPrivateGetattr(fileHandle, abspath, attr);
       LOG(4, ("Retrieve attr from server. result = %d \n", res));
       if (res == 0 ) {
          HgfsSetAttrCache(abspath, attr);
+      } else if (res == -ENOENT) {
+         HgfsNegCacheAdd(abspath);
       }
    }
 
@@ -375,7 +340,7 @@ hgfs_readdir(const char *path,              //IN: path to a directory
              fuse_fill_dir_t filler,        //IN: function pointer to fill buf
              off_t offset,                  //IN: offset to read the dir
              struct fuse_file_info *fi,     //IN: file info set by open call
-             enum fuse_readdir_flags flags) //IN: unused
+             enum fuse_readdir_flags flags) //IN: readdirplus requested
 #else
 static int
 hgfs_readdir(const char *path,          //IN: path to a directory
@@ -401,7 +366,12 @@ hgfs_readdir(const char *path,          //IN: path to a directory
    }
 
    fi->fh = fileHandle;
-   res = HgfsReaddir(fileHandle, buf, filler);
+#if FUSE_MAJOR_VERSION == 3
+   res = HgfsReaddir(fileHandle, abspath, (flags & FUSE_READDIR_PLUS) != 0,
+                     buf, filler);
+#else
+   res = HgfsReaddir(fileHandle, abspath, FALSE, buf, filler);
+#endif
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -472,6 +442,9 @@ hgfs_mkdir(const char *path,  //IN: path to a new dir
    }
 
    res = HgfsMkdir(abspath, mode);
+   if (res == 0) {
+      HgfsNegCacheInvalidate(abspath, TRUE);
+   }
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -591,6 +564,9 @@ hgfs_symlink(const char *symname,   //IN: symname target
 
    LOG(4, ("symname = %s, abs source = %s)\n", symname, absSource));
    res = HgfsSymlink(absSource, symname);
+   if (res == 0) {
+      HgfsNegCacheInvalidate(absSource, FALSE);
+   }
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -644,6 +620,7 @@ hgfs_rename(const char *from,  //IN: from path name
    if (res == 0) {
       HgfsInvalidateAttrCache(absfrom);
       HgfsInvalidateAttrCache(absto);
+      HgfsNegCacheInvalidate(absto, TRUE);
    }
 
 exit:
@@ -1037,6 +1014,12 @@ hgfs_open(const char *path,          //IN: path to a file
    }
 
    res = HgfsOpen(abspath, fi);
+   if (res == 0 && (fi->flags & O_CREAT)) {
+      HgfsNegCacheInvalidate(abspath, FALSE);
+   }
+   if (res == 0) {
+      fi->keep_cache = HgfsPageCacheOpen(abspath, fi->fh);
+   }
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -1076,6 +1059,9 @@ hgfs_create(const char *path,          //IN: path to a file
    }
 
    res = HgfsCreate(abspath, mode, fi);
+   if (res == 0) {
+      HgfsNegCacheInvalidate(abspath, FALSE);
+   }
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -1124,7 +1110,7 @@ hgfs_read(const char *path,          //IN: path to a file
          goto exit;
       }
    }
-   res = HgfsRead(fi, buf, size, offset);
+   res = HgfsRead(fi, abspath, buf, size, offset);
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -1174,7 +1160,7 @@ hgfs_write(const char *path,          //IN: path to a file
       }
    }
 
-   res = HgfsWrite(fi, buf, size, offset);
+   res = HgfsWrite(fi, abspath, buf, size, offset);
    if (res >= 0) {
       /*
        * Positive result indicates the number of bytes written.
@@ -1190,6 +1176,146 @@ exit:
    return res;
 }
 
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 8) && \
+    defined(SEEK_DATA) && defined(SEEK_HOLE)
+/*
+ *----------------------------------------------------------------------
+ *
+ * hgfs_lseek
+ *
+ *    Find the next data or hole of a file. FUSE only asks for SEEK_DATA
+ *    and SEEK_HOLE, other whence values are handled by the kernel.
+ *
+ * Results:
+ *    Returns the new offset on success, or a negative error on failure.
+ *    -ENOSYS makes the kernel treat the whole file as data from now on.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static off_t
+hgfs_lseek(const char *path,          //IN: path to a file
+           off_t offset,              //IN: offset to look from
+           int whence,                //IN: SEEK_DATA or SEEK_HOLE
+           struct fuse_file_info *fi) //IN: file info structure
+{
+   char *abspath = NULL;
+   HgfsSeekExtentType type;
+   off_t res;
+
+   LOG(4, ("Entry(path = %s, fi->fh = %#"FMT64"x, whence %d @ %#"FMT64"x)\n",
+           path, fi->fh, whence, offset));
+
+   switch (whence) {
+   case SEEK_DATA:
+      type = HGFS_SEEK_EXTENT_DATA;
+      break;
+   case SEEK_HOLE:
+      type = HGFS_SEEK_EXTENT_HOLE;
+      break;
+   default:
+      res = -EINVAL;
+      goto exit;
+   }
+
+   res = getAbsPath(path, &abspath);
+   if (res < 0) {
+      goto exit;
+   }
+
+   if (fi->fh == HGFS_INVALID_HANDLE) {
+      res = HgfsOpen(abspath, fi);
+      if (res) {
+         goto exit;
+      }
+   }
+
+   res = HgfsSeekExtent(fi->fh, type, offset);
+   if (res == -EOPNOTSUPP) {
+      res = -ENOSYS;
+   }
+
+exit:
+   LOG(4, ("Exit(%"FMT64"d)\n", res));
+   freeAbsPath(abspath);
+   return res;
+}
+#endif
+
+
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(2, 9) && defined(__linux__)
+/*
+ *----------------------------------------------------------------------
+ *
+ * hgfs_fallocate
+ *
+ *    Allocate the storage of a byte range of a file, or punch a hole in
+ *    it. Only the FALLOC_FL_KEEP_SIZE and FALLOC_FL_PUNCH_HOLE modes
+ *    are supported.
+ *
+ * Results:
+ *    Returns zero on success, or a negative error on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+hgfs_fallocate(const char *path,          //IN: path to a file
+               int mode,                  //IN: fallocate mode
+               off_t offset,              //IN: range start
+               off_t length,              //IN: range length
+               struct fuse_file_info *fi) //IN: file info structure
+{
+   char *abspath = NULL;
+   HgfsAllocateFlags flags = 0;
+   int res;
+
+   LOG(4, ("Entry(path = %s, fi->fh = %#"FMT64"x, mode %#x %#"FMT64"x + "
+           "%#"FMT64"x)\n", path, fi->fh, mode, offset, length));
+
+   if ((mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE)) != 0) {
+      res = -EOPNOTSUPP;
+      goto exit;
+   }
+   if ((mode & FALLOC_FL_KEEP_SIZE) != 0) {
+      flags |= HGFS_ALLOCATE_KEEP_SIZE;
+   }
+   if ((mode & FALLOC_FL_PUNCH_HOLE) != 0) {
+      flags |= HGFS_ALLOCATE_PUNCH_HOLE;
+   }
+
+   res = getAbsPath(path, &abspath);
+   if (res < 0) {
+      goto exit;
+   }
+
+   if (fi->fh == HGFS_INVALID_HANDLE) {
+      res = HgfsOpen(abspath, fi);
+      if (res) {
+         goto exit;
+      }
+   }
+
+   res = HgfsAllocate(fi->fh, abspath, flags, offset, length);
+   if (res == 0) {
+      /* The file size or its allocated blocks may have changed. */
+      HgfsInvalidateAttrCache(abspath);
+   }
+
+exit:
+   LOG(4, ("Exit(%d)\n", res));
+   freeAbsPath(abspath);
+   return res;
+}
+#endif
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1269,6 +1395,70 @@ exit:
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * hgfs_flush
+ *
+ *    Called on each close of a file, write the buffered writes back.
+ *
+ * Results:
+ *    Returns zero on success, or the error of a buffered write.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+hgfs_flush(const char *path,                //IN: path to a file
+           struct fuse_file_info *fi)       //IN: file info structure
+{
+   int res = 0;
+
+   LOG(4, ("Entry(path = %s, fi->fh = %#"FMT64"x)\n", path, fi->fh));
+   if (fi->fh != HGFS_INVALID_HANDLE) {
+      res = HgfsWritebackFlush(fi->fh);
+   }
+   LOG(4, ("Exit(%d)\n", res));
+   return res;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * hgfs_fsync
+ *
+ *    Sync a file, write the buffered writes back. The host does not
+ *    offer more than that.
+ *
+ * Results:
+ *    Returns zero on success, or the error of a buffered write.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+hgfs_fsync(const char *path,                //IN: path to a file
+           int datasync,                    //IN: unused
+           struct fuse_file_info *fi)       //IN: file info structure
+{
+   int res = 0;
+
+   LOG(4, ("Entry(path = %s, fi->fh = %#"FMT64"x)\n", path, fi->fh));
+   if (fi->fh != HGFS_INVALID_HANDLE) {
+      res = HgfsWritebackFlush(fi->fh);
+   }
+   LOG(4, ("Exit(%d)\n", res));
+   return res;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1315,6 +1505,10 @@ hgfs_init(struct fuse_conn_info *conn) // IN: unused
       LOG(4, ("Create session failed. error = %d\n", res));
    }
 
+   HgfsReadaheadInit();
+   HgfsWritebackInit();
+   HgfsPageCacheInit();
+
    LOG(4, ("Exit(NULL)\n"));
    return NULL;
 }
@@ -1343,6 +1537,11 @@ hgfs_destroy(void *data) // IN: unused
 
    LOG(4, ("Entry()\n"));
 
+   HgfsPageCacheExit();
+   HgfsWritebackExit();
+   HgfsReadaheadExit();
+   HgfsNegCacheExit();
+
    res = HgfsDestroySession();
    if (res < 0) {
       LOG(4, ("Destroy session failed. error = %d\n", res));
@@ -1383,9 +1582,18 @@ static struct fuse_operations vmhgfs_operations = {
    .write       = hgfs_write,
    .statfs      = hgfs_statfs,
    .release     = hgfs_release,
+   .flush       = hgfs_flush,
+   .fsync       = hgfs_fsync,
    .create      = hgfs_create,
    .init        = hgfs_init,
    .destroy     = hgfs_destroy,
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(2, 9) && defined(__linux__)
+   .fallocate   = hgfs_fallocate,
+#endif
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 8) && \
+    defined(SEEK_DATA) && defined(SEEK_HOLE)
+   .lseek       = hgfs_lseek,
+#endif
 };
 
 
@@ -1427,6 +1635,7 @@ main(int argc,       //IN: Argument count
       return res;
    }
    HgfsInitCache();
+   HgfsNegCacheInit();
 
    return fuse_main(args.argc, args.argv, &vmhgfs_operations, NULL);
 }
@@ -70,6 +70,10 @@
 #include "transport.h"
 #include "session.h"
 #include "config.h"
+#include "readahead.h"
+#include "negcache.h"
+#include "pagecache.h"
+#include "writeback.h"
 
 #if defined(__SOLARIS__) || defined(__APPLE__)
 #define DT_UNKNOWN      0
@@ -132,6 +136,8 @@ extern HgfsOp hgfsVersionDeleteDir;
 extern HgfsOp hgfsVersionRename;
 extern HgfsOp hgfsVersionQueryVolumeInfo;
 extern HgfsOp hgfsVersionCreateSymlink;
+extern HgfsOp hgfsVersionSeekExtent;
+extern HgfsOp hgfsVersionAllocate;
 
 extern HgfsFuseState *gState;
 
@@ -0,0 +1,506 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * negcache.c --
+ *
+ * Cache of paths found not to exist.
+ *
+ * Build tools probe many paths which do not exist, such as the include
+ * and library search paths, and each probe is a getattr request to the
+ * server. The names the server reported as not existing are remembered
+ * per parent directory for the neg_cache_ttl time, and getattr and access
+ * fail with ENOENT for them without a request.
+ *
+ * A directory drops all its names when this client creates, renames or
+ * makes a directory in it. Changes made on the host, or by other guests,
+ * are only seen once the names expire.
+ *
+ * The number of directories and of names per directory are bounded, the
+ * least recently used directory and the oldest name are dropped first.
+ * One lock protects all the state.
+ */
+
+#include "module.h"
+#include "negcache.h"
+
+#define HGFS_NEG_CACHE_BUCKETS  64
+#define HGFS_NEG_CACHE_DIRS     1024
+#define HGFS_NEG_CACHE_NAMES    256
+
+typedef struct HgfsNegCacheName {
+   struct list_head list;            /* Directory names, newest first. */
+   uint64 time;                      /* When it was found missing, in ms. */
+   char name[1];
+} HgfsNegCacheName;
+
+typedef struct HgfsNegCacheDir {
+   struct list_head list;            /* Hash bucket link. */
+   struct list_head lru;             /* Directories, most recent first. */
+   struct list_head names;
+   uint32 count;                     /* Entries in names. */
+   uint32 hash;
+   size_t pathLen;
+   char path[1];
+} HgfsNegCacheDir;
+
+typedef struct HgfsNegCacheStats {
+   uint64 lookups;
+   uint64 hits;           /* Lookups answered without a server request. */
+   uint64 added;
+   uint64 expired;
+   uint64 invalidated;    /* Directories dropped after a local change. */
+   uint64 evicted;        /* Names and directories dropped for space. */
+} HgfsNegCacheStats;
+
+static pthread_mutex_t gHgfsNegCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static struct list_head gHgfsNegCacheDirs[HGFS_NEG_CACHE_BUCKETS];
+static struct list_head gHgfsNegCacheLru;
+static uint32 gHgfsNegCacheDirCount;
+static HgfsNegCacheStats gHgfsNegCacheStats;
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsNegCacheHash --
+ *
+ *    FNV-1a hash of a directory path.
+ *
+ * Results:
+ *    The hash value.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static uint32
+HgfsNegCacheHash(const char *path,  // IN: Directory path
+                 size_t pathLen)    // IN: Length of path
+{
+   uint32 hash = 2166136261U;
+   size_t i;
+
+   for (i = 0; i < pathLen; i++) {
+      hash ^= (unsigned char)path[i];
+      hash *= 16777619U;
+   }
+   return hash;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsNegCacheSplit --
+ *
+ *    Split a path into its parent directory and its final name.
+ *
+ * Results:
+ *    The length of the parent directory part of path, the final name is
+ *    returned in name.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static size_t
+HgfsNegCacheSplit(const char *path,   // IN: Path
+                  const char **name)  // OUT: Final name of path
+{
+   const char *slash = strrchr(path, '/');
+
+   if (NULL == slash) {
+      *name = path;
+      return 0;
+   }
+   *name = slash + 1;
+   return slash - path;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsNegCacheFindDir --
+ *
+ *    Find the entry of a directory, with the lock held.
+ *
+ * Results:
+ *    The directory entry, or NULL if there is none.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static HgfsNegCacheDir *
+HgfsNegCacheFindDir(const char *path,  // IN: Directory path
+                    size_t pathLen,    // IN: Length of path
+                    uint32 hash)       // IN: Hash of path
+{
+   struct list_head *bucket = &gHgfsNegCacheDirs[hash % HGFS_NEG_CACHE_BUCKETS];
+   HgfsNegCacheDir *dir;
+
+   list_for_each_entry(dir, bucket, list) {
+      if (dir->hash == hash && dir->pathLen == pathLen &&
+          memcmp(dir->path, path, pathLen) == 0) {
+         return dir;
+      }
+   }
+   return NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsNegCacheFreeName --
+ *
+ *    Free a name of a directory entry, with the lock held.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsNegCacheFreeName(HgfsNegCacheDir *dir,    // IN: Directory entry
+                     HgfsNegCacheName *name)  // IN: Name to free
+{
+   list_del(&name->list);
+   dir->count--;
+   free(name);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsNegCacheFreeDir --
+ *
+ *    Free a directory entry and all its names, with the lock held.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsNegCacheFreeDir(HgfsNegCacheDir *dir)  // IN: Directory entry
+{
+   while (!list_empty(&dir->names)) {
+      HgfsNegCacheFreeName(dir, list_entry(dir->names.next,
+                                           HgfsNegCacheName, list));
+   }
+   list_del(&dir->list);
+   list_del(&dir->lru);
+   gHgfsNegCacheDirCount--;
+   free(dir);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsNegCacheInit --
+ *
+ *    Initialize the negative cache.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsNegCacheInit(void)
+{
+   uint32 i;
+
+   for (i = 0; i < ARRAYSIZE(gHgfsNegCacheDirs); i++) {
+      INIT_LIST_HEAD(&gHgfsNegCacheDirs[i]);
+   }
+   INIT_LIST_HEAD(&gHgfsNegCacheLru);
+   gHgfsNegCacheDirCount = 0;
+
+   LOG(4, ("Negative cache TTL %u ms\n", gState->negCacheTtl));
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsNegCacheExit --
+ *
+ *    Free the negative cache and log its counters.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsNegCacheExit(void)
+{
+   pthread_mutex_lock(&gHgfsNegCacheLock);
+   while (!list_empty(&gHgfsNegCacheLru)) {
+      HgfsNegCacheFreeDir(list_entry(gHgfsNegCacheLru.next,
+                                     HgfsNegCacheDir, lru));
+   }
+   pthread_mutex_unlock(&gHgfsNegCacheLock);
+
+   LOG(4, ("%"FMT64"u of %"FMT64"u lookups answered without a getattr "
+           "request, %"FMT64"u names added, %"FMT64"u expired, "
+           "%"FMT64"u directories invalidated, %"FMT64"u evicted\n",
+           gHgfsNegCacheStats.hits, gHgfsNegCacheStats.lookups,
+           gHgfsNegCacheStats.added, gHgfsNegCacheStats.expired,
+           gHgfsNegCacheStats.invalidated, gHgfsNegCacheStats.evicted));
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsNegCacheLookup --
+ *
+ *    Check whether a path was recently found not to exist.
+ *
+ * Results:
+ *    TRUE if the path is known not to exist, FALSE if the server must be
+ *    asked.
+ *
+ * Side effects:
+ *    Drops the name if it expired.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Bool
+HgfsNegCacheLookup(const char *path)  // IN: Path to look up
+{
+   HgfsNegCacheDir *dir;
+   HgfsNegCacheName *name;
+   const char *last;
+   size_t dirLen;
+   Bool found = FALSE;
+
+   if (0 == gState->negCacheTtl) {
+      return FALSE;
+   }
+
+   dirLen = HgfsNegCacheSplit(path, &last);
+
+   pthread_mutex_lock(&gHgfsNegCacheLock);
+   gHgfsNegCacheStats.lookups++;
+   dir = HgfsNegCacheFindDir(path, dirLen, HgfsNegCacheHash(path, dirLen));
+   if (NULL == dir) {
+      goto exit;
+   }
+
+   list_for_each_entry(name, &dir->names, list) {
+      if (strcmp(name->name, last) == 0) {
+         if (HgfsGetMonotonicTime() - name->time < gState->negCacheTtl) {
+            found = TRUE;
+            gHgfsNegCacheStats.hits++;
+            list_move(&dir->lru, &gHgfsNegCacheLru);
+         } else {
+            gHgfsNegCacheStats.expired++;
+            HgfsNegCacheFreeName(dir, name);
+            if (0 == dir->count) {
+               HgfsNegCacheFreeDir(dir);
+            }
+         }
+         break;
+      }
+   }
+
+exit:
+   pthread_mutex_unlock(&gHgfsNegCacheLock);
+   LOG(4, ("%s: %s\n", path, found ? "cached missing" : "not cached"));
+   return found;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsNegCacheAdd --
+ *
+ *    Remember that the server reported a path does not exist.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    May drop the least recently used directory or the oldest name of
+ *    the directory to make room.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsNegCacheAdd(const char *path)  // IN: Path which does not exist
+{
+   HgfsNegCacheDir *dir;
+   HgfsNegCacheName *name;
+   const char *last;
+   size_t dirLen;
+   size_t nameLen;
+   uint32 hash;
+
+   if (0 == gState->negCacheTtl) {
+      return;
+   }
+
+   dirLen = HgfsNegCacheSplit(path, &last);
+   nameLen = strlen(last);
+   hash = HgfsNegCacheHash(path, dirLen);
+
+   pthread_mutex_lock(&gHgfsNegCacheLock);
+   dir = HgfsNegCacheFindDir(path, dirLen, hash);
+   if (NULL == dir) {
+      if (gHgfsNegCacheDirCount >= HGFS_NEG_CACHE_DIRS) {
+         gHgfsNegCacheStats.evicted++;
+         HgfsNegCacheFreeDir(list_entry(gHgfsNegCacheLru.prev,
+                                        HgfsNegCacheDir, lru));
+      }
+      dir = malloc(sizeof *dir + dirLen);
+      if (NULL == dir) {
+         LOG(4, ("Out of memory for %s\n", path));
+         goto exit;
+      }
+      INIT_LIST_HEAD(&dir->names);
+      dir->count = 0;
+      dir->hash = hash;
+      dir->pathLen = dirLen;
+      memcpy(dir->path, path, dirLen);
+      dir->path[dirLen] = '\0';
+      list_add(&dir->list,
+               &gHgfsNegCacheDirs[hash % HGFS_NEG_CACHE_BUCKETS]);
+      list_add(&dir->lru, &gHgfsNegCacheLru);
+      gHgfsNegCacheDirCount++;
+   } else {
+      list_move(&dir->lru, &gHgfsNegCacheLru);
+      list_for_each_entry(name, &dir->names, list) {
+         if (strcmp(name->name, last) == 0) {
+            name->time = HgfsGetMonotonicTime();
+            list_move(&name->list, &dir->names);
+            goto exit;
+         }
+      }
+   }
+
+   if (dir->count >= HGFS_NEG_CACHE_NAMES) {
+      gHgfsNegCacheStats.evicted++;
+      HgfsNegCacheFreeName(dir, list_entry(dir->names.prev,
+                                           HgfsNegCacheName, list));
+   }
+   name = malloc(sizeof *name + nameLen);
+   if (NULL == name) {
+      LOG(4, ("Out of memory for %s\n", path));
+      if (0 == dir->count) {
+         HgfsNegCacheFreeDir(dir);
+      }
+      goto exit;
+   }
+   name->time = HgfsGetMonotonicTime();
+   memcpy(name->name, last, nameLen + 1);
+   list_add(&name->list, &dir->names);
+   dir->count++;
+   gHgfsNegCacheStats.added++;
+
+exit:
+   pthread_mutex_unlock(&gHgfsNegCacheLock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsNegCacheInvalidate --
+ *
+ *    Forget the missing names of the directory holding a path which this
+ *    client just created or renamed. If subtree is set, path itself is a
+ *    new directory and the names under it are forgotten too.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsNegCacheInvalidate(const char *path,  // IN: Created or renamed path
+                       Bool subtree)      // IN: Also drop names under path
+{
+   HgfsNegCacheDir *dir;
+   HgfsNegCacheDir *next;
+   const char *last;
+   size_t dirLen;
+   size_t pathLen;
+
+   if (0 == gState->negCacheTtl) {
+      return;
+   }
+
+   dirLen = HgfsNegCacheSplit(path, &last);
+
+   pthread_mutex_lock(&gHgfsNegCacheLock);
+   dir = HgfsNegCacheFindDir(path, dirLen, HgfsNegCacheHash(path, dirLen));
+   if (dir != NULL) {
+      gHgfsNegCacheStats.invalidated++;
+      HgfsNegCacheFreeDir(dir);
+   }
+
+   if (subtree) {
+      pathLen = strlen(path);
+      list_for_each_entry_safe(dir, next, &gHgfsNegCacheLru, lru) {
+         if (dir->pathLen >= pathLen &&
+             memcmp(dir->path, path, pathLen) == 0 &&
+             (dir->path[pathLen] == '\0' || dir->path[pathLen] == '/')) {
+            gHgfsNegCacheStats.invalidated++;
+            HgfsNegCacheFreeDir(dir);
+         }
+      }
+   }
+   pthread_mutex_unlock(&gHgfsNegCacheLock);
+}
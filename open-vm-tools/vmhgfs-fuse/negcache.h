@@ -0,0 +1,41 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * negcache.h --
+ *
+ * Cache of paths found not to exist.
+ */
+
+#ifndef _VMHGFS_FUSE_NEGCACHE_H_
+#define _VMHGFS_FUSE_NEGCACHE_H_
+
+/*
+ * Time, in milliseconds, a path found not to exist is remembered, see the
+ * neg_cache_ttl mount option. Zero disables the cache.
+ */
+#define HGFS_NEG_CACHE_TTL_DEFAULT   1000
+#define HGFS_NEG_CACHE_TTL_MAX       60000
+
+void HgfsNegCacheInit(void);
+void HgfsNegCacheExit(void);
+Bool HgfsNegCacheLookup(const char *path);
+void HgfsNegCacheAdd(const char *path);
+void HgfsNegCacheInvalidate(const char *path, Bool subtree);
+
+#endif // _VMHGFS_FUSE_NEGCACHE_H_
@@ -0,0 +1,437 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * pagecache.c --
+ *
+ * Keeping file data in the kernel page cache across opens.
+ *
+ * By default the kernel drops the cached data of a file whenever it is
+ * opened, so every open reads the file from the server again. With the
+ * page_cache mount option the write time and size of each opened file
+ * are remembered by its host file id, and an open asks the kernel to keep
+ * the cached data if the server reports they did not change since the
+ * last open.
+ *
+ * When attributes fetched from the server later show the file changed,
+ * the data the kernel cached is invalidated. With FUSE 3 this is done by
+ * fuse_invalidate_path, which notifies the kernel through
+ * fuse_lowlevel_notify_inval_inode, from a worker thread since it must
+ * not be called while the kernel waits on a request for the same file.
+ * FUSE 2 has no invalidation in its high level API, so there a change is
+ * only noticed by the next open.
+ *
+ * The number of files remembered is bounded, the least recently used one
+ * is forgotten first, which only makes its next open read it again.
+ */
+
+#include "module.h"
+#include "pagecache.h"
+#include "cache.h"
+
+#define HGFS_PAGE_CACHE_BUCKETS  1024
+#define HGFS_PAGE_CACHE_FILES    4096
+
+/* The attributes needed to tell whether a file changed. */
+#define HGFS_PAGE_CACHE_ATTR_MASK (HGFS_ATTR_VALID_SIZE | \
+                                   HGFS_ATTR_VALID_WRITE_TIME | \
+                                   HGFS_ATTR_VALID_FILEID)
+
+typedef struct HgfsPageCacheFile {
+   struct list_head list;            /* Hash bucket link. */
+   struct list_head lru;             /* Files, most recently opened first. */
+   uint64 fileId;
+   uint64 writeTime;
+   uint64 size;
+} HgfsPageCacheFile;
+
+typedef struct HgfsPageCacheInval {
+   struct list_head list;            /* Invalidation queue link. */
+   char path[1];                     /* Path relative to the mount point. */
+} HgfsPageCacheInval;
+
+typedef struct HgfsPageCacheStats {
+   uint64 kept;           /* Opens which kept the cached data. */
+   uint64 dropped;        /* Opens which dropped it. */
+   uint64 invalidated;    /* Changes found outside of an open. */
+} HgfsPageCacheStats;
+
+static pthread_mutex_t gHgfsPageCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static struct list_head gHgfsPageCacheFiles[HGFS_PAGE_CACHE_BUCKETS];
+static struct list_head gHgfsPageCacheLru;
+static uint32 gHgfsPageCacheCount;
+static HgfsPageCacheStats gHgfsPageCacheStats;
+
+#if FUSE_MAJOR_VERSION == 3
+static pthread_cond_t gHgfsPageCacheInvalCond = PTHREAD_COND_INITIALIZER;
+static struct list_head gHgfsPageCacheInvalQueue;
+static struct fuse *gHgfsPageCacheFuse;
+static pthread_t gHgfsPageCacheThread;
+static Bool gHgfsPageCacheThreadStarted;
+static Bool gHgfsPageCacheExiting;
+#endif
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsPageCacheFind --
+ *
+ *    Find the remembered attributes of a file, with the lock held.
+ *
+ * Results:
+ *    The file entry, or NULL if the file is not remembered.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static HgfsPageCacheFile *
+HgfsPageCacheFind(uint64 fileId)  // IN: Host file id
+{
+   struct list_head *bucket;
+   HgfsPageCacheFile *file;
+
+   bucket = &gHgfsPageCacheFiles[fileId % HGFS_PAGE_CACHE_BUCKETS];
+   list_for_each_entry(file, bucket, list) {
+      if (file->fileId == fileId) {
+         return file;
+      }
+   }
+   return NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsPageCacheFree --
+ *
+ *    Forget a file, with the lock held.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsPageCacheFree(HgfsPageCacheFile *file)  // IN: File entry
+{
+   list_del(&file->list);
+   list_del(&file->lru);
+   gHgfsPageCacheCount--;
+   free(file);
+}
+
+
+#if FUSE_MAJOR_VERSION == 3
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsPageCacheWorker --
+ *
+ *    Invalidation thread, tells the kernel to drop the cached data of
+ *    the queued paths.
+ *
+ * Results:
+ *    Returns NULL.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void *
+HgfsPageCacheWorker(void *data)  // IN: unused
+{
+   pthread_mutex_lock(&gHgfsPageCacheLock);
+   for (;;) {
+      HgfsPageCacheInval *inval;
+      int res;
+
+      while (!gHgfsPageCacheExiting &&
+             list_empty(&gHgfsPageCacheInvalQueue)) {
+         pthread_cond_wait(&gHgfsPageCacheInvalCond, &gHgfsPageCacheLock);
+      }
+      if (gHgfsPageCacheExiting) {
+         break;
+      }
+
+      inval = list_entry(gHgfsPageCacheInvalQueue.next,
+                         HgfsPageCacheInval, list);
+      list_del(&inval->list);
+      pthread_mutex_unlock(&gHgfsPageCacheLock);
+
+      /* ENOENT only means the kernel has nothing cached for the path. */
+      res = fuse_invalidate_path(gHgfsPageCacheFuse, inval->path);
+      LOG(4, ("Invalidated %s, result = %d\n", inval->path, res));
+      free(inval);
+
+      pthread_mutex_lock(&gHgfsPageCacheLock);
+   }
+   pthread_mutex_unlock(&gHgfsPageCacheLock);
+   return NULL;
+}
+#endif
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsPageCacheInit --
+ *
+ *    Initialize the page cache state and start the invalidation thread.
+ *    Must be called from the FUSE init callback.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsPageCacheInit(void)
+{
+   uint32 i;
+
+   for (i = 0; i < ARRAYSIZE(gHgfsPageCacheFiles); i++) {
+      INIT_LIST_HEAD(&gHgfsPageCacheFiles[i]);
+   }
+   INIT_LIST_HEAD(&gHgfsPageCacheLru);
+   gHgfsPageCacheCount = 0;
+
+   if (!gState->pageCache) {
+      LOG(4, ("Page cache across opens disabled\n"));
+      return;
+   }
+
+#if FUSE_MAJOR_VERSION == 3
+   INIT_LIST_HEAD(&gHgfsPageCacheInvalQueue);
+   gHgfsPageCacheExiting = FALSE;
+   gHgfsPageCacheFuse = fuse_get_context()->fuse;
+   gHgfsPageCacheThreadStarted =
+      pthread_create(&gHgfsPageCacheThread, NULL,
+                     HgfsPageCacheWorker, NULL) == 0;
+   if (!gHgfsPageCacheThreadStarted) {
+      LOG(4, ("Pthread create fail, changes only seen on open\n"));
+   }
+#endif
+   LOG(4, ("Page cache across opens enabled\n"));
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsPageCacheExit --
+ *
+ *    Stop the invalidation thread, free the state and log the counters.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsPageCacheExit(void)
+{
+   if (!gState->pageCache) {
+      return;
+   }
+
+#if FUSE_MAJOR_VERSION == 3
+   if (gHgfsPageCacheThreadStarted) {
+      pthread_mutex_lock(&gHgfsPageCacheLock);
+      gHgfsPageCacheExiting = TRUE;
+      pthread_cond_signal(&gHgfsPageCacheInvalCond);
+      pthread_mutex_unlock(&gHgfsPageCacheLock);
+      pthread_join(gHgfsPageCacheThread, NULL);
+      gHgfsPageCacheThreadStarted = FALSE;
+   }
+   while (!list_empty(&gHgfsPageCacheInvalQueue)) {
+      HgfsPageCacheInval *inval = list_entry(gHgfsPageCacheInvalQueue.next,
+                                             HgfsPageCacheInval, list);
+      list_del(&inval->list);
+      free(inval);
+   }
+#endif
+
+   pthread_mutex_lock(&gHgfsPageCacheLock);
+   while (!list_empty(&gHgfsPageCacheLru)) {
+      HgfsPageCacheFree(list_entry(gHgfsPageCacheLru.next,
+                                   HgfsPageCacheFile, lru));
+   }
+   pthread_mutex_unlock(&gHgfsPageCacheLock);
+
+   LOG(4, ("%"FMT64"u opens kept cached data, %"FMT64"u dropped it, "
+           "%"FMT64"u invalidations\n",
+           gHgfsPageCacheStats.kept, gHgfsPageCacheStats.dropped,
+           gHgfsPageCacheStats.invalidated));
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsPageCacheOpen --
+ *
+ *    Get the attributes of a file just opened from the server, and check
+ *    whether they are unchanged since the file was last opened.
+ *
+ * Results:
+ *    TRUE if the kernel may keep the data it cached for the file, FALSE
+ *    if it must read it again or page_cache is not set.
+ *
+ * Side effects:
+ *    Remembers the attributes and updates the attribute cache.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Bool
+HgfsPageCacheOpen(const char *path,   // IN: Path of the file
+                  HgfsHandle handle)  // IN: Handle of the open file
+{
+   HgfsAttrInfo attr = {0};
+   HgfsPageCacheFile *file;
+   Bool keep = FALSE;
+   int res;
+
+   if (!gState->pageCache) {
+      return FALSE;
+   }
+
+   res = HgfsPrivateGetattr(handle, path, &attr);
+   if (res != 0) {
+      LOG(4, ("Getattr of %s failed, result = %d\n", path, res));
+      return FALSE;
+   }
+   HgfsSetAttrCache(path, &attr);
+
+   if ((attr.mask & HGFS_PAGE_CACHE_ATTR_MASK) != HGFS_PAGE_CACHE_ATTR_MASK) {
+      LOG(4, ("Attributes of %s cannot tell changes\n", path));
+      return FALSE;
+   }
+
+   pthread_mutex_lock(&gHgfsPageCacheLock);
+   file = HgfsPageCacheFind(attr.hostFileId);
+   if (file != NULL) {
+      keep = file->writeTime == attr.writeTime && file->size == attr.size;
+      list_move(&file->lru, &gHgfsPageCacheLru);
+   } else {
+      if (gHgfsPageCacheCount >= HGFS_PAGE_CACHE_FILES) {
+         HgfsPageCacheFree(list_entry(gHgfsPageCacheLru.prev,
+                                      HgfsPageCacheFile, lru));
+      }
+      file = malloc(sizeof *file);
+      if (file != NULL) {
+         file->fileId = attr.hostFileId;
+         list_add(&file->list, &gHgfsPageCacheFiles[file->fileId %
+                                                    HGFS_PAGE_CACHE_BUCKETS]);
+         list_add(&file->lru, &gHgfsPageCacheLru);
+         gHgfsPageCacheCount++;
+      }
+   }
+   if (file != NULL) {
+      file->writeTime = attr.writeTime;
+      file->size = attr.size;
+   }
+   if (keep) {
+      gHgfsPageCacheStats.kept++;
+   } else {
+      gHgfsPageCacheStats.dropped++;
+   }
+   pthread_mutex_unlock(&gHgfsPageCacheLock);
+
+   LOG(4, ("%s: %s cached data\n", path, keep ? "keep" : "drop"));
+   return keep;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsPageCacheUpdate --
+ *
+ *    Check attributes just fetched from the server against the ones
+ *    remembered for the file, and invalidate the data the kernel cached
+ *    for it if they changed.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    With FUSE 3, queues the invalidation of the file.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsPageCacheUpdate(const char *path,          // IN: Path of the file
+                    const HgfsAttrInfo *attr)  // IN: Its new attributes
+{
+   HgfsPageCacheFile *file;
+
+   if (!gState->pageCache ||
+       (attr->mask & HGFS_PAGE_CACHE_ATTR_MASK) != HGFS_PAGE_CACHE_ATTR_MASK) {
+      return;
+   }
+
+   pthread_mutex_lock(&gHgfsPageCacheLock);
+   file = HgfsPageCacheFind(attr->hostFileId);
+   if (file != NULL &&
+       (file->writeTime != attr->writeTime || file->size != attr->size)) {
+      /*
+       * Forget the file rather than remember the new attributes, so its
+       * next open drops the cached data even if it cannot be invalidated
+       * now.
+       */
+      HgfsPageCacheFree(file);
+      gHgfsPageCacheStats.invalidated++;
+
+#if FUSE_MAJOR_VERSION == 3
+      if (gHgfsPageCacheThreadStarted) {
+         /* The kernel knows the path relative to the mount point. */
+         const char *fusePath = path + gState->basePathLen;
+         size_t pathLen = strlen(fusePath);
+         HgfsPageCacheInval *inval = malloc(sizeof *inval + pathLen);
+
+         if (inval != NULL) {
+            memcpy(inval->path, fusePath, pathLen + 1);
+            list_add_tail(&inval->list, &gHgfsPageCacheInvalQueue);
+            pthread_cond_signal(&gHgfsPageCacheInvalCond);
+         }
+      }
+#endif
+   }
+   pthread_mutex_unlock(&gHgfsPageCacheLock);
+}
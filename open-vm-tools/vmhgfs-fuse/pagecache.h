@@ -0,0 +1,33 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * pagecache.h --
+ *
+ * Keeping file data in the kernel page cache across opens.
+ */
+
+#ifndef _VMHGFS_FUSE_PAGECACHE_H_
+#define _VMHGFS_FUSE_PAGECACHE_H_
+
+void HgfsPageCacheInit(void);
+void HgfsPageCacheExit(void);
+Bool HgfsPageCacheOpen(const char *path, HgfsHandle handle);
+void HgfsPageCacheUpdate(const char *path, const HgfsAttrInfo *attr);
+
+#endif // _VMHGFS_FUSE_PAGECACHE_H_
@@ -0,0 +1,738 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * readahead.c --
+ *
+ * Readahead of sequentially read open files.
+ *
+ * Each open file which is read keeps the offset its next read would start
+ * at if the reads are sequential. After a sequential read the chunks of
+ * the maximum IO size following it, up to the readahead window, are queued
+ * for the worker threads which read them from the server while the caller
+ * processes the data it got. Later reads are served from the read chunks,
+ * or wait for a chunk being read rather than sending the same read again.
+ *
+ * A chunk which is consumed, or which failed, is dropped; the data of a
+ * failed chunk is read again by the caller so its error is reported.
+ * Each open file records the path it is read by, so that a write, a size
+ * change or an allocation through any handle, or a rename, drops the
+ * chunks of all the open files of the path.
+ *
+ * One lock protects all the state, the chunk data is only accessed without
+ * it by the worker reading into it.
+ */
+
+#include "module.h"
+#include "readahead.h"
+
+#define HGFS_READAHEAD_THREADS  4
+#define HGFS_READAHEAD_BUCKETS  64
+
+typedef enum {
+   HGFS_READAHEAD_EMPTY,      /* Unused slot. */
+   HGFS_READAHEAD_PENDING,    /* Queued or being read by a worker. */
+   HGFS_READAHEAD_READY,      /* Read, result holds the size or error. */
+} HgfsReadaheadState;
+
+struct HgfsReadaheadFile;
+
+typedef struct HgfsReadaheadChunk {
+   struct list_head queue;           /* Work queue link while not started. */
+   struct HgfsReadaheadFile *file;
+   HgfsReadaheadState state;
+   uint32 generation;                /* File generation it was queued in. */
+   loff_t offset;
+   int result;                       /* Bytes read or negative error. */
+   char *data;                       /* Chunk size bytes. */
+} HgfsReadaheadChunk;
+
+typedef struct HgfsReadaheadFile {
+   struct list_head list;            /* Hash bucket link. */
+   HgfsHandle handle;
+   char *path;                       /* Path of the last read. */
+   loff_t nextOffset;                /* End of the last read. */
+   Bool sequential;                  /* Last read started at nextOffset. */
+   uint32 chunkSize;
+   uint32 generation;                /* Bumped when the chunks are dropped. */
+   uint32 pending;                   /* Chunks in the PENDING state. */
+   HgfsReadaheadChunk chunks[HGFS_READAHEAD_MAX];
+} HgfsReadaheadFile;
+
+typedef struct HgfsReadaheadStats {
+   uint64 issued;       /* Chunks queued. */
+   uint64 hits;         /* Reads served, at least partly, from chunks. */
+   uint64 waits;        /* Hits which waited for a chunk being read. */
+   uint64 bytes;        /* Bytes served from chunks. */
+   uint64 dropped;      /* Chunks dropped before being consumed. */
+} HgfsReadaheadStats;
+
+static pthread_mutex_t gHgfsReadaheadLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gHgfsReadaheadWorkCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t gHgfsReadaheadDoneCond = PTHREAD_COND_INITIALIZER;
+
+static struct list_head gHgfsReadaheadFiles[HGFS_READAHEAD_BUCKETS];
+static struct list_head gHgfsReadaheadQueue;
+static pthread_t gHgfsReadaheadThreads[HGFS_READAHEAD_THREADS];
+static uint32 gHgfsReadaheadNumThreads;
+static Bool gHgfsReadaheadExiting;
+static HgfsReadaheadStats gHgfsReadaheadStats;
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadaheadFind --
+ *
+ *    Find the readahead state of an open file, with the lock held.
+ *
+ * Results:
+ *    The file state, or NULL if the handle has none and create is FALSE
+ *    or the state cannot be allocated.
+ *
+ * Side effects:
+ *    May allocate the file state.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static HgfsReadaheadFile *
+HgfsReadaheadFind(HgfsHandle handle,  // IN: Open file handle
+                  Bool create)        // IN: Create the state if missing
+{
+   struct list_head *bucket;
+   HgfsReadaheadFile *file;
+   uint32 i;
+
+   bucket = &gHgfsReadaheadFiles[handle % HGFS_READAHEAD_BUCKETS];
+   list_for_each_entry(file, bucket, list) {
+      if (file->handle == handle) {
+         return file;
+      }
+   }
+
+   if (!create) {
+      return NULL;
+   }
+
+   file = calloc(1, sizeof *file);
+   if (NULL == file) {
+      LOG(4, ("Out of memory for handle %u\n", handle));
+      return NULL;
+   }
+   file->handle = handle;
+   for (i = 0; i < ARRAYSIZE(file->chunks); i++) {
+      INIT_LIST_HEAD(&file->chunks[i].queue);
+   }
+   list_add(&file->list, bucket);
+   return file;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadaheadDrop --
+ *
+ *    Drop a chunk which is read, or remove it from the work queue, with
+ *    the lock held. Chunks being read by a worker are left to it.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsReadaheadDrop(HgfsReadaheadChunk *chunk)  // IN: Chunk
+{
+   if (chunk->state == HGFS_READAHEAD_READY) {
+      chunk->state = HGFS_READAHEAD_EMPTY;
+   } else if (chunk->state == HGFS_READAHEAD_PENDING &&
+              !list_empty(&chunk->queue)) {
+      list_del_init(&chunk->queue);
+      chunk->state = HGFS_READAHEAD_EMPTY;
+      chunk->file->pending--;
+      gHgfsReadaheadStats.dropped++;
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadaheadDropAll --
+ *
+ *    Drop all the chunks of a file, with the lock held. The chunks still
+ *    being read are dropped by the worker when it is done.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsReadaheadDropAll(HgfsReadaheadFile *file)  // IN: File
+{
+   uint32 i;
+
+   file->generation++;
+   for (i = 0; i < ARRAYSIZE(file->chunks); i++) {
+      if (file->chunks[i].state == HGFS_READAHEAD_READY) {
+         gHgfsReadaheadStats.dropped++;
+      }
+      HgfsReadaheadDrop(&file->chunks[i]);
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadaheadPathMatches --
+ *
+ *    Check whether the path of a file is the given path or, for a
+ *    subtree, is below it.
+ *
+ * Results:
+ *    TRUE if it is, FALSE otherwise.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+HgfsReadaheadPathMatches(const char *filePath,  // IN: Path of a file
+                         const char *path,      // IN: Path looked for
+                         Bool subtree)          // IN: Match paths below
+{
+   size_t pathLen = strlen(path);
+
+   if (NULL == filePath || strncmp(filePath, path, pathLen) != 0) {
+      return FALSE;
+   }
+   return '\0' == filePath[pathLen] || (subtree && '/' == filePath[pathLen]);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadaheadWorker --
+ *
+ *    Readahead thread, reads the queued chunks.
+ *
+ * Results:
+ *    Returns NULL.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void *
+HgfsReadaheadWorker(void *data)  // IN: unused
+{
+   pthread_mutex_lock(&gHgfsReadaheadLock);
+   for (;;) {
+      HgfsReadaheadChunk *chunk;
+      HgfsReadaheadFile *file;
+      uint32 chunkSize;
+      int result;
+
+      while (!gHgfsReadaheadExiting && list_empty(&gHgfsReadaheadQueue)) {
+         pthread_cond_wait(&gHgfsReadaheadWorkCond, &gHgfsReadaheadLock);
+      }
+      if (gHgfsReadaheadExiting) {
+         break;
+      }
+
+      chunk = list_entry(gHgfsReadaheadQueue.next, HgfsReadaheadChunk, queue);
+      list_del_init(&chunk->queue);
+      file = chunk->file;
+      chunkSize = file->chunkSize;
+      pthread_mutex_unlock(&gHgfsReadaheadLock);
+
+      result = HgfsDoRead(file->handle, chunk->data, chunkSize,
+                          chunk->offset);
+
+      pthread_mutex_lock(&gHgfsReadaheadLock);
+      if (chunk->generation == file->generation) {
+         chunk->result = result;
+         chunk->state = HGFS_READAHEAD_READY;
+      } else {
+         chunk->state = HGFS_READAHEAD_EMPTY;
+         gHgfsReadaheadStats.dropped++;
+      }
+      file->pending--;
+      pthread_cond_broadcast(&gHgfsReadaheadDoneCond);
+   }
+   pthread_mutex_unlock(&gHgfsReadaheadLock);
+
+   return NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadaheadInit --
+ *
+ *    Start the readahead threads. Must be called after the process is
+ *    daemonized, from the FUSE init callback.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    Readahead is disabled if no thread can be created.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsReadaheadInit(void)
+{
+   uint32 i;
+
+   for (i = 0; i < ARRAYSIZE(gHgfsReadaheadFiles); i++) {
+      INIT_LIST_HEAD(&gHgfsReadaheadFiles[i]);
+   }
+   INIT_LIST_HEAD(&gHgfsReadaheadQueue);
+   gHgfsReadaheadExiting = FALSE;
+
+   if (0 == gState->readahead) {
+      LOG(4, ("Readahead disabled\n"));
+      return;
+   }
+
+   for (i = 0; i < ARRAYSIZE(gHgfsReadaheadThreads); i++) {
+      int res = pthread_create(&gHgfsReadaheadThreads[i], NULL,
+                               HgfsReadaheadWorker, NULL);
+      if (res != 0) {
+         LOG(4, ("Pthread create fail. error = %d\n", res));
+         break;
+      }
+   }
+   gHgfsReadaheadNumThreads = i;
+   if (0 == gHgfsReadaheadNumThreads) {
+      gState->readahead = 0;
+   }
+   LOG(4, ("Readahead of %u chunks, %u threads\n", gState->readahead,
+           gHgfsReadaheadNumThreads));
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadaheadExit --
+ *
+ *    Stop the readahead threads and free the state of the files still
+ *    open.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsReadaheadExit(void)
+{
+   uint32 i;
+
+   pthread_mutex_lock(&gHgfsReadaheadLock);
+   gHgfsReadaheadExiting = TRUE;
+   pthread_cond_broadcast(&gHgfsReadaheadWorkCond);
+   pthread_mutex_unlock(&gHgfsReadaheadLock);
+
+   for (i = 0; i < gHgfsReadaheadNumThreads; i++) {
+      pthread_join(gHgfsReadaheadThreads[i], NULL);
+   }
+   gHgfsReadaheadNumThreads = 0;
+
+   for (i = 0; i < ARRAYSIZE(gHgfsReadaheadFiles); i++) {
+      while (!list_empty(&gHgfsReadaheadFiles[i])) {
+         HgfsReadaheadFile *file = list_entry(gHgfsReadaheadFiles[i].next,
+                                              HgfsReadaheadFile, list);
+         HgfsReadaheadRelease(file->handle);
+      }
+   }
+
+   LOG(4, ("%"FMT64"u chunks issued, %"FMT64"u hits (%"FMT64"u waited) "
+           "for %"FMT64"u bytes, %"FMT64"u chunks dropped\n",
+           gHgfsReadaheadStats.issued, gHgfsReadaheadStats.hits,
+           gHgfsReadaheadStats.waits, gHgfsReadaheadStats.bytes,
+           gHgfsReadaheadStats.dropped));
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadaheadGet --
+ *
+ *    Serve the start of a read from the read ahead chunks of the file,
+ *    waiting for the chunks being read. Also records whether the read is
+ *    sequential, see HgfsReadaheadNext.
+ *
+ * Results:
+ *    The number of bytes copied to buf, which may be less than count if
+ *    the rest is not read ahead. eof is set if the end of the file was
+ *    found.
+ *
+ * Side effects:
+ *    Consumed chunks are dropped.
+ *
+ *----------------------------------------------------------------------
+ */
+
+size_t
+HgfsReadaheadGet(HgfsHandle handle,  // IN:  Open file handle
+                 const char *path,   // IN:  Path of the file
+                 char *buf,          // OUT: Buffer to copy data into
+                 size_t count,       // IN:  Number of bytes to read
+                 loff_t offset,      // IN:  Offset at which to read
+                 uint32 chunkSize,   // IN:  Size of a chunk
+                 Bool *eof)          // OUT: End of file reached
+{
+   HgfsReadaheadFile *file;
+   size_t copied = 0;
+   Bool waited = FALSE;
+
+   *eof = FALSE;
+   if (0 == gState->readahead) {
+      return 0;
+   }
+
+   pthread_mutex_lock(&gHgfsReadaheadLock);
+   file = HgfsReadaheadFind(handle, TRUE);
+   if (NULL == file) {
+      goto out;
+   }
+
+   if (NULL == file->path || strcmp(file->path, path) != 0) {
+      char *newPath = strdup(path);
+
+      if (NULL == newPath) {
+         /* Read nothing ahead for a path which cannot be invalidated. */
+         HgfsReadaheadDropAll(file);
+         file->sequential = FALSE;
+         goto out;
+      }
+      free(file->path);
+      file->path = newPath;
+   }
+
+   file->sequential = (offset == file->nextOffset);
+   if (file->chunkSize != chunkSize) {
+      uint32 i;
+
+      /*
+       * The maximum IO size changed with a new session. The chunk buffers
+       * were sized for the old one and are reallocated on their next use.
+       */
+      HgfsReadaheadDropAll(file);
+      while (file->pending > 0) {
+         pthread_cond_wait(&gHgfsReadaheadDoneCond, &gHgfsReadaheadLock);
+      }
+      for (i = 0; i < ARRAYSIZE(file->chunks); i++) {
+         free(file->chunks[i].data);
+         file->chunks[i].data = NULL;
+      }
+      file->chunkSize = chunkSize;
+   }
+
+   while (copied < count) {
+      HgfsReadaheadChunk *chunk = NULL;
+      loff_t curOffset = offset + copied;
+      size_t chunkOffset;
+      size_t n;
+      uint32 i;
+
+      for (i = 0; i < ARRAYSIZE(file->chunks); i++) {
+         if (file->chunks[i].state != HGFS_READAHEAD_EMPTY &&
+             curOffset >= file->chunks[i].offset &&
+             curOffset < file->chunks[i].offset + chunkSize) {
+            chunk = &file->chunks[i];
+            break;
+         }
+      }
+      if (NULL == chunk) {
+         break;
+      }
+
+      if (chunk->state == HGFS_READAHEAD_PENDING) {
+         if (!list_empty(&chunk->queue)) {
+            /* Not started yet, the caller's own read is as fast. */
+            HgfsReadaheadDrop(chunk);
+            break;
+         }
+         waited = TRUE;
+         pthread_cond_wait(&gHgfsReadaheadDoneCond, &gHgfsReadaheadLock);
+         continue;
+      }
+
+      if (chunk->result < 0) {
+         LOG(4, ("Chunk @ 0x%"FMT64"x failed: %d\n", chunk->offset,
+                 chunk->result));
+         chunk->state = HGFS_READAHEAD_EMPTY;
+         break;
+      }
+
+      chunkOffset = curOffset - chunk->offset;
+      if (chunkOffset >= (size_t)chunk->result) {
+         /* Past the data of a short chunk. */
+         chunk->state = HGFS_READAHEAD_EMPTY;
+         *eof = TRUE;
+         break;
+      }
+
+      n = MIN(count - copied, chunk->result - chunkOffset);
+      memcpy(buf + copied, chunk->data + chunkOffset, n);
+      copied += n;
+
+      if (chunkOffset + n == chunk->result) {
+         chunk->state = HGFS_READAHEAD_EMPTY;
+         if (chunk->result < chunkSize) {
+            *eof = TRUE;
+            break;
+         }
+      }
+   }
+
+   if (copied > 0) {
+      gHgfsReadaheadStats.hits++;
+      gHgfsReadaheadStats.bytes += copied;
+      if (waited) {
+         gHgfsReadaheadStats.waits++;
+      }
+   }
+
+out:
+   pthread_mutex_unlock(&gHgfsReadaheadLock);
+   LOG(8, ("Handle %u: 0x%"FMTSZ"x of 0x%"FMTSZ"x bytes @ 0x%"FMT64"x\n",
+           handle, copied, count, offset));
+   return copied;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadaheadNext --
+ *
+ *    Record the end of a read and, if it was sequential, queue the reads
+ *    of the chunks following it up to the readahead window.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    Wakes up the readahead threads.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsReadaheadNext(HgfsHandle handle,  // IN: Open file handle
+                  loff_t offset,      // IN: End of the read
+                  Bool eof)           // IN: Read reached the end of file
+{
+   HgfsReadaheadFile *file;
+   loff_t chunkOffset;
+   uint32 queued = 0;
+   uint32 n;
+
+   if (0 == gState->readahead) {
+      return;
+   }
+
+   pthread_mutex_lock(&gHgfsReadaheadLock);
+   file = HgfsReadaheadFind(handle, FALSE);
+   if (NULL == file || 0 == file->chunkSize) {
+      goto out;
+   }
+
+   file->nextOffset = offset;
+   if (!file->sequential || eof) {
+      goto out;
+   }
+
+   chunkOffset = offset - offset % file->chunkSize;
+   for (n = 0; n < gState->readahead; n++, chunkOffset += file->chunkSize) {
+      HgfsReadaheadChunk *slot = NULL;
+      uint32 i;
+
+      for (i = 0; i < ARRAYSIZE(file->chunks); i++) {
+         HgfsReadaheadChunk *chunk = &file->chunks[i];
+
+         if (chunk->state != HGFS_READAHEAD_EMPTY &&
+             chunk->offset == chunkOffset) {
+            break;
+         }
+         if (NULL == slot) {
+            if (chunk->state == HGFS_READAHEAD_EMPTY) {
+               slot = chunk;
+            } else if (chunk->state == HGFS_READAHEAD_READY &&
+                       chunk->offset + file->chunkSize <= offset) {
+               /* Left behind by the reader. */
+               gHgfsReadaheadStats.dropped++;
+               slot = chunk;
+            }
+         }
+      }
+      if (i < ARRAYSIZE(file->chunks)) {
+         HgfsReadaheadChunk *chunk = &file->chunks[i];
+
+         if (chunk->state == HGFS_READAHEAD_READY &&
+             chunk->result >= 0 && chunk->result < file->chunkSize) {
+            /* The end of the file is already read. */
+            break;
+         }
+         continue;
+      }
+      if (NULL == slot) {
+         break;
+      }
+
+      if (NULL == slot->data) {
+         slot->data = malloc(file->chunkSize);
+         if (NULL == slot->data) {
+            LOG(4, ("Out of memory for a chunk\n"));
+            break;
+         }
+      }
+      slot->file = file;
+      slot->state = HGFS_READAHEAD_PENDING;
+      slot->generation = file->generation;
+      slot->offset = chunkOffset;
+      slot->result = 0;
+      list_add_tail(&slot->queue, &gHgfsReadaheadQueue);
+      file->pending++;
+      queued++;
+   }
+
+   if (queued > 0) {
+      gHgfsReadaheadStats.issued += queued;
+      pthread_cond_broadcast(&gHgfsReadaheadWorkCond);
+   }
+
+out:
+   pthread_mutex_unlock(&gHgfsReadaheadLock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadaheadInvalidatePath --
+ *
+ *    Drop the read ahead data of all the open files of a path, which is
+ *    written to, resized or allocated through any handle, or of all the
+ *    open files below a directory which is renamed.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsReadaheadInvalidatePath(const char *path,  // IN: Path of the file(s)
+                            Bool subtree)      // IN: Also the paths below
+{
+   HgfsReadaheadFile *file;
+   uint32 i;
+
+   if (0 == gState->readahead) {
+      return;
+   }
+
+   pthread_mutex_lock(&gHgfsReadaheadLock);
+   for (i = 0; i < ARRAYSIZE(gHgfsReadaheadFiles); i++) {
+      list_for_each_entry(file, &gHgfsReadaheadFiles[i], list) {
+         if (HgfsReadaheadPathMatches(file->path, path, subtree)) {
+            HgfsReadaheadDropAll(file);
+         }
+      }
+   }
+   pthread_mutex_unlock(&gHgfsReadaheadLock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadaheadRelease --
+ *
+ *    Free the readahead state of a file being closed, waiting for the
+ *    chunks being read.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsReadaheadRelease(HgfsHandle handle)  // IN: Open file handle
+{
+   HgfsReadaheadFile *file;
+   uint32 i;
+
+   pthread_mutex_lock(&gHgfsReadaheadLock);
+   file = HgfsReadaheadFind(handle, FALSE);
+   if (NULL == file) {
+      pthread_mutex_unlock(&gHgfsReadaheadLock);
+      return;
+   }
+
+   HgfsReadaheadDropAll(file);
+   while (file->pending > 0) {
+      pthread_cond_wait(&gHgfsReadaheadDoneCond, &gHgfsReadaheadLock);
+   }
+   list_del(&file->list);
+   pthread_mutex_unlock(&gHgfsReadaheadLock);
+
+   for (i = 0; i < ARRAYSIZE(file->chunks); i++) {
+      free(file->chunks[i].data);
+   }
+   free(file->path);
+   free(file);
+}
@@ -0,0 +1,44 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * readahead.h --
+ *
+ * Readahead of sequentially read open files.
+ */
+
+#ifndef _VMHGFS_FUSE_READAHEAD_H_
+#define _VMHGFS_FUSE_READAHEAD_H_
+
+/*
+ * Readahead window, in chunks of the maximum IO size read ahead of a
+ * sequential reader, see the readahead mount option. Zero disables it.
+ */
+#define HGFS_READAHEAD_DEFAULT  4
+#define HGFS_READAHEAD_MAX      16
+
+void HgfsReadaheadInit(void);
+void HgfsReadaheadExit(void);
+size_t HgfsReadaheadGet(HgfsHandle handle, const char *path, char *buf,
+                        size_t count, loff_t offset, uint32 chunkSize,
+                        Bool *eof);
+void HgfsReadaheadNext(HgfsHandle handle, loff_t offset, Bool eof);
+void HgfsReadaheadInvalidatePath(const char *path, Bool subtree);
+void HgfsReadaheadRelease(HgfsHandle handle);
+
+#endif // _VMHGFS_FUSE_READAHEAD_H_
@@ -71,6 +71,65 @@ HgfsPackCreateSessionRequest(HgfsOp opUsed, // IN: Op to be used
 }
 
 
+/*
+ *----------------------------------------------------------------------------
+ *
+ * HgfsCreateSessionSetOps --
+ *
+ *    Enable the optional ops the server listed as supported in its create
+ *    session reply. These ops are only known to recent servers, so they
+ *    are never sent to a server which did not list them, or to one with
+ *    which no session was created.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    Sets the versions of the optional ops.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+HgfsCreateSessionSetOps(const HgfsReplyCreateSessionV4 *reply, // IN: reply or NULL
+                        size_t replySize)                      // IN: reply size
+{
+   uint32 i;
+
+   hgfsVersionSeekExtent = HGFS_OP_MAX;
+   hgfsVersionAllocate = HGFS_OP_MAX;
+
+   if (NULL == reply ||
+       replySize < offsetof(HgfsReplyCreateSessionV4, capabilities) ||
+       reply->numCapabilities > (replySize -
+                                 offsetof(HgfsReplyCreateSessionV4,
+                                          capabilities)) /
+                                sizeof reply->capabilities[0]) {
+      return;
+   }
+
+   for (i = 0; i < reply->numCapabilities; i++) {
+      if ((reply->capabilities[i].flags & HGFS_OP_CAPFLAG_IS_SUPPORTED) == 0) {
+         continue;
+      }
+      switch (reply->capabilities[i].op) {
+      case HGFS_OP_SEEK_EXTENT_V4:
+         hgfsVersionSeekExtent = HGFS_OP_SEEK_EXTENT_V4;
+         break;
+      case HGFS_OP_ALLOCATE_V4:
+         hgfsVersionAllocate = HGFS_OP_ALLOCATE_V4;
+         break;
+      default:
+         break;
+      }
+   }
+
+   LOG(4, ("Seek extent %s, allocate %s\n",
+           hgfsVersionSeekExtent != HGFS_OP_MAX ? "on" : "off",
+           hgfsVersionAllocate != HGFS_OP_MAX ? "on" : "off"));
+}
+
+
 /*
  *----------------------------------------------------------------------------
  *
@@ -105,7 +164,7 @@ HgfsCreateSessionProcessResult(const char *result,  // IN: Reply packet
    HgfsOp op;
    void *replyPayload;
    size_t replyPayloadSize;
-   HgfsReplyCreateSessionV4 *createSessionReply;
+   HgfsReplyCreateSessionV4 *createSessionReply = NULL;
 
    tmpStatus = HgfsUnpackHeader((void *) result,
 				resultSize,
@@ -150,6 +209,8 @@ HgfsCreateSessionProcessResult(const char *result,  // IN: Reply packet
    }
 
 out:
+   HgfsCreateSessionSetOps(createSessionReply,
+                           createSessionReply != NULL ? replyPayloadSize : 0);
    gState->sessionId = sessionId;
    gState->headerVersion = headerVersion;
    gState->sessionEnabled = sessionIdPresent;
@@ -187,6 +248,8 @@ HgfsCreateSession(void)
    LOG(4, ("Entry()\n"));
    gState->sessionEnabled = TRUE;
    gState->headerVersion = HGFS_HEADER_VERSION;
+   /* Until the server lists the optional ops it supports. */
+   HgfsCreateSessionSetOps(NULL, 0);
 
    req = HgfsGetNewRequest();
    if (!req) {
@@ -26,7 +26,16 @@
  * The sends happen in the process context, where as a thread
  * handles the asynchronous replies. A queue of pending replies is
  * maintained and is protected by a lock. The channel opens and close
- * is protected by a mutex.
+ * is protected by a reader/writer lock: senders share it so several
+ * requests can be in the channel at once, while opening, resetting
+ * and closing the channel take it exclusively.
+ *
+ * The number of requests in flight is bounded by the transport window
+ * (the max_requests mount option). Replies are matched to the pending
+ * requests by request id, in any order.
+ *
+ * The round trips to the host are counted per operation and logged when
+ * the transport is torn down, at unmount.
  */
 
 
@@ -39,15 +48,39 @@
 #include "vm_assert.h"
 
 static HgfsTransportChannel *gHgfsActiveChannel;     /* Current active channel. */
-static pthread_mutex_t gHgfsActiveChannelLock;       /* Current active channel lock. */
+static pthread_rwlock_t gHgfsActiveChannelLock;      /* Current active channel lock. */
 static Bool gHgfsActiveChannelLockInited;
 
 static struct list_head gHgfsPendingRequests;        /* Pending requests queue. */
 static pthread_mutex_t gHgfsPendingRequestsLock;     /* Pending requests queue lock. */
 static Bool gHgfsPendingRequestsLockInited;
 
+/* Both conditions below use the pending requests lock. */
+static pthread_cond_t gHgfsReplyCond;                /* Signalled on completions. */
+static pthread_cond_t gHgfsWindowCond;               /* Signalled on free slots. */
+static Bool gHgfsTransportCondsInited;
+
+static uint32 gHgfsTransportWindow;                  /* Max requests in flight. */
+static uint32 gHgfsRequestsInFlight;                 /* Requests in flight. */
 
-#define HgfsRequestId(req) ((HgfsRequest *)req)->id
+/* Requests handed to a channel per operation, uses the pending requests lock. */
+static uint64 gHgfsRoundTrips[HGFS_OP_MAX];
+
+
+/*
+ * Replies with the new header carry the request id in the header, older
+ * replies in the HgfsReply. The new header has HGFS_OP_NEW_HEADER where
+ * the old header has the opcode.
+ */
+#define HgfsRequestId(reply, size)                                         \
+   ((size) >= sizeof (HgfsHeader) &&                                       \
+    ((HgfsHeader *)(reply))->dummy == HGFS_OP_NEW_HEADER ?                 \
+       ((HgfsHeader *)(reply))->requestId : ((HgfsReply *)(reply))->id)
+
+/* Likewise for the opcode of a request. */
+#define HgfsRequestOp(request)                                             \
+   (((HgfsHeader *)(request))->dummy == HGFS_OP_NEW_HEADER ?              \
+       ((HgfsHeader *)(request))->op : ((HgfsRequest *)(request))->op)
 
 static void HgfsTransportChannelClose(HgfsTransportChannel **channel);
 
@@ -112,6 +145,16 @@ HgfsTransportChannelClose(HgfsTransportChannel **channel) // active channel
    if (NULL != *channel) {
       HgfsTransportChannel *closeChannel = *channel;
 
+      pthread_mutex_lock(&gHgfsPendingRequestsLock);
+      LOG(4, ("Channel %s: %"FMT64"u sent, mean depth %"FMT64"u, "
+              "max depth %u, %"FMT64"u window waits.\n",
+              closeChannel->name, closeChannel->stats.sent,
+              closeChannel->stats.sent == 0 ? 0 :
+                 closeChannel->stats.depthTotal / closeChannel->stats.sent,
+              closeChannel->stats.maxInFlight,
+              closeChannel->stats.windowWaits));
+      pthread_mutex_unlock(&gHgfsPendingRequestsLock);
+
       closeChannel->ops.close(closeChannel);
       closeChannel->ops.exit(closeChannel);
       *channel = NULL;
@@ -158,22 +201,38 @@ HgfsTransportChannelReset(HgfsTransportChannel **channel) // IN: active channel
  *
  * HgfsTransportEnqueueRequest --
  *
- *     Add the request to the gHgfsPendingRequests queue.
+ *     Add the request to the gHgfsPendingRequests queue of the channel.
  *
+ * Results:
+ *     None
  *
  * Side effects:
- *     None
+ *     Updates the channel statistics and the round trip counters.
  *
  *----------------------------------------------------------------------
  */
 
 static void
-HgfsTransportEnqueueRequest(HgfsReq *req)   // IN: Request to add
+HgfsTransportEnqueueRequest(HgfsReq *req,                    // IN: Request to add
+                            HgfsTransportChannel *channel)   // IN: Channel used
 {
+   HgfsOp op;
+
    ASSERT(req);
+   ASSERT(channel);
+
+   op = HgfsRequestOp(HGFS_REQ_PAYLOAD(req));
 
    pthread_mutex_lock(&gHgfsPendingRequestsLock);
    list_add_tail(&req->list, &gHgfsPendingRequests);
+   if (op < HGFS_OP_MAX) {
+      gHgfsRoundTrips[op]++;
+   }
+   channel->stats.inFlight++;
+   channel->stats.sent++;
+   channel->stats.depthTotal += channel->stats.inFlight;
+   channel->stats.maxInFlight = MAX(channel->stats.maxInFlight,
+                                    channel->stats.inFlight);
    pthread_mutex_unlock(&gHgfsPendingRequestsLock);
 }
 
@@ -183,27 +242,132 @@ HgfsTransportEnqueueRequest(HgfsReq *req)   // IN: Request to add
  *
  * HgfsTransportDequeueRequest --
  *
- *     Removes the request from the gHgfsPendingRequests queue.
+ *     Removes the request from the gHgfsPendingRequests queue, if it
+ *     was not completed yet, and from the channel queue depth.
  *
  * Results:
  *     None
  *
  * Side effects:
- *     None
+ *     Updates the channel statistics.
  *
  *----------------------------------------------------------------------
  */
 
 static void
-HgfsTransportDequeueRequest(HgfsReq *req)   // IN: Request to dequeue
+HgfsTransportDequeueRequest(HgfsReq *req,                    // IN: Request to dequeue
+                            HgfsTransportChannel *channel)   // IN: Channel used
 {
    ASSERT(req);
+   ASSERT(channel);
 
    pthread_mutex_lock(&gHgfsPendingRequestsLock);
    if (!list_empty(&req->list)) {
       list_del_init(&req->list);
    }
+   ASSERT(channel->stats.inFlight > 0);
+   channel->stats.inFlight--;
+   pthread_mutex_unlock(&gHgfsPendingRequestsLock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsTransportWindowEnter --
+ *
+ *     Take a slot in the transport window, waiting for one to be freed
+ *     if the window is full.
+ *
+ * Results:
+ *     TRUE if the caller had to wait.
+ *
+ * Side effects:
+ *     None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+HgfsTransportWindowEnter(void)
+{
+   Bool waited = FALSE;
+
+   pthread_mutex_lock(&gHgfsPendingRequestsLock);
+   while (gHgfsRequestsInFlight >= gHgfsTransportWindow) {
+      waited = TRUE;
+      pthread_cond_wait(&gHgfsWindowCond, &gHgfsPendingRequestsLock);
+   }
+   gHgfsRequestsInFlight++;
+   pthread_mutex_unlock(&gHgfsPendingRequestsLock);
+
+   return waited;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsTransportWindowExit --
+ *
+ *     Give back a slot taken by HgfsTransportWindowEnter, after waiting
+ *     for the reply of a request the channel delivers asynchronously.
+ *
+ * Results:
+ *     None
+ *
+ * Side effects:
+ *     Wakes up a sender waiting for a slot.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsTransportWindowExit(HgfsReq *req)   // IN: Request sent
+{
+   pthread_mutex_lock(&gHgfsPendingRequestsLock);
+   while (req->state == HGFS_REQ_STATE_SUBMITTED) {
+      pthread_cond_wait(&gHgfsReplyCond, &gHgfsPendingRequestsLock);
+   }
+   ASSERT(gHgfsRequestsInFlight > 0);
+   gHgfsRequestsInFlight--;
+   pthread_cond_signal(&gHgfsWindowCond);
+   pthread_mutex_unlock(&gHgfsPendingRequestsLock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsTransportLogRoundTrips --
+ *
+ *     Log the round trips to the host made for each operation since the
+ *     transport was initialized.
+ *
+ * Results:
+ *     None
+ *
+ * Side effects:
+ *     None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsTransportLogRoundTrips(void)
+{
+   uint64 total = 0;
+   uint32 op;
+
+   pthread_mutex_lock(&gHgfsPendingRequestsLock);
+   for (op = 0; op < HGFS_OP_MAX; op++) {
+      if (gHgfsRoundTrips[op] != 0) {
+         LOG(4, ("Op %u: %"FMT64"u round trips.\n", op, gHgfsRoundTrips[op]));
+         total += gHgfsRoundTrips[op];
+      }
+   }
    pthread_mutex_unlock(&gHgfsPendingRequestsLock);
+   LOG(4, ("%"FMT64"u round trips in total.\n", total));
 }
 
 
@@ -238,8 +402,8 @@ HgfsTransportProcessPacket(char *receivedPacket,    //IN: received packet
 
    /* Got the reply. */
 
-   ASSERT(receivedPacket != NULL && receivedSize > 0);
-   id = HgfsRequestId(receivedPacket);
+   ASSERT(receivedPacket != NULL && receivedSize >= sizeof (HgfsReply));
+   id = HgfsRequestId(receivedPacket, receivedSize);
    LOG(8, ("Entered.\n"));
    LOG(6, ("Req id: %d\n", id));
    /*
@@ -257,6 +421,9 @@ HgfsTransportProcessPacket(char *receivedPacket,    //IN: received packet
          break;
       }
    }
+   if (found) {
+      pthread_cond_broadcast(&gHgfsReplyCond);
+   }
    pthread_mutex_unlock(&gHgfsPendingRequestsLock);
 
    if (!found) {
@@ -298,6 +465,35 @@ HgfsTransportBeforeExitingRecvThread(void)
       LOG(6, ("Injecting error reply to req id: %d\n", req->id));
       HgfsCompleteReq(req, (char *)&reply, sizeof reply);
    }
+   pthread_cond_broadcast(&gHgfsReplyCond);
+   pthread_mutex_unlock(&gHgfsPendingRequestsLock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsTransportCompleteRequest --
+ *
+ *     Complete a request with its reply, called by channels which get
+ *     the reply in the sending thread.
+ *
+ * Results:
+ *     None
+ *
+ * Side effects:
+ *     Removes the request from the gHgfsPendingRequests queue.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsTransportCompleteRequest(HgfsReq *req,       // IN: Request
+                             char const *reply,  // IN: Reply packet
+                             size_t replySize)   // IN: Size of reply packet
+{
+   pthread_mutex_lock(&gHgfsPendingRequestsLock);
+   HgfsCompleteReq(req, reply, replySize);
    pthread_mutex_unlock(&gHgfsPendingRequestsLock);
 }
 
@@ -321,45 +517,84 @@ HgfsTransportBeforeExitingRecvThread(void)
 int
 HgfsTransportSendRequest(HgfsReq *req)   // IN: Request to send
 {
-   int ret;
+   HgfsTransportChannel *channel;
+   Bool waited;
+   int ret = 0;
+
    ASSERT(req);
    ASSERT(req->state == HGFS_REQ_STATE_UNSENT);
    ASSERT(req->payloadSize <= HgfsLargePacketMax(FALSE));
 
-   pthread_mutex_lock(&gHgfsActiveChannelLock);
+   waited = HgfsTransportWindowEnter();
+
+   pthread_rwlock_rdlock(&gHgfsActiveChannelLock);
 
    /* Try opening the channel. */
    if (NULL == gHgfsActiveChannel) {
-      ret = HgfsTransportChannelOpen(&gHgfsActiveChannel);
+      pthread_rwlock_unlock(&gHgfsActiveChannelLock);
+      pthread_rwlock_wrlock(&gHgfsActiveChannelLock);
+      if (NULL == gHgfsActiveChannel) {
+         ret = HgfsTransportChannelOpen(&gHgfsActiveChannel);
+      }
+      pthread_rwlock_unlock(&gHgfsActiveChannelLock);
       if (ret != 0) {
          goto exit;
       }
+      pthread_rwlock_rdlock(&gHgfsActiveChannelLock);
    }
 
-   ASSERT(gHgfsActiveChannel->ops.send);
+   channel = gHgfsActiveChannel;
+   ASSERT(channel->ops.send);
 
-   HgfsTransportEnqueueRequest(req);
+   HgfsTransportEnqueueRequest(req, channel);
+   if (waited) {
+      pthread_mutex_lock(&gHgfsPendingRequestsLock);
+      channel->stats.windowWaits++;
+      pthread_mutex_unlock(&gHgfsPendingRequestsLock);
+   }
 
-   ret = gHgfsActiveChannel->ops.send(gHgfsActiveChannel, req);
+   ret = channel->ops.send(channel, req);
    if (ret < 0) {
       LOG(4, ("Send failed, status = %d. Try reopening the channel ...\n",
               ret));
-      if (HgfsTransportChannelReset(&gHgfsActiveChannel)) {
-         ret = gHgfsActiveChannel->ops.send(gHgfsActiveChannel, req);
+      HgfsTransportDequeueRequest(req, channel);
+
+      /*
+       * Other senders may have failed on the same channel, only the first
+       * one to get the lock exclusively resets it.
+       */
+      pthread_rwlock_unlock(&gHgfsActiveChannelLock);
+      pthread_rwlock_wrlock(&gHgfsActiveChannelLock);
+      if (gHgfsActiveChannel == channel &&
+          !HgfsTransportChannelReset(&gHgfsActiveChannel)) {
+         pthread_rwlock_unlock(&gHgfsActiveChannelLock);
+         goto exit;
       }
+      pthread_rwlock_unlock(&gHgfsActiveChannelLock);
+      pthread_rwlock_rdlock(&gHgfsActiveChannelLock);
+
+      channel = gHgfsActiveChannel;
+      if (NULL == channel) {
+         pthread_rwlock_unlock(&gHgfsActiveChannelLock);
+         goto exit;
+      }
+      HgfsTransportEnqueueRequest(req, channel);
+      ret = channel->ops.send(channel, req);
    }
 
-exit:
+   pthread_rwlock_unlock(&gHgfsActiveChannelLock);
+
    ASSERT(req->state == HGFS_REQ_STATE_COMPLETED ||
           req->state == HGFS_REQ_STATE_SUBMITTED ||
           req->state == HGFS_REQ_STATE_UNSENT);
 
-   pthread_mutex_unlock(&gHgfsActiveChannelLock);
-
-   if (ret < 0) {
-      HgfsTransportDequeueRequest(req);
-   }
+   /* Wait for an asynchronous reply, the channel is not needed for it. */
+   HgfsTransportWindowExit(req);
+   HgfsTransportDequeueRequest(req, channel);
+   return ret;
 
+exit:
+   HgfsTransportWindowExit(req);
    return ret;
 }
 
@@ -391,8 +626,18 @@ HgfsTransportInit(void)
    gHgfsActiveChannel = NULL;
    gHgfsPendingRequestsLockInited = FALSE;
    gHgfsActiveChannelLockInited = FALSE;
+   gHgfsTransportCondsInited = FALSE;
    INIT_LIST_HEAD(&gHgfsPendingRequests);
 
+   gHgfsRequestsInFlight = 0;
+   memset(gHgfsRoundTrips, 0, sizeof gHgfsRoundTrips);
+   gHgfsTransportWindow = gState->maxRequests;
+   if (gHgfsTransportWindow == 0) {
+      gHgfsTransportWindow = HGFS_TRANSPORT_WINDOW_DEFAULT;
+   }
+   gHgfsTransportWindow = MIN(gHgfsTransportWindow, HGFS_TRANSPORT_WINDOW_MAX);
+   LOG(4, ("Transport window of %u requests.\n", gHgfsTransportWindow));
+
    res = pthread_mutex_init(&gHgfsPendingRequestsLock, NULL);
    if (res != 0) {
       res = -res;
@@ -400,7 +645,20 @@ HgfsTransportInit(void)
    }
    gHgfsPendingRequestsLockInited = TRUE;
 
-   res = pthread_mutex_init(&gHgfsActiveChannelLock, NULL);
+   res = pthread_cond_init(&gHgfsReplyCond, NULL);
+   if (res != 0) {
+      res = -res;
+      goto exit;
+   }
+   res = pthread_cond_init(&gHgfsWindowCond, NULL);
+   if (res != 0) {
+      pthread_cond_destroy(&gHgfsReplyCond);
+      res = -res;
+      goto exit;
+   }
+   gHgfsTransportCondsInited = TRUE;
+
+   res = pthread_rwlock_init(&gHgfsActiveChannelLock, NULL);
    if (res != 0) {
       res = -res;
       goto exit;
@@ -439,15 +697,26 @@ HgfsTransportExit(void)
    LOG(8, ("Entered.\n"));
 
    if (gHgfsActiveChannelLockInited) {
-      pthread_mutex_lock(&gHgfsActiveChannelLock);
+      pthread_rwlock_wrlock(&gHgfsActiveChannelLock);
       HgfsTransportChannelClose(&gHgfsActiveChannel);
-      pthread_mutex_unlock(&gHgfsActiveChannelLock);
+      pthread_rwlock_unlock(&gHgfsActiveChannelLock);
 
-      pthread_mutex_destroy(&gHgfsActiveChannelLock);
+      pthread_rwlock_destroy(&gHgfsActiveChannelLock);
       gHgfsActiveChannelLockInited = FALSE;
    }
 
    ASSERT(list_empty(&gHgfsPendingRequests));
+   ASSERT(gHgfsRequestsInFlight == 0);
+
+   if (gHgfsPendingRequestsLockInited) {
+      HgfsTransportLogRoundTrips();
+   }
+
+   if (gHgfsTransportCondsInited) {
+      pthread_cond_destroy(&gHgfsWindowCond);
+      pthread_cond_destroy(&gHgfsReplyCond);
+      gHgfsTransportCondsInited = FALSE;
+   }
 
    if (gHgfsPendingRequestsLockInited) {
       pthread_mutex_destroy(&gHgfsPendingRequestsLock);
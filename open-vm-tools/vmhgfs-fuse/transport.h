@@ -32,6 +32,25 @@ typedef enum {
    HGFS_CHANNEL_CONNECTED,
 } HgfsChannelStatus;
 
+/*
+ * Bounds of the transport window, the number of requests which may be in
+ * flight at the same time, see the max_requests mount option.
+ */
+#define HGFS_TRANSPORT_WINDOW_DEFAULT  16
+#define HGFS_TRANSPORT_WINDOW_MAX      256
+
+/*
+ * Per channel queue depth statistics, protected by the pending requests
+ * lock.
+ */
+typedef struct HgfsTransportStats {
+   uint64 sent;           /* Requests handed to the channel. */
+   uint64 depthTotal;     /* Sum of the queue depth seen by each send. */
+   uint64 windowWaits;    /* Sends which waited for a free window slot. */
+   uint32 inFlight;       /* Requests currently queued on the channel. */
+   uint32 maxInFlight;    /* High-water mark of inFlight. */
+} HgfsTransportStats;
+
 /*
  * There are the operations a channel should implement.
  */
@@ -50,6 +69,7 @@ typedef struct HgfsTransportChannel {
    HgfsChannelStatus status;       /* Connection status. */
    void *priv;                     /* Channel private data. */
    pthread_mutex_t connLock;       /* Protect _this_ struct. */
+   HgfsTransportStats stats;       /* Queue depth statistics. */
 } HgfsTransportChannel;
 
 /* Public functions (with respect to the entire module). */
@@ -58,6 +78,9 @@ void HgfsTransportExit(void);
 int HgfsTransportSendRequest(HgfsReq *req);
 void HgfsTransportProcessPacket(char *receivedPacket,
                                 size_t receivedSize);
+void HgfsTransportCompleteRequest(HgfsReq *req,
+                                  char const *reply,
+                                  size_t replySize);
 void HgfsTransportBeforeExitingRecvThread(void);
 
 #endif // _HGFS_DRIVER_TRANSPORT_H_
@@ -0,0 +1,789 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * writeback.c --
+ *
+ * Coalescing of small writes to open files.
+ *
+ * When enabled, each open file which is written has a buffer of the
+ * maximum IO size. A write which continues the buffered data and fits in
+ * the buffer is only copied to it. The buffer is written to the server
+ * when a write does not continue it or does not fit, when it is full,
+ * when the file is synced, flushed or released, and by the flusher thread
+ * when the data is older than the writeback delay.
+ *
+ * Operations which must see the buffered data only write the buffers of
+ * the files they are about: reads, getattrs and setattrs of a file those
+ * of its path, a directory listing those of the files directly in the
+ * directory, and a rename those of the renamed path and anything below
+ * it. Each buffer records the path of its file as given by the last
+ * buffered write.
+ *
+ * An error writing the buffer which cannot be returned to the caller is
+ * kept and returned by the next write, sync, flush (i.e. close) of the
+ * file, as for a local file system writing back its page cache.
+ *
+ * The file table lock protects the table, the reference counts and the
+ * dirty count. Each file has a lock held while its buffer is used,
+ * including while it is written to the server. The file lock may be
+ * held when taking the table lock, not the other way around.
+ */
+
+#include <time.h>
+
+#include "module.h"
+#include "writeback.h"
+
+#define HGFS_WRITEBACK_BUCKETS  64
+
+typedef struct HgfsWritebackFile {
+   struct list_head list;      /* Hash bucket link. */
+   HgfsHandle handle;
+   uint32 refs;                /* Table lock. Users of the file. */
+   pthread_mutex_t lock;       /* Protects the fields below. */
+   char *path;                 /* Absolute path of the file. */
+   char *data;                 /* Buffer of size bytes. */
+   uint32 size;
+   loff_t offset;              /* File offset of the buffered data. */
+   uint32 length;              /* Buffered bytes. */
+   uint64 dirtyTime;           /* Time the first byte was buffered, in ms. */
+   int error;                  /* Write back error not reported yet. */
+} HgfsWritebackFile;
+
+typedef struct HgfsWritebackStats {
+   uint64 writes;       /* Writes buffered. */
+   uint64 flushes;      /* Buffers written to the server. */
+   uint64 pathFlushes;  /* Of which by an operation on their path. */
+   uint64 errors;       /* Buffers which failed to be written. */
+} HgfsWritebackStats;
+
+/* Files whose buffers HgfsWritebackFlushMatching writes. */
+typedef enum {
+   HGFS_WRITEBACK_MATCH_OLDER,      /* Data buffered before a time. */
+   HGFS_WRITEBACK_MATCH_PATH,       /* The file at a path. */
+   HGFS_WRITEBACK_MATCH_CHILDREN,   /* Files directly in a directory. */
+   HGFS_WRITEBACK_MATCH_SUBTREE,    /* Files anywhere below a directory. */
+} HgfsWritebackMatch;
+
+static pthread_mutex_t gHgfsWritebackLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gHgfsWritebackCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t gHgfsWritebackRefCond = PTHREAD_COND_INITIALIZER;
+
+static struct list_head gHgfsWritebackFiles[HGFS_WRITEBACK_BUCKETS];
+static uint32 gHgfsWritebackDirty;          /* Files with buffered data. */
+static pthread_t gHgfsWritebackThread;
+static Bool gHgfsWritebackThreadStarted;
+static Bool gHgfsWritebackExiting;
+static HgfsWritebackStats gHgfsWritebackStats;
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWritebackGetFile --
+ *
+ *    Find the write back state of an open file and take a reference.
+ *
+ * Results:
+ *    The file state, or NULL if the handle has none and create is FALSE
+ *    or the state cannot be allocated.
+ *
+ * Side effects:
+ *    May allocate the file state.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static HgfsWritebackFile *
+HgfsWritebackGetFile(HgfsHandle handle,  // IN: Open file handle
+                     Bool create)        // IN: Create the state if missing
+{
+   struct list_head *bucket;
+   HgfsWritebackFile *file;
+
+   pthread_mutex_lock(&gHgfsWritebackLock);
+   bucket = &gHgfsWritebackFiles[handle % HGFS_WRITEBACK_BUCKETS];
+   list_for_each_entry(file, bucket, list) {
+      if (file->handle == handle) {
+         file->refs++;
+         goto out;
+      }
+   }
+
+   file = NULL;
+   if (create) {
+      file = calloc(1, sizeof *file);
+      if (NULL == file) {
+         LOG(4, ("Out of memory for handle %u\n", handle));
+         goto out;
+      }
+      file->handle = handle;
+      file->refs = 1;
+      pthread_mutex_init(&file->lock, NULL);
+      list_add(&file->list, bucket);
+   }
+
+out:
+   pthread_mutex_unlock(&gHgfsWritebackLock);
+   return file;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWritebackPutFile --
+ *
+ *    Drop a reference taken by HgfsWritebackGetFile.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsWritebackPutFile(HgfsWritebackFile *file)  // IN: File
+{
+   pthread_mutex_lock(&gHgfsWritebackLock);
+   ASSERT(file->refs > 0);
+   file->refs--;
+   pthread_cond_broadcast(&gHgfsWritebackRefCond);
+   pthread_mutex_unlock(&gHgfsWritebackLock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWritebackFlushInt --
+ *
+ *    Write the buffered data of a file to the server, with the file lock
+ *    held.
+ *
+ * Results:
+ *    Zero on success, or the error of the write which is also kept in
+ *    the file if no error is kept yet.
+ *
+ * Side effects:
+ *    The buffer is empty, even on failure.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HgfsWritebackFlushInt(HgfsWritebackFile *file)  // IN: File
+{
+   uint32 done = 0;
+   int result = 0;
+
+   if (0 == file->length) {
+      return 0;
+   }
+
+   LOG(6, ("Handle %u: 0x%x bytes @ 0x%"FMT64"x\n", file->handle,
+           file->length, file->offset));
+
+   while (done < file->length) {
+      result = HgfsDoWrite(file->handle, file->data + done,
+                           file->length - done, file->offset + done);
+      if (result <= 0) {
+         if (0 == result) {
+            result = -EIO;
+         }
+         break;
+      }
+      done += result;
+      result = 0;
+   }
+
+   file->length = 0;
+
+   pthread_mutex_lock(&gHgfsWritebackLock);
+   ASSERT(gHgfsWritebackDirty > 0);
+   gHgfsWritebackDirty--;
+   gHgfsWritebackStats.flushes++;
+   if (result < 0) {
+      gHgfsWritebackStats.errors++;
+   }
+   pthread_mutex_unlock(&gHgfsWritebackLock);
+
+   if (result < 0) {
+      LOG(4, ("Handle %u: write back failed: %d\n", file->handle, result));
+      if (0 == file->error) {
+         file->error = result;
+      }
+   }
+   return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWritebackTakeError --
+ *
+ *    Get and clear the error kept in a file, with the file lock held.
+ *
+ * Results:
+ *    Zero or the error kept.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HgfsWritebackTakeError(HgfsWritebackFile *file)  // IN: File
+{
+   int error = file->error;
+
+   file->error = 0;
+   return error;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWritebackPathMatches --
+ *
+ *    Check whether the path of a file is the given path, or is in or below
+ *    the given directory.
+ *
+ * Results:
+ *    TRUE if it is, FALSE otherwise.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+HgfsWritebackPathMatches(const char *filePath,      // IN: Path of a file
+                         const char *path,          // IN: Path looked for
+                         HgfsWritebackMatch match)  // IN: Kind of match
+{
+   size_t pathLen = strlen(path);
+   const char *rest;
+
+   if (strncmp(filePath, path, pathLen) != 0) {
+      return FALSE;
+   }
+   if (HGFS_WRITEBACK_MATCH_PATH == match) {
+      return '\0' == filePath[pathLen];
+   }
+
+   /* The root directory path may end with a separator. */
+   if (pathLen > 0 && '/' == path[pathLen - 1]) {
+      rest = filePath + pathLen;
+   } else if ('/' == filePath[pathLen]) {
+      rest = filePath + pathLen + 1;
+   } else {
+      return FALSE;
+   }
+   if ('\0' == *rest) {
+      return FALSE;
+   }
+   return HGFS_WRITEBACK_MATCH_SUBTREE == match || NULL == strchr(rest, '/');
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWritebackFlushMatching --
+ *
+ *    Write to the server the buffers of the files which have data older
+ *    than a given time, or whose path matches a given one.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    Errors are kept in the files for later report.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsWritebackFlushMatching(HgfsWritebackMatch match,  // IN: Files to flush
+                           uint64 time,               // IN: Flush data buffered before it
+                           const char *path)          // IN: Path to flush
+{
+   uint32 i;
+
+   pthread_mutex_lock(&gHgfsWritebackLock);
+   if (0 == gHgfsWritebackDirty) {
+      pthread_mutex_unlock(&gHgfsWritebackLock);
+      return;
+   }
+
+   for (i = 0; i < ARRAYSIZE(gHgfsWritebackFiles); i++) {
+      HgfsWritebackFile *file;
+
+      list_for_each_entry(file, &gHgfsWritebackFiles[i], list) {
+         /*
+          * The reference keeps the file in the table, and so the list
+          * position valid, while the table lock is dropped.
+          */
+         file->refs++;
+         pthread_mutex_unlock(&gHgfsWritebackLock);
+
+         pthread_mutex_lock(&file->lock);
+         if (file->length > 0) {
+            if (HGFS_WRITEBACK_MATCH_OLDER == match) {
+               if (file->dirtyTime <= time) {
+                  HgfsWritebackFlushInt(file);
+               }
+            } else if (HgfsWritebackPathMatches(file->path, path, match)) {
+               HgfsWritebackFlushInt(file);
+               pthread_mutex_lock(&gHgfsWritebackLock);
+               gHgfsWritebackStats.pathFlushes++;
+               pthread_mutex_unlock(&gHgfsWritebackLock);
+            }
+         }
+         pthread_mutex_unlock(&file->lock);
+
+         pthread_mutex_lock(&gHgfsWritebackLock);
+         file->refs--;
+         pthread_cond_broadcast(&gHgfsWritebackRefCond);
+      }
+   }
+   pthread_mutex_unlock(&gHgfsWritebackLock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWritebackFlusher --
+ *
+ *    Flusher thread, writes to the server the data buffered for longer
+ *    than the writeback delay.
+ *
+ * Results:
+ *    Returns NULL.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void *
+HgfsWritebackFlusher(void *data)  // IN: unused
+{
+   uint32 delay = gState->writebackDelay;
+
+   pthread_mutex_lock(&gHgfsWritebackLock);
+   while (!gHgfsWritebackExiting) {
+      struct timespec deadline;
+      uint64 wakeup;
+
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      wakeup = (uint64)deadline.tv_nsec + (uint64)delay * 1000000 / 2;
+      deadline.tv_sec += wakeup / 1000000000;
+      deadline.tv_nsec = wakeup % 1000000000;
+      pthread_cond_timedwait(&gHgfsWritebackCond, &gHgfsWritebackLock,
+                             &deadline);
+      if (gHgfsWritebackExiting) {
+         break;
+      }
+
+      pthread_mutex_unlock(&gHgfsWritebackLock);
+      HgfsWritebackFlushMatching(HGFS_WRITEBACK_MATCH_OLDER,
+                                 HgfsGetMonotonicTime() - delay, NULL);
+      pthread_mutex_lock(&gHgfsWritebackLock);
+   }
+   pthread_mutex_unlock(&gHgfsWritebackLock);
+
+   return NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWritebackInit --
+ *
+ *    Start the flusher thread if write back is enabled. Must be called
+ *    after the process is daemonized, from the FUSE init callback.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    Write back is disabled if the thread cannot be created.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsWritebackInit(void)
+{
+   uint32 i;
+   int res;
+
+   for (i = 0; i < ARRAYSIZE(gHgfsWritebackFiles); i++) {
+      INIT_LIST_HEAD(&gHgfsWritebackFiles[i]);
+   }
+   gHgfsWritebackExiting = FALSE;
+
+   if (0 == gState->writebackDelay) {
+      LOG(4, ("Write back disabled\n"));
+      return;
+   }
+
+   res = pthread_create(&gHgfsWritebackThread, NULL, HgfsWritebackFlusher,
+                        NULL);
+   if (res != 0) {
+      LOG(4, ("Pthread create fail. error = %d\n", res));
+      gState->writebackDelay = 0;
+      return;
+   }
+   gHgfsWritebackThreadStarted = TRUE;
+   LOG(4, ("Write back delay of %u ms\n", gState->writebackDelay));
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWritebackExit --
+ *
+ *    Stop the flusher thread and write back the buffered data.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsWritebackExit(void)
+{
+   uint32 i;
+
+   if (!gHgfsWritebackThreadStarted) {
+      return;
+   }
+
+   pthread_mutex_lock(&gHgfsWritebackLock);
+   gHgfsWritebackExiting = TRUE;
+   pthread_cond_signal(&gHgfsWritebackCond);
+   pthread_mutex_unlock(&gHgfsWritebackLock);
+   pthread_join(gHgfsWritebackThread, NULL);
+   gHgfsWritebackThreadStarted = FALSE;
+
+   for (i = 0; i < ARRAYSIZE(gHgfsWritebackFiles); i++) {
+      while (!list_empty(&gHgfsWritebackFiles[i])) {
+         HgfsWritebackFile *file = list_entry(gHgfsWritebackFiles[i].next,
+                                              HgfsWritebackFile, list);
+         HgfsWritebackRelease(file->handle);
+      }
+   }
+
+   LOG(4, ("%"FMT64"u writes buffered, %"FMT64"u flushes, %"FMT64"u by "
+           "path, %"FMT64"u failed\n", gHgfsWritebackStats.writes,
+           gHgfsWritebackStats.flushes, gHgfsWritebackStats.pathFlushes,
+           gHgfsWritebackStats.errors));
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWritebackWrite --
+ *
+ *    Buffer a write to an open file. The buffered data is first written
+ *    to the server if the write does not continue it or does not fit.
+ *
+ * Results:
+ *    TRUE if the write was handled, with error set to zero if the data is
+ *    buffered or to the error of an earlier write back. FALSE if the write
+ *    must be sent by the caller, nothing is buffered for the file then.
+ *
+ * Side effects:
+ *    May write buffered data to the server.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Bool
+HgfsWritebackWrite(HgfsHandle handle,   // IN:  Open file handle
+                   const char *path,    // IN:  Absolute path of the file
+                   const char *buf,     // IN:  Data to write
+                   size_t count,        // IN:  Number of bytes to write
+                   loff_t offset,       // IN:  Offset to write at
+                   uint32 bufferSize,   // IN:  Maximum IO size
+                   int *error)          // OUT: Error to return
+{
+   HgfsWritebackFile *file;
+   Bool handled = TRUE;
+
+   *error = 0;
+   if (0 == gState->writebackDelay) {
+      return FALSE;
+   }
+
+   file = HgfsWritebackGetFile(handle, count < bufferSize);
+   if (NULL == file) {
+      return FALSE;
+   }
+
+   pthread_mutex_lock(&file->lock);
+
+   *error = HgfsWritebackTakeError(file);
+   if (*error != 0) {
+      goto out;
+   }
+
+   if (file->length > 0 &&
+       (offset != file->offset + file->length ||
+        count > file->size - file->length ||
+        strcmp(file->path, path) != 0)) {
+      *error = HgfsWritebackFlushInt(file);
+      if (*error != 0) {
+         HgfsWritebackTakeError(file);
+         goto out;
+      }
+   }
+
+   if (count >= bufferSize) {
+      handled = FALSE;
+      goto out;
+   }
+
+   if (NULL == file->path || strcmp(file->path, path) != 0) {
+      /* First write, or the file was renamed since. */
+      char *newPath = strdup(path);
+
+      if (NULL == newPath) {
+         LOG(4, ("Out of memory for a path\n"));
+         handled = FALSE;
+         goto out;
+      }
+      ASSERT(0 == file->length);
+      free(file->path);
+      file->path = newPath;
+   }
+
+   if (file->size != bufferSize) {
+      /* The maximum IO size changed with a new session. */
+      ASSERT(0 == file->length);
+      free(file->data);
+      file->data = malloc(bufferSize);
+      file->size = (NULL == file->data) ? 0 : bufferSize;
+      if (NULL == file->data) {
+         LOG(4, ("Out of memory for a buffer\n"));
+         handled = FALSE;
+         goto out;
+      }
+   }
+
+   if (0 == file->length) {
+      file->offset = offset;
+      file->dirtyTime = HgfsGetMonotonicTime();
+      pthread_mutex_lock(&gHgfsWritebackLock);
+      gHgfsWritebackDirty++;
+      pthread_mutex_unlock(&gHgfsWritebackLock);
+   }
+   memcpy(file->data + file->length, buf, count);
+   file->length += count;
+
+   pthread_mutex_lock(&gHgfsWritebackLock);
+   gHgfsWritebackStats.writes++;
+   pthread_mutex_unlock(&gHgfsWritebackLock);
+
+   if (file->length == file->size) {
+      *error = HgfsWritebackFlushInt(file);
+      if (*error != 0) {
+         HgfsWritebackTakeError(file);
+      }
+   }
+
+out:
+   pthread_mutex_unlock(&file->lock);
+   HgfsWritebackPutFile(file);
+   return handled;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWritebackFlush --
+ *
+ *    Write the buffered data of an open file to the server, for a sync or
+ *    a flush of the file.
+ *
+ * Results:
+ *    Zero on success, or the error of this or an earlier write back.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+HgfsWritebackFlush(HgfsHandle handle)  // IN: Open file handle
+{
+   HgfsWritebackFile *file;
+   int error;
+
+   if (0 == gState->writebackDelay) {
+      return 0;
+   }
+
+   file = HgfsWritebackGetFile(handle, FALSE);
+   if (NULL == file) {
+      return 0;
+   }
+
+   pthread_mutex_lock(&file->lock);
+   HgfsWritebackFlushInt(file);
+   error = HgfsWritebackTakeError(file);
+   pthread_mutex_unlock(&file->lock);
+
+   HgfsWritebackPutFile(file);
+   return error;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWritebackFlushPath --
+ *
+ *    Write the buffered data of the files open at a path to the server,
+ *    before an operation on the path which must see it.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    Errors are kept in the files for later report.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsWritebackFlushPath(const char *path)  // IN: Absolute path
+{
+   if (0 == gState->writebackDelay) {
+      return;
+   }
+
+   HgfsWritebackFlushMatching(HGFS_WRITEBACK_MATCH_PATH, 0, path);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWritebackFlushDir --
+ *
+ *    Write the buffered data of the files open in a directory to the
+ *    server: only those directly in it, as for a listing of the directory,
+ *    or all those below it.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    Errors are kept in the files for later report.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsWritebackFlushDir(const char *path,  // IN: Absolute directory path
+                      Bool subtree)      // IN: Also below subdirectories
+{
+   if (0 == gState->writebackDelay) {
+      return;
+   }
+
+   HgfsWritebackFlushMatching(subtree ? HGFS_WRITEBACK_MATCH_SUBTREE :
+                                        HGFS_WRITEBACK_MATCH_CHILDREN,
+                              0, path);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWritebackRelease --
+ *
+ *    Write the buffered data of a file being closed to the server and
+ *    free its write back state.
+ *
+ * Results:
+ *    Zero on success, or the error of this or an earlier write back.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+HgfsWritebackRelease(HgfsHandle handle)  // IN: Open file handle
+{
+   HgfsWritebackFile *file;
+   int error;
+
+   if (0 == gState->writebackDelay) {
+      return 0;
+   }
+
+   file = HgfsWritebackGetFile(handle, FALSE);
+   if (NULL == file) {
+      return 0;
+   }
+
+   pthread_mutex_lock(&file->lock);
+   HgfsWritebackFlushInt(file);
+   error = HgfsWritebackTakeError(file);
+   pthread_mutex_unlock(&file->lock);
+
+   /* Wait for the flusher to be done with the file. */
+   pthread_mutex_lock(&gHgfsWritebackLock);
+   while (file->refs > 1) {
+      pthread_cond_wait(&gHgfsWritebackRefCond, &gHgfsWritebackLock);
+   }
+   list_del(&file->list);
+   pthread_mutex_unlock(&gHgfsWritebackLock);
+
+   pthread_mutex_destroy(&file->lock);
+   free(file->path);
+   free(file->data);
+   free(file);
+   return error;
+}
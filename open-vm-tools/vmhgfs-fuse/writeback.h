@@ -0,0 +1,44 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * writeback.h --
+ *
+ * Coalescing of small writes to open files.
+ */
+
+#ifndef _VMHGFS_FUSE_WRITEBACK_H_
+#define _VMHGFS_FUSE_WRITEBACK_H_
+
+/*
+ * Longest time, in milliseconds, written data may stay buffered, see the
+ * writeback mount option. Zero, the default, disables the buffering.
+ */
+#define HGFS_WRITEBACK_DELAY_MAX   10000
+
+void HgfsWritebackInit(void);
+void HgfsWritebackExit(void);
+Bool HgfsWritebackWrite(HgfsHandle handle, const char *path, const char *buf,
+                        size_t count, loff_t offset, uint32 bufferSize,
+                        int *error);
+int HgfsWritebackFlush(HgfsHandle handle);
+void HgfsWritebackFlushPath(const char *path);
+void HgfsWritebackFlushDir(const char *path, Bool subtree);
+int HgfsWritebackRelease(HgfsHandle handle);
+
+#endif // _VMHGFS_FUSE_WRITEBACK_H_